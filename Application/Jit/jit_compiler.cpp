@@ -1,4 +1,4 @@
-#include "jit_compiler.hpp"
+﻿#include "jit_compiler.hpp"
 #include "../mplx-compiler/bytecode.hpp"
 #include "jit_runtime.hpp"
 #include "platform.hpp"
@@ -24,6 +24,9 @@ namespace mplx::jit {
     const Bytecode &bc = *ctx.bc;
     if (ctx.fnIndex >= bc.functions.size())
       return std::nullopt;
+    // translates base opcodes only; fused code (superinstructions.hpp) stays interpreted
+    if (bc.fused.mask != 0)
+      return std::nullopt;
     const auto &fn = bc.functions[ctx.fnIndex];
     uint32_t ip    = fn.entry;
     std::vector<long long> st;
@@ -44,6 +47,16 @@ namespace mplx::jit {
         continue;
       }
 
+      if (op == OP_PUSH_I8 || op == OP_PUSH_I32) {
+        if (ip + op_operand_size(op) > bc.code.size()) {
+          ok = false;
+          break;
+        }
+        st.push_back(immediate_at(bc.code, ip - 1));
+        ip += op_operand_size(op);
+        continue;
+      }
+
       if (op == OP_LOAD_LOCAL) {
         uint32_t idx = read_u32(bc.code, ip);
         if (idx >= locals.size()) {
@@ -99,6 +112,29 @@ namespace mplx::jit {
         continue;
       }
 
+      // stores that pop the value (peephole.hpp)
+      if (op == OP_SET_LOCAL) {
+        uint32_t idx = read_u32(bc.code, ip);
+        if (st.empty() || idx >= locals.size()) { ok = false; break; }
+        locals[(size_t)idx] = st.back(); st.pop_back();
+        continue;
+      }
+
+      if (op == OP_SET_LOCAL8) {
+        if (ip >= bc.code.size()) { ok = false; break; }
+        uint32_t idx = bc.code[ip++];
+        if (st.empty() || idx >= locals.size()) { ok = false; break; }
+        locals[(size_t)idx] = st.back(); st.pop_back();
+        continue;
+      }
+
+      if (op == OP_SET0 || op == OP_SET1 || op == OP_SET2 || op == OP_SET3) {
+        uint32_t idx = (uint32_t)(op - OP_SET0);
+        if (st.empty() || idx >= locals.size()) { ok = false; break; }
+        locals[(size_t)idx] = st.back(); st.pop_back();
+        continue;
+      }
+
       if (op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV || op == OP_MOD) {
         if (st.size() < 2) {
           ok = false;
@@ -235,7 +271,7 @@ namespace mplx::jit {
         break;
       }
 
-      if (op == OP_CALL) {
+      if (op == OP_CALL || op == OP_TAILCALL) {
         // v0: we do not inline calls; stop JIT for this function for now
         ok = false;
         break;
@@ -281,9 +317,11 @@ namespace mplx::jit {
         } else if (sop == OP_JMP_IF_FALSE || sop == OP_JMP_IF_TRUE) {
           uint32_t dst = read_u32(bc.code, sip);
           record_label(dst);
-        } else if (sop == OP_CALL || sop == OP_PUSH_CONST || sop == OP_LOAD_LOCAL || sop == OP_STORE_LOCAL) {
+        } else if (sop == OP_CALL || sop == OP_TAILCALL || sop == OP_PUSH_CONST || sop == OP_LOAD_LOCAL || sop == OP_STORE_LOCAL || sop == OP_SET_LOCAL) {
           (void)read_u32(bc.code, sip);
-        } else if (sop == OP_LOAD_LOCAL8 || sop == OP_STORE_LOCAL8) {
+        } else if (sop == OP_PUSH_I32) {
+          sip += 4;
+        } else if (sop == OP_LOAD_LOCAL8 || sop == OP_STORE_LOCAL8 || sop == OP_SET_LOCAL8 || sop == OP_PUSH_I8) {
           if (sip < bc.code.size()) ++sip;
         }
         if (sop == OP_RET || sop == OP_HALT) break;
@@ -333,6 +371,15 @@ namespace mplx::jit {
           e.inc_r12();
           continue;
         }
+        if (gop == OP_PUSH_I8 || gop == OP_PUSH_I32) {
+          uint64_t imm = (uint64_t)immediate_at(bc.code, gip - 1);
+          bc_to_mc.push_back({gip - 1, e.buf.size()});
+          gip += op_operand_size(gop);
+          e.mov_rax_imm(imm);
+          e.mov_m_r13_r12_s8_disp32_rax(0);
+          e.inc_r12();
+          continue;
+        }
         if (gop == OP_LOAD_LOCAL) {
           uint32_t localIdx = read_u32(bc.code, gip);
           bc_to_mc.push_back({gip - 5, e.buf.size()});
@@ -342,7 +389,7 @@ namespace mplx::jit {
           e.inc_r12();
           continue;
         }
-        if (gop == OP_STORE_LOCAL) {
+        if (gop == OP_STORE_LOCAL || gop == OP_SET_LOCAL) {
           uint32_t localIdx = read_u32(bc.code, gip);
           bc_to_mc.push_back({gip - 5, e.buf.size()});
           // Store TOS to local variable [rbp + localIdx*8]
@@ -504,9 +551,11 @@ namespace mplx::jit {
         if (gop == OP_RET) break;
         if (gop == OP_HALT) break;
         // Skip immediates to keep stream aligned
-        if (gop == OP_PUSH_CONST || gop == OP_LOAD_LOCAL || gop == OP_STORE_LOCAL || gop == OP_CALL) {
+        if (gop == OP_PUSH_CONST || gop == OP_LOAD_LOCAL || gop == OP_STORE_LOCAL || gop == OP_SET_LOCAL || gop == OP_CALL || gop == OP_TAILCALL) {
           (void)read_u32(bc.code, gip);
-        } else if (gop == OP_LOAD_LOCAL8 || gop == OP_STORE_LOCAL8) {
+        } else if (gop == OP_PUSH_I32) {
+          gip += 4;
+        } else if (gop == OP_LOAD_LOCAL8 || gop == OP_STORE_LOCAL8 || gop == OP_SET_LOCAL8 || gop == OP_PUSH_I8) {
           if (gip < bc.code.size()) ++gip;
         }
       }
@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace mplx {
@@ -42,34 +43,225 @@ namespace mplx {
     OP_CALL,
     OP_RET,
     OP_POP,
-    OP_HALT
+    OP_HALT,
+    // immediate constants: the value is the operand, no pool lookup
+    OP_PUSH_I8,    // i8 v: push(v)
+    OP_PUSH_I32,   // i32 v (little-endian): push(v)
+    // stores that pop the value: produced by the peephole pass (peephole.hpp) for a store
+    // whose value is discarded (STx POP)
+    OP_SET0,
+    OP_SET1,
+    OP_SET2,
+    OP_SET3,
+    OP_SET_LOCAL8, // 1-byte index
+    OP_SET_LOCAL,
+    // u32 f: call f in place of the current frame, which the callee's arguments, locals and
+    // result take over; the compiler always follows it with RET, so a tier that does not
+    // reuse frames can run it as CALL
+    OP_TAILCALL,
+    // superinstructions: only produced by fuse_superinstructions() (superinstructions.hpp);
+    // PUSH_CONST in the source sequences stands for any of the three constant pushes
+    OP_ST_POP,     // u8 x: locals[x] = pop()                                  (STx POP)
+    OP_INC_LOCAL,  // u8 x, u32 k: locals[x] += consts[k]                       (LDx PUSH_CONST ADD STx POP, or SETx)
+    OP_LL_LT_JF,   // u8 a, u8 b, u32 t: if !(locals[a] < locals[b]) jump t     (LDa LDb LT JMP_IF_FALSE)
+    OP_LL_LE_JF,   // u8 a, u8 b, u32 t: if !(locals[a] <= locals[b]) jump t    (LDa LDb LE JMP_IF_FALSE)
+    OP_LK_LT_JF,   // u8 a, u32 k, u32 t: if !(locals[a] < consts[k]) jump t    (LDa PUSH_CONST LT JMP_IF_FALSE)
+    OP_LK_LE_JF,   // u8 a, u32 k, u32 t: if !(locals[a] <= consts[k]) jump t   (LDa PUSH_CONST LE JMP_IF_FALSE)
+    OP_LL_ADD,     // u8 a, u8 b: push(locals[a] + locals[b])                   (LDa LDb ADD)
+    OP_LK_SUB      // u8 a, u32 k: push(locals[a] - consts[k])                  (LDa PUSH_CONST SUB)
   };
+  constexpr Op kLastOp = OP_LK_SUB;
+
+  // Version of the superinstruction set above. Bump it whenever a fused opcode is added,
+  // removed or changes meaning, so code fused by another build is rejected.
+  constexpr uint32_t kSuperinstructionVersion = 4;
 
   struct FuncMeta {
     std::string name;
     uint32_t entry{0};
     uint8_t arity{0};
     uint16_t locals{0};
-    // JIT integration
-    void *compiled_entry{nullptr};
-    bool is_jitted{false};
-    uint32_t hot_count{0};
+    // Result depends only on the arguments (set by analyze_purity, purity.hpp)
+    bool pure{false};
+  };
+
+  // Superinstructions the code was rewritten with: a bit per fused opcode
+  // (1u << (op - OP_ST_POP)). A zero mask means base opcodes only.
+  struct FusedSet {
+    uint32_t version{0};
+    uint32_t mask{0};
   };
 
   struct Bytecode {
     std::vector<uint8_t> code;
     std::vector<long long> consts;
     std::vector<FuncMeta> functions;
+    FusedSet fused;
+    // Function name -> index, built once by the compiler so lookups by entry name do not
+    // rebuild a map per run. May be empty for hand-built bytecode (see find_function).
+    std::unordered_map<std::string, uint32_t> symbols;
+    // Identifies the compiled module (0 = not assigned); lets caches keyed by a Bytecode
+    // address notice that a different module now lives there.
+    uint64_t module_id{0};
   };
 
+  // Index of the function called `name`; false if there is none
+  inline bool find_function(const Bytecode &bc, const std::string &name, uint32_t &index) {
+    if (!bc.symbols.empty()) {
+      auto it = bc.symbols.find(name);
+      if (it == bc.symbols.end())
+        return false;
+      index = it->second;
+      return true;
+    }
+    for (uint32_t i = (uint32_t)bc.functions.size(); i-- > 0;) // the last definition wins, as in `symbols`
+      if (bc.functions[i].name == name) {
+        index = i;
+        return true;
+      }
+    return false;
+  }
+
+  inline const char *op_name(Op op) {
+    static const char *names[] = {"PUSH_CONST", "LD0", "LD1", "LD2", "LD3", "ST0", "ST1", "ST2", "ST3", "LOAD_LOCAL8", "STORE_LOCAL8",
+                                  "LOAD_LOCAL", "STORE_LOCAL", "ADD", "SUB", "MUL", "DIV", "MOD", "NEG", "EQ", "NE", "LT", "LE", "GT",
+                                  "GE", "JMP", "JMP_IF_FALSE", "JMP_IF_TRUE", "AND", "OR", "NOT", "CALL", "RET", "POP", "HALT",
+                                  "PUSH_I8", "PUSH_I32", "SET0", "SET1", "SET2", "SET3", "SET_LOCAL8", "SET_LOCAL", "TAILCALL", "ST_POP", "INC_LOCAL",
+                                  "LL_LT_JF", "LL_LE_JF", "LK_LT_JF", "LK_LE_JF", "LL_ADD", "LK_SUB"};
+    static_assert(sizeof(names) / sizeof(names[0]) == kLastOp + 1, "op name table");
+    return op <= kLastOp ? names[op] : "?";
+  }
+
+  // Size in bytes of the inline operand that follows `op` in Bytecode::code
+  inline uint32_t op_operand_size(Op op) {
+    switch (op) {
+    case OP_PUSH_CONST:
+    case OP_PUSH_I32:
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_JMP:
+    case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_TRUE:
+    case OP_CALL:
+    case OP_TAILCALL: return 4;
+    case OP_LOAD_LOCAL8:
+    case OP_STORE_LOCAL8:
+    case OP_SET_LOCAL8:
+    case OP_PUSH_I8:
+    case OP_ST_POP: return 1;
+    case OP_LL_ADD: return 2;
+    case OP_INC_LOCAL:
+    case OP_LK_SUB: return 5;
+    case OP_LL_LT_JF:
+    case OP_LL_LE_JF: return 6;
+    case OP_LK_LT_JF:
+    case OP_LK_LE_JF: return 9;
+    default: return 0;
+    }
+  }
+
+  // Branching opcodes; their target is the last u32 of the operand
+  inline bool op_is_jump(Op op) {
+    switch (op) {
+    case OP_JMP:
+    case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_TRUE:
+    case OP_LL_LT_JF:
+    case OP_LL_LE_JF:
+    case OP_LK_LT_JF:
+    case OP_LK_LE_JF: return true;
+    default: return false;
+    }
+  }
+
+  // Operand stack effect of one instruction: values popped, then values pushed. A CALL
+  // pops the callee's arity (`calleeArity`); a POP directly followed by RET is skipped
+  // by the interpreter, which the caller has to account for. TAILCALL is counted as the
+  // CALL it stands for, its result then returned by the RET after it.
+  struct StackEffect {
+    uint32_t pops;
+    uint32_t pushes;
+  };
+  inline StackEffect op_stack_effect(Op op, uint32_t calleeArity = 0) {
+    switch (op) {
+    case OP_PUSH_CONST:
+    case OP_PUSH_I8:
+    case OP_PUSH_I32:
+    case OP_LD0:
+    case OP_LD1:
+    case OP_LD2:
+    case OP_LD3:
+    case OP_LOAD_LOCAL8:
+    case OP_LOAD_LOCAL:
+    case OP_LL_ADD:
+    case OP_LK_SUB: return {0, 1};
+    // stores leave the value on the stack
+    case OP_ST0:
+    case OP_ST1:
+    case OP_ST2:
+    case OP_ST3:
+    case OP_STORE_LOCAL8:
+    case OP_STORE_LOCAL:
+    case OP_NEG:
+    case OP_NOT: return {1, 1};
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_EQ:
+    case OP_NE:
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+    case OP_AND:
+    case OP_OR: return {2, 1};
+    case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_TRUE:
+    case OP_RET:
+    case OP_POP:
+    case OP_HALT:
+    case OP_SET0:
+    case OP_SET1:
+    case OP_SET2:
+    case OP_SET3:
+    case OP_SET_LOCAL8:
+    case OP_SET_LOCAL:
+    case OP_ST_POP: return {1, 0};
+    case OP_CALL:
+    case OP_TAILCALL: return {calleeArity, 1};
+    default: return {0, 0};
+    }
+  }
+
+  // Little-endian u32 operand at code[pos]
+  inline uint32_t read_u32_at(const std::vector<uint8_t> &code, uint32_t pos) {
+    return (uint32_t)code[pos] | ((uint32_t)code[pos + 1] << 8) | ((uint32_t)code[pos + 2] << 16) | ((uint32_t)code[pos + 3] << 24);
+  }
+
+  // Value pushed by the PUSH_I8 / PUSH_I32 instruction at `ip`
+  inline long long immediate_at(const std::vector<uint8_t> &code, uint32_t ip) {
+    if ((Op)code[ip] == OP_PUSH_I8)
+      return (int8_t)code[ip + 1];
+    return (int32_t)read_u32_at(code, ip + 1);
+  }
+
+  // Target of the branch instruction at `ip` (requires op_is_jump)
+  inline uint32_t jump_target_at(const std::vector<uint8_t> &code, uint32_t ip) {
+    return read_u32_at(code, ip + op_operand_size((Op)code[ip]) - 3);
+  }
+
   inline std::string dump_bytecode_json(const Bytecode &bc) {
     std::string out = "{";
+    out += "\"fused\":{\"version\":" + std::to_string(bc.fused.version) + ",\"mask\":" + std::to_string(bc.fused.mask) + "},";
     out += "\"functions\":[";
     for (size_t i = 0; i < bc.functions.size(); ++i) {
       const auto &f = bc.functions[i];
       if (i)
         out += ",";
-      out += "{\"name\":\"" + f.name + "\",\"entry\":" + std::to_string(f.entry) + ",\"arity\":" + std::to_string(f.arity) + ",\"locals\":" + std::to_string(f.locals) + "}";
+      out += "{\"name\":\"" + f.name + "\",\"entry\":" + std::to_string(f.entry) + ",\"arity\":" + std::to_string(f.arity) + ",\"locals\":" + std::to_string(f.locals) + ",\"pure\":" + (f.pure ? "true" : "false") + "}";
     }
     out += "],\"consts\":[";
     for (size_t i = 0; i < bc.consts.size(); ++i) {
@@ -107,24 +299,13 @@ namespace mplx {
     // scan code to find jump targets and fallthroughs
     uint32_t ip = 0;
     while (ip < bc.code.size()) {
-      Op op       = (Op)bc.code[ip++];
-      auto read32 = [&](uint32_t &ptr) { uint32_t v = (uint32_t)bc.code[ptr] | ((uint32_t)bc.code[ptr+1]<<8) | ((uint32_t)bc.code[ptr+2]<<16) | ((uint32_t)bc.code[ptr+3]<<24); ptr+=4; return v; };
-      if (op == OP_JMP) {
-        uint32_t dst = read32(ip);
-        add_leader(dst);
-        add_leader(ip);
-      } else if (op == OP_JMP_IF_FALSE || op == OP_JMP_IF_TRUE) {
-        uint32_t dst = read32(ip);
-        add_leader(dst);
-        add_leader(ip);
-      } else if (op == OP_CALL) {
-        (void)read32(ip);
-      } else if (op == OP_PUSH_CONST || op == OP_LOAD_LOCAL || op == OP_STORE_LOCAL) {
-        (void)read32(ip);
-      } else if (op == OP_LOAD_LOCAL8 || op == OP_STORE_LOCAL8) {
-        // 1-byte immediate
-        if (ip < bc.code.size()) ++ip;
+      Op op         = (Op)bc.code[ip];
+      uint32_t next = ip + 1 + op_operand_size(op);
+      if (op_is_jump(op)) {
+        add_leader(jump_target_at(bc.code, ip));
+        add_leader(next);
       }
+      ip = next;
     }
     // sort leaders and form blocks
     std::sort(leaders.begin(), leaders.end());
@@ -143,31 +324,20 @@ namespace mplx {
     };
     std::vector<Edge> edges;
     for (size_t bi = 0; bi < blocks.size(); ++bi) {
-      uint32_t ptr = blocks[bi].end;
-      // rewind one instruction to read terminator; approximate by scanning from start
+      // find the block's terminator by scanning from its start
       uint32_t p    = blocks[bi].start;
       uint32_t last = p;
       while (p < blocks[bi].end) {
-        last         = p;
-        Op op        = (Op)bc.code[p++];
-        auto read32b = [&](uint32_t &q) { uint32_t v = (uint32_t)bc.code[q] | ((uint32_t)bc.code[q+1]<<8) | ((uint32_t)bc.code[q+2]<<16) | ((uint32_t)bc.code[q+3]<<24); q+=4; return v; };
-        if (op == OP_JMP || op == OP_CALL || op == OP_PUSH_CONST || op == OP_LOAD_LOCAL || op == OP_STORE_LOCAL || op == OP_JMP_IF_FALSE || op == OP_JMP_IF_TRUE) {
-          if (op == OP_JMP || op == OP_JMP_IF_FALSE || op == OP_JMP_IF_TRUE || op == OP_CALL || op == OP_PUSH_CONST || op == OP_LOAD_LOCAL || op == OP_STORE_LOCAL)
-            (void)read32b(p);
-        } else if (op == OP_LOAD_LOCAL8 || op == OP_STORE_LOCAL8) {
-          if (p < blocks[bi].end) ++p;
-        }
+        last = p;
+        p += 1 + op_operand_size((Op)bc.code[p]);
       }
-      Op term    = (Op)bc.code[last];
-      uint32_t q = last + 1;
+      Op term = (Op)bc.code[last];
       if (term == OP_JMP) {
-        uint32_t dst = (uint32_t)bc.code[q] | ((uint32_t)bc.code[q + 1] << 8) | ((uint32_t)bc.code[q + 2] << 16) | ((uint32_t)bc.code[q + 3] << 24);
-        int tb       = find_block(dst);
+        int tb = find_block(jump_target_at(bc.code, last));
         if (tb >= 0)
           edges.push_back({(int)bi, tb});
-      } else if (term == OP_JMP_IF_FALSE || term == OP_JMP_IF_TRUE) {
-        uint32_t dst = (uint32_t)bc.code[q] | ((uint32_t)bc.code[q + 1] << 8) | ((uint32_t)bc.code[q + 2] << 16) | ((uint32_t)bc.code[q + 3] << 24);
-        int tb       = find_block(dst);
+      } else if (op_is_jump(term)) {
+        int tb = find_block(jump_target_at(bc.code, last));
         if (tb >= 0)
           edges.push_back({(int)bi, tb});
         int fb = find_block(blocks[bi].end);
@@ -0,0 +1,492 @@
+#include "compile_cache.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <utility>
+
+namespace mplx {
+
+  namespace {
+
+    // Part of every key and every file: bump it whenever code generation or the file layout
+    // changes, so entries written by an older compiler miss instead of linking stale code
+    constexpr uint32_t kCacheFormat = 1;
+    constexpr char kFileMagic[8]    = {'M', 'P', 'L', 'X', 'F', 'N', 'C', '1'};
+
+    // 64-bit hash over a stream of fields, a multiply-xorshift round per 8 bytes; strings
+    // and lists carry their length
+    struct Hasher {
+      uint64_t h{0xcbf29ce484222325ull};
+
+      void u64(uint64_t v) {
+        h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+      }
+      void str(const std::string &s) {
+        u64(s.size());
+        for (size_t i = 0; i < s.size(); i += 8) {
+          uint64_t w = 0;
+          for (size_t k = 0; k < 8 && i + k < s.size(); ++k)
+            w |= (uint64_t)(uint8_t)s[i + k] << (k * 8);
+          u64(w);
+        }
+      }
+    };
+
+    using Block = std::vector<std::unique_ptr<Stmt>>;
+
+    // Hashes function bodies once each and composes them into keys
+    class KeyBuilder {
+    public:
+      KeyBuilder(const Module &m, const std::unordered_map<std::string, uint32_t> &funcIndex, const InlinePlan &plan)
+          : m_(m), funcIndex_(funcIndex), plan_(plan), bodies_(m.functions.size()), inlined_(m.functions.size()) {}
+
+      uint64_t key(uint32_t f, uint64_t options) {
+        Hasher h;
+        h.u64(kCacheFormat);
+        h.u64(options);
+        const Body &b = body(f);
+        h.u64(b.hash);
+        for (auto &name : b.calls)
+          callee(h, name, f);
+        return h.h;
+      }
+
+    private:
+      struct Body {
+        bool done{false};
+        uint64_t hash{0};
+        std::vector<std::string> calls; // names called, in order of first call
+      };
+
+      const Body &body(uint32_t f) {
+        Body &b = bodies_[f];
+        if (!b.done) {
+          const Function &fn = m_.functions[f];
+          Hasher h;
+          h.str(fn.name);
+          h.u64(fn.params.size());
+          for (auto &p : fn.params)
+            h.str(p.name);
+          stmts(h, fn.body, b.calls);
+          b.hash = h.h;
+          b.done = true;
+        }
+        return b;
+      }
+
+      // The facts about `name` that a call to it from function `self` compiles with
+      void callee(Hasher &h, const std::string &name, uint32_t self) {
+        h.str(name);
+        auto it = funcIndex_.find(name);
+        if (it == funcIndex_.end()) {
+          h.u64(0);
+          return;
+        }
+        uint32_t f = it->second;
+        h.u64(1);
+        h.u64(f == self);
+        h.u64(m_.functions[f].params.size());
+        bool inlinable = f < plan_.inlinable.size() && plan_.inlinable[f];
+        h.u64(inlinable);
+        if (inlinable) {
+          h.u64(plan_.cost[f]);
+          h.u64(inlined(f));
+        }
+      }
+
+      // An inlinable function's body together with its own calls. Inlinable functions are
+      // not recursive, so none of these calls leads back to the function being keyed.
+      uint64_t inlined(uint32_t f) {
+        auto &memo = inlined_[f];
+        if (!memo.first) {
+          const Body &b = body(f);
+          Hasher h;
+          h.u64(b.hash);
+          for (auto &name : b.calls)
+            callee(h, name, UINT32_MAX);
+          memo = {true, h.h};
+        }
+        return memo.second;
+      }
+
+      void stmts(Hasher &h, const Block &body, std::vector<std::string> &calls) {
+        h.u64(body.size());
+        for (auto &s : body)
+          stmt(h, s.get(), calls);
+      }
+      void stmt(Hasher &h, const Stmt *s, std::vector<std::string> &calls) {
+        h.u64((uint64_t)s->kind);
+        switch (s->kind) {
+        case StmtKind::Let: {
+          auto ls = static_cast<const LetStmt *>(s);
+          h.str(ls->name);
+          expr(h, ls->init.get(), calls);
+          return;
+        }
+        case StmtKind::Assign: {
+          auto as = static_cast<const AssignStmt *>(s);
+          h.str(as->name);
+          expr(h, as->value.get(), calls);
+          return;
+        }
+        case StmtKind::Return: expr(h, static_cast<const ReturnStmt *>(s)->value.get(), calls); return;
+        case StmtKind::Expr: expr(h, static_cast<const ExprStmt *>(s)->expr.get(), calls); return;
+        case StmtKind::If: {
+          auto ifs = static_cast<const IfStmt *>(s);
+          expr(h, ifs->cond.get(), calls);
+          stmts(h, ifs->thenS, calls);
+          stmts(h, ifs->elseS, calls);
+          return;
+        }
+        case StmtKind::While: {
+          auto ws = static_cast<const WhileStmt *>(s);
+          expr(h, ws->cond.get(), calls);
+          stmts(h, ws->body, calls);
+          return;
+        }
+        }
+      }
+      void expr(Hasher &h, const Expr *e, std::vector<std::string> &calls) {
+        if (!e) {
+          h.u64(UINT64_MAX);
+          return;
+        }
+        h.u64((uint64_t)e->kind);
+        switch (e->kind) {
+        case ExprKind::Literal: h.u64((uint64_t) static_cast<const LiteralExpr *>(e)->value); return;
+        case ExprKind::Var: h.str(static_cast<const VarExpr *>(e)->name); return;
+        case ExprKind::Unary: {
+          auto u = static_cast<const UnaryExpr *>(e);
+          h.u64((uint64_t)u->op);
+          expr(h, u->rhs.get(), calls);
+          return;
+        }
+        case ExprKind::Binary: {
+          auto b = static_cast<const BinaryExpr *>(e);
+          h.u64((uint64_t)b->op);
+          expr(h, b->lhs.get(), calls);
+          expr(h, b->rhs.get(), calls);
+          return;
+        }
+        case ExprKind::Call: {
+          auto c = static_cast<const CallExpr *>(e);
+          h.str(c->callee);
+          if (std::find(calls.begin(), calls.end(), c->callee) == calls.end())
+            calls.push_back(c->callee);
+          h.u64(c->args.size());
+          for (auto &a : c->args)
+            expr(h, a.get(), calls);
+          return;
+        }
+        }
+      }
+
+      const Module &m_;
+      const std::unordered_map<std::string, uint32_t> &funcIndex_;
+      const InlinePlan &plan_;
+      std::vector<Body> bodies_;
+      std::vector<std::pair<bool, uint64_t>> inlined_;
+    };
+
+    // Calls `fn(position of the u32 operand)` for every OP_CALL/OP_TAILCALL of `code`
+    template <typename Fn> void for_each_call(const std::vector<uint8_t> &code, Fn fn) {
+      for (uint32_t ip = 0; ip < code.size();) {
+        const Op op       = (Op)code[ip];
+        const uint32_t sz = op_operand_size(op);
+        if (ip + sz >= code.size())
+          break;
+        if (op == OP_CALL || op == OP_TAILCALL)
+          fn(ip + 1);
+        ip += 1 + sz;
+      }
+    }
+
+    void put_u32(std::vector<uint8_t> &code, uint32_t pos, uint32_t v) {
+      for (int i = 0; i < 4; ++i)
+        code[pos + i] = (uint8_t)((v >> (i * 8)) & 0xFF);
+    }
+
+    // Rewrites the callee positions of a cached unit's calls into this module's indices.
+    // The key covered each callee's signature, so the names resolve unless two modules'
+    // keys collided; false then.
+    bool bind_calls(std::vector<uint8_t> &code, const std::vector<std::string> &callees,
+                    const std::unordered_map<std::string, uint32_t> &funcIndex) {
+      std::vector<uint32_t> targets;
+      for (auto &name : callees) {
+        auto it = funcIndex.find(name);
+        if (it == funcIndex.end())
+          return false;
+        targets.push_back(it->second);
+      }
+      bool bound = true;
+      for_each_call(code, [&](uint32_t pos) {
+        uint32_t k = read_u32_at(code, pos);
+        if (k < targets.size())
+          put_u32(code, pos, targets[k]);
+        else
+          bound = false;
+      });
+      return bound;
+    }
+
+    // Little-endian fields for the cache files
+    struct Writer {
+      std::string out;
+      void u64(uint64_t v, int bytes = 8) {
+        for (int i = 0; i < bytes; ++i)
+          out.push_back((char)(uint8_t)(v >> (i * 8)));
+      }
+      void str(const std::string &s) {
+        u64(s.size(), 4);
+        out += s;
+      }
+    };
+    struct Reader {
+      const std::string &in;
+      size_t pos{0};
+      bool ok{true};
+      uint64_t u64(int bytes = 8) {
+        if (in.size() - pos < (size_t)bytes) {
+          ok = false;
+          return 0;
+        }
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; ++i)
+          v |= (uint64_t)(uint8_t)in[pos++] << (i * 8);
+        return v;
+      }
+      std::string str() {
+        size_t n = (size_t)u64(4);
+        if (!ok || in.size() - pos < n) {
+          ok = false;
+          return {};
+        }
+        std::string s = in.substr(pos, n);
+        pos += n;
+        return s;
+      }
+      // A list length, each item taking at least `each` bytes; more than the rest of the
+      // input holds fails instead of sizing a list from a garbled field
+      size_t count(size_t each) {
+        size_t n = (size_t)u64(4);
+        if (!ok || n > (in.size() - pos) / each) {
+          ok = false;
+          return 0;
+        }
+        return n;
+      }
+    };
+
+    // Hash of a file's contents, stored after them so a damaged file reads as a miss
+    uint64_t checksum(const std::string &data, size_t size) {
+      Hasher h;
+      h.str(data.substr(0, size));
+      return h.h;
+    }
+
+  } // namespace
+
+  std::vector<uint64_t> function_cache_keys(const Module &m, const std::unordered_map<std::string, uint32_t> &funcIndex,
+                                            const InlinePlan &plan, const CompileOptions &opts) {
+    // the options code generation reads; peephole, superinstructions and threads only act on
+    // the linked module or not on the code at all
+    Hasher options;
+    options.u64(opts.ssa);
+    options.u64(opts.inlineBudget);
+    options.u64(opts.tailCalls);
+    options.u64(opts.licm);
+    options.u64(opts.strengthReduction);
+    options.u64(opts.closedForm);
+    KeyBuilder kb(m, funcIndex, plan);
+    std::vector<uint64_t> keys(m.functions.size());
+    for (uint32_t f = 0; f < keys.size(); ++f)
+      keys[f] = kb.key(f, options.h);
+    return keys;
+  }
+
+  CompileCache::CompileCache(std::filesystem::path dir) : dir_(std::move(dir)) {}
+
+  bool CompileCache::load(uint64_t key, const std::unordered_map<std::string, uint32_t> &funcIndex, FunctionCode &out,
+                          bool *fromDisk) {
+    Entry e;
+    bool found = false, disk = false;
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      auto it = entries_.find(key);
+      if (it != entries_.end()) {
+        e     = it->second;
+        found = true;
+      }
+    }
+    if (!found && !dir_.empty() && readFile(key, e)) {
+      insert(key, e);
+      found = disk = true;
+    }
+    if (found)
+      found = bind_calls(e.unit.code, e.callees, funcIndex);
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      if (found) {
+        ++stats_.hits;
+        stats_.diskHits += disk;
+      } else {
+        ++stats_.misses;
+      }
+    }
+    if (!found)
+      return false;
+    out = std::move(e.unit);
+    if (fromDisk)
+      *fromDisk = disk;
+    return true;
+  }
+
+  void CompileCache::store(uint64_t key, const FunctionCode &unit, const Module &m) {
+    Entry e;
+    e.unit = unit;
+    std::unordered_map<uint32_t, uint32_t> slot; // module index -> position in callees
+    for_each_call(e.unit.code, [&](uint32_t pos) {
+      uint32_t f        = read_u32_at(e.unit.code, pos);
+      auto [it, inserted] = slot.try_emplace(f, (uint32_t)e.callees.size());
+      if (inserted)
+        e.callees.push_back(f < m.functions.size() ? m.functions[f].name : std::string());
+      put_u32(e.unit.code, pos, it->second);
+    });
+    if (!dir_.empty())
+      writeFile(key, e);
+    insert(key, std::move(e));
+  }
+
+  void CompileCache::insert(uint64_t key, Entry e) {
+    std::lock_guard<std::mutex> lk(m_);
+    auto [it, inserted] = entries_.insert_or_assign(key, std::move(e));
+    (void)it;
+    if (inserted)
+      order_.push_back(key);
+    while (capacity_ && entries_.size() > capacity_) {
+      entries_.erase(order_.front());
+      order_.pop_front();
+    }
+  }
+
+  void CompileCache::setCapacity(size_t entries) {
+    std::lock_guard<std::mutex> lk(m_);
+    capacity_ = entries;
+    while (capacity_ && entries_.size() > capacity_) {
+      entries_.erase(order_.front());
+      order_.pop_front();
+    }
+  }
+
+  size_t CompileCache::size() const {
+    std::lock_guard<std::mutex> lk(m_);
+    return entries_.size();
+  }
+
+  void CompileCache::clear() {
+    std::lock_guard<std::mutex> lk(m_);
+    entries_.clear();
+    order_.clear();
+  }
+
+  CompileCacheStats CompileCache::stats() const {
+    std::lock_guard<std::mutex> lk(m_);
+    return stats_;
+  }
+
+  std::filesystem::path CompileCache::file(uint64_t key) const {
+    static const char hex[] = "0123456789abcdef";
+    std::string name(16, '0');
+    for (int i = 15; i >= 0; --i, key >>= 4)
+      name[i] = hex[key & 15];
+    return dir_ / (name + ".mfc");
+  }
+
+  bool CompileCache::readFile(uint64_t key, Entry &e) const {
+    std::ifstream f(file(key), std::ios::binary);
+    if (!f)
+      return false;
+    std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if (data.size() < sizeof kFileMagic + 8 || data.compare(0, sizeof kFileMagic, kFileMagic, sizeof kFileMagic) != 0)
+      return false;
+    Reader tail{data, data.size() - 8};
+    if (tail.u64() != checksum(data, data.size() - 8))
+      return false;
+    data.resize(data.size() - 8);
+    Reader r{data};
+    r.pos = sizeof kFileMagic;
+    if (r.u64(4) != kCacheFormat || r.u64() != key)
+      return false;
+    FunctionCode &u = e.unit;
+    u.meta.name   = r.str();
+    u.meta.entry  = (uint32_t)r.u64(4);
+    u.meta.arity  = (uint8_t)r.u64(1);
+    u.meta.locals = (uint16_t)r.u64(2);
+    std::string code = r.str();
+    u.code.assign(code.begin(), code.end());
+    u.consts.resize(r.count(8));
+    for (auto &c : u.consts)
+      c = (long long)r.u64();
+    u.diags.resize(r.count(4));
+    for (auto &d : u.diags)
+      d = r.str();
+    u.inlined.resize(r.count(8));
+    for (auto &s : u.inlined) {
+      s.caller = r.str();
+      s.callee = r.str();
+    }
+    e.callees.resize(r.count(4));
+    for (auto &c : e.callees)
+      c = r.str();
+    return r.ok && r.pos == data.size();
+  }
+
+  void CompileCache::writeFile(uint64_t key, const Entry &e) const {
+    const FunctionCode &u = e.unit;
+    Writer w;
+    w.out.append(kFileMagic, sizeof kFileMagic);
+    w.u64(kCacheFormat, 4);
+    w.u64(key);
+    w.str(u.meta.name);
+    w.u64(u.meta.entry, 4);
+    w.u64(u.meta.arity, 1);
+    w.u64(u.meta.locals, 2);
+    w.str(std::string(u.code.begin(), u.code.end()));
+    w.u64(u.consts.size(), 4);
+    for (long long c : u.consts)
+      w.u64((uint64_t)c);
+    w.u64(u.diags.size(), 4);
+    for (auto &d : u.diags)
+      w.str(d);
+    w.u64(u.inlined.size(), 4);
+    for (auto &s : u.inlined) {
+      w.str(s.caller);
+      w.str(s.callee);
+    }
+    w.u64(e.callees.size(), 4);
+    for (auto &c : e.callees)
+      w.str(c);
+    w.u64(checksum(w.out, w.out.size()));
+    // written under a name of its own and renamed into place, so concurrent compiles never
+    // read a partial file; failures only cost a later miss
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    std::filesystem::path target = file(key);
+    std::filesystem::path tmp = target;
+    tmp += ".tmp" + std::to_string(std::random_device{}());
+    {
+      std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+      if (!f)
+        return;
+      f.write(w.out.data(), (std::streamsize)w.out.size());
+      if (!f)
+        return;
+    }
+    std::filesystem::rename(tmp, target, ec);
+    if (ec)
+      std::filesystem::remove(tmp, ec);
+  }
+
+} // namespace mplx
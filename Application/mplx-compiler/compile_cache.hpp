@@ -0,0 +1,70 @@
+#pragma once
+#include "compiler.hpp"
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mplx {
+
+  // For every function of `m`, in Module order, a content hash of everything compiling it
+  // reads: its name, parameters and body; for every name it calls, whether that resolves, the callee's arity, whether it
+  // is the function itself and its inlining decision; the body of each callee that gets
+  // inlined (with that body's own calls, recursively); and the options code generation looks
+  // at. Parameter and return types are left out: code generation ignores them.
+  std::vector<uint64_t> function_cache_keys(const Module &m, const std::unordered_map<std::string, uint32_t> &funcIndex,
+                                            const InlinePlan &plan, const CompileOptions &opts);
+
+  // Per-function bytecode reused across compilations (Compiler::setCache). Compiler::compile
+  // looks every function up by its function_cache_keys key and compiles only the ones that
+  // miss, so after an edit the changed function and the callers that inline it recompile and
+  // the rest is linked from here. An entry's calls name their callees, so it stays valid when
+  // inserting or removing functions moves the indices. Entries live in memory and, with a
+  // directory, in one file per key there as well, which is how separate runs of the CLI share
+  // them. Thread-safe.
+  class CompileCache {
+  public:
+    // memory only, for long-lived processes
+    CompileCache() = default;
+    // memory in front of `dir` (created on first store); unreadable or damaged files count as
+    // misses
+    explicit CompileCache(std::filesystem::path dir);
+
+    // The unit stored under `key`, its calls bound to the indices of `funcIndex`; false when
+    // there is none. `fromDisk` tells whether it came from the directory.
+    bool load(uint64_t key, const std::unordered_map<std::string, uint32_t> &funcIndex, FunctionCode &out,
+              bool *fromDisk = nullptr);
+    // Keeps `unit` (function code of module `m`) under `key`
+    void store(uint64_t key, const FunctionCode &unit, const Module &m);
+
+    // Entries kept in memory (0 = unlimited); the oldest are dropped first
+    void setCapacity(size_t entries);
+    size_t size() const;
+    // Drops the in-memory entries; the directory is left alone
+    void clear();
+    // Lookups since construction, over every compile that used the cache
+    CompileCacheStats stats() const;
+
+  private:
+    // A unit whose OP_CALL/OP_TAILCALL operands index `callees` instead of the module
+    struct Entry {
+      FunctionCode unit;
+      std::vector<std::string> callees;
+    };
+    std::filesystem::path file(uint64_t key) const;
+    bool readFile(uint64_t key, Entry &out) const;
+    void writeFile(uint64_t key, const Entry &e) const;
+    void insert(uint64_t key, Entry e);
+
+    std::filesystem::path dir_;
+    mutable std::mutex m_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    std::deque<uint64_t> order_; // insertion order, for eviction
+    size_t capacity_{0};
+    CompileCacheStats stats_;
+  };
+
+} // namespace mplx
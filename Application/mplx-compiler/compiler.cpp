@@ -1,5 +1,15 @@
 ﻿#include "compiler.hpp"
+#include "compile_cache.hpp"
+#include "ir.hpp"
+#include "ir_passes.hpp"
+#include "optimizer.hpp"
+#include "purity.hpp"
+#include "superinstructions.hpp"
+#include "work_pool.hpp"
+#include <algorithm>
+#include <atomic>
 #include <stdexcept>
+#include <utility>
 
 namespace mplx {
 
@@ -19,9 +29,16 @@ namespace mplx {
     bc_.code[pos + 3] = (uint8_t)((val >> 24) & 0xFF);
   }
 
+  static uint64_t next_module_id() {
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
+  }
+
   uint32_t Compiler::addConst(long long v) {
-    bc_.consts.push_back(v);
-    return (uint32_t)bc_.consts.size() - 1;
+    auto [it, inserted] = constIndex_.try_emplace(v, (uint32_t)bc_.consts.size());
+    if (inserted)
+      bc_.consts.push_back(v);
+    return it->second;
   }
 
   uint16_t Compiler::localIndex(const std::string &name) {
@@ -34,287 +51,455 @@ namespace mplx {
     return 0;
   }
 
-  void Compiler::compileExpr(const Expr *e) {
-    if (auto lit = dynamic_cast<const LiteralExpr *>(e)) {
-      auto idx = addConst(lit->value);
-      emit_u8(OP_PUSH_CONST);
+  static const LiteralExpr *as_literal(const Expr *e) {
+    return e->kind == ExprKind::Literal ? static_cast<const LiteralExpr *>(e) : nullptr;
+  }
+
+  // Does `e` read the variable `name`?
+  static bool mentions(const Expr *e, const std::string &name) {
+    switch (e->kind) {
+    case ExprKind::Literal: return false;
+    case ExprKind::Var: return static_cast<const VarExpr *>(e)->name == name;
+    case ExprKind::Unary: return mentions(static_cast<const UnaryExpr *>(e)->rhs.get(), name);
+    case ExprKind::Binary: {
+      auto b = static_cast<const BinaryExpr *>(e);
+      return mentions(b->lhs.get(), name) || mentions(b->rhs.get(), name);
+    }
+    case ExprKind::Call:
+      for (auto &a : static_cast<const CallExpr *>(e)->args)
+        if (mentions(a.get(), name))
+          return true;
+      return false;
+    }
+    return true;
+  }
+
+  // Does `body` contain `return name(...)` with `arity` arguments?
+  static bool returns_call_to(const std::vector<std::unique_ptr<Stmt>> &body, const std::string &name, size_t arity) {
+    for (auto &s : body) {
+      switch (s->kind) {
+      case StmtKind::Return: {
+        auto v = static_cast<const ReturnStmt *>(s.get())->value.get();
+        if (v->kind == ExprKind::Call && static_cast<const CallExpr *>(v)->callee == name &&
+            static_cast<const CallExpr *>(v)->args.size() == arity)
+          return true;
+        break;
+      }
+      case StmtKind::If: {
+        auto ifs = static_cast<const IfStmt *>(s.get());
+        if (returns_call_to(ifs->thenS, name, arity) || returns_call_to(ifs->elseS, name, arity))
+          return true;
+        break;
+      }
+      case StmtKind::While:
+        if (returns_call_to(static_cast<const WhileStmt *>(s.get())->body, name, arity))
+          return true;
+        break;
+      default: break;
+      }
+    }
+    return false;
+  }
+
+  // Does a statement of `body` assign the variable `name`?
+  static bool assigns(const std::vector<std::unique_ptr<Stmt>> &body, const std::string &name) {
+    for (auto &s : body) {
+      switch (s->kind) {
+      case StmtKind::Assign:
+        if (static_cast<const AssignStmt *>(s.get())->name == name)
+          return true;
+        break;
+      case StmtKind::If: {
+        auto ifs = static_cast<const IfStmt *>(s.get());
+        if (assigns(ifs->thenS, name) || assigns(ifs->elseS, name))
+          return true;
+        break;
+      }
+      case StmtKind::While:
+        if (assigns(static_cast<const WhileStmt *>(s.get())->body, name))
+          return true;
+        break;
+      default: break;
+      }
+    }
+    return false;
+  }
+
+  // Appends the names the lets of `body` declare, nested ones included
+  static void let_names(const std::vector<std::unique_ptr<Stmt>> &body, std::vector<std::string> &out) {
+    for (auto &s : body) {
+      switch (s->kind) {
+      case StmtKind::Let: out.push_back(static_cast<const LetStmt *>(s.get())->name); break;
+      case StmtKind::If: {
+        auto ifs = static_cast<const IfStmt *>(s.get());
+        let_names(ifs->thenS, out);
+        let_names(ifs->elseS, out);
+        break;
+      }
+      case StmtKind::While: let_names(static_cast<const WhileStmt *>(s.get())->body, out); break;
+      default: break;
+      }
+    }
+  }
+
+  void Compiler::emitLoadLocal(uint16_t idx) {
+    if (idx <= 3) {
+      switch (idx) {
+      case 0: emit_u8(OP_LD0); break;
+      case 1: emit_u8(OP_LD1); break;
+      case 2: emit_u8(OP_LD2); break;
+      case 3: emit_u8(OP_LD3); break;
+      }
+    } else if (idx <= 0xFF) {
+      emit_u8(OP_LOAD_LOCAL8);
+      emit_u8((uint8_t)idx);
+    } else {
+      emit_u8(OP_LOAD_LOCAL);
       emit_u32(idx);
-      return;
     }
-    if (auto v = dynamic_cast<const VarExpr *>(e)) {
-      auto idx = localIndex(v->name);
-      if (idx <= 3) {
-        switch (idx) {
-        case 0: emit_u8(OP_LD0); break;
-        case 1: emit_u8(OP_LD1); break;
-        case 2: emit_u8(OP_LD2); break;
-        case 3: emit_u8(OP_LD3); break;
-        }
-      } else if (idx <= 0xFF) {
-        emit_u8(OP_LOAD_LOCAL8);
-        emit_u8((uint8_t)idx);
-      } else {
-        emit_u8(OP_LOAD_LOCAL);
-        emit_u32(idx);
+  }
+
+  void Compiler::emitStoreLocal(uint16_t idx) {
+    if (idx <= 3) {
+      switch (idx) {
+      case 0: emit_u8(OP_ST0); break;
+      case 1: emit_u8(OP_ST1); break;
+      case 2: emit_u8(OP_ST2); break;
+      case 3: emit_u8(OP_ST3); break;
       }
-      return;
+    } else if (idx <= 0xFF) {
+      emit_u8(OP_STORE_LOCAL8);
+      emit_u8((uint8_t)idx);
+    } else {
+      emit_u8(OP_STORE_LOCAL);
+      emit_u32(idx);
     }
-    if (auto u = dynamic_cast<const UnaryExpr *>(e)) {
-      compileExpr(u->rhs.get());
-      if (u->op == "-")
-        emit_u8(OP_NEG);
-      else
-        diags_.push_back("unsupported unary op: " + u->op);
-      return;
+  }
+
+  void Compiler::emitSetLocal(uint16_t idx) {
+    if (idx <= 3) {
+      switch (idx) {
+      case 0: emit_u8(OP_SET0); break;
+      case 1: emit_u8(OP_SET1); break;
+      case 2: emit_u8(OP_SET2); break;
+      case 3: emit_u8(OP_SET3); break;
+      }
+    } else if (idx <= 0xFF) {
+      emit_u8(OP_SET_LOCAL8);
+      emit_u8((uint8_t)idx);
+    } else {
+      emit_u8(OP_SET_LOCAL);
+      emit_u32(idx);
     }
-    if (auto b = dynamic_cast<const BinaryExpr *>(e)) {
-      // algebraic simplifications and constant folding for integer literals
-      // x + 0, 0 + x, x - 0, x * 1, 1 * x, x * 0, 0 * x, x / 1, 0 / x
-      if (b->op == "+" || b->op == "-" || b->op == "*" || b->op == "/") {
-        auto ll = dynamic_cast<const LiteralExpr *>(b->lhs.get());
-        auto rr = dynamic_cast<const LiteralExpr *>(b->rhs.get());
-        if (!ll && rr) {
-          long long rv = rr->value;
-          if (b->op == "+" && rv == 0) {
-            compileExpr(b->lhs.get());
-            return;
-          }
-          if (b->op == "-" && rv == 0) {
-            compileExpr(b->lhs.get());
-            return;
-          }
-          if (b->op == "*" && rv == 1) {
-            compileExpr(b->lhs.get());
-            return;
-          }
-          if (b->op == "*" && rv == 0) {
-            auto idx = addConst(0);
-            emit_u8(OP_PUSH_CONST);
-            emit_u32(idx);
-            return;
-          }
-          if (b->op == "/" && rv == 1) {
-            compileExpr(b->lhs.get());
-            return;
-          }
-        }
-        if (ll && !rr) {
-          long long lv = ll->value;
-          if (b->op == "+" && lv == 0) {
-            compileExpr(b->rhs.get());
-            return;
-          }
-          if (b->op == "*" && lv == 1) {
-            compileExpr(b->rhs.get());
-            return;
-          }
-          if (b->op == "*" && lv == 0) {
-            auto idx = addConst(0);
-            emit_u8(OP_PUSH_CONST);
-            emit_u32(idx);
-            return;
-          }
-          if (b->op == "/" && lv == 0) {
-            auto idx = addConst(0);
-            emit_u8(OP_PUSH_CONST);
-            emit_u32(idx);
-            return;
-          }
-        }
+  }
+
+  void Compiler::emitConst(long long v) {
+    if (v >= INT8_MIN && v <= INT8_MAX) {
+      emit_u8(OP_PUSH_I8);
+      emit_u8((uint8_t)v);
+    } else if (v >= INT32_MIN && v <= INT32_MAX) {
+      emit_u8(OP_PUSH_I32);
+      emit_u32((uint32_t)v);
+    } else {
+      emit_u8(OP_PUSH_CONST);
+      emit_u32(addConst(v));
+    }
+  }
+
+  void Compiler::compileExpr(const Expr *e) {
+    switch (e->kind) {
+    case ExprKind::Literal: emitConst(static_cast<const LiteralExpr *>(e)->value); return;
+    case ExprKind::Var: emitLoadLocal(localIndex(static_cast<const VarExpr *>(e)->name)); return;
+    case ExprKind::Unary: compileUnary(static_cast<const UnaryExpr *>(e)); return;
+    case ExprKind::Binary: compileBinary(static_cast<const BinaryExpr *>(e)); return;
+    case ExprKind::Call: compileCall(static_cast<const CallExpr *>(e)); return;
+    }
+    diags_.push_back("unknown expr kind");
+  }
+
+  void Compiler::compileUnary(const UnaryExpr *u) {
+    compileExpr(u->rhs.get());
+    switch (u->op) {
+    case UnaryOp::Neg: emit_u8(OP_NEG); return;
+    }
+    diags_.push_back(std::string("unsupported unary op: ") + unary_op_spelling(u->op));
+  }
+
+  void Compiler::compileBinary(const BinaryExpr *b) {
+    const BinOp op        = b->op;
+    const LiteralExpr *ll = as_literal(b->lhs.get());
+    const LiteralExpr *rr = as_literal(b->rhs.get());
+    // algebraic simplifications for integer literals
+    // x + 0, 0 + x, x - 0, x * 1, 1 * x, x * 0, 0 * x, x / 1, 0 / x
+    if (!ll && rr) {
+      long long rv = rr->value;
+      if (((op == BinOp::Add || op == BinOp::Sub) && rv == 0) || ((op == BinOp::Mul || op == BinOp::Div) && rv == 1)) {
+        compileExpr(b->lhs.get());
+        return;
       }
-      // simple constant folding for literal op literal
-      if (auto ll = dynamic_cast<const LiteralExpr *>(b->lhs.get())) {
-        if (auto rr = dynamic_cast<const LiteralExpr *>(b->rhs.get())) {
-          const std::string &op = b->op;
-          long long lv          = ll->value;
-          long long rv          = rr->value;
-          bool folded           = true;
-          long long out         = 0;
-          if (op == "+")
-            out = lv + rv;
-          else if (op == "-")
-            out = lv - rv;
-          else if (op == "*")
-            out = lv * rv;
-          else if (op == "/") {
-            if (rv != 0)
-              out = lv / rv;
-            else
-              folded = false;
-          } else if (op == "==")
-            out = (lv == rv);
-          else if (op == "!=")
-            out = (lv != rv);
-          else if (op == "<")
-            out = (lv < rv);
-          else if (op == "<=")
-            out = (lv <= rv);
-          else if (op == ">")
-            out = (lv > rv);
-          else if (op == ">=")
-            out = (lv >= rv);
-          else
-            folded = false;
-          if (folded) {
-            auto idx = addConst(out);
-            emit_u8(OP_PUSH_CONST);
-            emit_u32(idx);
-            return;
-          }
-        }
+      if (op == BinOp::Mul && rv == 0) {
+        emitConst(0);
+        return;
       }
-      compileExpr(b->lhs.get());
-      compileExpr(b->rhs.get());
-      const std::string &op = b->op;
-      if (op == "+")
-        emit_u8(OP_ADD);
-      else if (op == "-")
-        emit_u8(OP_SUB);
-      else if (op == "*")
-        emit_u8(OP_MUL);
-      else if (op == "/")
-        emit_u8(OP_DIV);
-      else if (op == "==")
-        emit_u8(OP_EQ);
-      else if (op == "!=")
-        emit_u8(OP_NE);
-      else if (op == "<")
-        emit_u8(OP_LT);
-      else if (op == "<=")
-        emit_u8(OP_LE);
-      else if (op == ">")
-        emit_u8(OP_GT);
-      else if (op == ">=")
-        emit_u8(OP_GE);
-      else if (op == "!=")
-        emit_u8(OP_NE);
-      else
-        diags_.push_back("unsupported binary op: " + op);
-      return;
     }
-    if (auto c = dynamic_cast<const CallExpr *>(e)) {
-      auto it = funcIndex_.find(c->callee);
-      if (it == funcIndex_.end()) {
-        diags_.push_back("unknown function: " + c->callee);
-        emit_u8(OP_PUSH_CONST);
-        emit_u32(addConst(0));
+    if (ll && !rr) {
+      long long lv = ll->value;
+      if ((op == BinOp::Add && lv == 0) || (op == BinOp::Mul && lv == 1)) {
+        compileExpr(b->rhs.get());
         return;
       }
+      if ((op == BinOp::Mul || op == BinOp::Div) && lv == 0) {
+        emitConst(0);
+        return;
+      }
+    }
+    // constant folding for literal op literal, as optimize_module does; a division that
+    // faults is left for the VM
+    long long folded = 0;
+    if (ll && rr && eval_binary(op, ll->value, rr->value, folded)) {
+      emitConst(folded);
+      return;
+    }
+    compileExpr(b->lhs.get());
+    compileExpr(b->rhs.get());
+    switch (op) {
+    case BinOp::Add: emit_u8(OP_ADD); return;
+    case BinOp::Sub: emit_u8(OP_SUB); return;
+    case BinOp::Mul: emit_u8(OP_MUL); return;
+    case BinOp::Div: emit_u8(OP_DIV); return;
+    case BinOp::Eq: emit_u8(OP_EQ); return;
+    case BinOp::Ne: emit_u8(OP_NE); return;
+    case BinOp::Lt: emit_u8(OP_LT); return;
+    case BinOp::Le: emit_u8(OP_LE); return;
+    case BinOp::Gt: emit_u8(OP_GT); return;
+    case BinOp::Ge: emit_u8(OP_GE); return;
+    }
+    diags_.push_back(std::string("unsupported binary op: ") + binop_spelling(op));
+  }
+
+  void Compiler::compileCall(const CallExpr *c) {
+    auto it = info_->funcIndex.find(c->callee);
+    if (it == info_->funcIndex.end()) {
+      diags_.push_back("unknown function: " + c->callee);
+      emitConst(0);
+      return;
+    }
+    uint32_t callee = it->second;
+    // (a call with the wrong number of arguments keeps the stack code's behaviour)
+    if (callee < info_->inlinePlan.inlinable.size() && info_->inlinePlan.inlinable[callee] &&
+        c->args.size() == info_->module->functions[callee].params.size() &&
+        currentLocals_ + c->args.size() + info_->inlinePlan.cost[callee] <= UINT16_MAX) {
+      compileInlineCall(c, callee);
+      return;
+    }
+    for (auto &a : c->args)
+      compileExpr(a.get());
+    emit_u8(OP_CALL);
+    emit_u32(callee);
+  }
+
+  void Compiler::compileInlineCall(const CallExpr *c, uint32_t callee) {
+    const Function &f = info_->module->functions[callee];
+    // a parameter the body never assigns reads a variable argument's slot directly; the
+    // other arguments are evaluated in order and move from the stack into fresh slots, last
+    // first. The body's lets take further slots as they are compiled (the cost bounds how many).
+    std::vector<uint16_t> slots(f.params.size());
+    std::vector<bool> copied(f.params.size(), true);
+    for (size_t p = 0; p < f.params.size(); ++p) {
+      const Expr *a = c->args[p].get();
+      if (a->kind == ExprKind::Var && !assigns(f.body, f.params[p].name)) {
+        slots[p]  = localIndex(static_cast<const VarExpr *>(a)->name);
+        copied[p] = false;
+      } else {
+        compileExpr(a);
+        slots[p] = currentLocals_++;
+      }
+    }
+    for (size_t p = f.params.size(); p-- > 0;)
+      if (copied[p])
+        emitSetLocal(slots[p]);
+    auto callerScopes = std::exchange(scopes_, {{}});
+    for (size_t p = 0; p < f.params.size(); ++p)
+      scopes_.back()[f.params[p].name] = slots[p];
+    InlineFrame frame{{}, {}, nesting_};
+    InlineFrame *outer = std::exchange(inline_, &frame);
+    size_t diagCount   = diags_.size();
+    // a trailing `return` falls through to the end instead of jumping there
+    bool tailReturn = !f.body.empty() && f.body.back()->kind == StmtKind::Return;
+    for (size_t i = 0; i + (tailReturn ? 1 : 0) < f.body.size(); ++i)
+      compileStmt(f.body[i].get());
+    if (tailReturn)
+      compileExpr(static_cast<const ReturnStmt *>(f.body.back().get())->value.get());
+    else
+      emitConst(0); // implicit 0
+    for (uint32_t pos : frame.exits)
+      write_u32_at(pos, tell());
+    // inside a loop the copy runs again in the same frame, where a real call would start
+    // from zeroed locals
+    if (loopDepth_ > 0) {
+      for (uint16_t slot : frame.resets) {
+        emitConst(0);
+        emitSetLocal(slot);
+      }
+    }
+    inline_ = outer;
+    scopes_ = std::move(callerScopes);
+    diags_.resize(diagCount); // the callee's own compilation reports them
+    inlined_.push_back(InlineSite{currentFunction_, f.name});
+  }
+
+  bool Compiler::compileTailCall(const Expr *e) {
+    if (!opts_.tailCalls || e->kind != ExprKind::Call)
+      return false;
+    auto c  = static_cast<const CallExpr *>(e);
+    auto it = info_->funcIndex.find(c->callee);
+    if (it == info_->funcIndex.end() || c->args.size() != info_->module->functions[it->second].params.size())
+      return false;
+    uint32_t callee = it->second;
+    if (callee == currentIndex_ && selfLoop_) {
+      // the arguments are all evaluated before the first parameter is overwritten
       for (auto &a : c->args)
         compileExpr(a.get());
-      emit_u8(OP_CALL);
-      emit_u32(it->second);
-      return;
+      for (size_t p = c->args.size(); p-- > 0;)
+        emitSetLocal((uint16_t)p);
+      emit_u8(OP_JMP);
+      selfLoop_->exits.push_back(tell());
+      emit_u32(0);
+      return true;
     }
-    diags_.push_back("unknown expr kind");
+    if (callee < info_->inlinePlan.inlinable.size() && info_->inlinePlan.inlinable[callee])
+      return false; // compileCall substitutes the body
+    for (auto &a : c->args)
+      compileExpr(a.get());
+    emit_u8(OP_TAILCALL);
+    emit_u32(callee);
+    emit_u8(OP_RET);
+    return true;
   }
 
   void Compiler::compileStmt(const Stmt *s) {
-    if (auto let = dynamic_cast<const LetStmt *>(s)) {
-      auto &scope      = scopes_.back();
-      uint16_t idx     = currentLocals_++;
-      scope[let->name] = idx;
+    switch (s->kind) {
+    case StmtKind::Let: {
+      auto let                  = static_cast<const LetStmt *>(s);
+      uint16_t idx              = currentLocals_++;
+      scopes_.back()[let->name] = idx;
+      // an inlined body's slot keeps its value between runs of the copy, and so does a
+      // function's between its self tail calls; a `let` under an if/while or one reading its
+      // own name may expose that
+      InlineFrame *frame = inline_ ? inline_ : selfLoop_;
+      if (frame && (nesting_ > frame->nesting || mentions(let->init.get(), let->name)))
+        frame->resets.push_back(idx);
       compileExpr(let->init.get());
-      if (idx <= 3) {
-        switch (idx) {
-        case 0: emit_u8(OP_ST0); break;
-        case 1: emit_u8(OP_ST1); break;
-        case 2: emit_u8(OP_ST2); break;
-        case 3: emit_u8(OP_ST3); break;
-        }
-      } else if (idx <= 0xFF) {
-        emit_u8(OP_STORE_LOCAL8);
-        emit_u8((uint8_t)idx);
-      } else {
-        emit_u8(OP_STORE_LOCAL);
-        emit_u32(idx);
-      }
+      emitStoreLocal(idx);
+      emit_u8(OP_POP); // stores leave the value on the stack; a statement discards it
       return;
     }
-    if (auto as = dynamic_cast<const AssignStmt *>(s)) {
+    case StmtKind::Assign: {
+      auto as  = static_cast<const AssignStmt *>(s);
       auto idx = localIndex(as->name);
       compileExpr(as->value.get());
-      if (idx <= 3) {
-        switch (idx) {
-        case 0: emit_u8(OP_ST0); break;
-        case 1: emit_u8(OP_ST1); break;
-        case 2: emit_u8(OP_ST2); break;
-        case 3: emit_u8(OP_ST3); break;
-        }
-      } else if (idx <= 0xFF) {
-        emit_u8(OP_STORE_LOCAL8);
-        emit_u8((uint8_t)idx);
-      } else {
-        emit_u8(OP_STORE_LOCAL);
-        emit_u32(idx);
-      }
+      emitStoreLocal(idx);
+      emit_u8(OP_POP); // stores leave the value on the stack; a statement discards it
       return;
     }
-    if (auto ret = dynamic_cast<const ReturnStmt *>(s)) {
-      compileExpr(ret->value.get());
+    case StmtKind::Return:
+      if (!inline_ && compileTailCall(static_cast<const ReturnStmt *>(s)->value.get()))
+        return;
+      compileExpr(static_cast<const ReturnStmt *>(s)->value.get());
+      if (inline_) {
+        emit_u8(OP_JMP);
+        inline_->exits.push_back(tell());
+        emit_u32(0);
+        return;
+      }
       emit_u8(OP_RET);
       return;
+    case StmtKind::Expr:
+      compileExpr(static_cast<const ExprStmt *>(s)->expr.get());
+      emit_u8(OP_POP);
+      return;
+    case StmtKind::If: compileIf(static_cast<const IfStmt *>(s)); return;
+    case StmtKind::While: compileWhile(static_cast<const WhileStmt *>(s)); return;
     }
-    if (auto ifs = dynamic_cast<const IfStmt *>(s)) {
-      // constant-condition fold: if(true){then} else {else} -> compile only taken branch
-      if (auto litc = dynamic_cast<const LiteralExpr *>(ifs->cond.get())) {
-        if (litc->value) {
-          for (auto &st : ifs->thenS)
-            compileStmt(st.get());
-          return;
-        } else {
-          for (auto &st : ifs->elseS)
-            compileStmt(st.get());
-          return;
-        }
-      }
-      compileExpr(ifs->cond.get());
-      emit_u8(OP_JMP_IF_FALSE);
-      auto jmpFalsePos = tell();
-      emit_u32(0);
-      // then
-      for (auto &st : ifs->thenS)
+    diags_.push_back("unknown stmt kind");
+  }
+
+  void Compiler::compileIf(const IfStmt *ifs) {
+    ++nesting_;
+    // constant-condition fold: if(true){then} else {else} -> compile only taken branch
+    if (auto litc = as_literal(ifs->cond.get())) {
+      if (!litc->value)
+        declareDropped(ifs->thenS);
+      for (auto &st : litc->value ? ifs->thenS : ifs->elseS)
         compileStmt(st.get());
-      if (ifs->elseS.empty()) {
-        // no else: avoid extra JMP, patch false to end
-        write_u32_at(jmpFalsePos, tell());
-      } else {
-        emit_u8(OP_JMP);
-        auto jmpEndPos = tell();
-        emit_u32(0);
-        // patch false to else start
-        write_u32_at(jmpFalsePos, tell());
-        // else
-        for (auto &st : ifs->elseS)
-          compileStmt(st.get());
-        // patch end to code end
-        write_u32_at(jmpEndPos, tell());
-      }
+      if (litc->value)
+        declareDropped(ifs->elseS);
+      --nesting_;
       return;
     }
-    if (auto ws = dynamic_cast<const WhileStmt *>(s)) {
-      uint32_t loopStart = tell();
-      // cond
-      compileExpr(ws->cond.get());
-      emit_u8(OP_JMP_IF_FALSE);
-      auto jmpExitPos = tell();
+    compileExpr(ifs->cond.get());
+    emit_u8(OP_JMP_IF_FALSE);
+    auto jmpFalsePos = tell();
+    emit_u32(0);
+    // then
+    for (auto &st : ifs->thenS)
+      compileStmt(st.get());
+    if (ifs->elseS.empty()) {
+      // no else: avoid extra JMP, patch false to end
+      write_u32_at(jmpFalsePos, tell());
+    } else {
+      emit_u8(OP_JMP);
+      auto jmpEndPos = tell();
       emit_u32(0);
-      // body
-      for (auto &st : ws->body)
+      // patch false to else start
+      write_u32_at(jmpFalsePos, tell());
+      // else
+      for (auto &st : ifs->elseS)
         compileStmt(st.get());
-      // jump back to start
-      emit_u8(OP_JMP);
-      emit_u32(loopStart);
-      // patch exit
-      write_u32_at(jmpExitPos, tell());
-      return;
+      // patch end to code end
+      write_u32_at(jmpEndPos, tell());
     }
-    if (auto es = dynamic_cast<const ExprStmt *>(s)) {
-      compileExpr(es->expr.get());
-      emit_u8(OP_POP);
-      return;
+    --nesting_;
+  }
+
+  // Names are flat per function, so code after a branch the fold drops may still read or
+  // assign the names its lets declare. Each one not bound yet gets a slot of its own that no
+  // initializer writes, where a compiled branch would have bound it: it reads 0 until assigned.
+  void Compiler::declareDropped(const std::vector<std::unique_ptr<Stmt>> &body) {
+    std::vector<std::string> names;
+    let_names(body, names);
+    for (auto &name : names) {
+      bool bound = false;
+      for (auto &scope : scopes_)
+        bound = bound || scope.count(name) != 0;
+      if (bound)
+        continue;
+      uint16_t idx         = currentLocals_++;
+      scopes_.back()[name] = idx;
+      if (InlineFrame *frame = inline_ ? inline_ : selfLoop_)
+        frame->resets.push_back(idx); // as for a `let` under an if
     }
-    diags_.push_back("unknown stmt kind");
+  }
+
+  void Compiler::compileWhile(const WhileStmt *ws) {
+    ++nesting_;
+    ++loopDepth_;
+    uint32_t loopStart = tell();
+    // cond
+    compileExpr(ws->cond.get());
+    emit_u8(OP_JMP_IF_FALSE);
+    auto jmpExitPos = tell();
+    emit_u32(0);
+    // body
+    for (auto &st : ws->body)
+      compileStmt(st.get());
+    // jump back to start
+    emit_u8(OP_JMP);
+    emit_u32(loopStart);
+    // patch exit
+    write_u32_at(jmpExitPos, tell());
+    --loopDepth_;
+    --nesting_;
   }
 
   void Compiler::compileFunction(const Function &f) {
@@ -323,29 +508,150 @@ namespace mplx {
     meta.entry = tell();
     meta.arity = (uint8_t)f.params.size();
     scopes_.push_back({});
-    currentArity_  = meta.arity;
-    currentLocals_ = meta.arity;
+    currentFunction_ = f.name;
+    currentArity_    = meta.arity;
+    currentLocals_   = meta.arity;
     for (uint16_t p = 0; p < meta.arity; ++p) {
       scopes_.back()[f.params[p].name] = p;
     }
+    // with self tail calls the body is a loop, so inlined copies reset their lets as well
+    InlineFrame loop{{}, {}, 0};
+    if (opts_.tailCalls && info_->funcIndex.at(f.name) == currentIndex_ && returns_call_to(f.body, f.name, f.params.size())) {
+      selfLoop_  = &loop;
+      loopDepth_ = 1;
+    }
     for (auto &st : f.body)
       compileStmt(st.get());
-    emit_u8(OP_PUSH_CONST);
-    emit_u32(addConst(0)); // implicit 0
+    emitConst(0); // implicit 0
     emit_u8(OP_RET);
+    if (selfLoop_) {
+      // a real call would start from zeroed locals
+      uint32_t target = meta.entry;
+      if (!loop.resets.empty()) {
+        target = tell();
+        for (uint16_t slot : loop.resets) {
+          emitConst(0);
+          emitSetLocal(slot);
+        }
+        emit_u8(OP_JMP);
+        emit_u32(meta.entry);
+      }
+      for (uint32_t pos : loop.exits)
+        write_u32_at(pos, target);
+      selfLoop_  = nullptr;
+      loopDepth_ = 0;
+    }
     meta.locals = currentLocals_;
     bc_.functions.push_back(meta);
     scopes_.pop_back();
   }
 
+  FunctionCode Compiler::compileUnit(uint32_t index) {
+    currentIndex_ = index;
+    if (opts_.ssa) {
+      IrFunction ir = build_ir_function(*info_->module, index, info_->funcIndex, diags_, &info_->inlinePlan, &inlined_);
+      IrPipelineOptions passes;
+      passes.tailRecursion     = opts_.tailCalls;
+      passes.licm              = opts_.licm;
+      passes.strengthReduction = opts_.strengthReduction;
+      passes.closedForm        = opts_.closedForm;
+      // a pipeline per function: its pass counters are not shared between threads
+      default_ir_pipeline(passes).run(ir);
+      compileIrFunction(ir);
+    } else {
+      compileFunction(info_->module->functions[index]);
+    }
+    return FunctionCode{std::move(bc_.functions.back()), std::move(bc_.code), std::move(bc_.consts),
+                        std::move(diags_), std::move(inlined_)};
+  }
+
+  void Compiler::link(std::vector<FunctionCode> &units) {
+    std::vector<uint32_t> constMap;
+    for (auto &u : units) {
+      const uint32_t base = tell();
+      // renumbering through addConst keeps the pool in order of first use, exactly as if
+      // every function had been emitted into it directly
+      constMap.clear();
+      for (long long v : u.consts)
+        constMap.push_back(addConst(v));
+      auto patch = [&](uint32_t pos, uint32_t val) {
+        for (int i = 0; i < 4; ++i)
+          u.code[pos + i] = (uint8_t)((val >> (i * 8)) & 0xFF);
+      };
+      // calls name their callee by module index, so only jumps and pool operands move
+      for (uint32_t ip = 0; ip < u.code.size();) {
+        const Op op       = (Op)u.code[ip];
+        const uint32_t sz = op_operand_size(op);
+        if (ip + sz >= u.code.size())
+          break;
+        if (op == OP_PUSH_CONST)
+          patch(ip + 1, constMap[read_u32_at(u.code, ip + 1)]);
+        else if (op_is_jump(op))
+          patch(ip + sz - 3, jump_target_at(u.code, ip) + base);
+        ip += 1 + sz;
+      }
+      bc_.code.insert(bc_.code.end(), u.code.begin(), u.code.end());
+      u.meta.entry += base;
+      bc_.functions.push_back(std::move(u.meta));
+      diags_.insert(diags_.end(), std::make_move_iterator(u.diags.begin()), std::make_move_iterator(u.diags.end()));
+      inlined_.insert(inlined_.end(), std::make_move_iterator(u.inlined.begin()),
+                      std::make_move_iterator(u.inlined.end()));
+    }
+  }
+
   CompileResult Compiler::compile(const Module &m) {
+    ModuleInfo info;
+    info.module = &m;
     for (size_t i = 0; i < m.functions.size(); ++i) {
-      funcIndex_[m.functions[i].name] = (uint32_t)i;
+      info.funcIndex[m.functions[i].name] = (uint32_t)i;
     }
-    for (auto &f : m.functions)
-      compileFunction(f);
+    if (opts_.inlineBudget > 0)
+      info.inlinePlan = plan_inlining(m, opts_.inlineBudget);
+    std::vector<uint64_t> keys;
+    if (cache_)
+      keys = function_cache_keys(m, info.funcIndex, info.inlinePlan, opts_);
+    // each function compiles into its own unit on a fresh Compiler, so a unit does not
+    // depend on which thread ran it or when, or on whether it came from the cache
+    std::vector<FunctionCode> units(m.functions.size());
+    std::atomic<uint64_t> hits{0}, diskHits{0};
+    auto compileRange = [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        bool fromDisk = false;
+        if (cache_ && cache_->load(keys[i], info.funcIndex, units[i], &fromDisk)) {
+          ++hits;
+          diskHits += fromDisk;
+          continue;
+        }
+        Compiler worker(opts_, info);
+        units[i] = worker.compileUnit((uint32_t)i);
+        if (cache_)
+          cache_->store(keys[i], units[i], m);
+      }
+    };
+    if (opts_.threads == 1 || units.size() < 2) {
+      compileRange(0, units.size());
+    } else {
+      WorkStealingPool pool(opts_.threads);
+      size_t grain = std::max<size_t>(1, units.size() / (size_t(pool.size()) * 16));
+      pool.parallelFor(units.size(), grain, [&](unsigned, size_t begin, size_t end) { compileRange(begin, end); });
+    }
+    link(units);
     emit_u8(OP_HALT);
-    return CompileResult{std::move(bc_), std::move(diags_)};
+    bc_.symbols   = std::move(info.funcIndex);
+    bc_.module_id = next_module_id();
+    PeepholeStats peephole;
+    if (opts_.peephole && diags_.empty())
+      peephole = peephole_optimize(bc_, opts_.superinstructions);
+    analyze_purity(bc_);
+    if (diags_.empty())
+      fuse_superinstructions(bc_, opts_.superinstructions);
+    CompileCacheStats cache;
+    if (cache_) {
+      cache.hits     = hits;
+      cache.diskHits = diskHits;
+      cache.misses   = units.size() - cache.hits;
+    }
+    return CompileResult{std::move(bc_), std::move(diags_), peephole, std::move(inlined_), cache};
   }
 
-} 
+} 
\ No newline at end of file
@@ -1,22 +1,93 @@
 ﻿#pragma once
 #include "../mplx-lang/ast.hpp"
 #include "bytecode.hpp"
+#include "inliner.hpp"
+#include "peephole.hpp"
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 namespace mplx {
 
+  struct IrFunction;
+  class CompileCache;
+
+  struct CompileOptions {
+    // Superinstructions to fuse after code generation (superinstructions.hpp); 0 = none
+    uint32_t superinstructions{0};
+    // Generate code through the SSA IR (ir.hpp) and its default pass pipeline instead of
+    // straight from the AST
+    bool ssa{false};
+    // Clean up the emitted code with peephole_optimize (peephole.hpp) before fusing
+    bool peephole{true};
+    // Substitute calls to non-recursive functions whose cost is at most this many AST
+    // nodes (inliner.hpp); 0 = never inline
+    uint32_t inlineBudget{24};
+    // Run `return f(...)` as OP_TAILCALL, which reuses the caller's frame, and turn a
+    // function's calls to itself in that position into a jump back to its entry
+    bool tailCalls{true};
+    // Loop transforms of the SSA pipeline (ir_passes.hpp), each switchable for comparison:
+    // hoisting invariant code, replacing products with an induction variable by additions
+    // (off: it costs dispatches in this VM) and computing counting loops' sums in closed form
+    bool licm{true};
+    bool strengthReduction{false};
+    bool closedForm{true};
+    // Threads compiling the module's functions (0 = one per hardware thread, 1 = all on the
+    // calling thread); the bytecode is the same for every count
+    unsigned threads{1};
+  };
+
+  // One function compiled on its own: `code` starts at offset 0 (meta.entry is relative to
+  // it) and the PUSH_CONST operands index `consts`. Compiler::compile links the units in
+  // function order.
+  struct FunctionCode {
+    FuncMeta meta;
+    std::vector<uint8_t> code;
+    std::vector<long long> consts;
+    std::vector<std::string> diags;
+    std::vector<InlineSite> inlined;
+  };
+
+  struct CompileCacheStats {
+    uint64_t hits{0};     // functions linked from the cache
+    uint64_t diskHits{0}; // of those, read from the cache directory
+    uint64_t misses{0};   // functions compiled (and stored)
+  };
+
   struct CompileResult {
     Bytecode bc;
     std::vector<std::string> diags;
+    PeepholeStats peephole;
+    std::vector<InlineSite> inlined; // in code order
+    CompileCacheStats cache;         // this compile's lookups (Compiler::setCache)
   };
 
   class Compiler {
   public:
+    Compiler() = default;
+    explicit Compiler(const CompileOptions &opts) : opts_(opts) {}
     CompileResult compile(const Module &m);
+    // Link functions whose code is already in `cache` (compile_cache.hpp) instead of
+    // compiling them, and store the others there; nullptr = compile everything
+    void setCache(CompileCache *cache) {
+      cache_ = cache;
+    }
 
   private:
+    // What every function's compilation reads about the module; built once by compile()
+    // and shared read-only by the workers
+    struct ModuleInfo {
+      const Module *module{nullptr};
+      std::unordered_map<std::string, uint32_t> funcIndex;
+      InlinePlan inlinePlan;
+    };
+    Compiler(const CompileOptions &opts, const ModuleInfo &info) : opts_(opts), info_(&info) {}
+
+    // compiles function `index` of the module, through SSA with CompileOptions::ssa
+    FunctionCode compileUnit(uint32_t index);
+    // appends the units in function order, relocating their jumps and merging their pools
+    void link(std::vector<FunctionCode> &units);
+
     void emit_u8(uint8_t x);
     void emit_u32(uint32_t x);
     void write_u32_at(uint32_t pos, uint32_t val);
@@ -24,21 +95,60 @@ namespace mplx {
       return (uint32_t)bc_.code.size();
     }
 
-    // functions
+    // functions; compileStmt/compileExpr switch on the node kind
     void compileFunction(const Function &f);
     void compileStmt(const Stmt *s);
+    void compileIf(const IfStmt *s);
+    void declareDropped(const std::vector<std::unique_ptr<Stmt>> &body);
+    void compileWhile(const WhileStmt *s);
     void compileExpr(const Expr *e);
+    void compileUnary(const UnaryExpr *e);
+    void compileBinary(const BinaryExpr *e);
+    void compileCall(const CallExpr *e);
+    // substitutes the body of `callee` for the call, with its locals in fresh slots of the
+    // caller's frame; returns jump to the end of the copy instead of returning
+    void compileInlineCall(const CallExpr *e, uint32_t callee);
+    // `return e` outside an inlined body when `e` calls a function that is not inlined: a
+    // call to the function itself becomes a jump back to its entry, any other call
+    // OP_TAILCALL. Returns false (nothing emitted) for every other `e`.
+    bool compileTailCall(const Expr *e);
+    // lowers one optimized SSA function (ir_emit.cpp)
+    void compileIrFunction(IrFunction &f);
 
-    // helpers
+    // helpers; emitConst uses PUSH_I8/PUSH_I32 for values that fit, the pool otherwise
+    void emitConst(long long v);
+    void emitLoadLocal(uint16_t idx);
+    void emitStoreLocal(uint16_t idx);
+    void emitSetLocal(uint16_t idx); // popping store
+    // pool index of `v`, adding it on first use (the pool holds each value once)
     uint32_t addConst(long long v);
     uint16_t localIndex(const std::string &name);
 
+    CompileOptions opts_;
+    CompileCache *cache_{nullptr};
     Bytecode bc_;
     std::vector<std::string> diags_;
-    std::unordered_map<std::string, uint32_t> funcIndex_;
+    std::unordered_map<long long, uint32_t> constIndex_;
+    const ModuleInfo *info_{nullptr};
     std::vector<std::unordered_map<std::string, uint16_t>> scopes_;
     uint8_t currentArity_{0};
     uint16_t currentLocals_{0};
+
+    // inlining state
+    struct InlineFrame {
+      std::vector<uint32_t> exits;  // operand positions of the jumps `return` emits
+      std::vector<uint16_t> resets; // slots of `let`s that may be read before they are written
+      uint32_t nesting;             // nesting_ at the top level of the body
+    };
+    std::vector<InlineSite> inlined_;
+    std::string currentFunction_;
+    InlineFrame *inline_{nullptr}; // innermost body being inlined
+    uint32_t loopDepth_{0};        // enclosing `while`s, including those around an inlined call
+    uint32_t nesting_{0};          // enclosing if/while statements
+    uint32_t currentIndex_{0};     // of the function being compiled
+    // while the function has self tail calls: their jumps back to the entry and the lets
+    // to zero before each one
+    InlineFrame *selfLoop_{nullptr};
   };
 
 } // namespace mplx
\ No newline at end of file
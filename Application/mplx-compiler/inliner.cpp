@@ -0,0 +1,176 @@
+#include "inliner.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace mplx {
+
+  namespace {
+
+    using Block = std::vector<std::unique_ptr<Stmt>>;
+
+    // Call graph edges and costs over the AST. Strongly connected components come out of
+    // Tarjan's algorithm callees first, which is the order the costs need.
+    class Planner {
+    public:
+      Planner(const Module &m, uint32_t budget) : m_(m), budget_(budget) {
+        for (size_t i = 0; i < m.functions.size(); ++i)
+          index_[m.functions[i].name] = (uint32_t)i;
+        size_t n = m.functions.size();
+        callees_.resize(n);
+        for (size_t i = 0; i < n; ++i)
+          calls(m.functions[i].body, callees_[i]);
+        plan_.cost.assign(n, 0);
+        plan_.inlinable.assign(n, false);
+        order_.assign(n, UINT32_MAX);
+        low_.assign(n, 0);
+        onStack_.assign(n, false);
+      }
+
+      InlinePlan run() {
+        for (uint32_t f = 0; f < m_.functions.size(); ++f)
+          if (order_[f] == UINT32_MAX)
+            visit(f);
+        return std::move(plan_);
+      }
+
+    private:
+      void calls(const Block &body, std::vector<uint32_t> &out) const {
+        for (auto &s : body)
+          calls(s.get(), out);
+      }
+      void calls(const Stmt *s, std::vector<uint32_t> &out) const {
+        switch (s->kind) {
+        case StmtKind::Let: calls(static_cast<const LetStmt *>(s)->init.get(), out); return;
+        case StmtKind::Assign: calls(static_cast<const AssignStmt *>(s)->value.get(), out); return;
+        case StmtKind::Return: calls(static_cast<const ReturnStmt *>(s)->value.get(), out); return;
+        case StmtKind::Expr: calls(static_cast<const ExprStmt *>(s)->expr.get(), out); return;
+        case StmtKind::If: {
+          auto ifs = static_cast<const IfStmt *>(s);
+          calls(ifs->cond.get(), out);
+          calls(ifs->thenS, out);
+          calls(ifs->elseS, out);
+          return;
+        }
+        case StmtKind::While: {
+          auto ws = static_cast<const WhileStmt *>(s);
+          calls(ws->cond.get(), out);
+          calls(ws->body, out);
+          return;
+        }
+        }
+      }
+      void calls(const Expr *e, std::vector<uint32_t> &out) const {
+        switch (e->kind) {
+        case ExprKind::Literal:
+        case ExprKind::Var: return;
+        case ExprKind::Unary: calls(static_cast<const UnaryExpr *>(e)->rhs.get(), out); return;
+        case ExprKind::Binary: {
+          auto b = static_cast<const BinaryExpr *>(e);
+          calls(b->lhs.get(), out);
+          calls(b->rhs.get(), out);
+          return;
+        }
+        case ExprKind::Call: {
+          auto c  = static_cast<const CallExpr *>(e);
+          auto it = index_.find(c->callee);
+          if (it != index_.end())
+            out.push_back(it->second);
+          for (auto &a : c->args)
+            calls(a.get(), out);
+          return;
+        }
+        }
+      }
+
+      uint32_t cost(const Block &body) const {
+        uint32_t n = 0;
+        for (auto &s : body)
+          n += cost(s.get());
+        return n;
+      }
+      uint32_t cost(const Stmt *s) const {
+        switch (s->kind) {
+        case StmtKind::Let: return 1 + cost(static_cast<const LetStmt *>(s)->init.get());
+        case StmtKind::Assign: return 1 + cost(static_cast<const AssignStmt *>(s)->value.get());
+        case StmtKind::Return: return 1 + cost(static_cast<const ReturnStmt *>(s)->value.get());
+        case StmtKind::Expr: return 1 + cost(static_cast<const ExprStmt *>(s)->expr.get());
+        case StmtKind::If: {
+          auto ifs = static_cast<const IfStmt *>(s);
+          return 1 + cost(ifs->cond.get()) + cost(ifs->thenS) + cost(ifs->elseS);
+        }
+        case StmtKind::While: {
+          auto ws = static_cast<const WhileStmt *>(s);
+          return 1 + cost(ws->cond.get()) + cost(ws->body);
+        }
+        }
+        return 1;
+      }
+      uint32_t cost(const Expr *e) const {
+        switch (e->kind) {
+        case ExprKind::Literal:
+        case ExprKind::Var: return 1;
+        case ExprKind::Unary: return 1 + cost(static_cast<const UnaryExpr *>(e)->rhs.get());
+        case ExprKind::Binary: {
+          auto b = static_cast<const BinaryExpr *>(e);
+          return 1 + cost(b->lhs.get()) + cost(b->rhs.get());
+        }
+        case ExprKind::Call: {
+          auto c     = static_cast<const CallExpr *>(e);
+          auto it    = index_.find(c->callee);
+          uint32_t n = it != index_.end() && plan_.inlinable[it->second] ? plan_.cost[it->second] : 1;
+          for (auto &a : c->args)
+            n += cost(a.get());
+          return n;
+        }
+        }
+        return 1;
+      }
+
+      void visit(uint32_t f) {
+        order_[f] = low_[f] = next_++;
+        stack_.push_back(f);
+        onStack_[f] = true;
+        for (uint32_t g : callees_[f]) {
+          if (order_[g] == UINT32_MAX) {
+            visit(g);
+            low_[f] = std::min(low_[f], low_[g]);
+          } else if (onStack_[g]) {
+            low_[f] = std::min(low_[f], order_[g]);
+          }
+        }
+        if (low_[f] != order_[f])
+          return;
+        std::vector<uint32_t> scc;
+        uint32_t g;
+        do {
+          g = stack_.back();
+          stack_.pop_back();
+          onStack_[g] = false;
+          scc.push_back(g);
+        } while (g != f);
+        // every callee outside the component is already decided
+        bool recursive = scc.size() > 1 || std::find(callees_[f].begin(), callees_[f].end(), f) != callees_[f].end();
+        for (uint32_t h : scc) {
+          plan_.cost[h]      = cost(m_.functions[h].body);
+          plan_.inlinable[h] = budget_ > 0 && !recursive && plan_.cost[h] <= budget_;
+        }
+      }
+
+      const Module &m_;
+      uint32_t budget_;
+      std::unordered_map<std::string, uint32_t> index_;
+      std::vector<std::vector<uint32_t>> callees_;
+      InlinePlan plan_;
+      std::vector<uint32_t> order_, low_;
+      std::vector<bool> onStack_;
+      std::vector<uint32_t> stack_;
+      uint32_t next_{0};
+    };
+
+  } // namespace
+
+  InlinePlan plan_inlining(const Module &m, uint32_t budget) {
+    return Planner(m, budget).run();
+  }
+
+} // namespace mplx
@@ -0,0 +1,28 @@
+#pragma once
+#include "../mplx-lang/ast.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mplx {
+
+  // A call whose callee body was substituted in place of OP_CALL/OP_RET
+  struct InlineSite {
+    std::string caller; // function whose code now contains the body
+    std::string callee;
+  };
+
+  // Which functions the code generators may inline (CompileOptions::inlineBudget). Indexed
+  // by function, in Module order.
+  struct InlinePlan {
+    std::vector<uint32_t> cost;  // AST nodes of the body, counting an inlinable callee's cost in place of its call
+    std::vector<bool> inlinable; // not recursive (directly or through other functions) and cost <= budget
+  };
+
+  // Builds the call graph of `m` and decides for every function whether a call to it gets
+  // its body substituted. Costs are computed callees first, so a small function that calls
+  // other small functions is charged for their bodies too and nested inlining stays within
+  // the budget. A budget of 0 inlines nothing.
+  InlinePlan plan_inlining(const Module &m, uint32_t budget);
+
+} // namespace mplx
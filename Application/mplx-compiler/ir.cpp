@@ -0,0 +1,704 @@
+#include "ir.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace mplx {
+
+  std::vector<BlockId> IrFunction::successors(BlockId b) const {
+    const IrTerm &t = blocks[b].term;
+    switch (t.kind) {
+    case IrTermKind::Jump: return {t.target[0]};
+    case IrTermKind::Branch: return {t.target[0], t.target[1]};
+    default: return {};
+    }
+  }
+
+  ValueId IrFunction::add(BlockId b, IrOp op, long long imm, std::vector<ValueId> args) {
+    ValueId id = (ValueId)values.size();
+    values.push_back(IrInst{op, b, imm, std::move(args)});
+    auto &insts = blocks[b].insts;
+    if (op == IrOp::Phi) {
+      auto firstNonPhi = std::find_if(insts.begin(), insts.end(), [&](ValueId v) { return values[v].op != IrOp::Phi; });
+      insts.insert(firstNonPhi, id);
+    } else {
+      insts.push_back(id);
+    }
+    return id;
+  }
+
+  BlockId IrFunction::addBlock() {
+    blocks.emplace_back();
+    return (BlockId)(blocks.size() - 1);
+  }
+
+  void IrFunction::removeEdge(BlockId from, BlockId to) {
+    auto &preds = blocks[to].preds;
+    auto it     = std::find(preds.begin(), preds.end(), from);
+    if (it == preds.end())
+      return;
+    size_t k = (size_t)(it - preds.begin());
+    preds.erase(it);
+    for (ValueId v : blocks[to].insts) {
+      if (values[v].op != IrOp::Phi)
+        break;
+      values[v].args.erase(values[v].args.begin() + (ptrdiff_t)k);
+    }
+  }
+
+  void IrFunction::removeBlock(BlockId b) {
+    for (BlockId s : successors(b))
+      removeEdge(b, s);
+    for (ValueId v : blocks[b].insts)
+      values[v].dead = true;
+    blocks[b] = IrBlock{};
+    blocks[b].dead = true;
+  }
+
+  void IrFunction::forwardValues(const std::vector<ValueId> &to) {
+    auto resolve = [&](ValueId v) {
+      while (v < to.size() && to[v] != kNoValue)
+        v = to[v];
+      return v;
+    };
+    for (ValueId v = 0; v < to.size(); ++v)
+      if (to[v] != kNoValue)
+        values[v].dead = true;
+    for (auto &blk : blocks) {
+      if (blk.dead)
+        continue;
+      blk.insts.erase(std::remove_if(blk.insts.begin(), blk.insts.end(), [&](ValueId v) { return values[v].dead; }),
+                      blk.insts.end());
+      for (ValueId v : blk.insts)
+        for (ValueId &a : values[v].args)
+          a = resolve(a);
+      if (blk.term.value != kNoValue)
+        blk.term.value = resolve(blk.term.value);
+    }
+  }
+
+  namespace {
+
+    // SSA construction as in Braun et al., "Simple and Efficient Construction of Static
+    // Single Assignment Form" (2013): values of a variable are looked up through the
+    // predecessors on demand, a block is sealed once all its predecessors are known and
+    // loop headers get placeholder phis until then. Trivial phis are left to the copy
+    // propagation pass.
+    class IrBuilder {
+    public:
+      IrBuilder(IrFunction &f, const std::unordered_map<std::string, uint32_t> &funcIndex, const Module &m,
+                std::vector<std::string> &diags, const InlinePlan *plan, std::vector<InlineSite> *inlined)
+          : f_(f), funcIndex_(funcIndex), module_(m), diags_(diags), plan_(plan), inlined_(inlined) {}
+
+      void build(const Function &fn) {
+        f_.name  = fn.name;
+        f_.arity = (uint8_t)fn.params.size();
+        cur_     = newBlock();
+        seal(cur_);
+        // variables are the compiler's local slots: parameters first, then one per `let`
+        for (uint32_t p = 0; p < f_.arity; ++p) {
+          names_[fn.params[p].name] = p;
+          writeVar(p, cur_, f_.add(cur_, IrOp::Param, p));
+        }
+        nextVar_ = f_.arity;
+        stmts(fn.body);
+        ret(constant(0)); // implicit 0
+        // drop the blocks that follow a `return` and anything else nothing reaches
+        std::vector<bool> reachable(f_.blocks.size(), false);
+        for (BlockId b : reverse_postorder(f_))
+          reachable[b] = true;
+        for (BlockId b = 0; b < f_.blocks.size(); ++b)
+          if (!reachable[b])
+            f_.removeBlock(b);
+      }
+
+    private:
+      BlockId newBlock() {
+        defs_.emplace_back();
+        incomplete_.emplace_back();
+        sealed_.push_back(false);
+        return f_.addBlock();
+      }
+
+      ValueId constant(long long v) {
+        auto [it, inserted] = consts_.try_emplace(v, kNoValue);
+        if (inserted)
+          it->second = f_.add(0, IrOp::Const, v);
+        return it->second;
+      }
+
+      void edge(BlockId from, BlockId to) {
+        f_.blocks[to].preds.push_back(from);
+      }
+      void jump(BlockId to) {
+        f_.blocks[cur_].term = IrTerm{IrTermKind::Jump, kNoValue, {to, kNoBlock}};
+        edge(cur_, to);
+      }
+      void branch(ValueId cond, BlockId ifTrue, BlockId ifFalse) {
+        f_.blocks[cur_].term = IrTerm{IrTermKind::Branch, cond, {ifTrue, ifFalse}};
+        edge(cur_, ifTrue);
+        edge(cur_, ifFalse);
+      }
+      void ret(ValueId v) {
+        f_.blocks[cur_].term = IrTerm{IrTermKind::Ret, v, {kNoBlock, kNoBlock}};
+      }
+
+      void writeVar(uint32_t var, BlockId b, ValueId v) {
+        defs_[b][var] = v;
+      }
+      ValueId readVar(uint32_t var, BlockId b) {
+        auto it = defs_[b].find(var);
+        if (it != defs_[b].end())
+          return it->second;
+        ValueId v;
+        if (!sealed_[b]) {
+          v = f_.add(b, IrOp::Phi);
+          incomplete_[b].emplace_back(var, v);
+        } else if (f_.blocks[b].preds.size() == 1) {
+          v = readVar(var, f_.blocks[b].preds[0]);
+        } else if (f_.blocks[b].preds.empty()) {
+          v = constant(0); // locals start at 0 (and nothing reads it in unreachable code)
+        } else {
+          v = f_.add(b, IrOp::Phi);
+          writeVar(var, b, v); // breaks the cycle through loops
+          addPhiOperands(var, v);
+        }
+        writeVar(var, b, v);
+        return v;
+      }
+      void addPhiOperands(uint32_t var, ValueId phi) {
+        BlockId b = f_.values[phi].block;
+        for (size_t i = 0; i < f_.blocks[b].preds.size(); ++i) {
+          ValueId a = readVar(var, f_.blocks[b].preds[i]);
+          f_.values[phi].args.push_back(a);
+        }
+      }
+      void seal(BlockId b) {
+        auto pending = std::move(incomplete_[b]);
+        incomplete_[b].clear();
+        for (auto &[var, phi] : pending)
+          addPhiOperands(var, phi);
+        sealed_[b] = true;
+      }
+
+      uint32_t lookup(const std::string &name) {
+        auto it = names_.find(name);
+        if (it != names_.end())
+          return it->second;
+        diags_.push_back("unknown variable: " + name);
+        return UINT32_MAX;
+      }
+
+      void stmts(const std::vector<std::unique_ptr<Stmt>> &body) {
+        for (auto &s : body)
+          stmt(s.get());
+      }
+
+      void stmt(const Stmt *s) {
+        switch (s->kind) {
+        case StmtKind::Let: {
+          auto let         = static_cast<const LetStmt *>(s);
+          uint32_t var     = nextVar_++;
+          names_[let->name] = var; // bound before the initializer, as in Compiler
+          if (inline_)
+            defs_[inline_->entry][var] = constant(0); // zero on every run of the copy, as in a call
+          writeVar(var, cur_, expr(let->init.get()));
+          return;
+        }
+        case StmtKind::Assign: {
+          auto as     = static_cast<const AssignStmt *>(s);
+          uint32_t var = lookup(as->name);
+          ValueId v   = expr(as->value.get());
+          if (var != UINT32_MAX)
+            writeVar(var, cur_, v);
+          return;
+        }
+        case StmtKind::Return:
+          if (inline_) {
+            writeVar(inline_->result, cur_, expr(static_cast<const ReturnStmt *>(s)->value.get()));
+            jump(inline_->exit);
+          } else {
+            ret(expr(static_cast<const ReturnStmt *>(s)->value.get()));
+          }
+          cur_ = newBlock(); // whatever follows is unreachable
+          seal(cur_);
+          return;
+        case StmtKind::Expr: expr(static_cast<const ExprStmt *>(s)->expr.get()); return;
+        case StmtKind::If: ifStmt(static_cast<const IfStmt *>(s)); return;
+        case StmtKind::While: whileStmt(static_cast<const WhileStmt *>(s)); return;
+        }
+        diags_.push_back("unknown stmt kind");
+      }
+
+      // A name first declared in a dropped branch becomes a variable no initializer writes,
+      // as Compiler gives it a slot of its own: it reads 0 until assigned
+      void declareDropped(const std::vector<std::unique_ptr<Stmt>> &body) {
+        for (auto &s : body) {
+          switch (s->kind) {
+          case StmtKind::Let: {
+            auto let = static_cast<const LetStmt *>(s.get());
+            if (names_.count(let->name))
+              break;
+            uint32_t var      = nextVar_++;
+            names_[let->name] = var;
+            if (inline_)
+              defs_[inline_->entry][var] = constant(0);
+            break;
+          }
+          case StmtKind::If: {
+            auto ifs = static_cast<const IfStmt *>(s.get());
+            declareDropped(ifs->thenS);
+            declareDropped(ifs->elseS);
+            break;
+          }
+          case StmtKind::While: declareDropped(static_cast<const WhileStmt *>(s.get())->body); break;
+          default: break;
+          }
+        }
+      }
+
+      void ifStmt(const IfStmt *ifs) {
+        if (ifs->cond->kind == ExprKind::Literal) {
+          // like Compiler::compileIf: the other branch is not compiled, its lets only declare
+          // the names they would bind
+          bool taken = static_cast<const LiteralExpr *>(ifs->cond.get())->value != 0;
+          if (!taken)
+            declareDropped(ifs->thenS);
+          stmts(taken ? ifs->thenS : ifs->elseS);
+          if (taken)
+            declareDropped(ifs->elseS);
+          return;
+        }
+        ValueId c      = expr(ifs->cond.get());
+        BlockId thenB  = newBlock();
+        BlockId elseB  = ifs->elseS.empty() ? kNoBlock : newBlock();
+        BlockId join   = newBlock();
+        branch(c, thenB, elseB == kNoBlock ? join : elseB);
+        seal(thenB);
+        cur_ = thenB;
+        stmts(ifs->thenS);
+        jump(join);
+        if (elseB != kNoBlock) {
+          seal(elseB);
+          cur_ = elseB;
+          stmts(ifs->elseS);
+          jump(join);
+        }
+        seal(join);
+        cur_ = join;
+      }
+
+      void whileStmt(const WhileStmt *ws) {
+        BlockId header = newBlock();
+        jump(header);
+        cur_         = header;
+        ValueId c    = expr(ws->cond.get());
+        BlockId body = newBlock();
+        BlockId exit = newBlock();
+        branch(c, body, exit);
+        seal(body);
+        cur_ = body;
+        stmts(ws->body);
+        jump(header);
+        seal(header);
+        seal(exit);
+        cur_ = exit;
+      }
+
+      ValueId expr(const Expr *e) {
+        switch (e->kind) {
+        case ExprKind::Literal: return constant(static_cast<const LiteralExpr *>(e)->value);
+        case ExprKind::Var: {
+          uint32_t var = lookup(static_cast<const VarExpr *>(e)->name);
+          return var == UINT32_MAX ? constant(0) : readVar(var, cur_);
+        }
+        case ExprKind::Unary: {
+          auto u = static_cast<const UnaryExpr *>(e);
+          ValueId v = expr(u->rhs.get());
+          switch (u->op) {
+          case UnaryOp::Neg: return f_.add(cur_, IrOp::Neg, 0, {v});
+          }
+          diags_.push_back(std::string("unsupported unary op: ") + unary_op_spelling(u->op));
+          return v;
+        }
+        case ExprKind::Binary: {
+          auto b    = static_cast<const BinaryExpr *>(e);
+          ValueId l = expr(b->lhs.get());
+          ValueId r = expr(b->rhs.get());
+          return f_.add(cur_, binary(b->op), 0, {l, r});
+        }
+        case ExprKind::Call: return call(static_cast<const CallExpr *>(e));
+        }
+        diags_.push_back("unknown expr kind");
+        return constant(0);
+      }
+
+      static IrOp binary(BinOp op) {
+        switch (op) {
+        case BinOp::Add: return IrOp::Add;
+        case BinOp::Sub: return IrOp::Sub;
+        case BinOp::Mul: return IrOp::Mul;
+        case BinOp::Div: return IrOp::Div;
+        case BinOp::Eq: return IrOp::Eq;
+        case BinOp::Ne: return IrOp::Ne;
+        case BinOp::Lt: return IrOp::Lt;
+        case BinOp::Le: return IrOp::Le;
+        case BinOp::Gt: return IrOp::Gt;
+        case BinOp::Ge: return IrOp::Ge;
+        }
+        return IrOp::Add;
+      }
+
+      ValueId call(const CallExpr *c) {
+        auto it = funcIndex_.find(c->callee);
+        if (it == funcIndex_.end()) {
+          diags_.push_back("unknown function: " + c->callee);
+          return constant(0);
+        }
+        std::vector<ValueId> args;
+        for (auto &a : c->args)
+          args.push_back(expr(a.get()));
+        size_t arity = module_.functions[it->second].params.size();
+        if (args.size() != arity) {
+          // the stack code would pop the callee's arity whatever was pushed; SSA needs it exact
+          diags_.push_back("wrong number of arguments to " + c->callee + ": expected " + std::to_string(arity) +
+                           ", got " + std::to_string(args.size()));
+          return constant(0);
+        }
+        if (plan_ && it->second < plan_->inlinable.size() && plan_->inlinable[it->second])
+          return inlineCall(module_.functions[it->second], args);
+        return f_.add(cur_, IrOp::Call, it->second, std::move(args));
+      }
+
+      // Builds the body of `fn` into the current function with its variables renamed to
+      // fresh ones; every `return` and the end of the body flow into one exit block
+      ValueId inlineCall(const Function &fn, const std::vector<ValueId> &args) {
+        Inline frame{nextVar_++, newBlock(), cur_};
+        auto callerNames = std::exchange(names_, {});
+        for (size_t p = 0; p < args.size(); ++p) {
+          uint32_t var              = nextVar_++;
+          names_[fn.params[p].name] = var;
+          writeVar(var, cur_, args[p]);
+        }
+        Inline *outer    = std::exchange(inline_, &frame);
+        size_t diagCount = diags_.size();
+        stmts(fn.body);
+        writeVar(frame.result, cur_, constant(0)); // implicit 0
+        jump(frame.exit);
+        seal(frame.exit);
+        cur_    = frame.exit;
+        inline_ = outer;
+        names_  = std::move(callerNames);
+        diags_.resize(diagCount); // the callee's own build reports them
+        if (inlined_)
+          inlined_->push_back(InlineSite{f_.name, fn.name});
+        return readVar(frame.result, cur_);
+      }
+
+      IrFunction &f_;
+      const std::unordered_map<std::string, uint32_t> &funcIndex_;
+      const Module &module_;
+      std::vector<std::string> &diags_;
+      const InlinePlan *plan_;
+      std::vector<InlineSite> *inlined_;
+      struct Inline {
+        uint32_t result; // variable the returns write
+        BlockId exit;
+        BlockId entry; // block the call was in; the body's variables start at 0 there
+      };
+      Inline *inline_{nullptr}; // innermost body being built in place of a call
+      BlockId cur_{0};
+      uint32_t nextVar_{0};
+      std::unordered_map<std::string, uint32_t> names_;
+      std::unordered_map<long long, ValueId> consts_;
+      std::vector<std::unordered_map<uint32_t, ValueId>> defs_;
+      std::vector<std::vector<std::pair<uint32_t, ValueId>>> incomplete_;
+      std::vector<bool> sealed_;
+    };
+
+    const char *op_name(IrOp op) {
+      switch (op) {
+      case IrOp::Const: return "const";
+      case IrOp::Param: return "param";
+      case IrOp::Phi: return "phi";
+      case IrOp::Neg: return "neg";
+      case IrOp::Add: return "add";
+      case IrOp::Sub: return "sub";
+      case IrOp::Mul: return "mul";
+      case IrOp::Div: return "div";
+      case IrOp::Eq: return "eq";
+      case IrOp::Ne: return "ne";
+      case IrOp::Lt: return "lt";
+      case IrOp::Le: return "le";
+      case IrOp::Gt: return "gt";
+      case IrOp::Ge: return "ge";
+      case IrOp::Call: return "call";
+      }
+      return "?";
+    }
+
+  } // namespace
+
+  IrModule build_ir(const Module &m, std::vector<std::string> &diags, const InlinePlan *plan,
+                    std::vector<InlineSite> *inlined) {
+    std::unordered_map<std::string, uint32_t> funcIndex;
+    for (size_t i = 0; i < m.functions.size(); ++i)
+      funcIndex[m.functions[i].name] = (uint32_t)i;
+    IrModule out;
+    out.functions.reserve(m.functions.size());
+    for (size_t i = 0; i < m.functions.size(); ++i)
+      out.functions.push_back(build_ir_function(m, (uint32_t)i, funcIndex, diags, plan, inlined));
+    return out;
+  }
+
+  IrFunction build_ir_function(const Module &m, uint32_t index,
+                               const std::unordered_map<std::string, uint32_t> &funcIndex,
+                               std::vector<std::string> &diags, const InlinePlan *plan,
+                               std::vector<InlineSite> *inlined) {
+    IrFunction f;
+    f.index = index;
+    IrBuilder(f, funcIndex, m, diags, plan, inlined).build(m.functions[index]);
+    return f;
+  }
+
+  std::vector<BlockId> reverse_postorder(const IrFunction &f) {
+    std::vector<BlockId> post;
+    if (f.blocks.empty())
+      return post;
+    std::vector<bool> seen(f.blocks.size(), false);
+    std::vector<std::pair<BlockId, size_t>> stack{{0, 0}};
+    seen[0] = true;
+    while (!stack.empty()) {
+      auto &[b, next] = stack.back();
+      auto succs      = f.successors(b);
+      if (next < succs.size()) {
+        BlockId s = succs[succs.size() - 1 - next++];
+        if (!seen[s]) {
+          seen[s] = true;
+          stack.emplace_back(s, 0);
+        }
+      } else {
+        post.push_back(b);
+        stack.pop_back();
+      }
+    }
+    return {post.rbegin(), post.rend()};
+  }
+
+  std::vector<BlockId> dominators(const IrFunction &f, const std::vector<BlockId> &rpo) {
+    // Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+    std::vector<BlockId> idom(f.blocks.size(), kNoBlock);
+    std::vector<uint32_t> order(f.blocks.size(), UINT32_MAX);
+    for (uint32_t i = 0; i < rpo.size(); ++i)
+      order[rpo[i]] = i;
+    if (rpo.empty())
+      return idom;
+    idom[rpo[0]] = rpo[0];
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 1; i < rpo.size(); ++i) {
+        BlockId b       = rpo[i];
+        BlockId newIdom = kNoBlock;
+        for (BlockId p : f.blocks[b].preds) {
+          if (idom[p] == kNoBlock)
+            continue;
+          if (newIdom == kNoBlock) {
+            newIdom = p;
+            continue;
+          }
+          BlockId x = p, y = newIdom;
+          while (x != y) {
+            while (order[x] > order[y])
+              x = idom[x];
+            while (order[y] > order[x])
+              y = idom[y];
+          }
+          newIdom = x;
+        }
+        if (idom[b] != newIdom) {
+          idom[b] = newIdom;
+          changed = true;
+        }
+      }
+    }
+    return idom;
+  }
+
+  bool ir_has_effects(const IrFunction &f, const IrInst &in) {
+    if (in.op == IrOp::Div) {
+      const IrInst &d = f.values[in.args[1]];
+      return d.op != IrOp::Const || d.imm == 0 || d.imm == -1;
+    }
+    return ir_has_effects(in.op);
+  }
+
+  std::vector<std::string> verify_ir(const IrFunction &f) {
+    std::vector<std::string> errs;
+    auto err = [&](const std::string &where, const std::string &what) { errs.push_back(f.name + ": " + where + ": " + what); };
+    auto rpo  = reverse_postorder(f);
+    auto idom = dominators(f, rpo);
+    std::vector<uint32_t> pos(f.values.size(), UINT32_MAX);
+    for (BlockId b = 0; b < f.blocks.size(); ++b)
+      for (uint32_t i = 0; i < f.blocks[b].insts.size(); ++i)
+        if (f.blocks[b].insts[i] < f.values.size())
+          pos[f.blocks[b].insts[i]] = i;
+    auto dominates = [&](BlockId a, BlockId b) {
+      for (;;) {
+        if (a == b)
+          return true;
+        if (idom[b] == b || idom[b] == kNoBlock)
+          return false;
+        b = idom[b];
+      }
+    };
+    // `v` may be read in block `b` before its instruction number `at`
+    auto checkOperand = [&](const std::string &where, ValueId v, BlockId b, uint32_t at) {
+      if (v >= f.values.size() || f.values[v].dead || pos[v] == UINT32_MAX) {
+        err(where, "operand v" + std::to_string(v) + " is not a live value");
+        return;
+      }
+      BlockId def = f.values[v].block;
+      if (def == b ? pos[v] >= at : !dominates(def, b)) {
+        std::string msg = "v";
+        msg += std::to_string(v);
+        msg += " does not dominate its use";
+        err(where, msg);
+      }
+    };
+
+    for (BlockId b = 0; b < f.blocks.size(); ++b) {
+      const IrBlock &blk = f.blocks[b];
+      if (blk.dead)
+        continue;
+      std::string bn = "b";
+      bn += std::to_string(b);
+      if (idom[b] == kNoBlock)
+        err(bn, "unreachable");
+      for (BlockId p : blk.preds) {
+        auto succs = f.successors(p);
+        if (p >= f.blocks.size() || f.blocks[p].dead ||
+            std::count(succs.begin(), succs.end(), b) != std::count(blk.preds.begin(), blk.preds.end(), p))
+          err(bn, "predecessor b" + std::to_string(p) + " does not match its terminator");
+      }
+      for (BlockId s : f.successors(b)) {
+        if (s >= f.blocks.size() || f.blocks[s].dead)
+          err(bn, "jumps to a removed block");
+        else if (std::find(f.blocks[s].preds.begin(), f.blocks[s].preds.end(), b) == f.blocks[s].preds.end())
+          err(bn, "missing from the predecessors of b" + std::to_string(s));
+      }
+      bool phis = true;
+      for (uint32_t i = 0; i < blk.insts.size(); ++i) {
+        ValueId v = blk.insts[i];
+        std::string vn = bn + " v" + std::to_string(v);
+        if (v >= f.values.size() || f.values[v].dead || f.values[v].block != b) {
+          err(vn, "listed in the wrong block or removed");
+          continue;
+        }
+        const IrInst &in = f.values[v];
+        size_t want      = in.args.size();
+        switch (in.op) {
+        case IrOp::Const:
+        case IrOp::Param: want = 0; break;
+        case IrOp::Phi: want = blk.preds.size(); break;
+        case IrOp::Neg: want = 1; break;
+        case IrOp::Call: break;
+        default: want = 2; break;
+        }
+        if (in.args.size() != want)
+          err(vn, "has " + std::to_string(in.args.size()) + " operands, expected " + std::to_string(want));
+        if (in.op == IrOp::Phi) {
+          if (!phis)
+            err(vn, "phi after a non-phi instruction");
+          for (size_t k = 0; k < in.args.size() && k < blk.preds.size(); ++k)
+            checkOperand(vn, in.args[k], blk.preds[k], UINT32_MAX);
+        } else {
+          phis = false;
+          for (ValueId a : in.args)
+            checkOperand(vn, a, b, i);
+        }
+      }
+      switch (blk.term.kind) {
+      case IrTermKind::None: err(bn, "has no terminator"); break;
+      case IrTermKind::Jump: break;
+      case IrTermKind::Branch:
+      case IrTermKind::Ret: checkOperand(bn + " terminator", blk.term.value, b, UINT32_MAX); break;
+      }
+    }
+    return errs;
+  }
+
+  std::string dump_ir(const IrFunction &f) {
+    // names are appended piecewise: "v" + std::to_string(v) trips a GCC 12 -Wrestrict false positive
+    auto name = [](char prefix, uint32_t id) {
+      std::string s(1, prefix);
+      s += std::to_string(id);
+      return s;
+    };
+    std::string out = "function ";
+    out += f.name;
+    out += '(';
+    out += std::to_string(f.arity);
+    out += ")\n";
+    for (BlockId b = 0; b < f.blocks.size(); ++b) {
+      const IrBlock &blk = f.blocks[b];
+      if (blk.dead)
+        continue;
+      out += name('b', b);
+      out += ':';
+      if (!blk.preds.empty()) {
+        out += " ; preds";
+        for (BlockId p : blk.preds) {
+          out += ' ';
+          out += name('b', p);
+        }
+      }
+      out += '\n';
+      for (ValueId v : blk.insts) {
+        const IrInst &in = f.values[v];
+        out += "  ";
+        out += name('v', v);
+        out += " = ";
+        out += op_name(in.op);
+        if (in.op == IrOp::Const || in.op == IrOp::Param || in.op == IrOp::Call) {
+          out += ' ';
+          out += std::to_string(in.imm);
+        }
+        for (size_t k = 0; k < in.args.size(); ++k) {
+          out += k ? ", " : " ";
+          out += name('v', in.args[k]);
+          if (in.op == IrOp::Phi && k < blk.preds.size()) {
+            out += " [";
+            out += name('b', blk.preds[k]);
+            out += ']';
+          }
+        }
+        out += '\n';
+      }
+      switch (blk.term.kind) {
+      case IrTermKind::None: out += "  <no terminator>\n"; break;
+      case IrTermKind::Jump:
+        out += "  jmp ";
+        out += name('b', blk.term.target[0]);
+        out += '\n';
+        break;
+      case IrTermKind::Branch:
+        out += "  br ";
+        out += name('v', blk.term.value);
+        out += ", ";
+        out += name('b', blk.term.target[0]);
+        out += ", ";
+        out += name('b', blk.term.target[1]);
+        out += '\n';
+        break;
+      case IrTermKind::Ret:
+        out += "  ret ";
+        out += name('v', blk.term.value);
+        out += '\n';
+        break;
+      }
+    }
+    return out;
+  }
+
+} // namespace mplx
@@ -0,0 +1,139 @@
+#pragma once
+#include "../mplx-lang/ast.hpp"
+#include "inliner.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mplx {
+
+  // SSA intermediate representation between the AST and Bytecode. Every value is a signed
+  // 64-bit integer (the language's only runtime type) defined exactly once by an IrInst;
+  // control flow is a graph of basic blocks ending in one terminator each, and values that
+  // merge at a join are phis. build_ir creates it, the passes in ir_passes.hpp rewrite it
+  // and Compiler lowers it back to stack bytecode (CompileOptions::ssa).
+  using ValueId              = uint32_t;
+  using BlockId              = uint32_t;
+  constexpr ValueId kNoValue = UINT32_MAX;
+  constexpr BlockId kNoBlock = UINT32_MAX;
+
+  enum class IrOp : uint8_t {
+    Const, // imm
+    Param, // parameter number imm
+    Phi,   // args[i] flows in from preds[i] of the block
+    Neg,
+    Add,
+    Sub,
+    Mul,
+    Div, // faults at run time on a zero divisor
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Call, // function index imm, args are the arguments
+  };
+
+  struct IrInst {
+    IrOp op;
+    BlockId block;
+    long long imm{0};
+    std::vector<ValueId> args;
+    bool dead{false}; // removed; the id stays reserved
+  };
+
+  enum class IrTermKind : uint8_t { None, Jump, Branch, Ret };
+
+  struct IrTerm {
+    IrTermKind kind{IrTermKind::None};
+    ValueId value{kNoValue};               // Branch condition, Ret value
+    BlockId target[2]{kNoBlock, kNoBlock}; // Jump: [0]; Branch: [0] if value != 0, [1] otherwise
+  };
+
+  struct IrBlock {
+    std::vector<ValueId> insts; // phis first, then the rest in evaluation order
+    std::vector<BlockId> preds; // one entry per incoming edge, in phi argument order
+    IrTerm term;
+    bool dead{false};
+  };
+
+  struct IrFunction {
+    std::string name;
+    uint8_t arity{0};
+    uint32_t index{0};           // position in the IrModule: the imm of a Call to this function
+    std::vector<IrInst> values;  // indexed by ValueId
+    std::vector<IrBlock> blocks; // indexed by BlockId; block 0 is the entry
+
+    // Successors of `b` in terminator order (a Branch to one block twice lists it twice)
+    std::vector<BlockId> successors(BlockId b) const;
+    ValueId add(BlockId b, IrOp op, long long imm = 0, std::vector<ValueId> args = {});
+    BlockId addBlock();
+    // Drops the edge from `from` into `to`: the pred entry and the matching phi argument
+    void removeEdge(BlockId from, BlockId to);
+    // Marks `b` dead and drops its outgoing edges
+    void removeBlock(BlockId b);
+    // For every v with to[v] != kNoValue: makes each use of v read to[v] (followed
+    // transitively) and removes v
+    void forwardValues(const std::vector<ValueId> &to);
+  };
+
+  struct IrModule {
+    std::vector<IrFunction> functions; // in Module order, so function indices carry over
+  };
+
+  // Builds SSA for every function of `m`. Names resolve exactly as Compiler resolves them
+  // (flat per function, a `let` binds before its initializer runs, locals start at 0) and
+  // an `if` on a literal only builds the taken branch, so both pipelines agree on every
+  // program. Problems are appended to `diags` with the compiler's wording. With a `plan`,
+  // calls to its inlinable functions build the callee's body in place (a `return` jumps to
+  // a join whose phi is the call's value) and each such call is appended to `inlined`.
+  IrModule build_ir(const Module &m, std::vector<std::string> &diags, const InlinePlan *plan = nullptr,
+                    std::vector<InlineSite> *inlined = nullptr);
+  // build_ir for function `index` alone; `funcIndex` maps each name to the index of its last
+  // definition, as build_ir computes it
+  IrFunction build_ir_function(const Module &m, uint32_t index,
+                               const std::unordered_map<std::string, uint32_t> &funcIndex,
+                               std::vector<std::string> &diags, const InlinePlan *plan = nullptr,
+                               std::vector<InlineSite> *inlined = nullptr);
+
+  // Blocks reachable from the entry in reverse postorder. Successors are visited last to
+  // first, so a block's first successor (a loop body, a `then` branch) tends to follow it;
+  // the bytecode emitter uses this order as the code layout.
+  std::vector<BlockId> reverse_postorder(const IrFunction &f);
+  // Immediate dominator of every block (the entry is its own; unreachable blocks get kNoBlock)
+  std::vector<BlockId> dominators(const IrFunction &f, const std::vector<BlockId> &rpo);
+
+  // A natural loop: the header, which dominates the loop, and every block that reaches an
+  // edge back to it without passing through it
+  struct IrLoop {
+    BlockId header;
+    std::vector<BlockId> blocks;  // header first, the rest in reverse postorder
+    std::vector<BlockId> latches; // blocks with an edge back to the header
+    std::vector<bool> contains;   // indexed by BlockId
+  };
+  // The loops of `f`, inner loops before the loops around them (ir_loops.cpp)
+  std::vector<IrLoop> find_loops(const IrFunction &f);
+  // The block outside `loop` that is the only way into its header, ending in a jump there.
+  // Creates it (and phis in it for values that come in from several places) when the
+  // header has several predecessors outside the loop or one that branches. A new block is
+  // added to the other loops of `loops` that contain the header.
+  BlockId ensure_preheader(IrFunction &f, IrLoop &loop, std::vector<IrLoop> &loops);
+
+  // Structural checks: edges and phi arguments agree, every live block is terminated and
+  // every operand is a live value whose definition dominates the use. Returns one message
+  // per problem; empty means well formed.
+  std::vector<std::string> verify_ir(const IrFunction &f);
+
+  // Readable listing, one instruction per line ("v3 = add v1, v2")
+  std::string dump_ir(const IrFunction &f);
+
+  // Does evaluating `op` have an effect besides its value (a call, or a division that may fault)?
+  inline bool ir_has_effects(IrOp op) {
+    return op == IrOp::Call || op == IrOp::Div;
+  }
+  // The same for one instruction: a division by a constant other than 0 and -1 cannot fault
+  bool ir_has_effects(const IrFunction &f, const IrInst &in);
+
+} // namespace mplx
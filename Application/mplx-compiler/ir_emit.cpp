@@ -0,0 +1,397 @@
+#include "compiler.hpp"
+#include "ir.hpp"
+#include <algorithm>
+
+namespace mplx {
+
+  namespace {
+
+    // Gives each edge from a branch into a block with phis a block of its own, so the phi
+    // copies for that edge have somewhere to go
+    void split_critical_edges(IrFunction &f) {
+      const BlockId n = (BlockId)f.blocks.size();
+      for (BlockId b = 0; b < n; ++b) {
+        if (f.blocks[b].dead || f.blocks[b].term.kind != IrTermKind::Branch)
+          continue;
+        for (int i = 0; i < 2; ++i) {
+          BlockId s         = f.blocks[b].term.target[i];
+          const auto &insts = f.blocks[s].insts;
+          if (insts.empty() || f.values[insts[0]].op != IrOp::Phi)
+            continue;
+          BlockId e         = f.addBlock();
+          f.blocks[e].preds = {b};
+          f.blocks[e].term  = IrTerm{IrTermKind::Jump, kNoValue, {s, kNoBlock}};
+          auto &preds       = f.blocks[s].preds;
+          *std::find(preds.begin(), preds.end(), b) = e; // same index, so phi arguments still line up
+          f.blocks[b].term.target[i] = e;
+        }
+      }
+    }
+
+    // How a function becomes stack code. Blocks are laid out in reverse postorder and every
+    // block starts and ends with an empty operand stack. Within a block, an instruction
+    // whose only use is an operand of a later one, with nothing else evaluated in between,
+    // is computed straight onto the operand stack where that user wants it (so expression
+    // trees come out as the AST compiler would emit them); every other value lives in a
+    // local slot, constants are pushed where they are used and parameters read from their
+    // own slots. A phi is a slot that each predecessor stores into before jumping.
+    struct LoweringPlan {
+      std::vector<BlockId> layout;
+      std::vector<uint32_t> uses;
+      std::vector<bool> onStack;
+      std::vector<uint32_t> slot;
+      uint32_t locals{0};
+      // per block ending in a jump: (phi, incoming value) stores for the target's phis in
+      // emission order, and whether they must all be evaluated before the first store
+      // (when the copies read each other's phis in a cycle)
+      std::vector<std::vector<std::pair<ValueId, ValueId>>> copies;
+      std::vector<bool> copiesViaStack;
+    };
+
+    // Phis of `target` that evaluating `v` in block `b` may read
+    void phi_reads(const IrFunction &f, ValueId v, BlockId b, BlockId target, std::vector<ValueId> &out) {
+      const IrInst &in = f.values[v];
+      if (in.op == IrOp::Phi) {
+        if (in.block == target)
+          out.push_back(v);
+        return;
+      }
+      if (in.block != b)
+        return;
+      for (ValueId a : in.args)
+        phi_reads(f, a, b, target, out);
+    }
+
+    // `pos` numbers the instructions of `b` in evaluation order
+    void plan_copies(const IrFunction &f, BlockId b, const std::vector<uint32_t> &pos, LoweringPlan &p) {
+      const IrTerm &t = f.blocks[b].term;
+      if (t.kind != IrTermKind::Jump)
+        return;
+      BlockId s         = t.target[0];
+      const auto &preds = f.blocks[s].preds;
+      size_t k          = (size_t)(std::find(preds.begin(), preds.end(), b) - preds.begin());
+      std::vector<std::pair<ValueId, ValueId>> pending;
+      for (ValueId v : f.blocks[s].insts) {
+        if (f.values[v].op != IrOp::Phi)
+          break;
+        ValueId in = f.values[v].args[k];
+        bool same  = in == v || (b == 0 && f.values[in].op == IrOp::Param && p.slot[v] == (uint32_t)f.values[in].imm);
+        if (p.uses[v] > 0 && !same)
+          pending.emplace_back(v, in);
+      }
+      // in the order the incoming values are computed, so their trees can stay on the stack
+      auto rank = [&](ValueId v) { return f.values[v].block == b && pos[v] != UINT32_MAX ? (long long)pos[v] : -1LL; };
+      std::stable_sort(pending.begin(), pending.end(), [&](auto &x, auto &y) { return rank(x.second) < rank(y.second); });
+      std::vector<std::vector<ValueId>> reads(pending.size());
+      for (size_t i = 0; i < pending.size(); ++i)
+        phi_reads(f, pending[i].second, b, s, reads[i]);
+      // store a phi once no copy still to come reads it; a cycle (x, y = y, x) falls back
+      // to evaluating everything before storing anything
+      auto &order = p.copies[b];
+      std::vector<bool> done(pending.size(), false);
+      while (order.size() < pending.size()) {
+        size_t pick = pending.size();
+        for (size_t i = 0; i < pending.size() && pick == pending.size(); ++i) {
+          if (done[i])
+            continue;
+          bool readLater = false;
+          for (size_t j = 0; j < pending.size() && !readLater; ++j)
+            readLater = j != i && !done[j] &&
+                        std::find(reads[j].begin(), reads[j].end(), pending[i].first) != reads[j].end();
+          if (!readLater)
+            pick = i;
+        }
+        if (pick == pending.size()) {
+          order                = pending;
+          p.copiesViaStack[b] = true;
+          return;
+        }
+        done[pick] = true;
+        order.push_back(pending[pick]);
+      }
+    }
+
+    LoweringPlan plan_lowering(const IrFunction &f) {
+      LoweringPlan p;
+      const size_t nv = f.values.size();
+      p.layout        = reverse_postorder(f);
+      p.uses.assign(nv, 0);
+      p.onStack.assign(nv, false);
+      p.slot.assign(nv, UINT32_MAX);
+      p.copies.resize(f.blocks.size());
+      p.copiesViaStack.assign(f.blocks.size(), false);
+      for (BlockId b : p.layout) {
+        for (ValueId v : f.blocks[b].insts)
+          for (ValueId a : f.values[v].args)
+            ++p.uses[a];
+        if (f.blocks[b].term.value != kNoValue)
+          ++p.uses[f.blocks[b].term.value];
+      }
+      // a phi that is the only reader of a parameter, which flows in from the entry block
+      // (a loop header ir_tail_recursion made), takes over the parameter's slot: the entry
+      // runs once, before any other edge stores into the phi, so that edge needs no copy
+      std::vector<uint32_t> paramUses(f.arity, 0);
+      for (ValueId v = 0; v < nv; ++v)
+        if (!f.values[v].dead && f.values[v].op == IrOp::Param)
+          paramUses[f.values[v].imm] += p.uses[v];
+      for (BlockId b : p.layout)
+        for (ValueId v : f.blocks[b].insts) {
+          if (f.values[v].op != IrOp::Phi)
+            break;
+          for (size_t k = 0; k < f.values[v].args.size(); ++k) {
+            const IrInst &a = f.values[f.values[v].args[k]];
+            if (a.op == IrOp::Param && f.blocks[b].preds[k] == 0 && paramUses[a.imm] == 1) {
+              p.slot[v]        = (uint32_t)a.imm;
+              paramUses[a.imm] = 0;
+              break;
+            }
+          }
+        }
+
+      std::vector<uint32_t> pos(nv, UINT32_MAX), treeStart(nv, 0);
+      std::vector<std::vector<ValueId>> seqs(f.blocks.size());
+      for (BlockId b : p.layout) {
+        // the instructions emitted in order, then the terminator with its operands
+        auto &seq = seqs[b];
+        for (ValueId v : f.blocks[b].insts) {
+          IrOp op = f.values[v].op;
+          if (op != IrOp::Phi && op != IrOp::Const && op != IrOp::Param) {
+            pos[v] = (uint32_t)seq.size();
+            seq.push_back(v);
+          }
+        }
+        plan_copies(f, b, pos, p);
+        std::vector<ValueId> termArgs;
+        for (auto &c : p.copies[b])
+          termArgs.push_back(c.second);
+        if (f.blocks[b].term.value != kNoValue)
+          termArgs.push_back(f.blocks[b].term.value);
+
+        for (uint32_t i = 0; i <= seq.size(); ++i) {
+          const auto &args = i < seq.size() ? f.values[seq[i]].args : termArgs;
+          // claim the operands, last first, while each is the tree right before the next
+          uint32_t cur = i; // one past the next expected position
+          for (size_t j = args.size(); j-- > 0;) {
+            ValueId o        = args[j];
+            const IrInst &in = f.values[o];
+            if (in.op == IrOp::Const || in.op == IrOp::Param)
+              continue; // pushed in place, occupies no position
+            if (in.block != b || in.op == IrOp::Phi || p.uses[o] != 1 || cur == 0 || pos[o] != cur - 1)
+              break;
+            p.onStack[o] = true;
+            cur          = treeStart[o];
+          }
+          if (i < seq.size())
+            treeStart[seq[i]] = cur;
+        }
+      }
+
+      // Phis and values read outside their block get a slot each. The rest share a pool:
+      // a slot is reused once the last instruction reading its value has been emitted.
+      auto needsSlot = [&](ValueId v) {
+        IrOp op = f.values[v].op;
+        return op != IrOp::Const && op != IrOp::Param && !p.onStack[v] && p.uses[v] > 0;
+      };
+      std::vector<BlockId> readIn(nv, kNoBlock);
+      std::vector<bool> blockLocal(nv, true);
+      auto noteRead = [&](ValueId a, BlockId where) {
+        if (readIn[a] == kNoBlock)
+          readIn[a] = where;
+        else if (readIn[a] != where)
+          blockLocal[a] = false;
+      };
+      for (BlockId b : p.layout) {
+        for (ValueId v : f.blocks[b].insts) {
+          const IrInst &in = f.values[v];
+          for (size_t k = 0; k < in.args.size(); ++k)
+            noteRead(in.args[k], in.op == IrOp::Phi ? f.blocks[b].preds[k] : b); // phi copies sit in the pred
+        }
+        if (f.blocks[b].term.value != kNoValue)
+          noteRead(f.blocks[b].term.value, b);
+      }
+      for (ValueId v = 0; v < nv; ++v)
+        blockLocal[v] = blockLocal[v] && f.values[v].op != IrOp::Phi && readIn[v] == f.values[v].block;
+
+      p.locals = f.arity;
+      for (BlockId b : p.layout)
+        for (ValueId v : f.blocks[b].insts)
+          if (needsSlot(v) && !blockLocal[v] && p.slot[v] == UINT32_MAX)
+            p.slot[v] = p.locals++;
+      const uint32_t poolBase = p.locals;
+      uint32_t poolSize       = 0;
+      std::vector<uint32_t> lastRead(nv, 0);
+      for (BlockId b : p.layout) {
+        const auto &seq = seqs[b];
+        // an on-stack tree is emitted, and reads its operands, at its root's position
+        auto reads = [&](auto &self, ValueId v, uint32_t at) -> void {
+          if (p.onStack[v]) {
+            for (ValueId a : f.values[v].args)
+              self(self, a, at);
+          } else if (blockLocal[v] && needsSlot(v)) {
+            lastRead[v] = std::max(lastRead[v], at);
+          }
+        };
+        for (ValueId v : seq)
+          lastRead[v] = pos[v] + 1; // read by nothing that is emitted: free right away
+        for (uint32_t i = 0; i < seq.size(); ++i)
+          if (!p.onStack[seq[i]])
+            for (ValueId a : f.values[seq[i]].args)
+              reads(reads, a, i);
+        for (auto &c : p.copies[b])
+          reads(reads, c.second, (uint32_t)seq.size());
+        if (f.blocks[b].term.value != kNoValue)
+          reads(reads, f.blocks[b].term.value, (uint32_t)seq.size());
+
+        std::vector<std::vector<ValueId>> freeAt(seq.size() + 1);
+        for (ValueId v : seq)
+          if (blockLocal[v] && needsSlot(v))
+            freeAt[lastRead[v]].push_back(v);
+        std::vector<uint32_t> freeSlots;
+        uint32_t used = 0;
+        for (uint32_t i = 0; i < seq.size(); ++i) {
+          for (ValueId v : freeAt[i])
+            freeSlots.push_back(p.slot[v]);
+          ValueId v = seq[i];
+          if (!blockLocal[v] || !needsSlot(v))
+            continue;
+          if (freeSlots.empty()) {
+            p.slot[v] = poolBase + used++;
+          } else {
+            p.slot[v] = freeSlots.back();
+            freeSlots.pop_back();
+          }
+        }
+        poolSize = std::max(poolSize, used);
+      }
+      p.locals = poolBase + poolSize;
+      return p;
+    }
+
+  } // namespace
+
+  void Compiler::compileIrFunction(IrFunction &f) {
+    split_critical_edges(f);
+    const LoweringPlan p = plan_lowering(f);
+    FuncMeta meta;
+    meta.name   = f.name;
+    meta.entry  = tell();
+    meta.arity  = f.arity;
+    meta.locals = (uint16_t)p.locals;
+
+    auto treeHasEffects = [&](auto &self, ValueId v) -> bool {
+      if (ir_has_effects(f.values[v].op))
+        return true;
+      for (ValueId a : f.values[v].args)
+        if (p.onStack[a] && self(self, a))
+          return true;
+      return false;
+    };
+    // pushes the value of `v`: computed here if `compute` or `v` is on-stack, loaded otherwise
+    auto value = [&](auto &self, ValueId v, bool compute) -> void {
+      const IrInst &in = f.values[v];
+      if (in.op == IrOp::Const) {
+        emitConst(in.imm);
+        return;
+      }
+      if (in.op == IrOp::Param) {
+        emitLoadLocal((uint16_t)in.imm);
+        return;
+      }
+      if (!compute && !p.onStack[v]) {
+        emitLoadLocal((uint16_t)p.slot[v]);
+        return;
+      }
+      for (ValueId a : in.args)
+        self(self, a, false);
+      switch (in.op) {
+      case IrOp::Neg: emit_u8(OP_NEG); return;
+      case IrOp::Add: emit_u8(OP_ADD); return;
+      case IrOp::Sub: emit_u8(OP_SUB); return;
+      case IrOp::Mul: emit_u8(OP_MUL); return;
+      case IrOp::Div: emit_u8(OP_DIV); return;
+      case IrOp::Eq: emit_u8(OP_EQ); return;
+      case IrOp::Ne: emit_u8(OP_NE); return;
+      case IrOp::Lt: emit_u8(OP_LT); return;
+      case IrOp::Le: emit_u8(OP_LE); return;
+      case IrOp::Gt: emit_u8(OP_GT); return;
+      case IrOp::Ge: emit_u8(OP_GE); return;
+      case IrOp::Call:
+        emit_u8(OP_CALL);
+        emit_u32((uint32_t)in.imm);
+        return;
+      default: diags_.push_back("cannot lower IR value v" + std::to_string(v)); return;
+      }
+    };
+
+    std::vector<uint32_t> blockStart(f.blocks.size(), 0);
+    std::vector<std::pair<uint32_t, BlockId>> fixups;
+    auto jumpTo = [&](Op op, BlockId target) {
+      emit_u8(op);
+      fixups.emplace_back(tell(), target);
+      emit_u32(0);
+    };
+    for (size_t li = 0; li < p.layout.size(); ++li) {
+      BlockId b          = p.layout[li];
+      BlockId next       = li + 1 < p.layout.size() ? p.layout[li + 1] : kNoBlock;
+      const IrBlock &blk = f.blocks[b];
+      blockStart[b]      = tell();
+      for (ValueId v : blk.insts) {
+        IrOp op = f.values[v].op;
+        if (op == IrOp::Phi || op == IrOp::Const || op == IrOp::Param || p.onStack[v])
+          continue;
+        if (p.uses[v] == 0 && !treeHasEffects(treeHasEffects, v))
+          continue;
+        value(value, v, true);
+        if (p.uses[v] > 0)
+          emitStoreLocal((uint16_t)p.slot[v]);
+        emit_u8(OP_POP);
+      }
+      const IrTerm &t = blk.term;
+      switch (t.kind) {
+      case IrTermKind::Jump: {
+        const auto &copies = p.copies[b];
+        if (p.copiesViaStack[b]) {
+          for (auto &c : copies)
+            value(value, c.second, false);
+          for (auto it = copies.rbegin(); it != copies.rend(); ++it) {
+            emitStoreLocal((uint16_t)p.slot[it->first]);
+            emit_u8(OP_POP);
+          }
+        } else {
+          for (auto &c : copies) {
+            value(value, c.second, false);
+            emitStoreLocal((uint16_t)p.slot[c.first]);
+            emit_u8(OP_POP);
+          }
+        }
+        if (t.target[0] != next)
+          jumpTo(OP_JMP, t.target[0]);
+        break;
+      }
+      case IrTermKind::Branch:
+        value(value, t.value, false);
+        if (t.target[0] == next) {
+          jumpTo(OP_JMP_IF_FALSE, t.target[1]);
+        } else if (t.target[1] == next) {
+          jumpTo(OP_JMP_IF_TRUE, t.target[0]);
+        } else {
+          jumpTo(OP_JMP_IF_FALSE, t.target[1]);
+          jumpTo(OP_JMP, t.target[0]);
+        }
+        break;
+      case IrTermKind::Ret:
+        value(value, t.value, false);
+        // a call computed right here is the last thing the frame does: reuse it
+        if (opts_.tailCalls && p.onStack[t.value] && f.values[t.value].op == IrOp::Call)
+          bc_.code[tell() - 5] = OP_TAILCALL;
+        emit_u8(OP_RET);
+        break;
+      case IrTermKind::None: diags_.push_back("IR block b" + std::to_string(b) + " of " + f.name + " has no terminator"); break;
+      }
+    }
+    for (auto &[at, target] : fixups)
+      write_u32_at(at, blockStart[target]);
+    bc_.functions.push_back(meta);
+  }
+
+} // namespace mplx
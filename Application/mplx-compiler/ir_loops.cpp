@@ -0,0 +1,696 @@
+#include "ir_passes.hpp"
+#include <algorithm>
+#include <map>
+#include <utility>
+
+namespace mplx {
+
+  std::vector<IrLoop> find_loops(const IrFunction &f) {
+    const size_t nb = f.blocks.size();
+    auto rpo        = reverse_postorder(f);
+    auto idom       = dominators(f, rpo);
+    auto dominates  = [&](BlockId a, BlockId b) {
+      for (;;) {
+        if (a == b)
+          return true;
+        if (idom[b] == b || idom[b] == kNoBlock)
+          return false;
+        b = idom[b];
+      }
+    };
+    std::vector<IrLoop> loops;
+    std::vector<uint32_t> loopOf(nb, UINT32_MAX); // by header
+    for (BlockId b : rpo) {
+      for (BlockId h : f.successors(b)) {
+        if (!dominates(h, b))
+          continue;
+        if (loopOf[h] == UINT32_MAX) {
+          loopOf[h] = (uint32_t)loops.size();
+          loops.push_back(IrLoop{h, {}, {}, std::vector<bool>(nb, false)});
+          loops.back().contains[h] = true;
+        }
+        IrLoop &l = loops[loopOf[h]];
+        if (std::find(l.latches.begin(), l.latches.end(), b) == l.latches.end())
+          l.latches.push_back(b);
+        // everything that reaches the latch without passing the header
+        std::vector<BlockId> work{b};
+        while (!work.empty()) {
+          BlockId x = work.back();
+          work.pop_back();
+          if (l.contains[x] || idom[x] == kNoBlock)
+            continue;
+          l.contains[x] = true;
+          for (BlockId p : f.blocks[x].preds)
+            work.push_back(p);
+        }
+      }
+    }
+    for (IrLoop &l : loops) {
+      l.blocks.push_back(l.header);
+      for (BlockId b : rpo)
+        if (b != l.header && l.contains[b])
+          l.blocks.push_back(b);
+    }
+    // a loop nested in another has fewer blocks
+    std::stable_sort(loops.begin(), loops.end(), [](const IrLoop &a, const IrLoop &b) { return a.blocks.size() < b.blocks.size(); });
+    return loops;
+  }
+
+  namespace {
+
+    // Adds a block that runs just before `near` to every loop of `loops` containing `near`,
+    // except `except`
+    BlockId add_loop_block(IrFunction &f, std::vector<IrLoop> &loops, BlockId near, const IrLoop *except) {
+      BlockId b = f.addBlock();
+      for (IrLoop &l : loops) {
+        l.contains.resize(f.blocks.size(), false);
+        if (&l == except || !l.contains[near])
+          continue;
+        l.contains[b] = true;
+        l.blocks.insert(std::find(l.blocks.begin() + 1, l.blocks.end(), near), b);
+      }
+      return b;
+    }
+
+  } // namespace
+
+  BlockId ensure_preheader(IrFunction &f, IrLoop &loop, std::vector<IrLoop> &loops) {
+    const BlockId h = loop.header;
+    std::vector<size_t> outside;
+    for (size_t k = 0; k < f.blocks[h].preds.size(); ++k)
+      if (!loop.contains[f.blocks[h].preds[k]])
+        outside.push_back(k);
+    if (outside.size() == 1 && f.blocks[f.blocks[h].preds[outside[0]]].term.kind == IrTermKind::Jump)
+      return f.blocks[h].preds[outside[0]];
+
+    BlockId p = add_loop_block(f, loops, h, &loop);
+    for (size_t k : outside) {
+      BlockId o = f.blocks[h].preds[k];
+      IrTerm &t = f.blocks[o].term;
+      // a branch to the header on both sides has an entry per edge: move one edge each time
+      for (BlockId &target : t.target)
+        if (target == h) {
+          target = p;
+          break;
+        }
+      f.blocks[p].preds.push_back(o);
+    }
+    f.blocks[p].term = IrTerm{IrTermKind::Jump, kNoValue, {h, kNoBlock}};
+
+    std::vector<bool> isOutside(f.blocks[h].preds.size(), false);
+    for (size_t k : outside)
+      isOutside[k] = true;
+    auto keepInside = [&](const std::vector<BlockId> &xs) {
+      std::vector<BlockId> kept;
+      for (size_t k = 0; k < xs.size(); ++k)
+        if (!isOutside[k])
+          kept.push_back(xs[k]);
+      return kept;
+    };
+    for (size_t i = 0; i < f.blocks[h].insts.size(); ++i) {
+      ValueId v = f.blocks[h].insts[i];
+      if (f.values[v].op != IrOp::Phi)
+        break;
+      std::vector<ValueId> incoming;
+      for (size_t k : outside)
+        incoming.push_back(f.values[v].args[k]);
+      ValueId in = incoming[0];
+      if (std::any_of(incoming.begin(), incoming.end(), [&](ValueId a) { return a != in; }))
+        in = f.add(p, IrOp::Phi, 0, std::move(incoming));
+      std::vector<ValueId> args = keepInside(f.values[v].args);
+      args.push_back(in);
+      f.values[v].args = std::move(args);
+    }
+    f.blocks[h].preds = keepInside(f.blocks[h].preds);
+    f.blocks[h].preds.push_back(p);
+    return p;
+  }
+
+  namespace {
+
+    // Appends instructions to one block, folding what constant operands allow
+    struct Builder {
+      IrFunction &f;
+      BlockId b;
+
+      bool constant(ValueId v, long long &c) const {
+        if (f.values[v].op != IrOp::Const)
+          return false;
+        c = f.values[v].imm;
+        return true;
+      }
+      ValueId k(long long c) {
+        return f.add(b, IrOp::Const, c);
+      }
+      // two's complement, as the VM computes
+      ValueId op(IrOp o, ValueId x, ValueId y) {
+        auto u = [](long long v) { return (unsigned long long)v; };
+        long long a = 0, c = 0;
+        bool ka = constant(x, a), kc = constant(y, c);
+        switch (o) {
+        case IrOp::Add:
+          if (ka && kc)
+            return k((long long)(u(a) + u(c)));
+          if (ka && a == 0)
+            return y;
+          if (kc && c == 0)
+            return x;
+          break;
+        case IrOp::Sub:
+          if (ka && kc)
+            return k((long long)(u(a) - u(c)));
+          if (kc && c == 0)
+            return x;
+          break;
+        case IrOp::Mul:
+          if (ka && kc)
+            return k((long long)(u(a) * u(c)));
+          if ((ka && a == 0) || (kc && c == 0))
+            return k(0);
+          if (ka && a == 1)
+            return y;
+          if (kc && c == 1)
+            return x;
+          break;
+        default: break;
+        }
+        return f.add(b, o, 0, {x, y});
+      }
+    };
+
+    // Moves `v` to just after `after` in the same block
+    void place_after(IrFunction &f, ValueId v, ValueId after) {
+      auto &insts = f.blocks[f.values[after].block].insts;
+      insts.erase(std::find(insts.begin(), insts.end(), v));
+      insts.insert(std::find(insts.begin(), insts.end(), after) + 1, v);
+    }
+
+    // A header phi that steps by the same amount every iteration: phi(init, phi +- step)
+    struct Induction {
+      ValueId next{kNoValue}; // the value on every back edge
+      ValueId step{kNoValue}; // invariant
+      bool down{false};       // next = phi - step
+    };
+
+    class LoopInfo {
+    public:
+      LoopInfo(const IrFunction &f, const IrLoop &loop) : f_(f), loop_(loop) {}
+
+      bool invariant(ValueId v) const {
+        return f_.values[v].op == IrOp::Const || !loop_.contains[f_.values[v].block];
+      }
+      // The value every back edge carries into header phi `v`, or kNoValue
+      ValueId backValue(ValueId v) const {
+        const auto &preds = f_.blocks[loop_.header].preds;
+        ValueId next      = kNoValue;
+        for (size_t k = 0; k < preds.size(); ++k) {
+          if (!loop_.contains[preds[k]])
+            continue;
+          if (next != kNoValue && f_.values[v].args[k] != next)
+            return kNoValue;
+          next = f_.values[v].args[k];
+        }
+        return next;
+      }
+      bool induction(ValueId v, Induction &out) const {
+        if (f_.values[v].op != IrOp::Phi || f_.values[v].block != loop_.header)
+          return false;
+        ValueId next = backValue(v);
+        if (next == kNoValue)
+          return false;
+        const IrInst &n = f_.values[next];
+        if (n.op == IrOp::Add && n.args[0] == v && invariant(n.args[1]))
+          out = {next, n.args[1], false};
+        else if (n.op == IrOp::Add && n.args[1] == v && invariant(n.args[0]))
+          out = {next, n.args[0], false};
+        else if (n.op == IrOp::Sub && n.args[0] == v && invariant(n.args[1]))
+          out = {next, n.args[1], true};
+        else
+          return false;
+        return true;
+      }
+      bool constInduction(ValueId v, long long &step) const {
+        Induction iv;
+        if (!induction(v, iv) || f_.values[iv.step].op != IrOp::Const)
+          return false;
+        step = f_.values[iv.step].imm;
+        if (iv.down)
+          step = (long long)(0ULL - (unsigned long long)step);
+        return true;
+      }
+
+    private:
+      const IrFunction &f_;
+      const IrLoop &loop_;
+    };
+
+    // Arithmetic on the iteration number t: base + stride * t
+    struct Affine {
+      ValueId base;
+      ValueId stride;
+    };
+
+    // One term a reduction adds (or subtracts) every iteration
+    struct Term {
+      ValueId value;
+      bool negative;
+    };
+
+    class ClosedForm {
+    public:
+      ClosedForm(IrFunction &f, IrLoop &loop, std::vector<IrLoop> &loops)
+          : f_(f), loop_(loop), loops_(loops), info_(f, loop) {}
+
+      bool run();
+
+    private:
+      // is `v` affine in t, given the loop's inductions?
+      bool affine(ValueId v);
+      Affine build(Builder &b, ValueId v);
+      bool reads(ValueId v, ValueId phi);
+      // `v` as `phi` plus affine terms, each read once
+      bool sum(ValueId v, ValueId phi, bool negative, bool &seen, std::vector<Term> &terms);
+      // the phis whose value after T iterations has a formula: inductions and sums of
+      // affine terms
+      bool computable(ValueId v, std::vector<Term> &terms);
+      ValueId final(Builder &b, ValueId v, ValueId trips, ValueId halfTrips);
+
+      IrFunction &f_;
+      IrLoop &loop_;
+      std::vector<IrLoop> &loops_;
+      LoopInfo info_;
+      size_t entry_{0}; // index of the preheader among the header's preds
+      std::map<ValueId, bool> affine_;
+      std::map<ValueId, Affine> built_;
+    };
+
+    bool ClosedForm::affine(ValueId v) {
+      if (info_.invariant(v))
+        return true;
+      auto it = affine_.find(v);
+      if (it != affine_.end())
+        return it->second;
+      const IrInst &in = f_.values[v];
+      Induction iv;
+      bool r = false;
+      switch (in.op) {
+      case IrOp::Phi: r = info_.induction(v, iv); break;
+      case IrOp::Neg: r = affine(in.args[0]); break;
+      case IrOp::Add:
+      case IrOp::Sub: r = affine(in.args[0]) && affine(in.args[1]); break;
+      case IrOp::Mul:
+        r = (info_.invariant(in.args[0]) && affine(in.args[1])) || (info_.invariant(in.args[1]) && affine(in.args[0]));
+        break;
+      default: break;
+      }
+      affine_[v] = r;
+      return r;
+    }
+
+    Affine ClosedForm::build(Builder &b, ValueId v) {
+      auto it = built_.find(v);
+      if (it != built_.end())
+        return it->second;
+      const IrInst in = f_.values[v]; // the builder appends to f_.values
+      Affine r;
+      if (in.op == IrOp::Const) {
+        r = {b.k(in.imm), b.k(0)}; // the constant may live inside the loop
+      } else if (info_.invariant(v)) {
+        r = {v, b.k(0)};
+      } else if (in.op == IrOp::Phi) {
+        Induction iv;
+        info_.induction(v, iv);
+        ValueId step = f_.values[iv.step].op == IrOp::Const ? b.k(f_.values[iv.step].imm) : iv.step;
+        r               = {in.args[entry_], iv.down ? b.op(IrOp::Sub, b.k(0), step) : step};
+      } else if (in.op == IrOp::Neg) {
+        Affine x = build(b, in.args[0]);
+        r        = {b.op(IrOp::Sub, b.k(0), x.base), b.op(IrOp::Sub, b.k(0), x.stride)};
+      } else if (in.op == IrOp::Add || in.op == IrOp::Sub) {
+        IrOp op  = in.op;
+        Affine x = build(b, in.args[0]);
+        Affine y = build(b, in.args[1]);
+        r        = {b.op(op, x.base, y.base), b.op(op, x.stride, y.stride)};
+      } else {
+        // Mul with an invariant side, whose stride is 0
+        ValueId lhs = in.args[0], rhs = in.args[1];
+        bool rightInvariant = info_.invariant(rhs);
+        Affine x            = build(b, rightInvariant ? lhs : rhs);
+        Affine y            = build(b, rightInvariant ? rhs : lhs);
+        r                   = {b.op(IrOp::Mul, x.base, y.base), b.op(IrOp::Mul, x.stride, y.base)};
+      }
+      built_[v] = r;
+      return r;
+    }
+
+    bool ClosedForm::reads(ValueId v, ValueId phi) {
+      if (v == phi)
+        return true;
+      const IrInst &in = f_.values[v];
+      if (info_.invariant(v) || in.op == IrOp::Phi)
+        return false;
+      return std::any_of(in.args.begin(), in.args.end(), [&](ValueId a) { return reads(a, phi); });
+    }
+
+    bool ClosedForm::sum(ValueId v, ValueId phi, bool negative, bool &seen, std::vector<Term> &terms) {
+      if (v == phi) {
+        if (negative || seen)
+          return false;
+        seen = true;
+        return true;
+      }
+      if (!reads(v, phi)) {
+        terms.push_back({v, negative});
+        return affine(v);
+      }
+      const IrInst &in = f_.values[v];
+      if (in.op != IrOp::Add && in.op != IrOp::Sub)
+        return false;
+      ValueId lhs = in.args[0], rhs = in.args[1];
+      return sum(lhs, phi, negative, seen, terms) && sum(rhs, phi, in.op == IrOp::Sub ? !negative : negative, seen, terms);
+    }
+
+    bool ClosedForm::computable(ValueId v, std::vector<Term> &terms) {
+      Induction iv;
+      if (info_.induction(v, iv))
+        return true;
+      ValueId next = info_.backValue(v);
+      bool seen    = false;
+      return next != kNoValue && sum(next, v, false, seen, terms) && seen;
+    }
+
+    ValueId ClosedForm::final(Builder &b, ValueId v, ValueId trips, ValueId halfTrips) {
+      std::vector<Term> terms;
+      computable(v, terms);
+      ValueId r = f_.values[v].args[entry_];
+      Induction iv;
+      if (info_.induction(v, iv)) {
+        Affine a = build(b, v);
+        return b.op(IrOp::Add, r, b.op(IrOp::Mul, a.stride, trips));
+      }
+      // the sum over t < T of base + stride * t
+      for (const Term &t : terms) {
+        Affine a    = build(b, t.value);
+        ValueId add = b.op(IrOp::Add, b.op(IrOp::Mul, a.base, trips), b.op(IrOp::Mul, a.stride, halfTrips));
+        r           = b.op(t.negative ? IrOp::Sub : IrOp::Add, r, add);
+      }
+      return r;
+    }
+
+    bool ClosedForm::run() {
+      const BlockId h  = loop_.header;
+      const IrTerm &ht = f_.blocks[h].term;
+      // one way out, from the header's test, into a block nothing else enters
+      if (ht.kind != IrTermKind::Branch || loop_.contains[ht.target[0]] == loop_.contains[ht.target[1]])
+        return false;
+      const bool continueOnTrue = loop_.contains[ht.target[0]];
+      const BlockId exit        = ht.target[continueOnTrue ? 1 : 0];
+      if (f_.blocks[exit].preds.size() != 1)
+        return false;
+      for (BlockId b : loop_.blocks) {
+        if (b != h)
+          for (BlockId s : f_.successors(b))
+            if (!loop_.contains[s])
+              return false;
+        for (ValueId v : f_.blocks[b].insts)
+          if (ir_has_effects(f_, f_.values[v]))
+            return false;
+      }
+      // an inner loop might never finish
+      for (const IrLoop &l : loops_)
+        if (&l != &loop_ && l.header != h && loop_.contains[l.header])
+          return false;
+
+      // the values the rest of the function reads are header phis (or constants, which
+      // are placed again in the preheader)
+      std::vector<ValueId> needed, constants;
+      for (BlockId b = 0; b < f_.blocks.size(); ++b) {
+        if (f_.blocks[b].dead || loop_.contains[b])
+          continue;
+        std::vector<ValueId> reads;
+        for (ValueId v : f_.blocks[b].insts)
+          reads.insert(reads.end(), f_.values[v].args.begin(), f_.values[v].args.end());
+        if (f_.blocks[b].term.value != kNoValue)
+          reads.push_back(f_.blocks[b].term.value);
+        for (ValueId a : reads) {
+          if (!loop_.contains[f_.values[a].block])
+            continue;
+          if (f_.values[a].op == IrOp::Const) {
+            constants.push_back(a);
+            continue;
+          }
+          if (f_.values[a].block != h || f_.values[a].op != IrOp::Phi)
+            return false;
+          if (std::find(needed.begin(), needed.end(), a) == needed.end())
+            needed.push_back(a);
+        }
+      }
+      for (ValueId v : needed) {
+        std::vector<Term> terms;
+        if (!computable(v, terms))
+          return false;
+      }
+
+      // the test compares an induction with a constant step against an invariant bound
+      const IrInst &cond = f_.values[ht.value];
+      if (cond.block != h || cond.args.size() != 2)
+        return false;
+      IrOp cmp    = cond.op;
+      ValueId iv  = cond.args[0];
+      ValueId lim = cond.args[1];
+      long long step = 0;
+      if (!info_.constInduction(iv, step)) {
+        std::swap(iv, lim);
+        switch (cmp) {
+        case IrOp::Lt: cmp = IrOp::Gt; break;
+        case IrOp::Le: cmp = IrOp::Ge; break;
+        case IrOp::Gt: cmp = IrOp::Lt; break;
+        case IrOp::Ge: cmp = IrOp::Le; break;
+        default: break;
+        }
+        if (!info_.constInduction(iv, step))
+          return false;
+      }
+      if (!info_.invariant(lim))
+        return false;
+      if (!continueOnTrue) {
+        switch (cmp) {
+        case IrOp::Lt: cmp = IrOp::Ge; break;
+        case IrOp::Le: cmp = IrOp::Gt; break;
+        case IrOp::Gt: cmp = IrOp::Le; break;
+        case IrOp::Ge: cmp = IrOp::Lt; break;
+        default: return false;
+        }
+      }
+      // counting up while below the bound or down while above it, by a step small enough
+      // that the bound check below rules out overflow
+      const bool up = step > 0;
+      if (step == 0 || step > (1 << 30) || step < -(1 << 30))
+        return false;
+      if (up ? cmp != IrOp::Lt && cmp != IrOp::Le : cmp != IrOp::Gt && cmp != IrOp::Ge)
+        return false;
+
+      BlockId p = ensure_preheader(f_, loop_, loops_);
+      const auto &hp = f_.blocks[h].preds;
+      entry_         = (size_t)(std::find(hp.begin(), hp.end(), p) - hp.begin());
+      ValueId init   = f_.values[iv].args[entry_];
+
+      // The count takes a difference of the start and the bound, so both must be within
+      // +-2^61 (checked on entry when they are not constants)
+      const long long kRange = 1LL << 61;
+      Builder pre{f_, p};
+      long long known;
+      for (ValueId x : {init, lim})
+        if (pre.constant(x, known) && (known < -kRange || known > kRange))
+          return false;
+      ValueId guard = kNoValue;
+      for (ValueId x : {init, lim}) {
+        if (pre.constant(x, known))
+          continue;
+        ValueId ok = pre.op(IrOp::Mul, pre.op(IrOp::Ge, x, pre.k(-kRange)), pre.op(IrOp::Le, x, pre.k(kRange)));
+        guard      = guard == kNoValue ? ok : pre.op(IrOp::Mul, guard, ok);
+      }
+
+      BlockId c = add_loop_block(f_, loops_, h, &loop_);
+      Builder b{f_, c};
+      // T = the number of times the body runs
+      long long mag = up ? step : -step;
+      ValueId bound = f_.values[lim].op == IrOp::Const ? b.k(f_.values[lim].imm) : lim;
+      ValueId dist  = up ? b.op(IrOp::Sub, bound, init) : b.op(IrOp::Sub, init, bound);
+      bool strict   = cmp == IrOp::Lt || cmp == IrOp::Gt;
+      ValueId runs  = dist; // ceil(dist / mag) when strict, dist / mag + 1 otherwise
+      if (strict && mag > 1)
+        runs = b.op(IrOp::Div, b.op(IrOp::Add, dist, b.k(mag - 1)), b.k(mag));
+      else if (!strict)
+        runs = b.op(IrOp::Add, b.op(IrOp::Div, dist, b.k(mag)), b.k(1));
+      ValueId trips = b.op(IrOp::Mul, b.op(strict ? IrOp::Gt : IrOp::Ge, dist, b.k(0)), runs);
+      // T * (T - 1) / 2 without overflowing the product: with q = T / 2 and r = T - 2q it is
+      // q * (T - 1) + r * q
+      ValueId q     = b.op(IrOp::Div, trips, b.k(2));
+      ValueId r     = b.op(IrOp::Sub, trips, b.op(IrOp::Mul, q, b.k(2)));
+      ValueId tri   = b.op(IrOp::Add, b.op(IrOp::Mul, q, b.op(IrOp::Sub, trips, b.k(1))), b.op(IrOp::Mul, r, q));
+      std::map<ValueId, ValueId> finals;
+      for (ValueId v : needed)
+        finals[v] = final(b, v, trips, tri);
+
+      // enter the closed form instead of the loop, always or when the guard holds
+      if (guard == kNoValue) {
+        f_.blocks[p].term = IrTerm{IrTermKind::Jump, kNoValue, {c, kNoBlock}};
+        f_.removeEdge(p, h);
+      } else {
+        f_.blocks[p].term = IrTerm{IrTermKind::Branch, guard, {c, h}};
+      }
+      f_.blocks[c].preds = {p};
+      f_.blocks[c].term  = IrTerm{IrTermKind::Jump, kNoValue, {exit, kNoBlock}};
+      f_.blocks[exit].preds.push_back(c);
+      std::map<ValueId, ValueId> consts;
+      for (ValueId k : constants)
+        if (!consts.count(k))
+          consts[k] = pre.k(f_.values[k].imm);
+      for (ValueId v : f_.blocks[exit].insts) {
+        if (f_.values[v].op != IrOp::Phi)
+          break;
+        ValueId a = f_.values[v].args[0];
+        f_.values[v].args.push_back(finals.count(a) ? finals[a] : consts.count(a) ? consts[a] : a);
+      }
+      // past the exit each value is the loop's or the closed form's, whichever ran; the
+      // exit's phis already choose by edge
+      std::map<ValueId, ValueId> merged;
+      for (ValueId v : needed)
+        merged[v] = f_.add(exit, IrOp::Phi, 0, {v, finals[v]});
+      auto redirect = [&](ValueId &a, bool choosing) {
+        if (consts.count(a))
+          a = consts[a];
+        else if (!choosing && merged.count(a))
+          a = merged[a];
+      };
+      for (BlockId bb = 0; bb < f_.blocks.size(); ++bb) {
+        if (f_.blocks[bb].dead || loop_.contains[bb] || bb == c)
+          continue;
+        for (ValueId v : f_.blocks[bb].insts)
+          for (ValueId &a : f_.values[v].args)
+            redirect(a, bb == exit && f_.values[v].op == IrOp::Phi);
+        if (f_.blocks[bb].term.value != kNoValue)
+          redirect(f_.blocks[bb].term.value, false);
+      }
+      if (guard == kNoValue)
+        for (BlockId bb : loop_.blocks)
+          f_.removeBlock(bb);
+      return true;
+    }
+
+  } // namespace
+
+  bool ir_licm(IrFunction &f) {
+    auto loops   = find_loops(f);
+    bool changed = false;
+    for (IrLoop &loop : loops) {
+      // in reverse postorder an operand's definition comes before its uses
+      std::vector<bool> hoisted(f.values.size(), false);
+      std::vector<ValueId> moves;
+      auto invariant = [&](ValueId v) {
+        return f.values[v].op == IrOp::Const || !loop.contains[f.values[v].block] || hoisted[v];
+      };
+      for (BlockId b : loop.blocks)
+        for (ValueId v : f.blocks[b].insts) {
+          const IrInst &in = f.values[v];
+          if (in.op == IrOp::Phi || in.op == IrOp::Const || in.op == IrOp::Call || ir_has_effects(f, in))
+            continue;
+          if (!std::all_of(in.args.begin(), in.args.end(), invariant))
+            continue;
+          // a constant the loop defines goes along, ahead of its reader
+          for (ValueId a : in.args)
+            if (loop.contains[f.values[a].block] && !hoisted[a]) {
+              hoisted[a] = true;
+              moves.push_back(a);
+            }
+          hoisted[v] = true;
+          moves.push_back(v);
+        }
+      if (moves.empty())
+        continue;
+      BlockId p = ensure_preheader(f, loop, loops);
+      for (ValueId v : moves) {
+        auto &insts = f.blocks[f.values[v].block].insts;
+        insts.erase(std::find(insts.begin(), insts.end(), v));
+        f.blocks[p].insts.push_back(v);
+        f.values[v].block = p;
+      }
+      changed = true;
+    }
+    return changed;
+  }
+
+  bool ir_strength_reduction(IrFunction &f) {
+    auto loops   = find_loops(f);
+    bool changed = false;
+    for (IrLoop &loop : loops) {
+      LoopInfo info(f, loop);
+      // (induction, invariant factor) -> the products that multiply them
+      std::map<std::pair<ValueId, ValueId>, std::vector<ValueId>> products;
+      for (BlockId b : loop.blocks)
+        for (ValueId v : f.blocks[b].insts) {
+          const IrInst &in = f.values[v];
+          if (in.op != IrOp::Mul)
+            continue;
+          for (int side = 0; side < 2; ++side) {
+            ValueId iv = in.args[side], factor = in.args[1 - side];
+            long long step = 0, c = 0;
+            if (!info.invariant(factor) || !info.constInduction(iv, step))
+              continue;
+            // x * 0, x * 1 and x * -1 are left to the other passes
+            if (f.values[factor].op == IrOp::Const && (c = f.values[factor].imm, c >= -1 && c <= 1))
+              continue;
+            products[{iv, factor}].push_back(v);
+            break;
+          }
+        }
+      if (products.empty())
+        continue;
+      BlockId p      = ensure_preheader(f, loop, loops);
+      const BlockId h = loop.header;
+      std::vector<ValueId> to(f.values.size(), kNoValue);
+      for (auto &[key, uses] : products) {
+        auto [iv, factor] = key;
+        Induction ind;
+        long long step = 0;
+        info.induction(iv, ind);
+        info.constInduction(iv, step);
+        // j = iv * factor from the start, stepping by step * factor alongside iv
+        const auto &hp = f.blocks[h].preds;
+        size_t entry   = (size_t)(std::find(hp.begin(), hp.end(), p) - hp.begin());
+        Builder pre{f, p};
+        ValueId fac   = f.values[factor].op == IrOp::Const ? pre.k(f.values[factor].imm) : factor;
+        ValueId first = pre.op(IrOp::Mul, f.values[iv].args[entry], fac);
+        ValueId delta = pre.op(IrOp::Mul, pre.k(step), fac);
+        ValueId j     = f.add(h, IrOp::Phi, 0, std::vector<ValueId>(f.blocks[h].preds.size(), first));
+        ValueId next = f.add(f.values[ind.next].block, IrOp::Add, 0, {j, delta});
+        place_after(f, next, ind.next);
+        for (size_t k = 0; k < f.blocks[h].preds.size(); ++k)
+          if (k != entry)
+            f.values[j].args[k] = next;
+        to.resize(f.values.size(), kNoValue);
+        for (ValueId m : uses)
+          to[m] = j;
+      }
+      f.forwardValues(to);
+      changed = true;
+    }
+    return changed;
+  }
+
+  bool ir_closed_form_loops(IrFunction &f) {
+    bool changed = false;
+    // each rewrite changes the CFG, so the loops are found again after it
+    for (bool progress = true; progress;) {
+      progress   = false;
+      auto loops = find_loops(f);
+      for (IrLoop &loop : loops)
+        if (ClosedForm(f, loop, loops).run()) {
+          progress = changed = true;
+          break;
+        }
+    }
+    return changed;
+  }
+
+} // namespace mplx
@@ -0,0 +1,643 @@
+#include "ir_passes.hpp"
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+namespace mplx {
+
+  namespace {
+
+    bool const_value(const IrFunction &f, ValueId v, long long &out) {
+      if (f.values[v].op != IrOp::Const)
+        return false;
+      out = f.values[v].imm;
+      return true;
+    }
+    bool is_const(const IrFunction &f, ValueId v, long long c) {
+      long long x;
+      return const_value(f, v, x) && x == c;
+    }
+
+    // Value of `op` on constant operands with the VM's two's complement wrap; false if
+    // evaluating it faults (left for the VM to report)
+    bool eval(IrOp op, long long a, long long b, long long &out) {
+      auto u = [](long long x) { return (unsigned long long)x; };
+      switch (op) {
+      case IrOp::Neg: out = (long long)(0 - u(a)); return true;
+      case IrOp::Add: out = (long long)(u(a) + u(b)); return true;
+      case IrOp::Sub: out = (long long)(u(a) - u(b)); return true;
+      case IrOp::Mul: out = (long long)(u(a) * u(b)); return true;
+      case IrOp::Div:
+        if (b == 0 || (a == LLONG_MIN && b == -1))
+          return false;
+        out = a / b;
+        return true;
+      case IrOp::Eq: out = a == b; return true;
+      case IrOp::Ne: out = a != b; return true;
+      case IrOp::Lt: out = a < b; return true;
+      case IrOp::Le: out = a <= b; return true;
+      case IrOp::Gt: out = a > b; return true;
+      case IrOp::Ge: out = a >= b; return true;
+      default: return false;
+      }
+    }
+
+    // Keeps the phis at the front of a block after some were turned into other instructions
+    void order_phis_first(IrFunction &f, BlockId b) {
+      auto &insts = f.blocks[b].insts;
+      std::stable_partition(insts.begin(), insts.end(), [&](ValueId v) { return f.values[v].op == IrOp::Phi; });
+    }
+
+  } // namespace
+
+  bool ir_tail_recursion(IrFunction &f) {
+    if (f.blocks.empty() || !f.blocks[0].preds.empty())
+      return false;
+    std::vector<uint32_t> uses(f.values.size(), 0);
+    for (auto &blk : f.blocks) {
+      if (blk.dead)
+        continue;
+      for (ValueId v : blk.insts)
+        for (ValueId a : f.values[v].args)
+          ++uses[a];
+      if (blk.term.value != kNoValue)
+        ++uses[blk.term.value];
+    }
+    // blocks returning a call to `f` that is their last effect and whose value nothing else reads
+    std::vector<BlockId> sites;
+    for (BlockId b = 0; b < f.blocks.size(); ++b) {
+      const IrBlock &blk = f.blocks[b];
+      if (blk.dead || blk.term.kind != IrTermKind::Ret)
+        continue;
+      ValueId c        = blk.term.value;
+      const IrInst &in = f.values[c];
+      if (in.op != IrOp::Call || in.imm != (long long)f.index || in.block != b || in.args.size() != f.arity ||
+          uses[c] != 1)
+        continue;
+      auto at   = std::find(blk.insts.begin(), blk.insts.end(), c);
+      bool last = std::none_of(at + 1, blk.insts.end(), [&](ValueId v) { return ir_has_effects(f, f.values[v]); });
+      if (last)
+        sites.push_back(b);
+    }
+    if (sites.empty())
+      return false;
+
+    // the entry keeps the constants and parameters and jumps to a loop header holding the rest
+    BlockId h = f.addBlock();
+    std::vector<ValueId> keep, body;
+    for (ValueId v : f.blocks[0].insts)
+      (f.values[v].op == IrOp::Const || f.values[v].op == IrOp::Param ? keep : body).push_back(v);
+    for (ValueId v : body)
+      f.values[v].block = h;
+    f.blocks[h].term = f.blocks[0].term;
+    for (BlockId s : f.successors(h))
+      std::replace(f.blocks[s].preds.begin(), f.blocks[s].preds.end(), BlockId(0), h);
+    f.blocks[0].insts = std::move(keep);
+    f.blocks[0].term  = IrTerm{IrTermKind::Jump, kNoValue, {h, kNoBlock}};
+    f.blocks[h].preds = {0};
+
+    // a phi per parameter merges the entry's value with the arguments of each self call
+    std::vector<ValueId> param(f.arity, kNoValue), phi(f.arity);
+    for (ValueId v : f.blocks[0].insts)
+      if (f.values[v].op == IrOp::Param && param[f.values[v].imm] == kNoValue)
+        param[f.values[v].imm] = v;
+    for (uint32_t i = 0; i < f.arity; ++i) {
+      if (param[i] == kNoValue)
+        param[i] = f.add(0, IrOp::Param, i);
+      phi[i] = f.add(h, IrOp::Phi, 0, {param[i]});
+    }
+    for (ValueId v : body)
+      f.blocks[h].insts.push_back(v);
+    std::vector<ValueId> to(f.values.size(), kNoValue);
+    for (ValueId v : f.blocks[0].insts)
+      if (f.values[v].op == IrOp::Param)
+        to[v] = phi[f.values[v].imm];
+    for (auto &blk : f.blocks) {
+      if (blk.dead)
+        continue;
+      for (ValueId v : blk.insts)
+        if (f.values[v].op != IrOp::Phi || f.values[v].block != h)
+          for (ValueId &a : f.values[v].args)
+            a = to[a] != kNoValue ? to[a] : a;
+      if (blk.term.value != kNoValue && to[blk.term.value] != kNoValue)
+        blk.term.value = to[blk.term.value];
+    }
+
+    for (BlockId b : sites) {
+      ValueId c   = f.blocks[b].term.value;
+      auto &insts = f.blocks[b].insts;
+      insts.erase(std::find(insts.begin(), insts.end(), c));
+      for (uint32_t i = 0; i < f.arity; ++i)
+        f.values[phi[i]].args.push_back(f.values[c].args[i]);
+      f.values[c].dead  = true;
+      f.blocks[b].term  = IrTerm{IrTermKind::Jump, kNoValue, {h, kNoBlock}};
+      f.blocks[h].preds.push_back(b);
+    }
+    return true;
+  }
+
+  bool ir_sccp(IrFunction &f) {
+    enum : uint8_t { Undefined, Constant, Overdefined };
+    const size_t nv = f.values.size();
+    const size_t nb = f.blocks.size();
+    std::vector<uint8_t> state(nv, Undefined);
+    std::vector<long long> val(nv, 0);
+    std::vector<bool> blockExec(nb, false);
+    std::vector<std::vector<bool>> edgeExec(nb);
+    std::vector<std::vector<ValueId>> users(nv);
+    std::vector<std::vector<BlockId>> termUsers(nv);
+    for (BlockId b = 0; b < nb; ++b) {
+      const IrBlock &blk = f.blocks[b];
+      if (blk.dead)
+        continue;
+      edgeExec[b].assign(blk.preds.size(), false);
+      for (ValueId v : blk.insts)
+        for (ValueId a : f.values[v].args)
+          users[a].push_back(v);
+      if (blk.term.value != kNoValue)
+        termUsers[blk.term.value].push_back(b);
+    }
+
+    std::vector<ValueId> ssaWork;
+    std::vector<BlockId> flowWork; // blocks with a newly executable incoming edge
+    auto lower = [&](ValueId v, uint8_t s, long long c) {
+      if (state[v] == Overdefined || s == Undefined)
+        return;
+      if (state[v] == Constant) {
+        if (s == Constant && val[v] == c)
+          return;
+        s = Overdefined;
+      }
+      state[v] = s;
+      val[v]   = c;
+      ssaWork.push_back(v);
+    };
+    auto markEdge = [&](BlockId from, BlockId to) {
+      const auto &preds = f.blocks[to].preds;
+      for (size_t k = 0; k < preds.size(); ++k)
+        if (preds[k] == from && !edgeExec[to][k]) {
+          edgeExec[to][k] = true;
+          flowWork.push_back(to);
+        }
+    };
+    auto evalInst = [&](ValueId v) {
+      const IrInst &in = f.values[v];
+      switch (in.op) {
+      case IrOp::Const: lower(v, Constant, in.imm); return;
+      case IrOp::Param:
+      case IrOp::Call: lower(v, Overdefined, 0); return;
+      case IrOp::Phi: {
+        const auto &exec = edgeExec[in.block];
+        uint8_t s        = Undefined;
+        long long c      = 0;
+        for (size_t k = 0; k < in.args.size(); ++k) {
+          ValueId a = in.args[k];
+          if (!exec[k] || state[a] == Undefined)
+            continue;
+          if (state[a] == Overdefined || (s == Constant && val[a] != c)) {
+            s = Overdefined;
+            break;
+          }
+          s = Constant;
+          c = val[a];
+        }
+        lower(v, s, c);
+        return;
+      }
+      case IrOp::Neg:
+        if (state[in.args[0]] != Constant) {
+          lower(v, state[in.args[0]], 0);
+          return;
+        }
+        {
+          long long r;
+          eval(in.op, val[in.args[0]], 0, r);
+          lower(v, Constant, r);
+        }
+        return;
+      default: {
+        ValueId a = in.args[0], b = in.args[1];
+        // x * 0 is 0 whatever x is
+        if (in.op == IrOp::Mul && ((state[a] == Constant && val[a] == 0) || (state[b] == Constant && val[b] == 0))) {
+          lower(v, Constant, 0);
+          return;
+        }
+        if (state[a] == Overdefined || state[b] == Overdefined) {
+          lower(v, Overdefined, 0);
+          return;
+        }
+        if (state[a] == Undefined || state[b] == Undefined)
+          return;
+        long long r;
+        if (eval(in.op, val[a], val[b], r))
+          lower(v, Constant, r);
+        else
+          lower(v, Overdefined, 0);
+        return;
+      }
+      }
+    };
+    auto evalTerm = [&](BlockId b) {
+      const IrTerm &t = f.blocks[b].term;
+      if (t.kind == IrTermKind::Jump) {
+        markEdge(b, t.target[0]);
+      } else if (t.kind == IrTermKind::Branch) {
+        if (state[t.value] == Constant) {
+          markEdge(b, val[t.value] ? t.target[0] : t.target[1]);
+        } else if (state[t.value] == Overdefined) {
+          markEdge(b, t.target[0]);
+          markEdge(b, t.target[1]);
+        }
+      }
+    };
+
+    blockExec[0] = true;
+    for (ValueId v : f.blocks[0].insts)
+      evalInst(v);
+    evalTerm(0);
+    while (!flowWork.empty() || !ssaWork.empty()) {
+      while (!flowWork.empty()) {
+        BlockId b = flowWork.back();
+        flowWork.pop_back();
+        if (!blockExec[b]) {
+          blockExec[b] = true;
+          for (ValueId v : f.blocks[b].insts)
+            evalInst(v);
+          evalTerm(b);
+        } else {
+          for (ValueId v : f.blocks[b].insts) {
+            if (f.values[v].op != IrOp::Phi)
+              break;
+            evalInst(v);
+          }
+        }
+      }
+      while (!ssaWork.empty()) {
+        ValueId v = ssaWork.back();
+        ssaWork.pop_back();
+        for (ValueId u : users[v])
+          if (blockExec[f.values[u].block])
+            evalInst(u);
+        for (BlockId b : termUsers[v])
+          if (blockExec[b])
+            evalTerm(b);
+      }
+    }
+
+    bool changed = false;
+    for (BlockId b = 0; b < nb; ++b)
+      if (!f.blocks[b].dead && !blockExec[b]) {
+        f.removeBlock(b);
+        changed = true;
+      }
+    for (BlockId b = 0; b < nb; ++b) {
+      IrBlock &blk = f.blocks[b];
+      if (blk.dead)
+        continue;
+      bool phiFolded = false;
+      for (ValueId v : blk.insts) {
+        IrInst &in = f.values[v];
+        if (state[v] != Constant || in.op == IrOp::Const)
+          continue;
+        phiFolded |= in.op == IrOp::Phi;
+        in.op  = IrOp::Const;
+        in.imm = val[v];
+        in.args.clear();
+        changed = true;
+      }
+      if (phiFolded)
+        order_phis_first(f, b);
+      IrTerm &t = blk.term;
+      if (t.kind == IrTermKind::Branch && state[t.value] == Constant) {
+        BlockId taken = val[t.value] ? t.target[0] : t.target[1];
+        BlockId other = val[t.value] ? t.target[1] : t.target[0];
+        if (other != taken)
+          f.removeEdge(b, other);
+        else
+          f.removeEdge(b, taken); // both edges went there; one stays
+        t = IrTerm{IrTermKind::Jump, kNoValue, {taken, kNoBlock}};
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  bool ir_copy_propagation(IrFunction &f) {
+    std::vector<ValueId> to(f.values.size(), kNoValue);
+    auto resolve = [&](ValueId v) {
+      while (to[v] != kNoValue)
+        v = to[v];
+      return v;
+    };
+    // the value `v` copies, or kNoValue
+    auto copyOf = [&](ValueId v) -> ValueId {
+      const IrInst &in = f.values[v];
+      switch (in.op) {
+      case IrOp::Phi: {
+        ValueId same = kNoValue;
+        for (ValueId a : in.args) {
+          a = resolve(a);
+          if (a == v || a == same)
+            continue;
+          if (same != kNoValue)
+            return kNoValue;
+          same = a;
+        }
+        return same;
+      }
+      case IrOp::Add:
+        if (is_const(f, resolve(in.args[1]), 0))
+          return resolve(in.args[0]);
+        if (is_const(f, resolve(in.args[0]), 0))
+          return resolve(in.args[1]);
+        return kNoValue;
+      case IrOp::Sub: return is_const(f, resolve(in.args[1]), 0) ? resolve(in.args[0]) : kNoValue;
+      case IrOp::Mul:
+        if (is_const(f, resolve(in.args[1]), 1))
+          return resolve(in.args[0]);
+        if (is_const(f, resolve(in.args[0]), 1))
+          return resolve(in.args[1]);
+        return kNoValue;
+      case IrOp::Div: return is_const(f, resolve(in.args[1]), 1) ? resolve(in.args[0]) : kNoValue;
+      default: return kNoValue;
+      }
+    };
+
+    bool changed = false;
+    for (bool progress = true; progress;) {
+      progress = false;
+      for (auto &blk : f.blocks) {
+        if (blk.dead)
+          continue;
+        for (ValueId v : blk.insts) {
+          if (to[v] != kNoValue)
+            continue;
+          ValueId c = copyOf(v);
+          if (c != kNoValue && c != v) {
+            to[v]    = c;
+            progress = changed = true;
+          }
+        }
+      }
+    }
+    if (changed)
+      f.forwardValues(to);
+    return changed;
+  }
+
+  bool ir_gvn(IrFunction &f) {
+    auto rpo  = reverse_postorder(f);
+    auto idom = dominators(f, rpo);
+    std::vector<std::vector<BlockId>> children(f.blocks.size());
+    for (BlockId b : rpo)
+      if (idom[b] != b)
+        children[idom[b]].push_back(b);
+
+    std::vector<ValueId> to(f.values.size(), kNoValue);
+    auto resolve = [&](ValueId v) {
+      while (to[v] != kNoValue)
+        v = to[v];
+      return v;
+    };
+    // Key of an instruction: operation, immediate, operands; commutative operands sorted and
+    // > / >= written as < / <= so that a < b and b > a meet. Phis also key on their block.
+    auto key = [&](ValueId v) {
+      const IrInst &in = f.values[v];
+      IrOp op          = in.op;
+      std::vector<long long> k;
+      std::vector<ValueId> args;
+      for (ValueId a : in.args)
+        args.push_back(resolve(a));
+      if (op == IrOp::Gt || op == IrOp::Ge) {
+        op = op == IrOp::Gt ? IrOp::Lt : IrOp::Le;
+        std::swap(args[0], args[1]);
+      }
+      if ((op == IrOp::Add || op == IrOp::Mul || op == IrOp::Eq || op == IrOp::Ne) && args[0] > args[1])
+        std::swap(args[0], args[1]);
+      k.push_back((long long)op);
+      k.push_back(in.imm);
+      k.push_back(op == IrOp::Phi ? (long long)in.block : -1);
+      k.insert(k.end(), args.begin(), args.end());
+      return k;
+    };
+
+    bool changed = false;
+    std::map<std::vector<long long>, ValueId> available;
+    // walk the dominator tree; a block's entries are withdrawn when its subtree is done
+    std::vector<std::pair<BlockId, size_t>> stack{{0, 0}};
+    std::vector<std::vector<std::map<std::vector<long long>, ValueId>::iterator>> added(1);
+    auto enter = [&](BlockId b) {
+      for (ValueId v : f.blocks[b].insts) {
+        if (f.values[v].op == IrOp::Call || f.values[v].op == IrOp::Param)
+          continue;
+        auto [it, inserted] = available.try_emplace(key(v), v);
+        if (inserted) {
+          added.back().push_back(it);
+        } else {
+          to[v]   = it->second;
+          changed = true;
+        }
+      }
+    };
+    enter(stack.back().first);
+    while (!stack.empty()) {
+      auto &[b, next] = stack.back();
+      if (next < children[b].size()) {
+        BlockId c = children[b][next++];
+        stack.emplace_back(c, 0);
+        added.emplace_back();
+        enter(c);
+      } else {
+        for (auto it : added.back())
+          available.erase(it);
+        added.pop_back();
+        stack.pop_back();
+      }
+    }
+    if (changed)
+      f.forwardValues(to);
+    return changed;
+  }
+
+  bool ir_dce(IrFunction &f) {
+    std::vector<bool> live(f.values.size(), false);
+    std::vector<ValueId> work;
+    auto mark = [&](ValueId v) {
+      if (!live[v]) {
+        live[v] = true;
+        work.push_back(v);
+      }
+    };
+    for (auto &blk : f.blocks) {
+      if (blk.dead)
+        continue;
+      if (blk.term.value != kNoValue)
+        mark(blk.term.value);
+      for (ValueId v : blk.insts)
+        if (ir_has_effects(f, f.values[v]))
+          mark(v);
+    }
+    while (!work.empty()) {
+      ValueId v = work.back();
+      work.pop_back();
+      for (ValueId a : f.values[v].args)
+        mark(a);
+    }
+    bool changed = false;
+    for (auto &blk : f.blocks) {
+      if (blk.dead)
+        continue;
+      for (ValueId v : blk.insts)
+        if (!live[v]) {
+          f.values[v].dead = true;
+          changed          = true;
+        }
+      blk.insts.erase(std::remove_if(blk.insts.begin(), blk.insts.end(), [&](ValueId v) { return !live[v]; }),
+                      blk.insts.end());
+    }
+    return changed;
+  }
+
+  bool ir_simplify_cfg(IrFunction &f) {
+    bool changed = false;
+    for (BlockId b = 0; b < f.blocks.size(); ++b) {
+      IrTerm &t = f.blocks[b].term;
+      if (f.blocks[b].dead || t.kind != IrTermKind::Branch)
+        continue;
+      long long c;
+      bool known = const_value(f, t.value, c);
+      if (t.target[0] == t.target[1] || known) {
+        BlockId taken = !known || c ? t.target[0] : t.target[1];
+        f.removeEdge(b, known && taken == t.target[0] ? t.target[1] : t.target[0]);
+        t       = IrTerm{IrTermKind::Jump, kNoValue, {taken, kNoBlock}};
+        changed = true;
+      }
+    }
+
+    std::vector<bool> reachable(f.blocks.size(), false);
+    for (BlockId b : reverse_postorder(f))
+      reachable[b] = true;
+    for (BlockId b = 0; b < f.blocks.size(); ++b)
+      if (!f.blocks[b].dead && !reachable[b]) {
+        f.removeBlock(b);
+        changed = true;
+      }
+
+    std::vector<ValueId> to(f.values.size(), kNoValue);
+    bool forwarded = false;
+    for (BlockId b : reverse_postorder(f)) {
+      if (f.blocks[b].dead)
+        continue;
+      // merge a jump target that has no other predecessor into `b`
+      for (;;) {
+        IrTerm &t = f.blocks[b].term;
+        if (t.kind != IrTermKind::Jump)
+          break;
+        BlockId s = t.target[0];
+        if (s == b || s == 0 || f.blocks[s].preds.size() != 1)
+          break;
+        IrBlock merged = std::move(f.blocks[s]);
+        for (ValueId v : merged.insts) {
+          IrInst &in = f.values[v];
+          if (in.op == IrOp::Phi) {
+            to[v]     = in.args[0];
+            forwarded = true;
+          } else {
+            in.block = b;
+            f.blocks[b].insts.push_back(v);
+          }
+        }
+        f.blocks[b].term = merged.term;
+        for (BlockId n : f.successors(b))
+          std::replace(f.blocks[n].preds.begin(), f.blocks[n].preds.end(), s, b);
+        f.blocks[s]      = IrBlock{};
+        f.blocks[s].dead = true;
+        changed          = true;
+      }
+    }
+    if (forwarded)
+      f.forwardValues(to); // phis of merged blocks had a single input
+
+    // bypass blocks that hold nothing but a jump into a block without phis
+    for (BlockId b = 1; b < f.blocks.size(); ++b) {
+      IrBlock &blk = f.blocks[b];
+      if (blk.dead || !blk.insts.empty() || blk.term.kind != IrTermKind::Jump)
+        continue;
+      BlockId s = blk.term.target[0];
+      if (s == b || (!f.blocks[s].insts.empty() && f.values[f.blocks[s].insts[0]].op == IrOp::Phi))
+        continue;
+      auto &sp = f.blocks[s].preds;
+      sp.erase(std::find(sp.begin(), sp.end(), b));
+      for (BlockId p : blk.preds) {
+        IrTerm &pt = f.blocks[p].term;
+        for (int i = 0; i < 2; ++i)
+          if (pt.target[i] == b) {
+            pt.target[i] = s;
+            sp.push_back(p);
+          }
+      }
+      blk      = IrBlock{};
+      blk.dead = true;
+      changed  = true;
+    }
+    return changed;
+  }
+
+  void IrPassManager::run(IrFunction &f) {
+    for (unsigned round = 0; round < maxRounds_; ++round) {
+      bool any = false;
+      for (auto &p : passes_) {
+        if (p.run(f)) {
+          ++p.changed;
+          any = true;
+        }
+        if (verify_) {
+          auto errs = verify_ir(f);
+          if (!errs.empty())
+            throw std::runtime_error("malformed IR after " + p.name + ": " + errs.front());
+        }
+      }
+      if (!any)
+        break;
+    }
+  }
+
+  void IrPassManager::run(IrModule &m) {
+    for (auto &f : m.functions)
+      run(f);
+  }
+
+  std::string IrPassManager::summary() const {
+    std::string out;
+    for (auto &p : passes_) {
+      if (!out.empty())
+        out += ", ";
+      out += p.name + " " + std::to_string(p.changed);
+    }
+    return out;
+  }
+
+  IrPassManager default_ir_pipeline(const IrPipelineOptions &options) {
+    IrPassManager pm;
+    if (options.tailRecursion)
+      pm.add("tail-recursion", ir_tail_recursion);
+    pm.add("sccp", ir_sccp);
+    pm.add("copy-prop", ir_copy_propagation);
+    pm.add("gvn", ir_gvn);
+    if (options.licm)
+      pm.add("licm", ir_licm);
+    if (options.closedForm)
+      pm.add("closed-form", ir_closed_form_loops);
+    if (options.strengthReduction)
+      pm.add("strength-reduction", ir_strength_reduction);
+    pm.add("dce", ir_dce);
+    pm.add("simplify-cfg", ir_simplify_cfg);
+#ifndef NDEBUG
+    pm.setVerify(true);
+#endif
+    return pm;
+  }
+
+} // namespace mplx
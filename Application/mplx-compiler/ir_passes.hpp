@@ -0,0 +1,100 @@
+#pragma once
+#include "ir.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mplx {
+
+  // A transform over one function; returns true if it changed anything. Passes keep the
+  // function well formed (verify_ir) and never drop a call or a division that may fault.
+  using IrPassFn = bool (*)(IrFunction &f);
+
+  // Self tail recursion to a loop: a block that returns a call to the function itself
+  // (with nothing that has an effect after the call) instead jumps to a header after the
+  // entry, where a phi per parameter takes the call's arguments
+  bool ir_tail_recursion(IrFunction &f);
+  // Sparse conditional constant propagation (Wegman and Zadeck): values that are constant
+  // on every executable path become Const, branches on them become jumps and blocks no
+  // executable edge reaches are removed
+  bool ir_sccp(IrFunction &f);
+  // Forwards values that only copy another: phis whose inputs are all one value (or the
+  // phi itself) and identities such as x + 0, x - 0, x * 1, x / 1
+  bool ir_copy_propagation(IrFunction &f);
+  // Global value numbering over the dominator tree: an instruction computing the same
+  // operation on the same operands as a dominating one reuses its value (calls excluded)
+  bool ir_gvn(IrFunction &f);
+  // Removes instructions whose values nothing live uses
+  bool ir_dce(IrFunction &f);
+  // Folds branches to one target, removes unreachable blocks, merges a block into its only
+  // predecessor and bypasses empty blocks that only jump on
+  bool ir_simplify_cfg(IrFunction &f);
+
+  // Loop transforms (ir_loops.cpp), over the natural loops of find_loops. Each creates a
+  // preheader where it needs one.
+  //
+  // Loop-invariant code motion: an instruction without effects whose operands are all
+  // defined outside the loop (or hoisted already) moves to the preheader. Calls stay put.
+  bool ir_licm(IrFunction &f);
+  // Strength reduction: i * k, where i is an induction variable with a constant step c and
+  // k is invariant, becomes a new induction variable j that starts at i0 * k and steps by
+  // c * k, so the loop adds where it multiplied. Off by default: in the stack VM a MUL is
+  // one dispatch like an ADD, and the new variable's update costs more than it saves.
+  bool ir_strength_reduction(IrFunction &f);
+  // Closed-form reductions: a loop without effects that counts an induction variable up to
+  // (or down to) an invariant bound, and whose results are induction variables and sums of
+  // terms affine in the iteration number, is replaced by the trip count and the sums'
+  // formulas. When the start or the bound is not a constant, the loop stays for the inputs
+  // the formulas cannot take (beyond +-2^61) and a branch in the preheader picks the form.
+  bool ir_closed_form_loops(IrFunction &f);
+
+  class IrPassManager {
+  public:
+    struct Pass {
+      std::string name;
+      IrPassFn run;
+      uint32_t changed{0}; // functions the pass changed, summed over rounds
+    };
+
+    void add(std::string name, IrPassFn fn) {
+      passes_.push_back(Pass{std::move(name), fn});
+    }
+    // The sequence repeats over a function until a round changes nothing, at most this often
+    void setMaxRounds(unsigned n) {
+      maxRounds_ = n;
+    }
+    // Check every function with verify_ir after each pass; malformed IR throws
+    // std::runtime_error naming the pass
+    void setVerify(bool on) {
+      verify_ = on;
+    }
+
+    void run(IrModule &m);
+    void run(IrFunction &f);
+
+    const std::vector<Pass> &passes() const {
+      return passes_;
+    }
+    // "sccp 2, copy-prop 5, ..." from the change counts
+    std::string summary() const;
+
+  private:
+    std::vector<Pass> passes_;
+    unsigned maxRounds_{4};
+    bool verify_{false};
+  };
+
+  // Which of the optional passes default_ir_pipeline includes
+  struct IrPipelineOptions {
+    bool tailRecursion{true};
+    bool licm{true};
+    bool strengthReduction{false};
+    bool closedForm{true};
+  };
+
+  // tail-recursion, sccp, copy-prop, gvn, licm, closed-form, strength-reduction, dce,
+  // simplify-cfg, with the optional ones as `options` selects; verifies after each pass in
+  // debug builds
+  IrPassManager default_ir_pipeline(const IrPipelineOptions &options = {});
+
+} // namespace mplx
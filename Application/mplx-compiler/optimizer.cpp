@@ -0,0 +1,424 @@
+#include "optimizer.hpp"
+#include <climits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+namespace mplx {
+
+  namespace {
+
+    using Block = std::vector<std::unique_ptr<Stmt>>;
+    using Env   = std::unordered_map<std::string, long long>;
+
+    const LiteralExpr *as_literal(const Expr *e) {
+      return e->kind == ExprKind::Literal ? static_cast<const LiteralExpr *>(e) : nullptr;
+    }
+    const VarExpr *as_var(const Expr *e) {
+      return e->kind == ExprKind::Var ? static_cast<const VarExpr *>(e) : nullptr;
+    }
+
+    // Two's complement arithmetic, as the VM's ADD/SUB/MUL/NEG produce on overflow
+    long long wrap_add(long long a, long long b) {
+      return (long long)((unsigned long long)a + (unsigned long long)b);
+    }
+    long long wrap_sub(long long a, long long b) {
+      return (long long)((unsigned long long)a - (unsigned long long)b);
+    }
+    long long wrap_mul(long long a, long long b) {
+      return (long long)((unsigned long long)a * (unsigned long long)b);
+    }
+
+    // `a op b` == `b mirror(op) a`
+    bool mirror(BinOp op, BinOp &out) {
+      switch (op) {
+      case BinOp::Add:
+      case BinOp::Mul:
+      case BinOp::Eq:
+      case BinOp::Ne: out = op; return true;
+      case BinOp::Lt: out = BinOp::Gt; return true;
+      case BinOp::Le: out = BinOp::Ge; return true;
+      case BinOp::Gt: out = BinOp::Lt; return true;
+      case BinOp::Ge: out = BinOp::Le; return true;
+      default: return false;
+      }
+    }
+
+    // Evaluating `e` can neither fault nor fail to terminate, so it may be dropped
+    bool droppable(const Expr *e) {
+      switch (e->kind) {
+      case ExprKind::Literal:
+      case ExprKind::Var: return true;
+      case ExprKind::Unary: return droppable(static_cast<const UnaryExpr *>(e)->rhs.get());
+      case ExprKind::Binary: {
+        auto b = static_cast<const BinaryExpr *>(e);
+        return b->op != BinOp::Div && droppable(b->lhs.get()) && droppable(b->rhs.get());
+      }
+      case ExprKind::Call: return false;
+      }
+      return false;
+    }
+
+    // Whether `body` declares a local anywhere. The compiler's scopes are per function, so a
+    // `let` in a branch that never runs still decides what the name means after the branch;
+    // such a branch cannot be dropped.
+    bool declares(const Block &body) {
+      for (auto &s : body) {
+        switch (s->kind) {
+        case StmtKind::Let: return true;
+        case StmtKind::If: {
+          auto ifs = static_cast<const IfStmt *>(s.get());
+          if (declares(ifs->thenS) || declares(ifs->elseS))
+            return true;
+          break;
+        }
+        case StmtKind::While:
+          if (declares(static_cast<const WhileStmt *>(s.get())->body))
+            return true;
+          break;
+        default: break;
+        }
+      }
+      return false;
+    }
+
+    // Per-name counts of declarations, assignments and reads in one function
+    struct NameUse {
+      uint32_t lets{0};
+      uint32_t assigns{0};
+      uint32_t reads{0};
+    };
+    using NameUses = std::unordered_map<std::string, NameUse>;
+
+    void count_reads(const Expr *e, NameUses &uses) {
+      switch (e->kind) {
+      case ExprKind::Literal: return;
+      case ExprKind::Var: ++uses[static_cast<const VarExpr *>(e)->name].reads; return;
+      case ExprKind::Unary: count_reads(static_cast<const UnaryExpr *>(e)->rhs.get(), uses); return;
+      case ExprKind::Binary: {
+        auto b = static_cast<const BinaryExpr *>(e);
+        count_reads(b->lhs.get(), uses);
+        count_reads(b->rhs.get(), uses);
+        return;
+      }
+      case ExprKind::Call:
+        for (auto &a : static_cast<const CallExpr *>(e)->args)
+          count_reads(a.get(), uses);
+        return;
+      }
+    }
+
+    void count_names(const Block &body, NameUses &uses) {
+      for (auto &s : body) {
+        switch (s->kind) {
+        case StmtKind::Let: {
+          auto let = static_cast<const LetStmt *>(s.get());
+          ++uses[let->name].lets;
+          count_reads(let->init.get(), uses);
+          break;
+        }
+        case StmtKind::Assign: {
+          auto as = static_cast<const AssignStmt *>(s.get());
+          ++uses[as->name].assigns;
+          count_reads(as->value.get(), uses);
+          break;
+        }
+        case StmtKind::Return: count_reads(static_cast<const ReturnStmt *>(s.get())->value.get(), uses); break;
+        case StmtKind::Expr: count_reads(static_cast<const ExprStmt *>(s.get())->expr.get(), uses); break;
+        case StmtKind::If: {
+          auto ifs = static_cast<const IfStmt *>(s.get());
+          count_reads(ifs->cond.get(), uses);
+          count_names(ifs->thenS, uses);
+          count_names(ifs->elseS, uses);
+          break;
+        }
+        case StmtKind::While: {
+          auto ws = static_cast<const WhileStmt *>(s.get());
+          count_reads(ws->cond.get(), uses);
+          count_names(ws->body, uses);
+          break;
+        }
+        }
+      }
+    }
+
+    class Folder {
+    public:
+      explicit Folder(OptimizeStats &stats) : stats_(stats) {}
+
+      void run(Function &f) {
+        NameUses uses;
+        count_names(f.body, uses);
+        std::unordered_set<std::string> params;
+        for (auto &p : f.params)
+          params.insert(p.name);
+        constant_.clear();
+        for (auto &[name, u] : uses)
+          if (u.lets == 1 && u.assigns == 0 && !params.count(name))
+            constant_.insert(name);
+        propagated_.clear();
+        block(f.body, Env{});
+        if (propagated_.empty())
+          return;
+        // drop the lets whose every read was replaced
+        NameUses left;
+        count_names(f.body, left);
+        dropDeadLets(f.body, left);
+      }
+
+    private:
+      // Folds the statements of `body` in order; lets seen here extend `env` for the
+      // statements after them (and blocks nested there), not for the enclosing block
+      void block(Block &body, Env env) {
+        for (size_t i = 0; i < body.size();) {
+          Stmt *s = body[i].get();
+          switch (s->kind) {
+          case StmtKind::Let: {
+            auto let  = static_cast<LetStmt *>(s);
+            let->init = fold(std::move(let->init), env);
+            if (auto lit = as_literal(let->init.get()); lit && constant_.count(let->name)) {
+              env[let->name] = lit->value;
+              propagated_.insert(let->name);
+            }
+            break;
+          }
+          case StmtKind::Assign: {
+            auto as   = static_cast<AssignStmt *>(s);
+            as->value = fold(std::move(as->value), env);
+            break;
+          }
+          case StmtKind::Return: {
+            auto ret   = static_cast<ReturnStmt *>(s);
+            ret->value = fold(std::move(ret->value), env);
+            break;
+          }
+          case StmtKind::Expr: {
+            auto es  = static_cast<ExprStmt *>(s);
+            es->expr = fold(std::move(es->expr), env);
+            if (as_literal(es->expr.get())) {
+              body.erase(body.begin() + (std::ptrdiff_t)i);
+              continue;
+            }
+            break;
+          }
+          case StmtKind::If: {
+            auto ifs = static_cast<IfStmt *>(s);
+            // Compiler::compileIf drops the untaken branch of a literal condition itself
+            if (declares(ifs->thenS) || declares(ifs->elseS))
+              ifs->cond = foldOperands(std::move(ifs->cond), env);
+            else
+              ifs->cond = fold(std::move(ifs->cond), env);
+            // the other branch goes too unless it declares a name, which the compiler still binds
+            if (auto lit = as_literal(ifs->cond.get()); lit && !declares(lit->value ? ifs->elseS : ifs->thenS)) {
+              // splice the taken branch in place and fold it as part of this block
+              Block taken = std::move(lit->value ? ifs->thenS : ifs->elseS);
+              body.erase(body.begin() + (std::ptrdiff_t)i);
+              body.insert(body.begin() + (std::ptrdiff_t)i, std::make_move_iterator(taken.begin()), std::make_move_iterator(taken.end()));
+              ++stats_.branchesRemoved;
+              continue;
+            }
+            block(ifs->thenS, env);
+            block(ifs->elseS, env);
+            break;
+          }
+          case StmtKind::While: {
+            auto ws  = static_cast<WhileStmt *>(s);
+            ws->cond = fold(std::move(ws->cond), env);
+            if (auto lit = as_literal(ws->cond.get()); lit && lit->value == 0 && !declares(ws->body)) {
+              body.erase(body.begin() + (std::ptrdiff_t)i);
+              ++stats_.branchesRemoved;
+              continue;
+            }
+            block(ws->body, env);
+            break;
+          }
+          }
+          ++i;
+        }
+      }
+
+      std::unique_ptr<Expr> fold(std::unique_ptr<Expr> e, const Env &env);
+      std::unique_ptr<Expr> foldOperands(std::unique_ptr<Expr> e, const Env &env);
+      std::unique_ptr<Expr> foldBinary(BinaryExpr *b, std::unique_ptr<Expr> self);
+
+      std::unique_ptr<Expr> literal(long long v) {
+        ++stats_.folded;
+        return std::make_unique<LiteralExpr>(v);
+      }
+
+      void dropDeadLets(Block &body, const NameUses &left) {
+        for (size_t i = 0; i < body.size();) {
+          Stmt *s = body[i].get();
+          if (s->kind == StmtKind::Let) {
+            auto let = static_cast<LetStmt *>(s);
+            auto it  = left.find(let->name);
+            if (propagated_.count(let->name) && (it == left.end() || it->second.reads == 0)) {
+              body.erase(body.begin() + (std::ptrdiff_t)i);
+              continue;
+            }
+          } else if (s->kind == StmtKind::If) {
+            dropDeadLets(static_cast<IfStmt *>(s)->thenS, left);
+            dropDeadLets(static_cast<IfStmt *>(s)->elseS, left);
+          } else if (s->kind == StmtKind::While) {
+            dropDeadLets(static_cast<WhileStmt *>(s)->body, left);
+          }
+          ++i;
+        }
+      }
+
+      OptimizeStats &stats_;
+      std::unordered_set<std::string> constant_;   // names a `let` may bind to a constant
+      std::unordered_set<std::string> propagated_; // names that were bound
+    };
+
+    std::unique_ptr<Expr> Folder::fold(std::unique_ptr<Expr> e, const Env &env) {
+      switch (e->kind) {
+      case ExprKind::Literal: return e;
+      case ExprKind::Var: {
+        auto it = env.find(static_cast<VarExpr *>(e.get())->name);
+        if (it == env.end())
+          return e;
+        ++stats_.propagated;
+        return std::make_unique<LiteralExpr>(it->second);
+      }
+      case ExprKind::Unary: {
+        auto u = static_cast<UnaryExpr *>(e.get());
+        u->rhs = fold(std::move(u->rhs), env);
+        if (auto lit = as_literal(u->rhs.get()))
+          return literal(wrap_sub(0, lit->value));
+        // --x -> x
+        if (u->rhs->kind == ExprKind::Unary) {
+          ++stats_.folded;
+          return std::move(static_cast<UnaryExpr *>(u->rhs.get())->rhs);
+        }
+        return e;
+      }
+      case ExprKind::Binary: {
+        auto b = static_cast<BinaryExpr *>(e.get());
+        b->lhs = fold(std::move(b->lhs), env);
+        b->rhs = fold(std::move(b->rhs), env);
+        return foldBinary(b, std::move(e));
+      }
+      case ExprKind::Call:
+        for (auto &a : static_cast<CallExpr *>(e.get())->args)
+          a = fold(std::move(a), env);
+        return e;
+      }
+      return e;
+    }
+
+    // Folds the operands of `e` but leaves `e` itself, so a non-literal stays non-literal
+    std::unique_ptr<Expr> Folder::foldOperands(std::unique_ptr<Expr> e, const Env &env) {
+      switch (e->kind) {
+      case ExprKind::Literal:
+      case ExprKind::Var: break;
+      case ExprKind::Unary: {
+        auto u = static_cast<UnaryExpr *>(e.get());
+        u->rhs = fold(std::move(u->rhs), env);
+        break;
+      }
+      case ExprKind::Binary: {
+        auto b = static_cast<BinaryExpr *>(e.get());
+        b->lhs = fold(std::move(b->lhs), env);
+        b->rhs = fold(std::move(b->rhs), env);
+        break;
+      }
+      case ExprKind::Call: return fold(std::move(e), env);
+      }
+      return e;
+    }
+
+    // `b` (owned by `self`) with folded operands
+    std::unique_ptr<Expr> Folder::foldBinary(BinaryExpr *b, std::unique_ptr<Expr> self) {
+      const LiteralExpr *ll = as_literal(b->lhs.get());
+      const LiteralExpr *rr = as_literal(b->rhs.get());
+      long long v;
+      if (ll && rr)
+        return eval_binary(b->op, ll->value, rr->value, v) ? literal(v) : std::move(self);
+      // a literal evaluates without effects, so it can swap sides: k < x -> x > k, 1 + x -> x + 1
+      BinOp mirrored;
+      if (ll && mirror(b->op, mirrored)) {
+        std::swap(b->lhs, b->rhs);
+        b->op = mirrored;
+        std::swap(ll, rr);
+      }
+      if (rr) {
+        long long k = rr->value;
+        if (b->op == BinOp::Add || b->op == BinOp::Sub) {
+          long long offset = b->op == BinOp::Add ? k : wrap_sub(0, k);
+          // (x + c1) + c2 -> x + (c1 + c2)
+          if (b->lhs->kind == ExprKind::Binary) {
+            auto inner = static_cast<BinaryExpr *>(b->lhs.get());
+            auto ik    = as_literal(inner->rhs.get());
+            if (ik && (inner->op == BinOp::Add || inner->op == BinOp::Sub)) {
+              offset = wrap_add(offset, inner->op == BinOp::Add ? ik->value : wrap_sub(0, ik->value));
+              b->lhs = std::move(inner->lhs);
+              ++stats_.folded;
+            }
+          }
+          if (offset == 0) {
+            ++stats_.folded;
+            return std::move(b->lhs);
+          }
+          bool sub = offset < 0 && offset != LLONG_MIN;
+          b->op    = sub ? BinOp::Sub : BinOp::Add;
+          b->rhs   = std::make_unique<LiteralExpr>(sub ? -offset : offset);
+          return self;
+        }
+        if ((b->op == BinOp::Mul || b->op == BinOp::Div) && k == 1) {
+          ++stats_.folded;
+          return std::move(b->lhs);
+        }
+        if (b->op == BinOp::Mul && k == 0 && droppable(b->lhs.get()))
+          return literal(0);
+        return self;
+      }
+      // x - x, x == x, x < x, ... on the same variable
+      auto lv = as_var(b->lhs.get());
+      auto rv = as_var(b->rhs.get());
+      if (lv && rv && lv->name == rv->name) {
+        switch (b->op) {
+        case BinOp::Sub:
+        case BinOp::Ne:
+        case BinOp::Lt:
+        case BinOp::Gt: return literal(0);
+        case BinOp::Eq:
+        case BinOp::Le:
+        case BinOp::Ge: return literal(1);
+        default: break;
+        }
+      }
+      return self;
+    }
+
+  } // namespace
+
+  bool eval_binary(BinOp op, long long a, long long b, long long &out) {
+    switch (op) {
+    case BinOp::Add: out = wrap_add(a, b); return true;
+    case BinOp::Sub: out = wrap_sub(a, b); return true;
+    case BinOp::Mul: out = wrap_mul(a, b); return true;
+    case BinOp::Div:
+      if (b == 0 || (a == LLONG_MIN && b == -1))
+        return false;
+      out = a / b;
+      return true;
+    case BinOp::Eq: out = a == b; return true;
+    case BinOp::Ne: out = a != b; return true;
+    case BinOp::Lt: out = a < b; return true;
+    case BinOp::Le: out = a <= b; return true;
+    case BinOp::Gt: out = a > b; return true;
+    case BinOp::Ge: out = a >= b; return true;
+    }
+    return false;
+  }
+
+  OptimizeStats optimize_module(Module &m) {
+    OptimizeStats stats;
+    Folder folder(stats);
+    for (auto &f : m.functions)
+      folder.run(f);
+    return stats;
+  }
+
+} // namespace mplx
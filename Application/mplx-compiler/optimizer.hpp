@@ -0,0 +1,32 @@
+#pragma once
+#include "../mplx-lang/ast.hpp"
+#include <cstdint>
+
+namespace mplx {
+
+  // What optimize_module changed
+  struct OptimizeStats {
+    uint32_t folded{0};          // expressions replaced by a literal or a simpler expression
+    uint32_t propagated{0};      // variable uses replaced by the value of their `let`
+    uint32_t branchesRemoved{0}; // if/while statements whose condition became constant
+  };
+
+  // Constant folding and propagation over the AST, run on a parsed module before
+  // Compiler::compile:
+  //  - folds constant subtrees of any depth, e.g. (1 + 2) * 3, and merges literal offsets
+  //    ((x + 1) + 2 -> x + 3); arithmetic wraps like the VM's
+  //  - replaces uses of a `let` local with its value when the initializer folds to a
+  //    literal and the function neither assigns the name nor declares it again or as a
+  //    parameter; the `let` is dropped once nothing reads it
+  //  - simplifies unary minus (--x, -literal) and comparisons (x == x, literal moved to the
+  //    right so the superinstruction patterns see `x < k`)
+  //  - replaces an `if` with its taken branch and drops a `while` whose condition is false
+  // Calls and divisions are never removed, so recursion and division by zero still happen
+  // at run time.
+  OptimizeStats optimize_module(Module &m);
+
+  // Value of the literal expression `a op b`, with arithmetic wrapping like the VM's; false
+  // if evaluating it faults (division by zero, LLONG_MIN / -1), which is left for the VM
+  bool eval_binary(BinOp op, long long a, long long b, long long &out);
+
+} // namespace mplx
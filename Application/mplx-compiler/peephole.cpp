@@ -0,0 +1,354 @@
+#include "peephole.hpp"
+#include "superinstructions.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace mplx {
+
+  namespace {
+
+    // Longest loop test (in instructions) copied to the bottom of its loop
+    constexpr size_t kMaxInvertedTest = 12;
+
+    // One decoded instruction. Jumps name their target by id, which survives insertions
+    // and removals; a removed instruction's id resolves to the next one kept.
+    struct Insn {
+      Op op;
+      uint32_t id;
+      uint32_t arg{0};    // operand of a non-jump (local, constant index, immediate bits, callee)
+      uint32_t target{0}; // id of the jump target
+      bool dead{false};
+    };
+
+    bool is_load(Op op) {
+      return (op >= OP_LD0 && op <= OP_LD3) || op == OP_LOAD_LOCAL8;
+    }
+    bool is_const(Op op) {
+      return op == OP_PUSH_CONST || op == OP_PUSH_I8 || op == OP_PUSH_I32;
+    }
+    // !(a op b) as a comparison of a and b; OP_HALT if `op` is not a comparison
+    Op negated(Op op) {
+      switch (op) {
+      case OP_EQ: return OP_NE;
+      case OP_NE: return OP_EQ;
+      case OP_LT: return OP_GE;
+      case OP_LE: return OP_GT;
+      case OP_GT: return OP_LE;
+      case OP_GE: return OP_LT;
+      default: return OP_HALT;
+      }
+    }
+    // The store of the same local that pops; OP_HALT if `op` is not a pushing store
+    Op popping_store(Op op) {
+      if (op >= OP_ST0 && op <= OP_ST3)
+        return (Op)(OP_SET0 + (op - OP_ST0));
+      if (op == OP_STORE_LOCAL8)
+        return OP_SET_LOCAL8;
+      if (op == OP_STORE_LOCAL)
+        return OP_SET_LOCAL;
+      return OP_HALT;
+    }
+    // Would `LDa (LDb | PUSH_CONST) cmp JMP_IF_FALSE` fuse into one superinstruction of `mask`?
+    bool test_fuses(Op a, Op b, Op cmp, uint32_t mask) {
+      if (!is_load(a))
+        return false;
+      Op fused = OP_HALT;
+      if (is_load(b))
+        fused = (cmp == OP_LT || cmp == OP_GT) ? OP_LL_LT_JF : (cmp == OP_LE || cmp == OP_GE) ? OP_LL_LE_JF : OP_HALT;
+      else if (is_const(b))
+        fused = cmp == OP_LT ? OP_LK_LT_JF : cmp == OP_LE ? OP_LK_LE_JF : OP_HALT;
+      return fused != OP_HALT && (mask & superinstruction_bit(fused)) != 0;
+    }
+
+    class Peephole {
+    public:
+      Peephole(Bytecode &bc, uint32_t fuseMask) : bc_(bc), fuseMask_(fuseMask) {}
+
+      PeepholeStats run() {
+        decode();
+        invertLoops();
+        bool changed = true;
+        while (changed) {
+          changed = threadJumps();
+          changed = removeUnreachable() || changed;
+        }
+        fuseStores();
+        encode();
+        return stats_;
+      }
+
+    private:
+      void decode() {
+        const auto &code = bc_.code;
+        std::vector<uint32_t> idAt(code.size() + 1, UINT32_MAX);
+        uint32_t ip = 0;
+        while (ip < code.size()) {
+          Op op = (Op)code[ip];
+          if (op > kLastOp)
+            throw std::runtime_error("peephole: unknown opcode");
+          uint32_t size = op_operand_size(op);
+          if (ip + 1 + size > code.size())
+            throw std::runtime_error("peephole: truncated instruction");
+          Insn in{op, (uint32_t)ins_.size()};
+          if (op_is_jump(op))
+            in.target = jump_target_at(code, ip); // byte offset until all ids are known
+          else if (size == 1)
+            in.arg = code[ip + 1];
+          else if (size == 4)
+            in.arg = read_u32_at(code, ip + 1);
+          idAt[ip] = in.id;
+          ins_.push_back(in);
+          ip += 1 + size;
+        }
+        for (auto &in : ins_) {
+          if (!op_is_jump(in.op))
+            continue;
+          if (in.target >= code.size() || idAt[in.target] == UINT32_MAX)
+            throw std::runtime_error("peephole: jump target is not an instruction");
+          in.target = idAt[in.target];
+        }
+        for (const auto &f : bc_.functions) {
+          if (f.entry >= code.size() || idAt[f.entry] == UINT32_MAX)
+            throw std::runtime_error("peephole: function entry is not an instruction");
+          entries_.push_back(idAt[f.entry]);
+        }
+        alias_.resize(ins_.size());
+        for (uint32_t i = 0; i < alias_.size(); ++i)
+          alias_[i] = i;
+      }
+
+      uint32_t newId() {
+        alias_.push_back((uint32_t)alias_.size());
+        return alias_.back();
+      }
+      uint32_t resolve(uint32_t id) const {
+        while (alias_[id] != id)
+          id = alias_[id];
+        return id;
+      }
+      // Position of every live id in ins_, and which positions a jump or an entry reaches
+      void index() {
+        pos_.assign(alias_.size(), UINT32_MAX);
+        for (uint32_t i = 0; i < ins_.size(); ++i)
+          pos_[ins_[i].id] = i;
+        leader_.assign(ins_.size(), false);
+        for (auto &in : ins_)
+          if (op_is_jump(in.op)) {
+            in.target = resolve(in.target);
+            leader_[pos_[in.target]] = true;
+          }
+        for (auto &e : entries_) {
+          e                = resolve(e);
+          leader_[pos_[e]] = true;
+        }
+      }
+      uint32_t targetPos(const Insn &in) const {
+        return pos_[resolve(in.target)];
+      }
+      // Drops dead instructions; their ids resolve to the next instruction kept
+      void compact() {
+        uint32_t next = UINT32_MAX;
+        for (size_t i = ins_.size(); i-- > 0;) {
+          if (ins_[i].dead) {
+            if (next != UINT32_MAX)
+              alias_[ins_[i].id] = next;
+          } else {
+            next = ins_[i].id;
+          }
+        }
+        ins_.erase(std::remove_if(ins_.begin(), ins_.end(), [](const Insn &in) { return in.dead; }), ins_.end());
+      }
+
+      // L: test; JMP_IF_FALSE X; body; JMP L; X:  ->  L: test; JMP_IF_FALSE X; body; test'; JMP_IF_* body; X:
+      void invertLoops() {
+        index();
+        std::vector<Insn> out;
+        out.reserve(ins_.size());
+        for (uint32_t j = 0; j < ins_.size(); ++j) {
+          const Insn &back = ins_[j];
+          uint32_t L       = back.op == OP_JMP ? targetPos(back) : UINT32_MAX;
+          if (L >= j) {
+            out.push_back(back);
+            continue;
+          }
+          // the test: straight-line code from L up to its conditional jump
+          uint32_t f = L;
+          while (f < j && !op_is_jump(ins_[f].op) && ins_[f].op != OP_RET && ins_[f].op != OP_HALT && (f == L || !leader_[f]))
+            ++f;
+          bool ok = f < j && f > L && f - L <= kMaxInvertedTest && !leader_[f] && ins_[f].op == OP_JMP_IF_FALSE && targetPos(ins_[f]) == j + 1;
+          Op cmp  = ok ? ins_[f - 1].op : OP_HALT;
+          Op neg  = negated(cmp);
+          if (ok && f - L == 3) {
+            Op a = ins_[L].op, b = ins_[L + 1].op;
+            ok   = !test_fuses(a, b, cmp, fuseMask_) || (neg != OP_HALT && test_fuses(a, b, neg, fuseMask_));
+          }
+          if (!ok) {
+            out.push_back(back);
+            continue;
+          }
+          // the copy takes over the JMP's id, so jumps to the loop's end still land on it
+          for (uint32_t k = L; k < f; ++k) {
+            Insn c = ins_[k];
+            c.id   = k == L ? back.id : newId();
+            if (k + 1 == f && neg != OP_HALT)
+              c.op = neg;
+            out.push_back(c);
+          }
+          Insn br{neg != OP_HALT ? OP_JMP_IF_FALSE : OP_JMP_IF_TRUE, newId()};
+          br.target = ins_[f + 1].id;
+          out.push_back(br);
+          ++stats_.loopsInverted;
+        }
+        ins_ = std::move(out);
+      }
+
+      bool threadJumps() {
+        index();
+        bool changed = false;
+        const uint32_t n = (uint32_t)ins_.size();
+        for (uint32_t i = 0; i < n; ++i) {
+          Insn &in = ins_[i];
+          if (!op_is_jump(in.op))
+            continue;
+          // follow JMPs (a cycle of them stops after n steps)
+          uint32_t t = in.target;
+          for (uint32_t steps = 0; steps < n && ins_[pos_[t]].op == OP_JMP && t != in.id; ++steps)
+            t = resolve(ins_[pos_[t]].target);
+          if (t != in.target) {
+            in.target = t;
+            ++stats_.jumpsThreaded;
+            changed = true;
+          }
+        }
+        // removals below keep positions stable; dead instructions go in compact()
+        for (uint32_t i = 0; i < n; ++i) {
+          Insn &in = ins_[i];
+          if (in.dead || !op_is_jump(in.op))
+            continue;
+          const uint32_t t = pos_[in.target];
+          // JMP_IF_FALSE X; JMP Y; X:  ->  JMP_IF_TRUE Y; X:
+          if ((in.op == OP_JMP_IF_FALSE || in.op == OP_JMP_IF_TRUE) && i + 2 < n && t == i + 2 && ins_[i + 1].op == OP_JMP && !leader_[i + 1] &&
+              ins_[i + 1].target != ins_[i + 1].id) {
+            in.op     = in.op == OP_JMP_IF_FALSE ? OP_JMP_IF_TRUE : OP_JMP_IF_FALSE;
+            in.target = ins_[i + 1].target;
+            ins_[i + 1].dead = true;
+            ++stats_.jumpsThreaded;
+            changed = true;
+            continue;
+          }
+          // JMP to the next instruction, unless that would put a POP right before a RET
+          if (in.op == OP_JMP && t == nextLive(i)) {
+            uint32_t prev = i;
+            while (prev > 0 && ins_[prev - 1].dead)
+              --prev;
+            if (prev > 0 && ins_[prev - 1].op == OP_POP && t < n && ins_[t].op == OP_RET)
+              continue;
+            in.dead = true;
+            ++stats_.jumpsThreaded;
+            changed = true;
+          }
+        }
+        compact();
+        return changed;
+      }
+      uint32_t nextLive(uint32_t i) const {
+        do
+          ++i;
+        while (i < ins_.size() && ins_[i].dead);
+        return i;
+      }
+
+      // Keeps what a function entry reaches; HALT (after the last function) is kept too
+      bool removeUnreachable() {
+        index();
+        std::vector<bool> seen(ins_.size(), false);
+        std::vector<uint32_t> work;
+        for (uint32_t e : entries_)
+          work.push_back(pos_[e]);
+        for (uint32_t i = 0; i < ins_.size(); ++i)
+          if (ins_[i].op == OP_HALT)
+            work.push_back(i);
+        while (!work.empty()) {
+          uint32_t i = work.back();
+          work.pop_back();
+          if (i >= ins_.size() || seen[i])
+            continue;
+          seen[i]     = true;
+          const Op op = ins_[i].op;
+          if (op_is_jump(op))
+            work.push_back(targetPos(ins_[i]));
+          if (op != OP_JMP && op != OP_RET && op != OP_HALT)
+            work.push_back(i + 1);
+        }
+        bool changed = false;
+        for (uint32_t i = 0; i < ins_.size(); ++i)
+          if (!seen[i]) {
+            ins_[i].dead = true;
+            ++stats_.unreachable;
+            changed = true;
+          }
+        compact();
+        return changed;
+      }
+
+      void fuseStores() {
+        index();
+        for (uint32_t i = 0; i + 1 < ins_.size(); ++i) {
+          Insn &st = ins_[i];
+          Op set   = popping_store(st.op);
+          if (set == OP_HALT || ins_[i + 1].op != OP_POP || leader_[i + 1])
+            continue;
+          if (i + 2 < ins_.size() && ins_[i + 2].op == OP_RET)
+            continue; // the POP is skipped, RET returns the stored value
+          st.op            = set;
+          ins_[i + 1].dead = true;
+          ++stats_.storesFused;
+          ++i;
+        }
+        compact();
+      }
+
+      void encode() {
+        index();
+        std::vector<uint32_t> at(ins_.size() + 1, 0);
+        for (uint32_t i = 0; i < ins_.size(); ++i)
+          at[i + 1] = at[i] + 1 + op_operand_size(ins_[i].op);
+        std::vector<uint8_t> code;
+        code.reserve(at.back());
+        auto put_u32 = [&](uint32_t v) {
+          for (int b = 0; b < 4; ++b)
+            code.push_back((uint8_t)(v >> (b * 8)));
+        };
+        for (const auto &in : ins_) {
+          code.push_back(in.op);
+          if (op_is_jump(in.op))
+            put_u32(at[targetPos(in)]);
+          else if (op_operand_size(in.op) == 1)
+            code.push_back((uint8_t)in.arg);
+          else if (op_operand_size(in.op) == 4)
+            put_u32(in.arg);
+        }
+        for (size_t f = 0; f < bc_.functions.size(); ++f)
+          bc_.functions[f].entry = at[pos_[entries_[f]]];
+        bc_.code = std::move(code);
+      }
+
+      Bytecode &bc_;
+      uint32_t fuseMask_;
+      PeepholeStats stats_;
+      std::vector<Insn> ins_;
+      std::vector<uint32_t> entries_; // entry id of each function
+      std::vector<uint32_t> alias_;   // id -> itself, or the id it was merged into
+      std::vector<uint32_t> pos_;     // id -> position in ins_ (index())
+      std::vector<bool> leader_;      // position -> jumped to or a function entry (index())
+    };
+
+  } // namespace
+
+  PeepholeStats peephole_optimize(Bytecode &bc, uint32_t fuseMask) {
+    if (bc.fused.mask != 0)
+      throw std::runtime_error("peephole: bytecode is already fused");
+    return Peephole(bc, fuseMask).run();
+  }
+
+} // namespace mplx
@@ -0,0 +1,31 @@
+#pragma once
+#include "bytecode.hpp"
+#include <cstdint>
+
+namespace mplx {
+
+  // What peephole_optimize changed
+  struct PeepholeStats {
+    uint32_t storesFused{0};   // STx POP pairs replaced by SETx
+    uint32_t jumpsThreaded{0}; // jumps retargeted past a JMP or removed as jumps to the next instruction
+    uint32_t loopsInverted{0}; // loops given a copy of their test at the bottom
+    uint32_t unreachable{0};   // instructions no path reaches, removed
+  };
+
+  // Post-emit cleanup of base-opcode code, run by Compiler::compile before superinstructions
+  // are fused (CompileOptions::peephole). Decodes the instructions, rewrites them and
+  // re-encodes them, relocating jump targets and function entries:
+  //  - a store whose value is popped right away (STx POP) becomes the popping SETx
+  //  - a jump to a JMP goes to that JMP's target, a JMP to the next instruction is removed
+  //    and a conditional jump over a JMP becomes the opposite conditional jump
+  //  - a loop `L: test; JMP_IF_FALSE X; body; JMP L; X:` gets a copy of the test in place of
+  //    its JMP, branching back to the body, so an iteration runs one jump instead of two. A
+  //    final comparison is negated and tested with JMP_IF_FALSE, which the LL_*_JF
+  //    superinstructions fuse; a test that would fuse (per `fuseMask`) only in its original
+  //    form stays on top.
+  //  - instructions that no path from a function entry reaches (code after RET) are removed
+  // A POP directly before RET is never removed or fused: the interpreter skips it.
+  // Throws std::runtime_error if `bc` is already fused.
+  PeepholeStats peephole_optimize(Bytecode &bc, uint32_t fuseMask = 0);
+
+} // namespace mplx
@@ -0,0 +1,115 @@
+#include "purity.hpp"
+#include <algorithm>
+#include <numeric>
+
+namespace mplx {
+
+  bool op_has_effects(Op op) {
+    switch (op) {
+    // the language has no globals, heap or I/O yet: every opcode only touches the frame
+    case OP_PUSH_CONST:
+    case OP_PUSH_I8:
+    case OP_PUSH_I32:
+    case OP_LD0:
+    case OP_LD1:
+    case OP_LD2:
+    case OP_LD3:
+    case OP_ST0:
+    case OP_ST1:
+    case OP_ST2:
+    case OP_ST3:
+    case OP_LOAD_LOCAL8:
+    case OP_STORE_LOCAL8:
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_SET0:
+    case OP_SET1:
+    case OP_SET2:
+    case OP_SET3:
+    case OP_SET_LOCAL8:
+    case OP_SET_LOCAL:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_NEG:
+    case OP_EQ:
+    case OP_NE:
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+    case OP_JMP:
+    case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_TRUE:
+    case OP_AND:
+    case OP_OR:
+    case OP_NOT:
+    case OP_CALL: // the callee is checked separately
+    case OP_TAILCALL:
+    case OP_RET:
+    case OP_POP:
+    case OP_HALT: // only emitted after the last function
+    case OP_ST_POP:
+    case OP_INC_LOCAL:
+    case OP_LL_LT_JF:
+    case OP_LL_LE_JF:
+    case OP_LK_LT_JF:
+    case OP_LK_LE_JF:
+    case OP_LL_ADD:
+    case OP_LK_SUB:
+      return false;
+    }
+    return true; // an opcode this analysis does not know about
+  }
+
+  void analyze_purity(Bytecode &bc) {
+    const auto &code = bc.code;
+    const size_t n   = bc.functions.size();
+    // a function's body runs from its entry to the next function's entry
+    std::vector<uint32_t> byEntry(n);
+    std::iota(byEntry.begin(), byEntry.end(), 0u);
+    std::sort(byEntry.begin(), byEntry.end(), [&](uint32_t a, uint32_t b) { return bc.functions[a].entry < bc.functions[b].entry; });
+
+    std::vector<bool> pure(n, true);
+    std::vector<std::vector<uint32_t>> callees(n);
+    for (size_t k = 0; k < n; ++k) {
+      const uint32_t f = byEntry[k];
+      uint32_t ip      = bc.functions[f].entry;
+      uint32_t end     = k + 1 < n ? bc.functions[byEntry[k + 1]].entry : (uint32_t)code.size();
+      while (ip < end) {
+        Op op = (Op)code[ip];
+        if (op > kLastOp || op_has_effects(op)) {
+          pure[f] = false;
+          break;
+        }
+        if (op == OP_CALL || op == OP_TAILCALL) {
+          uint32_t callee = read_u32_at(code, ip + 1);
+          if (callee < n)
+            callees[f].push_back(callee);
+          else
+            pure[f] = false;
+        }
+        ip += 1 + op_operand_size(op);
+      }
+    }
+    // impurity flows from callees to callers
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (uint32_t f = 0; f < n; ++f) {
+        if (!pure[f])
+          continue;
+        for (uint32_t c : callees[f])
+          if (!pure[c]) {
+            pure[f] = false;
+            changed = true;
+            break;
+          }
+      }
+    }
+    for (uint32_t f = 0; f < n; ++f)
+      bc.functions[f].pure = pure[f];
+  }
+
+} // namespace mplx
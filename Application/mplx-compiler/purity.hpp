@@ -0,0 +1,15 @@
+#pragma once
+#include "bytecode.hpp"
+
+namespace mplx {
+
+  // Whether executing `op` has an effect beyond the operand stack, the frame's locals and
+  // control flow (i.e. anything a caller could observe besides the return value)
+  bool op_has_effects(Op op);
+
+  // Sets FuncMeta::pure on every function whose body executes no effectful opcode and
+  // calls only pure functions. Recursion is resolved optimistically: a cycle of calls is
+  // pure unless something in it is not.
+  void analyze_purity(Bytecode &bc);
+
+} // namespace mplx
@@ -0,0 +1,560 @@
+#include "regcode.hpp"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace mplx {
+
+  namespace {
+
+    // Lowers one function. The operand stack is tracked symbolically: a slot holds an
+    // immediate, a local register, or its own operand register (locals + depth). Values
+    // are only materialized into their operand register when needed: at block
+    // boundaries, as call arguments, or before the local they alias is overwritten.
+    class FunctionLowering {
+    public:
+      FunctionLowering(const Bytecode &bc, RegCode &out, uint32_t fnIndex, uint32_t begin, uint32_t end)
+          : bc_(bc), out_(out), fnIndex_(fnIndex), begin_(begin), end_(end) {}
+
+      void run() {
+        const FuncMeta &fn = bc_.functions[fnIndex_];
+        locals_            = fn.locals;
+        nregs_             = fn.locals;
+        findLeaders();
+
+        RegFunc rf;
+        rf.name   = fn.name;
+        rf.entry  = (uint32_t)out_.code.size();
+        rf.arity  = fn.arity;
+        rf.locals = fn.locals;
+
+        bool reachable = true;
+        uint32_t ip    = begin_;
+        while (ip < end_) {
+          if (leaders_.count(ip)) {
+            size_t depth = st_.size();
+            if (reachable)
+              flush();
+            else {
+              auto it = depthAt_.find(ip);
+              depth   = it == depthAt_.end() ? 0 : it->second;
+            }
+            canonical(depth);
+            lastDefIndex_ = (size_t)-1; // a def in the previous block must not be retargeted
+            reachable     = true;
+          }
+          ipToIndex_[ip] = (uint32_t)out_.code.size();
+          Op op          = (Op)bc_.code[ip];
+          uint32_t next  = ip + 1 + op_operand_size(op);
+          switch (op) {
+          case OP_PUSH_CONST: push(Slot::constant(bc_.consts[read_u32_at(bc_.code, ip + 1)])); break;
+          case OP_PUSH_I8:
+          case OP_PUSH_I32: push(Slot::constant(immediate_at(bc_.code, ip))); break;
+          case OP_LD0:
+          case OP_LD1:
+          case OP_LD2:
+          case OP_LD3: push(Slot::inReg((uint16_t)(op - OP_LD0))); break;
+          case OP_LOAD_LOCAL8: push(Slot::inReg(bc_.code[ip + 1])); break;
+          case OP_LOAD_LOCAL: push(Slot::inReg(checkedReg(read_u32_at(bc_.code, ip + 1)))); break;
+          case OP_ST0:
+          case OP_ST1:
+          case OP_ST2:
+          case OP_ST3: store((uint16_t)(op - OP_ST0)); break;
+          case OP_STORE_LOCAL8: store(bc_.code[ip + 1]); break;
+          case OP_STORE_LOCAL: store(checkedReg(read_u32_at(bc_.code, ip + 1))); break;
+          case OP_SET0:
+          case OP_SET1:
+          case OP_SET2:
+          case OP_SET3:
+            store((uint16_t)(op - OP_SET0));
+            pop();
+            break;
+          case OP_SET_LOCAL8:
+            store(bc_.code[ip + 1]);
+            pop();
+            break;
+          case OP_SET_LOCAL:
+            store(checkedReg(read_u32_at(bc_.code, ip + 1)));
+            pop();
+            break;
+          case OP_ADD:
+          case OP_SUB:
+          case OP_MUL:
+          case OP_DIV:
+          case OP_MOD:
+          case OP_AND:
+          case OP_OR: binary(op); break;
+          case OP_EQ:
+          case OP_NE:
+          case OP_LT:
+          case OP_LE:
+          case OP_GT:
+          case OP_GE:
+            if (next < end_ && !leaders_.count(next) && ((Op)bc_.code[next] == OP_JMP_IF_FALSE || (Op)bc_.code[next] == OP_JMP_IF_TRUE)) {
+              bool onFalse    = (Op)bc_.code[next] == OP_JMP_IF_FALSE;
+              uint32_t target = read_u32_at(bc_.code, next + 1);
+              compareBranch(op, onFalse, target);
+              next += 5;
+            } else {
+              binary(op);
+            }
+            break;
+          case OP_NEG:
+          case OP_NOT: unary(op); break;
+          case OP_JMP:
+            flush();
+            emitJump(ROP_JMP, read_u32_at(bc_.code, ip + 1));
+            reachable = false;
+            break;
+          case OP_JMP_IF_FALSE:
+          case OP_JMP_IF_TRUE: condBranch(op == OP_JMP_IF_FALSE, read_u32_at(bc_.code, ip + 1)); break;
+          case OP_CALL:
+          case OP_TAILCALL: call(read_u32_at(bc_.code, ip + 1)); break; // the RET after it returns the result
+          case OP_RET: {
+            uint16_t r = materializeTop();
+            pop();
+            RegInsn in;
+            in.op = ROP_RET;
+            in.a  = r;
+            emit(in);
+            reachable = false;
+            break;
+          }
+          case OP_POP:
+            // the stack VM keeps the value when RET follows; mirror that
+            if (!(next < end_ && (Op)bc_.code[next] == OP_RET))
+              pop();
+            break;
+          case OP_HALT: {
+            RegInsn in;
+            in.op = ROP_HALT;
+            emit(in);
+            reachable = false;
+            break;
+          }
+          // superinstructions expand back into the sequences they fused
+          case OP_ST_POP:
+            store(checkedReg(bc_.code[ip + 1]));
+            pop();
+            break;
+          case OP_INC_LOCAL: {
+            uint16_t x = checkedReg(bc_.code[ip + 1]);
+            push(Slot::inReg(x));
+            push(Slot::constant(bc_.consts[read_u32_at(bc_.code, ip + 2)]));
+            binary(OP_ADD);
+            store(x);
+            pop();
+            break;
+          }
+          case OP_LL_LT_JF:
+          case OP_LL_LE_JF:
+            push(Slot::inReg(checkedReg(bc_.code[ip + 1])));
+            push(Slot::inReg(checkedReg(bc_.code[ip + 2])));
+            compareBranch(op == OP_LL_LT_JF ? OP_LT : OP_LE, true, jump_target_at(bc_.code, ip));
+            break;
+          case OP_LK_LT_JF:
+          case OP_LK_LE_JF:
+            push(Slot::inReg(checkedReg(bc_.code[ip + 1])));
+            push(Slot::constant(bc_.consts[read_u32_at(bc_.code, ip + 2)]));
+            compareBranch(op == OP_LK_LT_JF ? OP_LT : OP_LE, true, jump_target_at(bc_.code, ip));
+            break;
+          case OP_LL_ADD:
+          case OP_LK_SUB:
+            push(Slot::inReg(checkedReg(bc_.code[ip + 1])));
+            if (op == OP_LL_ADD)
+              push(Slot::inReg(checkedReg(bc_.code[ip + 2])));
+            else
+              push(Slot::constant(bc_.consts[read_u32_at(bc_.code, ip + 2)]));
+            binary(op == OP_LL_ADD ? OP_ADD : OP_SUB);
+            break;
+          default: throw std::runtime_error("regcode: unsupported opcode " + std::to_string((int)op));
+          }
+          ip = next;
+        }
+        // patch jump targets (stack ip -> register instruction index)
+        for (auto &fx : fixups_) {
+          auto it = ipToIndex_.find(fx.second);
+          if (it == ipToIndex_.end())
+            throw std::runtime_error("regcode: jump target outside function " + rf.name);
+          out_.code[fx.first].target = it->second;
+        }
+        rf.nregs = (uint16_t)nregs_;
+        out_.functions[fnIndex_] = rf;
+      }
+
+    private:
+      struct Slot {
+        bool isImm{false};
+        long long imm{0};
+        uint16_t reg{0};
+        static Slot constant(long long v) {
+          Slot s;
+          s.isImm = true;
+          s.imm   = v;
+          return s;
+        }
+        static Slot inReg(uint16_t r) {
+          Slot s;
+          s.reg = r;
+          return s;
+        }
+      };
+
+      void findLeaders() {
+        uint32_t ip = begin_;
+        while (ip < end_) {
+          Op op = (Op)bc_.code[ip];
+          if (op_is_jump(op))
+            leaders_.insert(jump_target_at(bc_.code, ip));
+          ip += 1 + op_operand_size(op);
+        }
+      }
+
+      uint16_t checkedReg(size_t r) {
+        if (r > 0xFFFF)
+          throw std::runtime_error("regcode: too many registers in " + bc_.functions[fnIndex_].name);
+        nregs_ = std::max(nregs_, r + 1);
+        return (uint16_t)r;
+      }
+      uint16_t operandReg(size_t depth) {
+        return checkedReg(locals_ + depth);
+      }
+
+      void emit(const RegInsn &in) {
+        out_.code.push_back(in);
+      }
+      // A branch that folded to never taken: its target may now be reachable only through
+      // dead code, which is still lowered and needs the stack depth the branch would carry
+      void skipJump(uint32_t targetIp) {
+        depthAt_.emplace(targetIp, st_.size());
+      }
+      void emitJump(RegOp op, uint32_t targetIp, uint16_t a = 0, uint16_t b = 0, long long imm = 0) {
+        depthAt_.emplace(targetIp, st_.size());
+        RegInsn in;
+        in.op  = op;
+        in.a   = a;
+        in.b   = b;
+        in.imm = imm;
+        fixups_.push_back({out_.code.size(), targetIp});
+        emit(in);
+      }
+
+      void push(Slot s) {
+        st_.push_back(s);
+      }
+      Slot pop() {
+        if (st_.empty())
+          throw std::runtime_error("regcode: operand stack underflow in " + bc_.functions[fnIndex_].name);
+        Slot s = st_.back();
+        st_.pop_back();
+        return s;
+      }
+
+      // Moves slot `d` into its own operand register
+      void materialize(size_t d) {
+        Slot &s    = st_[d];
+        uint16_t r = operandReg(d);
+        if (s.isImm) {
+          RegInsn in;
+          in.op  = ROP_LOADK;
+          in.dst = r;
+          in.imm = s.imm;
+          emit(in);
+        } else if (s.reg != r) {
+          RegInsn in;
+          in.op  = ROP_MOV;
+          in.dst = r;
+          in.a   = s.reg;
+          emit(in);
+        }
+        s = Slot::inReg(r);
+      }
+      uint16_t materializeTop() {
+        if (st_.empty())
+          throw std::runtime_error("regcode: operand stack underflow in " + bc_.functions[fnIndex_].name);
+        materialize(st_.size() - 1);
+        return st_.back().reg;
+      }
+      void flush() {
+        for (size_t d = 0; d < st_.size(); ++d)
+          materialize(d);
+      }
+      void canonical(size_t depth) {
+        st_.clear();
+        for (size_t d = 0; d < depth; ++d)
+          st_.push_back(Slot::inReg(operandReg(d)));
+      }
+
+      // slots still aliasing local `r` must be copied out before `r` is overwritten
+      bool aliases(uint16_t r, size_t below) const {
+        for (size_t d = 0; d < below; ++d)
+          if (!st_[d].isImm && st_[d].reg == r)
+            return true;
+        return false;
+      }
+      void spillAliases(uint16_t r, size_t below) {
+        for (size_t d = 0; d < below; ++d)
+          if (!st_[d].isImm && st_[d].reg == r)
+            materialize(d);
+      }
+
+      void store(uint16_t local) {
+        checkedReg(local);
+        if (st_.empty())
+          throw std::runtime_error("regcode: operand stack underflow in " + bc_.functions[fnIndex_].name);
+        size_t top = st_.size() - 1;
+        Slot v     = st_[top];
+        // retarget the instruction that just produced the value: t = a + b; x = t  ->  x = a + b
+        if (!v.isImm && v.reg == operandReg(top) && !out_.code.empty() && lastDefIndex_ == out_.code.size() - 1 &&
+            out_.code.back().dst == v.reg && !aliases(local, top)) {
+          out_.code.back().dst = local;
+        } else {
+          spillAliases(local, top);
+          RegInsn in;
+          in.dst = local;
+          if (v.isImm) {
+            in.op  = ROP_LOADK;
+            in.imm = v.imm;
+          } else {
+            in.op = ROP_MOV;
+            in.a  = v.reg;
+          }
+          emit(in);
+        }
+        st_[top] = Slot::inReg(local); // stores leave the value on the stack
+      }
+
+      static bool foldBinary(Op op, long long a, long long b, long long &out) {
+        auto ua = (unsigned long long)a, ub = (unsigned long long)b;
+        switch (op) {
+        case OP_ADD: out = (long long)(ua + ub); return true;
+        case OP_SUB: out = (long long)(ua - ub); return true;
+        case OP_MUL: out = (long long)(ua * ub); return true;
+        case OP_EQ: out = a == b; return true;
+        case OP_NE: out = a != b; return true;
+        case OP_LT: out = a < b; return true;
+        case OP_LE: out = a <= b; return true;
+        case OP_GT: out = a > b; return true;
+        case OP_GE: out = a >= b; return true;
+        case OP_AND: out = (a != 0) && (b != 0); return true;
+        case OP_OR: out = (a != 0) || (b != 0); return true;
+        default: return false; // DIV/MOD keep their runtime behaviour (trap on zero)
+        }
+      }
+      static RegOp regOpFor(Op op) {
+        switch (op) {
+        case OP_ADD: return ROP_ADD;
+        case OP_SUB: return ROP_SUB;
+        case OP_MUL: return ROP_MUL;
+        case OP_DIV: return ROP_DIV;
+        case OP_MOD: return ROP_MOD;
+        case OP_EQ: return ROP_EQ;
+        case OP_NE: return ROP_NE;
+        case OP_LT: return ROP_LT;
+        case OP_LE: return ROP_LE;
+        case OP_GT: return ROP_GT;
+        case OP_GE: return ROP_GE;
+        case OP_AND: return ROP_AND;
+        case OP_OR: return ROP_OR;
+        default: return ROP_HALT;
+        }
+      }
+      // a cmp b  <=>  b mirror(cmp) a
+      static Op mirrored(Op op) {
+        switch (op) {
+        case OP_LT: return OP_GT;
+        case OP_LE: return OP_GE;
+        case OP_GT: return OP_LT;
+        case OP_GE: return OP_LE;
+        default: return op;
+        }
+      }
+      static Op negated(Op op) {
+        switch (op) {
+        case OP_LT: return OP_GE;
+        case OP_LE: return OP_GT;
+        case OP_GT: return OP_LE;
+        case OP_GE: return OP_LT;
+        case OP_EQ: return OP_NE;
+        default: return OP_EQ; // OP_NE
+        }
+      }
+
+      void binary(Op op) {
+        Slot b = pop();
+        Slot a = pop();
+        long long folded;
+        if (a.isImm && b.isImm && foldBinary(op, a.imm, b.imm, folded)) {
+          push(Slot::constant(folded));
+          return;
+        }
+        // k + x and k * x use the immediate forms. No other operator is swapped: its operands are
+        // materialized in stack order, and loading the immediate into its slot's register would
+        // overwrite a register operand moved below it
+        if (a.isImm && !b.isImm && (op == OP_ADD || op == OP_MUL))
+          std::swap(a, b);
+        size_t d     = st_.size();
+        uint16_t dst = operandReg(d);
+        RegInsn in;
+        in.dst = dst;
+        if (!a.isImm && b.isImm && (op == OP_ADD || op == OP_SUB || op == OP_MUL)) {
+          in.op  = op == OP_MUL ? ROP_MULI : ROP_ADDI;
+          in.a   = a.reg;
+          in.imm = op == OP_SUB ? (long long)(0ull - (unsigned long long)b.imm) : b.imm;
+        } else {
+          // operands that are still immediates go to their own operand registers
+          st_.push_back(a);
+          st_.push_back(b);
+          materializeOperands(d);
+          b = pop();
+          a = pop();
+          in.op = regOpFor(op);
+          in.a  = a.reg;
+          in.b  = b.reg;
+        }
+        emitDef(in);
+        push(Slot::inReg(dst));
+      }
+
+      void materializeOperands(size_t from) {
+        for (size_t d = from; d < st_.size(); ++d)
+          if (st_[d].isImm)
+            materialize(d);
+      }
+
+      void unary(Op op) {
+        Slot a = pop();
+        if (a.isImm) {
+          push(Slot::constant(op == OP_NEG ? (long long)(0ull - (unsigned long long)a.imm) : (long long)(a.imm == 0)));
+          return;
+        }
+        RegInsn in;
+        in.op  = op == OP_NEG ? ROP_NEG : ROP_NOT;
+        in.dst = operandReg(st_.size());
+        in.a   = a.reg;
+        emitDef(in);
+        push(Slot::inReg(in.dst));
+      }
+
+      void emitDef(const RegInsn &in) {
+        emit(in);
+        lastDefIndex_ = out_.code.size() - 1;
+      }
+
+      void compareBranch(Op cmp, bool onFalse, uint32_t target) {
+        Slot b = pop();
+        Slot a = pop();
+        Op cond = onFalse ? negated(cmp) : cmp; // jump when `a cond b`
+        long long folded;
+        if (a.isImm && b.isImm && foldBinary(cond, a.imm, b.imm, folded)) {
+          flush();
+          if (folded)
+            emitJump(ROP_JMP, target);
+          else
+            skipJump(target);
+          return;
+        }
+        if (a.isImm) {
+          std::swap(a, b);
+          cond = mirrored(cond);
+        }
+        flush();
+        static const RegOp regForm[] = {ROP_JEQ, ROP_JNE, ROP_JLT, ROP_JLE, ROP_JGT, ROP_JGE};
+        static const RegOp immForm[] = {ROP_JEQI, ROP_JNEI, ROP_JLTI, ROP_JLEI, ROP_JGTI, ROP_JGEI};
+        size_t k = (size_t)(cond - OP_EQ);
+        if (b.isImm)
+          emitJump(immForm[k], target, a.reg, 0, b.imm);
+        else
+          emitJump(regForm[k], target, a.reg, b.reg);
+      }
+
+      void condBranch(bool onFalse, uint32_t target) {
+        Slot c = pop();
+        flush();
+        if (c.isImm) {
+          if ((c.imm == 0) == onFalse)
+            emitJump(ROP_JMP, target);
+          else
+            skipJump(target);
+          return;
+        }
+        emitJump(onFalse ? ROP_JF : ROP_JT, target, c.reg);
+      }
+
+      void call(uint32_t callee) {
+        if (callee >= bc_.functions.size())
+          throw std::runtime_error("regcode: call to unknown function index " + std::to_string(callee));
+        size_t arity = bc_.functions[callee].arity;
+        if (st_.size() < arity)
+          throw std::runtime_error("regcode: operand stack underflow in " + bc_.functions[fnIndex_].name);
+        size_t argBase = st_.size() - arity;
+        for (size_t d = argBase; d < st_.size(); ++d)
+          materialize(d);
+        st_.resize(argBase);
+        RegInsn in;
+        in.op  = ROP_CALL;
+        in.dst = operandReg(argBase);
+        in.a   = operandReg(argBase);
+        in.b   = (uint16_t)callee;
+        if (callee > 0xFFFF)
+          throw std::runtime_error("regcode: too many functions");
+        emitDef(in);
+        push(Slot::inReg(in.dst));
+      }
+
+      const Bytecode &bc_;
+      RegCode &out_;
+      uint32_t fnIndex_;
+      uint32_t begin_;
+      uint32_t end_;
+      size_t locals_{0};
+      size_t nregs_{0};
+      std::vector<Slot> st_;
+      std::set<uint32_t> leaders_;
+      std::unordered_map<uint32_t, size_t> depthAt_;
+      std::unordered_map<uint32_t, uint32_t> ipToIndex_;
+      std::vector<std::pair<size_t, uint32_t>> fixups_;
+      size_t lastDefIndex_{(size_t)-1};
+    };
+
+  } // namespace
+
+  RegCode lower_to_regcode(const Bytecode &bc) {
+    RegCode out;
+    out.functions.resize(bc.functions.size());
+    // functions are laid out back to back; each one ends where the next begins
+    std::vector<uint32_t> entries;
+    for (const auto &f : bc.functions)
+      entries.push_back(f.entry);
+    std::sort(entries.begin(), entries.end());
+    for (uint32_t i = 0; i < bc.functions.size(); ++i) {
+      uint32_t begin = bc.functions[i].entry;
+      auto it        = std::upper_bound(entries.begin(), entries.end(), begin);
+      uint32_t end   = it == entries.end() ? (uint32_t)bc.code.size() : *it;
+      FunctionLowering(bc, out, i, begin, end).run();
+    }
+    return out;
+  }
+
+  const char *regop_name(RegOp op) {
+    static const char *names[] = {"MOV", "LOADK", "ADD", "SUB", "MUL", "DIV", "MOD", "EQ", "NE", "LT", "LE", "GT", "GE",
+                                  "AND", "OR", "ADDI", "MULI", "NEG", "NOT", "JMP", "JF", "JT", "JLT", "JLE", "JGT", "JGE",
+                                  "JEQ", "JNE", "JLTI", "JLEI", "JGTI", "JGEI", "JEQI", "JNEI", "CALL", "RET", "HALT"};
+    static_assert(sizeof(names) / sizeof(names[0]) == ROP_HALT + 1, "regop name table");
+    return op <= ROP_HALT ? names[op] : "?";
+  }
+
+  std::string dump_regcode(const RegCode &rc) {
+    std::string out;
+    for (const auto &f : rc.functions)
+      out += "fn " + f.name + " entry=" + std::to_string(f.entry) + " arity=" + std::to_string(f.arity) + " regs=" + std::to_string(f.nregs) + "\n";
+    for (size_t i = 0; i < rc.code.size(); ++i) {
+      const auto &in = rc.code[i];
+      out += std::to_string(i) + ": " + regop_name(in.op) + " d=" + std::to_string(in.dst) + " a=" + std::to_string(in.a) + " b=" + std::to_string(in.b) +
+             " t=" + std::to_string(in.target) + " k=" + std::to_string(in.imm) + "\n";
+    }
+    return out;
+  }
+
+} // namespace mplx
@@ -0,0 +1,82 @@
+#pragma once
+#include "bytecode.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mplx {
+
+  // Register-machine tier. A function's locals are registers 0..locals-1; the stack
+  // bytecode's operand slots become registers above them, so `x = x + 1` is a single
+  // ADDI instead of LD/PUSH_CONST/ADD/ST.
+  enum RegOp : uint8_t {
+    ROP_MOV,   // r[dst] = r[a]
+    ROP_LOADK, // r[dst] = imm
+    ROP_ADD,   // r[dst] = r[a] op r[b]
+    ROP_SUB,
+    ROP_MUL,
+    ROP_DIV,
+    ROP_MOD,
+    ROP_EQ,
+    ROP_NE,
+    ROP_LT,
+    ROP_LE,
+    ROP_GT,
+    ROP_GE,
+    ROP_AND,
+    ROP_OR,
+    ROP_ADDI, // r[dst] = r[a] op imm
+    ROP_MULI,
+    ROP_NEG, // r[dst] = op r[a]
+    ROP_NOT,
+    ROP_JMP, // pc = target
+    ROP_JF,  // if (!r[a]) pc = target
+    ROP_JT,  // if (r[a]) pc = target
+    ROP_JLT, // if (r[a] cmp r[b]) pc = target
+    ROP_JLE,
+    ROP_JGT,
+    ROP_JGE,
+    ROP_JEQ,
+    ROP_JNE,
+    ROP_JLTI, // if (r[a] cmp imm) pc = target
+    ROP_JLEI,
+    ROP_JGTI,
+    ROP_JGEI,
+    ROP_JEQI,
+    ROP_JNEI,
+    ROP_CALL, // r[dst] = functions[b](r[a] .. r[a + arity - 1])
+    ROP_RET,  // return r[a]
+    ROP_HALT
+  };
+
+  struct RegInsn {
+    RegOp op{ROP_HALT};
+    uint16_t dst{0};
+    uint16_t a{0};
+    uint16_t b{0};
+    uint32_t target{0};
+    long long imm{0};
+  };
+
+  struct RegFunc {
+    std::string name;
+    uint32_t entry{0}; // index into RegCode::code
+    uint8_t arity{0};
+    uint16_t locals{0};
+    uint16_t nregs{0}; // locals + operand registers
+  };
+
+  struct RegCode {
+    std::vector<RegInsn> code;
+    std::vector<RegFunc> functions;
+  };
+
+  // Lowers compiled stack bytecode to the register tier. Throws std::runtime_error on
+  // bytecode the lowering cannot map (e.g. more than 65535 registers in one frame).
+  RegCode lower_to_regcode(const Bytecode &bc);
+
+  const char *regop_name(RegOp op);
+  // One instruction per line, for --dump style tooling
+  std::string dump_regcode(const RegCode &rc);
+
+} // namespace mplx
@@ -0,0 +1,369 @@
+#include "superinstructions.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace mplx {
+
+  namespace {
+
+    const std::vector<Op> kLoad  = {OP_LD0, OP_LD1, OP_LD2, OP_LD3, OP_LOAD_LOCAL8};
+    const std::vector<Op> kStore = {OP_ST0, OP_ST1, OP_ST2, OP_ST3, OP_STORE_LOCAL8};
+    const std::vector<Op> kSet   = {OP_SET0, OP_SET1, OP_SET2, OP_SET3, OP_SET_LOCAL8};
+    const std::vector<Op> kConst = {OP_PUSH_CONST, OP_PUSH_I8, OP_PUSH_I32};
+
+    // Source sequence of each superinstruction as opcode classes, used to score it from
+    // the n-gram profile; `alt` is the same sequence after the peephole pass, if it differs.
+    // Indexed by fused op - OP_ST_POP.
+    struct Pattern {
+      Op fused;
+      std::vector<std::vector<Op>> seq;
+      std::vector<std::vector<Op>> alt{};
+    };
+    const std::vector<Pattern> &patterns() {
+      static const std::vector<Pattern> table = {
+          {OP_ST_POP, {kStore, {OP_POP}}},
+          {OP_INC_LOCAL, {kLoad, kConst, {OP_ADD}, kStore, {OP_POP}}, {kLoad, kConst, {OP_ADD}, kSet}},
+          {OP_LL_LT_JF, {kLoad, kLoad, {OP_LT, OP_GT}, {OP_JMP_IF_FALSE}}},
+          {OP_LL_LE_JF, {kLoad, kLoad, {OP_LE, OP_GE}, {OP_JMP_IF_FALSE}}},
+          {OP_LK_LT_JF, {kLoad, kConst, {OP_LT}, {OP_JMP_IF_FALSE}}},
+          {OP_LK_LE_JF, {kLoad, kConst, {OP_LE}, {OP_JMP_IF_FALSE}}},
+          {OP_LL_ADD, {kLoad, kLoad, {OP_ADD}}},
+          {OP_LK_SUB, {kLoad, kConst, {OP_SUB}}},
+      };
+      return table;
+    }
+
+    // Estimated executions of a sequence: its pair count, or the least frequent of its
+    // overlapping triples
+    uint64_t score(const OpSequenceProfile &p, const std::vector<std::vector<Op>> &seq) {
+      if (seq.empty())
+        return 0;
+      if (seq.size() == 2) {
+        uint64_t n = 0;
+        for (Op a : seq[0])
+          for (Op b : seq[1])
+            n += p.pair(a, b);
+        return n;
+      }
+      uint64_t best = UINT64_MAX;
+      for (size_t w = 0; w + 2 < seq.size(); ++w) {
+        uint64_t n = 0;
+        for (Op a : seq[w])
+          for (Op b : seq[w + 1])
+            for (Op c : seq[w + 2])
+              n += p.triple(a, b, c);
+        best = std::min(best, n);
+      }
+      return best;
+    }
+    uint64_t score(const OpSequenceProfile &p, const Pattern &pat) {
+      return score(p, pat.seq) + score(p, pat.alt);
+    }
+
+    struct Insn {
+      uint32_t ip;
+      Op op;
+    };
+
+    class Fuser {
+    public:
+      Fuser(Bytecode &bc, uint32_t mask) : bc_(bc), mask_(mask) {}
+
+      void run(std::vector<uint8_t> &out, std::vector<uint32_t> &ipMap) {
+        decode();
+        out.reserve(bc_.code.size());
+        ipMap.assign(bc_.code.size() + 1, UINT32_MAX);
+        std::vector<std::pair<uint32_t, uint32_t>> fixups; // operand pos in `out`, old target
+        size_t i = 0;
+        while (i < ins_.size()) {
+          ipMap[ins_[i].ip] = (uint32_t)out.size();
+          size_t n          = tryFuse(i, out);
+          if (n == 0) {
+            Op op         = ins_[i].op;
+            uint32_t size = 1 + op_operand_size(op);
+            out.insert(out.end(), bc_.code.begin() + ins_[i].ip, bc_.code.begin() + ins_[i].ip + size);
+            n = 1;
+          }
+          if (op_is_jump((Op)out[ipMap[ins_[i].ip]])) {
+            uint32_t at = ipMap[ins_[i].ip];
+            fixups.push_back({(uint32_t)out.size() - 4, jump_target_at(out, at)});
+          }
+          i += n;
+        }
+        ipMap[bc_.code.size()] = (uint32_t)out.size();
+        for (auto &fx : fixups) {
+          if (fx.second >= ipMap.size() || ipMap[fx.second] == UINT32_MAX)
+            throw std::runtime_error("superinstructions: jump into a fused sequence");
+          write_u32(out, fx.first, ipMap[fx.second]);
+        }
+      }
+
+    private:
+      void decode() {
+        std::vector<uint32_t> entries;
+        for (const auto &f : bc_.functions)
+          entries.push_back(f.entry);
+        leader_.assign(bc_.code.size() + 1, false);
+        for (uint32_t e : entries)
+          if (e <= bc_.code.size())
+            leader_[e] = true;
+        uint32_t ip = 0;
+        while (ip < bc_.code.size()) {
+          Op op = (Op)bc_.code[ip];
+          if (op > kLastOp)
+            throw std::runtime_error("superinstructions: unknown opcode");
+          if (op_is_jump(op)) {
+            uint32_t t = jump_target_at(bc_.code, ip);
+            if (t <= bc_.code.size())
+              leader_[t] = true;
+          }
+          ins_.push_back({ip, op});
+          ip += 1 + op_operand_size(op);
+        }
+        // locals of the function each instruction belongs to
+        std::vector<const FuncMeta *> byEntry;
+        for (const auto &f : bc_.functions)
+          byEntry.push_back(&f);
+        std::sort(byEntry.begin(), byEntry.end(), [](const FuncMeta *a, const FuncMeta *b) { return a->entry < b->entry; });
+        size_t fi = 0;
+        locals_.resize(ins_.size(), 0);
+        for (size_t i = 0; i < ins_.size(); ++i) {
+          while (fi + 1 < byEntry.size() && byEntry[fi + 1]->entry <= ins_[i].ip)
+            ++fi;
+          locals_[i] = byEntry.empty() ? 0 : byEntry[fi]->locals;
+        }
+      }
+
+      bool loadOf(size_t i, uint8_t &x) const {
+        Op op = ins_[i].op;
+        if (op >= OP_LD0 && op <= OP_LD3)
+          x = (uint8_t)(op - OP_LD0);
+        else if (op == OP_LOAD_LOCAL8)
+          x = bc_.code[ins_[i].ip + 1];
+        else
+          return false;
+        return x < locals_[i]; // out-of-range accesses keep their unfused behaviour
+      }
+      bool storeOf(size_t i, uint8_t &x) const {
+        Op op = ins_[i].op;
+        if (op >= OP_ST0 && op <= OP_ST3)
+          x = (uint8_t)(op - OP_ST0);
+        else if (op == OP_STORE_LOCAL8)
+          x = bc_.code[ins_[i].ip + 1];
+        else
+          return false;
+        return x < locals_[i];
+      }
+      // a store that pops (SETx), as the peephole pass leaves STx POP
+      bool setOf(size_t i, uint8_t &x) const {
+        Op op = ins_[i].op;
+        if (op >= OP_SET0 && op <= OP_SET3)
+          x = (uint8_t)(op - OP_SET0);
+        else if (op == OP_SET_LOCAL8)
+          x = bc_.code[ins_[i].ip + 1];
+        else
+          return false;
+        return x < locals_[i];
+      }
+      bool constOf(size_t i, long long &v) const {
+        Op op = ins_[i].op;
+        if (op == OP_PUSH_CONST)
+          v = bc_.consts[read_u32_at(bc_.code, ins_[i].ip + 1)];
+        else if (op == OP_PUSH_I8 || op == OP_PUSH_I32)
+          v = immediate_at(bc_.code, ins_[i].ip);
+        else
+          return false;
+        return true;
+      }
+      // Pool index of `v` for the fused opcodes, which take their constant from the pool;
+      // immediates are added to it on first use
+      uint32_t poolIndex(long long v) {
+        if (poolIndex_.empty())
+          for (uint32_t k = (uint32_t)bc_.consts.size(); k-- > 0;)
+            poolIndex_[bc_.consts[k]] = k;
+        auto [it, inserted] = poolIndex_.try_emplace(v, (uint32_t)bc_.consts.size());
+        if (inserted)
+          bc_.consts.push_back(v);
+        return it->second;
+      }
+      bool is(size_t i, Op op) const {
+        return ins_[i].op == op;
+      }
+
+      // `n` instructions from `i` form one straight-line run inside the function
+      bool window(size_t i, size_t n) const {
+        if (i + n > ins_.size())
+          return false;
+        for (size_t k = 1; k < n; ++k)
+          if (leader_[ins_[i + k].ip])
+            return false;
+        return true;
+      }
+      bool enabled(Op fused) const {
+        return (mask_ & superinstruction_bit(fused)) != 0;
+      }
+      // POP directly before RET is a no-op in the VM; a fused pop must not change that
+      bool popFollowedByRet(size_t i, size_t n) const {
+        return i + n < ins_.size() && ins_[i + n].op == OP_RET;
+      }
+
+      static void put_u32(std::vector<uint8_t> &out, uint32_t v) {
+        for (int b = 0; b < 4; ++b)
+          out.push_back((uint8_t)(v >> (b * 8)));
+      }
+      static void write_u32(std::vector<uint8_t> &out, uint32_t pos, uint32_t v) {
+        for (int b = 0; b < 4; ++b)
+          out[pos + b] = (uint8_t)(v >> (b * 8));
+      }
+
+      size_t tryFuse(size_t i, std::vector<uint8_t> &out) {
+        uint8_t x, y;
+        long long k;
+        // LDx PUSH_CONST ADD STx POP
+        if (enabled(OP_INC_LOCAL) && window(i, 5) && loadOf(i, x) && constOf(i + 1, k) && is(i + 2, OP_ADD) && storeOf(i + 3, y) && x == y &&
+            is(i + 4, OP_POP) && !popFollowedByRet(i, 5)) {
+          out.push_back(OP_INC_LOCAL);
+          out.push_back(x);
+          put_u32(out, poolIndex(k));
+          return 5;
+        }
+        // LDx PUSH_CONST ADD SETx
+        if (enabled(OP_INC_LOCAL) && window(i, 4) && loadOf(i, x) && constOf(i + 1, k) && is(i + 2, OP_ADD) && setOf(i + 3, y) && x == y) {
+          out.push_back(OP_INC_LOCAL);
+          out.push_back(x);
+          put_u32(out, poolIndex(k));
+          return 4;
+        }
+        // LDa LDb cmp JMP_IF_FALSE (a > b is emitted as b < a)
+        if (window(i, 4) && loadOf(i, x) && loadOf(i + 1, y) && is(i + 3, OP_JMP_IF_FALSE)) {
+          Op cmp     = ins_[i + 2].op;
+          bool swap  = cmp == OP_GT || cmp == OP_GE;
+          Op fused   = (cmp == OP_LT || cmp == OP_GT) ? OP_LL_LT_JF : OP_LL_LE_JF;
+          bool isCmp = cmp == OP_LT || cmp == OP_GT || cmp == OP_LE || cmp == OP_GE;
+          if (isCmp && enabled(fused)) {
+            out.push_back(fused);
+            out.push_back(swap ? y : x);
+            out.push_back(swap ? x : y);
+            put_u32(out, read_u32_at(bc_.code, ins_[i + 3].ip + 1));
+            return 4;
+          }
+        }
+        // LDa PUSH_CONST cmp JMP_IF_FALSE
+        if (window(i, 4) && loadOf(i, x) && constOf(i + 1, k) && is(i + 3, OP_JMP_IF_FALSE)) {
+          Op cmp   = ins_[i + 2].op;
+          Op fused = cmp == OP_LT ? OP_LK_LT_JF : cmp == OP_LE ? OP_LK_LE_JF : OP_HALT;
+          if (fused != OP_HALT && enabled(fused)) {
+            out.push_back(fused);
+            out.push_back(x);
+            put_u32(out, poolIndex(k));
+            put_u32(out, read_u32_at(bc_.code, ins_[i + 3].ip + 1));
+            return 4;
+          }
+        }
+        // LDa LDb ADD
+        if (enabled(OP_LL_ADD) && window(i, 3) && loadOf(i, x) && loadOf(i + 1, y) && is(i + 2, OP_ADD)) {
+          out.push_back(OP_LL_ADD);
+          out.push_back(x);
+          out.push_back(y);
+          return 3;
+        }
+        // LDa PUSH_CONST SUB
+        if (enabled(OP_LK_SUB) && window(i, 3) && loadOf(i, x) && constOf(i + 1, k) && is(i + 2, OP_SUB)) {
+          out.push_back(OP_LK_SUB);
+          out.push_back(x);
+          put_u32(out, poolIndex(k));
+          return 3;
+        }
+        // STx POP
+        if (enabled(OP_ST_POP) && window(i, 2) && storeOf(i, x) && is(i + 1, OP_POP) && !popFollowedByRet(i, 2)) {
+          out.push_back(OP_ST_POP);
+          out.push_back(x);
+          return 2;
+        }
+        return 0;
+      }
+
+      Bytecode &bc_;
+      uint32_t mask_;
+      std::unordered_map<long long, uint32_t> poolIndex_;
+      std::vector<Insn> ins_;
+      std::vector<bool> leader_;
+      std::vector<uint16_t> locals_;
+    };
+
+  } // namespace
+
+  uint32_t select_superinstructions(const OpSequenceProfile &profile, double minShare, unsigned maxCount) {
+    if (profile.total() == 0)
+      return 0;
+    std::vector<std::pair<uint64_t, Op>> ranked;
+    for (const auto &pat : patterns()) {
+      uint64_t n = score(profile, pat);
+      if (n > 0 && (double)n >= minShare * (double)profile.total())
+        ranked.push_back({n, pat.fused});
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+    uint32_t mask = 0;
+    for (size_t i = 0; i < ranked.size() && i < maxCount; ++i)
+      mask |= superinstruction_bit(ranked[i].second);
+    return mask;
+  }
+
+  void fuse_superinstructions(Bytecode &bc, uint32_t mask) {
+    mask &= kAllSuperinstructions;
+    if (mask == 0)
+      return;
+    if (bc.fused.mask != 0)
+      throw std::runtime_error("superinstructions: bytecode is already fused");
+    std::vector<uint8_t> code;
+    std::vector<uint32_t> ipMap;
+    Fuser(bc, mask).run(code, ipMap);
+    for (auto &f : bc.functions)
+      f.entry = ipMap[f.entry];
+    bc.code  = std::move(code);
+    bc.fused = FusedSet{kSuperinstructionVersion, mask};
+  }
+
+  std::string superinstruction_names(uint32_t mask) {
+    std::string out;
+    for (unsigned op = OP_ST_POP; op <= kLastOp; ++op) {
+      if (!(mask & superinstruction_bit((Op)op)))
+        continue;
+      if (!out.empty())
+        out += ",";
+      out += op_name((Op)op);
+    }
+    return out;
+  }
+
+  std::string format_sequence_profile(const OpSequenceProfile &profile, size_t topN) {
+    constexpr unsigned N = OpSequenceProfile::kOps;
+    std::vector<std::pair<uint64_t, uint32_t>> pairs, triples;
+    for (unsigned a = 0; a <= kLastOp; ++a)
+      for (unsigned b = 0; b <= kLastOp; ++b) {
+        if (uint64_t n = profile.pair(a, b))
+          pairs.push_back({n, a * N + b});
+        for (unsigned c = 0; c <= kLastOp; ++c)
+          if (uint64_t n = profile.triple(a, b, c))
+            triples.push_back({n, (a * N + b) * N + c});
+      }
+    auto top = [&](std::vector<std::pair<uint64_t, uint32_t>> &v, unsigned len, const char *title) {
+      std::sort(v.begin(), v.end(), [](const auto &x, const auto &y) { return x.first > y.first; });
+      std::string out = title;
+      out += "\n";
+      for (size_t i = 0; i < v.size() && i < topN; ++i) {
+        std::string seq;
+        uint32_t key = v[i].second;
+        for (unsigned k = 0; k < len; ++k) {
+          seq = std::string(op_name((Op)(key % N))) + (seq.empty() ? "" : " ") + seq;
+          key /= N;
+        }
+        out += "  " + std::to_string(v[i].first) + "  " + seq + "\n";
+      }
+      return out;
+    };
+    return top(pairs, 2, "pairs:") + top(triples, 3, "triples:");
+  }
+
+} // namespace mplx
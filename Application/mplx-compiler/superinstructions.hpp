@@ -0,0 +1,82 @@
+﻿#pragma once
+#include "bytecode.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mplx {
+
+  // Dynamic opcode n-gram counts gathered by the VM profiler (VM::setProfile). A pair or
+  // triple is counted in execution order, so sequences that span a taken jump or a call
+  // are included too; the generator only uses them as an estimate.
+  class OpSequenceProfile {
+  public:
+    static constexpr unsigned kOps = 64; // opcode space covered by the tables
+    static_assert(kLastOp < kOps, "opcode space outgrew the sequence profile");
+
+    void record(unsigned op) {
+      if (pairs_.empty()) {
+        pairs_.assign(kOps * kOps, 0);
+        triples_.assign(kOps * kOps * kOps, 0);
+      }
+      ++total_;
+      if (prev1_ < kOps) {
+        ++pairs_[prev1_ * kOps + op];
+        if (prev2_ < kOps)
+          ++triples_[(prev2_ * kOps + prev1_) * kOps + op];
+      }
+      prev2_ = prev1_;
+      prev1_ = op;
+    }
+    // Forget the previous opcodes (a new run does not continue the last one's sequence)
+    void breakSequence() { prev1_ = prev2_ = kOps; }
+    // Zero the counts but keep the tables
+    void reset() {
+      std::fill(pairs_.begin(), pairs_.end(), 0);
+      std::fill(triples_.begin(), triples_.end(), 0);
+      total_ = 0;
+      breakSequence();
+    }
+    void clear() {
+      pairs_.clear();
+      triples_.clear();
+      total_ = 0;
+      breakSequence();
+    }
+
+    uint64_t total() const { return total_; }
+    uint64_t pair(unsigned a, unsigned b) const { return pairs_.empty() ? 0 : pairs_[a * kOps + b]; }
+    uint64_t triple(unsigned a, unsigned b, unsigned c) const { return triples_.empty() ? 0 : triples_[(a * kOps + b) * kOps + c]; }
+
+  private:
+    std::vector<uint64_t> pairs_;
+    std::vector<uint64_t> triples_;
+    uint64_t total_{0};
+    unsigned prev1_{kOps};
+    unsigned prev2_{kOps};
+  };
+
+  // All superinstructions of kSuperinstructionVersion
+  constexpr uint32_t kAllSuperinstructions = (1u << (kLastOp - OP_ST_POP + 1)) - 1;
+
+  inline uint32_t superinstruction_bit(Op op) {
+    return 1u << (op - OP_ST_POP);
+  }
+
+  // Picks the superinstructions whose source sequence makes up at least `minShare` of the
+  // dispatched instructions in `profile`, most frequent first, at most `maxCount` of them.
+  uint32_t select_superinstructions(const OpSequenceProfile &profile, double minShare = 0.01, unsigned maxCount = 32);
+
+  // Rewrites `bc` in place, fusing every occurrence of the sequences enabled in `mask`
+  // that lies inside one basic block, and relocates jump targets and function entries.
+  // Throws std::runtime_error if `bc` is already fused.
+  void fuse_superinstructions(Bytecode &bc, uint32_t mask);
+
+  // Names of the superinstructions in `mask`, comma separated ("ST_POP,INC_LOCAL")
+  std::string superinstruction_names(uint32_t mask);
+
+  // The `topN` most frequent opcode pairs and triples, one per line
+  std::string format_sequence_profile(const OpSequenceProfile &profile, size_t topN = 10);
+
+} // namespace mplx
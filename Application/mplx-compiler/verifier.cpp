@@ -0,0 +1,199 @@
+#include "verifier.hpp"
+#include <algorithm>
+#include <numeric>
+
+namespace mplx {
+
+  namespace {
+
+    class Verifier {
+    public:
+      Verifier(const Bytecode &bc, uint32_t maxDepth) : bc_(bc), code_(bc.code), max_depth_(maxDepth) {}
+
+      std::vector<std::string> run() {
+        if (!decode())
+          return errors_;
+        std::vector<uint32_t> byEntry(bc_.functions.size());
+        std::iota(byEntry.begin(), byEntry.end(), 0u);
+        std::sort(byEntry.begin(), byEntry.end(), [&](uint32_t a, uint32_t b) { return bc_.functions[a].entry < bc_.functions[b].entry; });
+        for (size_t k = 0; k < byEntry.size(); ++k) {
+          uint32_t end = k + 1 < byEntry.size() ? bc_.functions[byEntry[k + 1]].entry : (uint32_t)code_.size();
+          function(byEntry[k], end);
+        }
+        return errors_;
+      }
+
+    private:
+      void error(uint32_t ip, const std::string &what) {
+        errors_.push_back("ip " + std::to_string(ip) + ": " + what);
+      }
+
+      // Marks instruction boundaries; stops at the first malformed instruction
+      bool decode() {
+        boundary_.assign(code_.size() + 1, false);
+        uint32_t ip = 0;
+        while (ip < code_.size()) {
+          Op op = (Op)code_[ip];
+          if (op > kLastOp) {
+            error(ip, "unknown opcode " + std::to_string((unsigned)op));
+            return false;
+          }
+          uint32_t next = ip + 1 + op_operand_size(op);
+          if (next > code_.size()) {
+            error(ip, "truncated instruction");
+            return false;
+          }
+          boundary_[ip] = true;
+          ip            = next;
+        }
+        if (bc_.fused.mask != 0 && bc_.fused.version != kSuperinstructionVersion)
+          errors_.push_back("unsupported superinstruction set version " + std::to_string(bc_.fused.version));
+        return true;
+      }
+
+      void local(uint32_t ip, uint32_t idx, const FuncMeta &fn) {
+        if (idx >= fn.locals)
+          error(ip, "local " + std::to_string(idx) + " out of range (" + fn.name + " has " + std::to_string(fn.locals) + ")");
+      }
+      void constant(uint32_t ip, uint32_t idx) {
+        if (idx >= bc_.consts.size())
+          error(ip, "constant index " + std::to_string(idx) + " out of range");
+      }
+
+      // Checks operands of the instruction at ip; false if the CALL target is invalid
+      bool operands(uint32_t ip, const FuncMeta &fn, uint32_t begin, uint32_t end) {
+        Op op = (Op)code_[ip];
+        switch (op) {
+        case OP_PUSH_CONST: constant(ip, read_u32_at(code_, ip + 1)); break;
+        case OP_LD0:
+        case OP_ST0:
+        case OP_SET0: local(ip, 0, fn); break;
+        case OP_LD1:
+        case OP_ST1:
+        case OP_SET1: local(ip, 1, fn); break;
+        case OP_LD2:
+        case OP_ST2:
+        case OP_SET2: local(ip, 2, fn); break;
+        case OP_LD3:
+        case OP_ST3:
+        case OP_SET3: local(ip, 3, fn); break;
+        case OP_LOAD_LOCAL8:
+        case OP_STORE_LOCAL8:
+        case OP_SET_LOCAL8:
+        case OP_ST_POP: local(ip, code_[ip + 1], fn); break;
+        case OP_LOAD_LOCAL:
+        case OP_STORE_LOCAL:
+        case OP_SET_LOCAL: local(ip, read_u32_at(code_, ip + 1), fn); break;
+        case OP_INC_LOCAL:
+        case OP_LK_SUB:
+        case OP_LK_LT_JF:
+        case OP_LK_LE_JF:
+          local(ip, code_[ip + 1], fn);
+          constant(ip, read_u32_at(code_, ip + 2));
+          break;
+        case OP_LL_ADD:
+        case OP_LL_LT_JF:
+        case OP_LL_LE_JF:
+          local(ip, code_[ip + 1], fn);
+          local(ip, code_[ip + 2], fn);
+          break;
+        case OP_CALL:
+        case OP_TAILCALL:
+          if (read_u32_at(code_, ip + 1) >= bc_.functions.size()) {
+            error(ip, "call to function index " + std::to_string(read_u32_at(code_, ip + 1)) + " out of range");
+            return false;
+          }
+          if (op == OP_TAILCALL && (ip + 5 >= end || code_[ip + 5] != OP_RET)) {
+            error(ip, "TAILCALL not followed by RET");
+            return false;
+          }
+          break;
+        default: break;
+        }
+        if (op_is_jump(op)) {
+          uint32_t t = jump_target_at(code_, ip);
+          if (t < begin || t >= end || !boundary_[t]) {
+            error(ip, "jump target " + std::to_string(t) + " is not an instruction of " + fn.name);
+            return false;
+          }
+        }
+        return true;
+      }
+
+      // Walks every path of the function, propagating the operand stack depth
+      void function(uint32_t f, uint32_t end) {
+        const FuncMeta &fn = bc_.functions[f];
+        const uint32_t begin = fn.entry;
+        if (begin >= code_.size() || !boundary_[begin]) {
+          errors_.push_back("function " + fn.name + ": entry " + std::to_string(begin) + " is not an instruction");
+          return;
+        }
+        // functions are visited by entry, so an empty range means the next one starts here too
+        if (end == begin) {
+          errors_.push_back("function " + fn.name + ": entry " + std::to_string(begin) + " is shared with another function");
+          return;
+        }
+        if (fn.arity > fn.locals) {
+          errors_.push_back("function " + fn.name + ": arity exceeds locals");
+          return;
+        }
+        std::vector<int32_t> depth(end - begin, -1);
+        std::vector<uint32_t> work{begin};
+        depth[0] = 0;
+        auto flow = [&](uint32_t from, uint32_t to, int32_t d) {
+          if (to >= end) {
+            error(from, "falls off the end of " + fn.name);
+            return;
+          }
+          int32_t &slot = depth[to - begin];
+          if (slot < 0) {
+            slot = d;
+            work.push_back(to);
+          } else if (slot != d) {
+            error(to, "stack depth " + std::to_string(d) + " from ip " + std::to_string(from) + " differs from " + std::to_string(slot));
+          }
+        };
+        while (!work.empty()) {
+          uint32_t ip = work.back();
+          work.pop_back();
+          Op op = (Op)code_[ip];
+          if (!operands(ip, fn, begin, end))
+            continue;
+          uint32_t next       = ip + 1 + op_operand_size(op);
+          uint32_t calleeArgs = op == OP_CALL || op == OP_TAILCALL ? bc_.functions[read_u32_at(code_, ip + 1)].arity : 0;
+          StackEffect e       = op_stack_effect(op, calleeArgs);
+          if (op == OP_POP && next < code_.size() && code_[next] == OP_RET)
+            e.pops = 0; // the interpreter leaves the value for the RET
+          int32_t d           = depth[ip - begin];
+          if ((uint32_t)d < e.pops) {
+            error(ip, std::string(op_name(op)) + " pops " + std::to_string(e.pops) + " with stack depth " + std::to_string(d));
+            continue;
+          }
+          d = d - (int32_t)e.pops + (int32_t)e.pushes;
+          if ((uint32_t)d > max_depth_) {
+            error(ip, "stack depth exceeds " + std::to_string(max_depth_));
+            continue;
+          }
+          if (op == OP_RET || op == OP_HALT)
+            continue;
+          if (op_is_jump(op))
+            flow(ip, jump_target_at(code_, ip), d);
+          if (op != OP_JMP)
+            flow(ip, next, d);
+        }
+      }
+
+      const Bytecode &bc_;
+      const std::vector<uint8_t> &code_;
+      uint32_t max_depth_;
+      std::vector<bool> boundary_;
+      std::vector<std::string> errors_;
+    };
+
+  } // namespace
+
+  std::vector<std::string> verify_bytecode(const Bytecode &bc, uint32_t maxStackDepth) {
+    return Verifier(bc, maxStackDepth).run();
+  }
+
+} // namespace mplx
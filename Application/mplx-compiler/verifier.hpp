@@ -0,0 +1,20 @@
+#pragma once
+#include "bytecode.hpp"
+#include <string>
+#include <vector>
+
+namespace mplx {
+
+  // Static checks over a whole module. Code that passes can run without the interpreter's
+  // dynamic checks (VM uses its unchecked core for it):
+  //  - every instruction is a known opcode with its full operand, function entries are
+  //    distinct, and entries and jump targets fall on instruction boundaries inside the
+  //    owning function
+  //  - constant, function and local indices are in range (locals below FuncMeta::locals)
+  //  - the operand stack depth is the same on every path to an instruction, never drops
+  //    below the frame's locals, never exceeds `maxStackDepth`, and no path falls off the
+  //    end of a function without RET
+  // Returns one message per problem found; empty means verified.
+  std::vector<std::string> verify_bytecode(const Bytecode &bc, uint32_t maxStackDepth);
+
+} // namespace mplx
@@ -0,0 +1,134 @@
+#include "work_pool.hpp"
+#include <algorithm>
+
+namespace mplx {
+
+  WorkStealingPool::WorkStealingPool(unsigned threads) {
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; ++i)
+      queues_.push_back(std::make_unique<Queue>());
+    workers_.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i)
+      workers_.emplace_back([this, i] { workerLoop(i); });
+  }
+
+  WorkStealingPool::~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto &t : workers_)
+      t.join();
+  }
+
+  void WorkStealingPool::parallelFor(size_t n, size_t grain, const Body &body) {
+    if (n == 0)
+      return;
+    {
+      std::unique_lock<std::mutex> lk(m_);
+      // a worker may still be leaving the previous job
+      done_cv_.wait(lk, [&] { return active_ == 0; });
+      body_  = &body;
+      grain_ = std::max<size_t>(grain, 1);
+      failed_.store(false);
+      error_ = nullptr;
+      // one contiguous share per worker; stealing rebalances uneven work
+      const size_t share = (n + size() - 1) / size();
+      for (unsigned i = 0; i < size(); ++i) {
+        size_t b = std::min(n, i * share), e = std::min(n, b + share);
+        if (b < e) {
+          std::lock_guard<std::mutex> qlk(queues_[i]->m);
+          queues_[i]->ranges.push_back(Range{b, e});
+        }
+      }
+      remaining_.store(n);
+      ++generation_;
+    }
+    start_cv_.notify_all();
+    std::exception_ptr error;
+    {
+      std::unique_lock<std::mutex> lk(m_);
+      done_cv_.wait(lk, [&] { return remaining_.load() == 0 && active_ == 0; });
+      body_ = nullptr;
+      error = error_;
+      error_ = nullptr;
+    }
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  void WorkStealingPool::workerLoop(unsigned id) {
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lk(m_);
+        start_cv_.wait(lk, [&] { return stop_ || generation_ != seen; });
+        if (stop_)
+          return;
+        seen = generation_;
+        ++active_;
+      }
+      drain(id);
+      {
+        std::lock_guard<std::mutex> lk(m_);
+        --active_;
+      }
+      done_cv_.notify_all();
+    }
+  }
+
+  void WorkStealingPool::drain(unsigned id) {
+    Range r;
+    while (remaining_.load(std::memory_order_acquire) != 0) {
+      if (!popLocal(id, r) && !steal(id, r)) {
+        std::this_thread::yield();
+        continue;
+      }
+      while (r.end - r.begin > grain_) {
+        size_t mid = r.begin + (r.end - r.begin) / 2;
+        {
+          std::lock_guard<std::mutex> lk(queues_[id]->m);
+          queues_[id]->ranges.push_back(Range{mid, r.end});
+        }
+        r.end = mid;
+      }
+      if (!failed_.load(std::memory_order_relaxed)) {
+        try {
+          (*body_)(id, r.begin, r.end);
+        } catch (...) {
+          std::lock_guard<std::mutex> lk(m_);
+          if (!error_)
+            error_ = std::current_exception();
+          failed_.store(true);
+        }
+      }
+      remaining_.fetch_sub(r.end - r.begin, std::memory_order_acq_rel);
+    }
+  }
+
+  bool WorkStealingPool::popLocal(unsigned id, Range &r) {
+    Queue &q = *queues_[id];
+    std::lock_guard<std::mutex> lk(q.m);
+    if (q.ranges.empty())
+      return false;
+    r = q.ranges.back();
+    q.ranges.pop_back();
+    return true;
+  }
+
+  bool WorkStealingPool::steal(unsigned id, Range &r) {
+    for (unsigned k = 1; k < size(); ++k) {
+      Queue &q = *queues_[(id + k) % size()];
+      std::lock_guard<std::mutex> lk(q.m);
+      if (!q.ranges.empty()) {
+        r = q.ranges.front();
+        q.ranges.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+} // namespace mplx
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mplx {
+
+  // Fixed set of worker threads running index ranges. Each worker owns a deque of ranges:
+  // it splits its current range in halves, keeps working on the lower half and pushes the
+  // upper one to the back of its deque; an idle worker steals from the front of another
+  // worker's deque, which holds the largest pending ranges.
+  class WorkStealingPool {
+  public:
+    // threads == 0: one per hardware thread
+    explicit WorkStealingPool(unsigned threads = 0);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool &)            = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    unsigned size() const { return (unsigned)workers_.size(); }
+
+    // Calls body(worker, begin, end) on disjoint ranges of at most `grain` indices that
+    // cover [0, n), and blocks until all of them ran. If a call throws, the remaining
+    // ranges are skipped and the first exception is rethrown here.
+    using Body = std::function<void(unsigned, size_t, size_t)>;
+    void parallelFor(size_t n, size_t grain, const Body &body);
+
+  private:
+    struct Range {
+      size_t begin;
+      size_t end;
+    };
+    struct Queue {
+      std::mutex m;
+      std::deque<Range> ranges;
+    };
+
+    void workerLoop(unsigned id);
+    void drain(unsigned id);
+    bool popLocal(unsigned id, Range &r);
+    bool steal(unsigned id, Range &r);
+
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::mutex m_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    uint64_t generation_{0};
+    unsigned active_{0};
+    bool stop_{false};
+    const Body *body_{nullptr};
+    size_t grain_{1};
+    std::atomic<size_t> remaining_{0};
+    std::atomic<bool> failed_{false};
+    std::exception_ptr error_;
+  };
+
+} // namespace mplx
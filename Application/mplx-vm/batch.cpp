@@ -0,0 +1,42 @@
+#include "batch.hpp"
+#include <algorithm>
+
+namespace mplx {
+
+  BatchRunner::BatchRunner(const Bytecode &bc, unsigned threads) : bc_(bc), pool_(threads) {
+    vms_.reserve(pool_.size());
+    for (unsigned i = 0; i < pool_.size(); ++i) {
+      vms_.push_back(std::make_unique<VM>(bc_));
+#if defined(MPLX_WITH_JIT)
+      vms_.back()->setJitMode(VM::JitMode::Off);
+#endif
+    }
+  }
+
+  void BatchRunner::setStackSize(size_t slots) {
+    for (auto &vm : vms_)
+      vm->setStackSize(slots);
+  }
+
+  void BatchRunner::run(uint32_t fnIndex, const long long *args, size_t count, long long *results) {
+    if (fnIndex >= bc_.functions.size())
+      throw std::runtime_error("function index out of bounds");
+    const size_t arity = bc_.functions[fnIndex].arity;
+    // a few ranges per worker by default: enough to steal, few enough to stay cheap
+    size_t grain = grain_ ? grain_ : std::max<size_t>(1, count / (size_t(pool_.size()) * 16));
+    pool_.parallelFor(count, grain, [&](unsigned worker, size_t begin, size_t end) {
+      VM &vm = *vms_[worker];
+      vm.reset();
+      for (size_t i = begin; i < end; ++i)
+        results[i] = vm.call(fnIndex, args + i * arity, arity);
+    });
+  }
+
+  void BatchRunner::run(const std::string &fn, const long long *args, size_t count, long long *results) {
+    uint32_t fnIndex = 0;
+    if (!find_function(bc_, fn, fnIndex))
+      throw std::runtime_error("entry function not found");
+    run(fnIndex, args, count, results);
+  }
+
+} // namespace mplx
@@ -0,0 +1,35 @@
+#pragma once
+#include "vm.hpp"
+#include "work_pool.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mplx {
+
+  // Runs one function of a module over many independent argument tuples. Every worker
+  // has its own VM; all of them share the (read-only) Bytecode, which must outlive the
+  // runner.
+  class BatchRunner {
+  public:
+    explicit BatchRunner(const Bytecode &bc, unsigned threads = 0);
+
+    // args holds count * arity values, one tuple after another; results[i] receives the
+    // return value for tuple i. Throws std::runtime_error on the first failing call.
+    void run(uint32_t fnIndex, const long long *args, size_t count, long long *results);
+    void run(const std::string &fn, const long long *args, size_t count, long long *results);
+
+    unsigned threads() const { return pool_.size(); }
+    // Tuples per scheduled range (0 = pick from count and thread count)
+    void setGrain(size_t grain) { grain_ = grain; }
+    // Value stack size of every worker VM (see VM::setStackSize)
+    void setStackSize(size_t slots);
+
+  private:
+    const Bytecode &bc_;
+    WorkStealingPool pool_;
+    std::vector<std::unique_ptr<VM>> vms_; // one per worker
+    size_t grain_{0};
+  };
+
+} // namespace mplx
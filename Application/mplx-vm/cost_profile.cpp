@@ -0,0 +1,131 @@
+#include "cost_profile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+namespace mplx {
+
+  void CostProfile::attach(const Bytecode &bc, const std::vector<uint32_t> &recordPc) {
+    if (bc_ == &bc && record_pc_.size() == recordPc.size())
+      return;
+    bc_        = &bc;
+    record_pc_ = recordPc;
+    // owner of each record: the function with the closest entry at or below it
+    std::vector<uint32_t> byEntry(bc.functions.size());
+    std::iota(byEntry.begin(), byEntry.end(), 0u);
+    std::sort(byEntry.begin(), byEntry.end(), [&](uint32_t a, uint32_t b) { return bc.functions[a].entry < bc.functions[b].entry; });
+    record_fn_.assign(recordPc.size(), UINT32_MAX);
+    size_t k = 0;
+    for (size_t i = 0; i < recordPc.size(); ++i) {
+      while (k < byEntry.size() && bc.functions[byEntry[k]].entry <= recordPc[i])
+        ++k;
+      if (k > 0)
+        record_fn_[i] = byEntry[k - 1];
+    }
+    clear();
+  }
+
+  void CostProfile::clear() {
+    const size_t nfn = bc_ ? bc_->functions.size() : 0;
+    insns_.assign(record_pc_.size(), 0);
+    calls_.assign(nfn, 0);
+    self_ns_.assign(nfn, 0);
+    total_ns_.assign(nfn, 0);
+    seen_.assign(nfn, 0);
+    stacks_.clear();
+    sample_id_ = 0;
+    samples_   = 0;
+  }
+
+  void CostProfile::startSampler(uint32_t intervalUs) {
+    if (sampler_users_++ != 0)
+      return;
+    last_sample_ = std::chrono::steady_clock::now();
+    timer_stop_  = false;
+    const auto interval = std::chrono::microseconds(std::max<uint32_t>(intervalUs, 1));
+    timer_ = std::thread([this, interval] {
+      std::unique_lock<std::mutex> lk(timer_m_);
+      while (!timer_cv_.wait_for(lk, interval, [this] { return timer_stop_; }))
+        due_.store(true, std::memory_order_relaxed);
+    });
+  }
+
+  void CostProfile::stopSampler() {
+    if (sampler_users_ == 0 || --sampler_users_ != 0)
+      return;
+    {
+      std::lock_guard<std::mutex> lk(timer_m_);
+      timer_stop_ = true;
+    }
+    timer_cv_.notify_all();
+    timer_.join();
+    due_.store(false, std::memory_order_relaxed);
+  }
+
+  std::string CostProfile::report(size_t topN) const {
+    if (!bc_)
+      return "profile: nothing recorded\n";
+    const size_t nfn = bc_->functions.size();
+    std::vector<uint64_t> fnInsns(nfn, 0);
+    uint64_t totalInsns = 0;
+    for (size_t i = 0; i < insns_.size(); ++i) {
+      totalInsns += insns_[i];
+      if (record_fn_[i] != UINT32_MAX)
+        fnInsns[record_fn_[i]] += insns_[i];
+    }
+    uint64_t sampledNs = std::accumulate(self_ns_.begin(), self_ns_.end(), uint64_t(0));
+
+    std::string out;
+    char line[256];
+    std::snprintf(line, sizeof line, "profile: %llu instructions, %llu samples, %.3f ms sampled\n",
+                  (unsigned long long)totalInsns, (unsigned long long)samples_, sampledNs / 1e6);
+    out += line;
+    out += "  self%    self ms   total ms        calls         instrs  function\n";
+    std::vector<uint32_t> fns(nfn);
+    std::iota(fns.begin(), fns.end(), 0u);
+    std::sort(fns.begin(), fns.end(), [&](uint32_t a, uint32_t b) {
+      return self_ns_[a] != self_ns_[b] ? self_ns_[a] > self_ns_[b] : fnInsns[a] > fnInsns[b];
+    });
+    for (uint32_t f : fns) {
+      if (calls_[f] == 0 && fnInsns[f] == 0)
+        continue;
+      std::snprintf(line, sizeof line, "%6.2f %10.3f %10.3f %12llu %14llu  %s\n",
+                    sampledNs ? 100.0 * self_ns_[f] / sampledNs : 0.0, self_ns_[f] / 1e6, total_ns_[f] / 1e6,
+                    (unsigned long long)calls_[f], (unsigned long long)fnInsns[f], bc_->functions[f].name.c_str());
+      out += line;
+    }
+
+    std::vector<uint32_t> recs;
+    for (uint32_t i = 0; i < insns_.size(); ++i)
+      if (insns_[i] != 0)
+        recs.push_back(i);
+    std::sort(recs.begin(), recs.end(), [&](uint32_t a, uint32_t b) { return insns_[a] > insns_[b]; });
+    if (recs.size() > topN)
+      recs.resize(topN);
+    out += "     pc          count  instr%  op            function\n";
+    for (uint32_t r : recs) {
+      const uint32_t pc = record_pc_[r];
+      const char *fn    = record_fn_[r] != UINT32_MAX ? bc_->functions[record_fn_[r]].name.c_str() : "?";
+      std::snprintf(line, sizeof line, "%7u %14llu %7.2f  %-13s %s\n", pc, (unsigned long long)insns_[r],
+                    totalInsns ? 100.0 * insns_[r] / totalInsns : 0.0, pc < bc_->code.size() ? op_name((Op)bc_->code[pc]) : "HALT", fn);
+      out += line;
+    }
+    return out;
+  }
+
+  std::string CostProfile::collapsedStacks() const {
+    std::string out;
+    for (const auto &[stack, count] : stacks_) {
+      for (size_t i = 0; i < stack.size(); ++i) {
+        if (i)
+          out += ';';
+        out += bc_->functions[stack[i]].name;
+      }
+      out += ' ';
+      out += std::to_string(count);
+      out += '\n';
+    }
+    return out;
+  }
+
+} // namespace mplx
@@ -0,0 +1,88 @@
+#pragma once
+#include "../mplx-compiler/bytecode.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mplx {
+
+  // Cost profile gathered by VM::setCostProfile: exact instruction counts per decoded
+  // record and call counts per function, plus self/total time from periodic stack
+  // samples. A timer thread raises a flag every interval; the interpreter takes the
+  // sample at the next instruction, so samples carry no safepoint bias.
+  class CostProfile {
+  public:
+    ~CostProfile() { stopSampler(); }
+
+    // Sizes the tables for a module; recordPc[i] is the byte offset of decoded record i.
+    // Counts are kept while the module stays the same.
+    void attach(const Bytecode &bc, const std::vector<uint32_t> &recordPc);
+    void clear();
+
+    void countInsn(uint32_t record) { ++insns_[record]; }
+    void countCall(uint32_t fn) { ++calls_[fn]; }
+    bool sampleDue() const { return due_.load(std::memory_order_relaxed); }
+    // Records one sample for the call stack `frames` (anything with a `fn` member)
+    template <typename Frames>
+    void sample(const Frames &frames) {
+      due_.store(false, std::memory_order_relaxed);
+      auto now    = std::chrono::steady_clock::now();
+      uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_sample_).count();
+      last_sample_ = now;
+      if (frames.empty())
+        return;
+      ++sample_id_;
+      stack_.clear();
+      for (const auto &f : frames) {
+        stack_.push_back(f.fn);
+        // total time counts a function once per sample, however deep it recurses
+        if (seen_[f.fn] != sample_id_) {
+          seen_[f.fn] = sample_id_;
+          total_ns_[f.fn] += ns;
+        }
+      }
+      self_ns_[frames.back().fn] += ns;
+      ++stacks_[stack_];
+      ++samples_;
+    }
+
+    // Starts/stops the timer thread; nested starts are counted
+    void startSampler(uint32_t intervalUs);
+    void stopSampler();
+
+    uint64_t samples() const { return samples_; }
+    // Per-function table (by self time) and the `topN` hottest instructions
+    std::string report(size_t topN = 20) const;
+    // One line per sampled call stack, "main;fib;fib 42", for flamegraph.pl/speedscope
+    std::string collapsedStacks() const;
+
+  private:
+    const Bytecode *bc_{nullptr};
+    std::vector<uint32_t> record_pc_;
+    std::vector<uint32_t> record_fn_;
+    std::vector<uint64_t> insns_;
+    std::vector<uint64_t> calls_;
+    std::vector<uint64_t> self_ns_;
+    std::vector<uint64_t> total_ns_;
+    std::vector<uint64_t> seen_;
+    std::vector<uint32_t> stack_;
+    std::map<std::vector<uint32_t>, uint64_t> stacks_;
+    uint64_t sample_id_{0};
+    uint64_t samples_{0};
+    std::chrono::steady_clock::time_point last_sample_{};
+
+    std::atomic<bool> due_{false};
+    std::thread timer_;
+    std::mutex timer_m_;
+    std::condition_variable timer_cv_;
+    bool timer_stop_{false};
+    unsigned sampler_users_{0};
+  };
+
+} // namespace mplx
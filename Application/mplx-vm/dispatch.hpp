@@ -0,0 +1,54 @@
+#pragma once
+// Internal to mplx-vm: instruction-dispatch scaffolding shared by the interpreters.
+//
+// With MPLX_VM_COMPUTED_GOTO on GCC/Clang every handler ends in its own indirect jump
+// through a label table (threaded code), so the branch predictor gets one dispatch site
+// per opcode instead of a single shared `switch`. Other compilers, or builds with the
+// option off, use the portable switch loop.
+//
+// Before VM_LOOP_BEGIN() an interpreter defines:
+//   VM_FETCH()   - load the next opcode into `op` and advance the instruction pointer
+//   VM_HOOK()    - per-instruction policy hook (may expand to nothing)
+//   VM_LABELS    - &&L_<opcode> for every opcode, in enum order
+//   VM_LAST_OP   - highest valid opcode
+#include <stdexcept>
+
+#if defined(MPLX_VM_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+#define MPLX_VM_THREADED 1
+#else
+#define MPLX_VM_THREADED 0
+#endif
+
+#if MPLX_VM_THREADED
+#define VM_CASE(name) L_##name:
+#define VM_NEXT()                                                                                   \
+  do {                                                                                             \
+    VM_FETCH();                                                                                    \
+    VM_HOOK();                                                                                     \
+    if (__builtin_expect(op > VM_LAST_OP, 0))                                                      \
+      goto L_BAD_OPCODE;                                                                           \
+    goto *kDispatch[op];                                                                           \
+  } while (0)
+#define VM_LOOP_BEGIN()                                                                             \
+  static const void *const kDispatch[] = {VM_LABELS};                                               \
+  static_assert(sizeof(kDispatch) / sizeof(kDispatch[0]) == VM_LAST_OP + 1, "dispatch table size"); \
+  unsigned op;                                                                                     \
+  VM_NEXT();
+#define VM_LOOP_END()                                                                               \
+  L_BAD_OPCODE:                                                                                    \
+  throw std::runtime_error("unknown opcode");
+#else
+#define VM_CASE(name) case name:
+#define VM_NEXT() break
+#define VM_LOOP_BEGIN()                                                                             \
+  while (true) {                                                                                   \
+    unsigned op;                                                                                   \
+    VM_FETCH();                                                                                    \
+    VM_HOOK();                                                                                     \
+    switch (op) {
+#define VM_LOOP_END()                                                                               \
+  default:                                                                                         \
+    throw std::runtime_error("unknown opcode");                                                    \
+    }                                                                                              \
+    }
+#endif
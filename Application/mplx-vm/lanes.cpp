@@ -0,0 +1,382 @@
+#include "lanes.hpp"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace mplx {
+
+  namespace {
+    constexpr unsigned W     = LaneRunner::kLanes;
+    constexpr uint32_t kAll  = (1u << W) - 1;
+    constexpr uint32_t kNone = UINT32_MAX;
+
+    // Wrapping arithmetic: lanes outside the mask compute on stale values, which must not
+    // be undefined behaviour
+    inline long long wrap_add(long long a, long long b) { return (long long)((unsigned long long)a + (unsigned long long)b); }
+    inline long long wrap_sub(long long a, long long b) { return (long long)((unsigned long long)a - (unsigned long long)b); }
+    inline long long wrap_mul(long long a, long long b) { return (long long)((unsigned long long)a * (unsigned long long)b); }
+
+    // Row kernels over W lanes of 64-byte aligned rows. Built with AVX2 (MPLX_VM_AVX2) a row
+    // is two 256-bit registers; otherwise they are plain fixed-width loops, left to the
+    // compiler's auto-vectorizer.
+    template <typename F>
+    inline void map(long long *r, const long long *a, const long long *b, F f) {
+      for (unsigned l = 0; l < W; ++l)
+        r[l] = f(a[l], b[l]);
+    }
+
+#if defined(__AVX2__)
+    inline __m256i load(const long long *p) { return _mm256_load_si256((const __m256i *)p); }
+    inline void store(long long *p, __m256i v) { _mm256_store_si256((__m256i *)p, v); }
+
+    template <typename F>
+    inline void map256(long long *r, const long long *a, const long long *b, F f) {
+      store(r, f(load(a), load(b)));
+      store(r + 4, f(load(a + 4), load(b + 4)));
+    }
+    // 1 where the mask lane is all ones, 0 where it is zero
+    inline __m256i bit(__m256i m) { return _mm256_srli_epi64(m, 63); }
+    inline __m256i notBit(__m256i m) { return _mm256_srli_epi64(_mm256_xor_si256(m, _mm256_set1_epi64x(-1)), 63); }
+#endif
+
+    // r = a op b, comparisons and AND/OR giving 0 or 1
+    inline void binary(Op op, long long *r, const long long *a, const long long *b) {
+#if defined(__AVX2__)
+      const __m256i z = _mm256_setzero_si256();
+      switch (op) {
+      case OP_ADD: map256(r, a, b, [](__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }); return;
+      case OP_SUB: map256(r, a, b, [](__m256i x, __m256i y) { return _mm256_sub_epi64(x, y); }); return;
+      case OP_EQ: map256(r, a, b, [](__m256i x, __m256i y) { return bit(_mm256_cmpeq_epi64(x, y)); }); return;
+      case OP_NE: map256(r, a, b, [](__m256i x, __m256i y) { return notBit(_mm256_cmpeq_epi64(x, y)); }); return;
+      case OP_LT: map256(r, a, b, [](__m256i x, __m256i y) { return bit(_mm256_cmpgt_epi64(y, x)); }); return;
+      case OP_LE: map256(r, a, b, [](__m256i x, __m256i y) { return notBit(_mm256_cmpgt_epi64(x, y)); }); return;
+      case OP_GT: map256(r, a, b, [](__m256i x, __m256i y) { return bit(_mm256_cmpgt_epi64(x, y)); }); return;
+      case OP_GE: map256(r, a, b, [](__m256i x, __m256i y) { return notBit(_mm256_cmpgt_epi64(y, x)); }); return;
+      case OP_AND:
+        map256(r, a, b, [&](__m256i x, __m256i y) { return notBit(_mm256_or_si256(_mm256_cmpeq_epi64(x, z), _mm256_cmpeq_epi64(y, z))); });
+        return;
+      case OP_OR:
+        map256(r, a, b, [&](__m256i x, __m256i y) { return notBit(_mm256_and_si256(_mm256_cmpeq_epi64(x, z), _mm256_cmpeq_epi64(y, z))); });
+        return;
+      default: break;
+      }
+#endif
+      switch (op) {
+      case OP_ADD: map(r, a, b, wrap_add); return;
+      case OP_SUB: map(r, a, b, wrap_sub); return;
+      case OP_MUL: map(r, a, b, wrap_mul); return;
+      case OP_EQ: map(r, a, b, [](long long x, long long y) { return (long long)(x == y); }); return;
+      case OP_NE: map(r, a, b, [](long long x, long long y) { return (long long)(x != y); }); return;
+      case OP_LT: map(r, a, b, [](long long x, long long y) { return (long long)(x < y); }); return;
+      case OP_LE: map(r, a, b, [](long long x, long long y) { return (long long)(x <= y); }); return;
+      case OP_GT: map(r, a, b, [](long long x, long long y) { return (long long)(x > y); }); return;
+      case OP_GE: map(r, a, b, [](long long x, long long y) { return (long long)(x >= y); }); return;
+      case OP_AND: map(r, a, b, [](long long x, long long y) { return (long long)((x != 0) & (y != 0)); }); return;
+      case OP_OR: map(r, a, b, [](long long x, long long y) { return (long long)((x != 0) | (y != 0)); }); return;
+      default: throw std::runtime_error("opcode not supported on lanes");
+      }
+    }
+
+    inline void splat(long long *r, long long k) {
+#if defined(__AVX2__)
+      store(r, _mm256_set1_epi64x(k));
+      store(r + 4, _mm256_set1_epi64x(k));
+#else
+      std::fill(r, r + W, k);
+#endif
+    }
+
+    // dst = m ? r : dst per lane, m holding -1 or 0
+    inline void blend(long long *dst, const long long *r, const long long *m) {
+#if defined(__AVX2__)
+      store(dst, _mm256_blendv_epi8(load(dst), load(r), load(m)));
+      store(dst + 4, _mm256_blendv_epi8(load(dst + 4), load(r + 4), load(m + 4)));
+#else
+      for (unsigned l = 0; l < W; ++l)
+        dst[l] = (r[l] & m[l]) | (dst[l] & ~m[l]);
+#endif
+    }
+
+    // Bit l set where lane l is not 0
+    inline uint32_t nonzero(const long long *a) {
+#if defined(__AVX2__)
+      const __m256i z = _mm256_setzero_si256();
+      uint32_t lo     = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(load(a), z)));
+      uint32_t hi     = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(load(a + 4), z)));
+      return ~(lo | hi << 4) & kAll;
+#else
+      uint32_t bits = 0;
+      for (unsigned l = 0; l < W; ++l)
+        bits |= (uint32_t)(a[l] != 0) << l;
+      return bits;
+#endif
+    }
+  } // namespace
+
+  LaneRunner::LaneRunner(const Bytecode &bc) : bc_(bc), scalar_(bc) {
+#if defined(MPLX_WITH_JIT)
+    scalar_.setJitMode(VM::JitMode::Off);
+#endif
+    lanes_ok_.assign(bc_.functions.size(), false);
+    // lanes rely on the verifier: equal stack depth at equal pc, jumps inside the function,
+    // locals in range and at most VM::kStackHeadroom operands
+    if (!scalar_.isVerified())
+      return;
+    const auto &code = scalar_.decodedCode();
+    std::vector<uint32_t> order(bc_.functions.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return scalar_.decodedEntry(a) < scalar_.decodedEntry(b); });
+    for (size_t k = 0; k < order.size(); ++k) {
+      uint32_t begin = scalar_.decodedEntry(order[k]);
+      uint32_t end   = k + 1 < order.size() ? scalar_.decodedEntry(order[k + 1]) : (uint32_t)code.size();
+      bool ok        = true;
+      for (uint32_t i = begin; i < end && ok; ++i)
+        ok = code[i].op != OP_CALL && code[i].op != OP_TAILCALL;
+      lanes_ok_[order[k]] = ok;
+    }
+  }
+
+  void LaneRunner::run(const std::string &fn, const long long *args, size_t count, long long *results) {
+    uint32_t fnIndex = 0;
+    if (!find_function(bc_, fn, fnIndex))
+      throw std::runtime_error("entry function not found");
+    run(fnIndex, args, count, results);
+  }
+
+  void LaneRunner::run(uint32_t fnIndex, const long long *args, size_t count, long long *results) {
+    if (fnIndex >= bc_.functions.size())
+      throw std::runtime_error("function index out of bounds");
+    const FuncMeta &fn = bc_.functions[fnIndex];
+    if (!lanes_ok_[fnIndex]) {
+      scalar_.reset();
+      for (size_t i = 0; i < count; ++i)
+        results[i] = scalar_.call(fnIndex, args + i * fn.arity, fn.arity);
+      return;
+    }
+    stack_.resize(std::max(stack_.size(), size_t(fn.locals) + VM::kStackHeadroom));
+    long long out[W];
+    for (size_t i = 0; i < count; i += W) {
+      // a short last group repeats its first tuple in the unused lanes
+      const size_t n = std::min<size_t>(W, count - i);
+      for (uint32_t p = 0; p < fn.arity; ++p)
+        for (unsigned l = 0; l < W; ++l)
+          stack_[p].v[l] = args[(i + (l < n ? l : 0)) * fn.arity + p];
+      for (uint32_t p = fn.arity; p < fn.locals; ++p)
+        std::fill(std::begin(stack_[p].v), std::end(stack_[p].v), 0);
+      runGroup(fnIndex, out);
+      std::copy(out, out + n, results + i);
+    }
+  }
+
+  void LaneRunner::runGroup(uint32_t fnIndex, long long *out) {
+    const DecodedInsn *code = scalar_.decodedCode().data();
+    Row *s                  = stack_.data();
+    // the running group: lanes in `mask`, all at `pc` with `sp` operands; lanes outside
+    // it wait in lpc/lsp, the lowest of them at minOther
+    uint32_t pc       = scalar_.decodedEntry(fnIndex);
+    uint32_t sp       = bc_.functions[fnIndex].locals;
+    uint32_t mask     = kAll;
+    uint32_t done     = 0;
+    uint32_t minOther = kNone;
+    uint32_t lpc[W], lsp[W];
+    Row lm; // -1 in the lanes of mask, 0 elsewhere
+    std::fill(std::begin(lm.v), std::end(lm.v), -1);
+
+    auto setMask = [&](uint32_t m) {
+      mask = m;
+      for (unsigned l = 0; l < W; ++l)
+        lm.v[l] = -(long long)((m >> l) & 1);
+    };
+    auto park = [&](uint32_t lanes, uint32_t at, uint32_t depth) {
+      for (unsigned l = 0; l < W; ++l)
+        if ((lanes >> l) & 1) {
+          lpc[l] = at;
+          lsp[l] = depth;
+        }
+    };
+    // Picks the lanes with the lowest pc as the next group; false once every lane returned
+    auto schedule = [&]() {
+      const uint32_t live = kAll & ~done;
+      if (live == 0)
+        return false;
+      uint32_t lo = kNone;
+      for (unsigned l = 0; l < W; ++l)
+        if ((live >> l) & 1)
+          lo = std::min(lo, lpc[l]);
+      uint32_t m = 0;
+      minOther   = kNone;
+      for (unsigned l = 0; l < W; ++l) {
+        if (!((live >> l) & 1))
+          continue;
+        if (lpc[l] == lo)
+          m |= 1u << l;
+        else
+          minOther = std::min(minOther, lpc[l]);
+      }
+      pc = lo;
+      for (unsigned l = 0; l < W; ++l)
+        if ((m >> l) & 1) {
+          sp = lsp[l];
+          break;
+        }
+      setMask(m);
+      return true;
+    };
+    // dst = r in the lanes of the group; other lanes keep their value. r may be dst.
+    auto put = [&](Row &dst, const Row &r) {
+      if (mask == kAll) {
+        if (&dst != &r)
+          dst = r;
+      } else {
+        blend(dst.v, r.v, lm.v);
+      }
+    };
+    // dst = a op b in the lanes of the group
+    auto op2 = [&](Op op, Row &dst, const Row &a, const Row &b) {
+      Row r;
+      binary(op, r.v, a.v, b.v);
+      put(dst, r);
+    };
+    Row k; // an immediate operand in every lane
+    auto imm = [&](long long v) -> const Row & {
+      splat(k.v, v);
+      return k;
+    };
+    Row zero;
+    splat(zero.v, 0);
+
+    for (;;) {
+      const DecodedInsn &in = code[pc];
+      uint32_t next         = pc + 1;
+      uint32_t taken        = 0; // lanes branching to in.b
+      switch ((Op)in.op) {
+      case OP_PUSH_CONST:
+      case OP_PUSH_I8:
+      case OP_PUSH_I32:
+        put(s[sp], imm(in.k));
+        ++sp;
+        break;
+      case OP_LD0:
+      case OP_LD1:
+      case OP_LD2:
+      case OP_LD3:
+      case OP_LOAD_LOCAL8:
+      case OP_LOAD_LOCAL:
+        put(s[sp], s[in.op == OP_LOAD_LOCAL ? in.b : in.op == OP_LOAD_LOCAL8 ? in.a : in.op - OP_LD0]);
+        ++sp;
+        break;
+      // stores leave the value on the stack
+      case OP_ST0:
+      case OP_ST1:
+      case OP_ST2:
+      case OP_ST3:
+      case OP_STORE_LOCAL8:
+      case OP_STORE_LOCAL: put(s[in.op == OP_STORE_LOCAL ? in.b : in.op == OP_STORE_LOCAL8 ? in.a : in.op - OP_ST0], s[sp - 1]); break;
+      case OP_SET0:
+      case OP_SET1:
+      case OP_SET2:
+      case OP_SET3:
+      case OP_SET_LOCAL8:
+      case OP_SET_LOCAL:
+        --sp;
+        put(s[in.op == OP_SET_LOCAL ? in.b : in.op == OP_SET_LOCAL8 ? in.a : in.op - OP_SET0], s[sp]);
+        break;
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_EQ:
+      case OP_NE:
+      case OP_LT:
+      case OP_LE:
+      case OP_GT:
+      case OP_GE:
+      case OP_AND:
+      case OP_OR:
+        op2((Op)in.op, s[sp - 2], s[sp - 2], s[sp - 1]);
+        --sp;
+        break;
+      // no vector division: only the group's lanes divide, so waiting lanes cannot trap
+      case OP_DIV:
+      case OP_MOD: {
+        const Row &b = s[sp - 1];
+        Row &a       = s[sp - 2];
+        for (unsigned l = 0; l < W; ++l)
+          if ((mask >> l) & 1)
+            a.v[l] = in.op == OP_DIV ? a.v[l] / b.v[l] : a.v[l] % b.v[l];
+        --sp;
+        break;
+      }
+      case OP_NEG: op2(OP_SUB, s[sp - 1], zero, s[sp - 1]); break;
+      case OP_NOT: op2(OP_EQ, s[sp - 1], s[sp - 1], zero); break;
+      case OP_JMP: next = in.b; break;
+      case OP_JMP_IF_FALSE:
+      case OP_JMP_IF_TRUE: {
+        uint32_t set = nonzero(s[--sp].v);
+        taken        = (in.op == OP_JMP_IF_FALSE ? ~set : set) & mask;
+        break;
+      }
+      case OP_POP:
+        // as in the interpreter, a POP right before RET leaves the value for it
+        if (code[next].op != OP_RET)
+          --sp;
+        break;
+      case OP_RET:
+      case OP_HALT: {
+        const Row &r = s[sp - 1];
+        for (unsigned l = 0; l < W; ++l)
+          if ((mask >> l) & 1)
+            out[l] = r.v[l];
+        done |= mask;
+        if (!schedule())
+          return;
+        continue;
+      }
+      // superinstructions
+      case OP_ST_POP:
+        --sp;
+        put(s[in.a], s[sp]);
+        break;
+      case OP_INC_LOCAL: op2(OP_ADD, s[in.a], s[in.a], imm(in.k)); break;
+      // the jump is taken where the comparison fails
+      case OP_LL_LT_JF:
+      case OP_LL_LE_JF:
+      case OP_LK_LT_JF:
+      case OP_LK_LE_JF: {
+        const Op cmp = in.op == OP_LL_LT_JF || in.op == OP_LK_LT_JF ? OP_LT : OP_LE;
+        Row r;
+        binary(cmp, r.v, s[in.a].v, in.op == OP_LL_LT_JF || in.op == OP_LL_LE_JF ? s[in.k].v : imm(in.k).v);
+        taken = ~nonzero(r.v) & mask;
+        break;
+      }
+      case OP_LL_ADD:
+        op2(OP_ADD, s[sp], s[in.a], s[in.k]);
+        ++sp;
+        break;
+      case OP_LK_SUB:
+        op2(OP_SUB, s[sp], s[in.a], imm(in.k));
+        ++sp;
+        break;
+      default: throw std::runtime_error("opcode not supported on lanes");
+      }
+      if (taken != 0) {
+        if (taken != mask) {
+          // divergent branch: both sides wait, the lower pc runs first
+          park(taken, in.b, sp);
+          park(mask & ~taken, next, sp);
+          schedule();
+          continue;
+        }
+        next = in.b;
+      }
+      pc = next;
+      if (pc >= minOther) {
+        park(mask, pc, sp);
+        schedule();
+      }
+    }
+  }
+
+} // namespace mplx
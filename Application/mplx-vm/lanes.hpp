@@ -0,0 +1,48 @@
+#pragma once
+#include "vm.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mplx {
+
+  // Data-parallel evaluation of one function over many argument tuples: kLanes tuples run
+  // together, each stack slot and local holding one value per lane, so an arithmetic or
+  // comparison opcode is a single vector operation: AVX2 intrinsics, a row per two 256-bit
+  // registers, when built with MPLX_VM_AVX2; otherwise fixed-width loops that the compiler
+  // may auto-vectorize for the baseline ISA (SSE2 on x86-64). MUL and DIV/MOD always go lane
+  // by lane, AVX2 having no 64-bit multiply or divide. When a conditional jump splits the
+  // lanes, each side keeps its own pc under a lane mask; the group with the lowest pc runs
+  // next, which reconverges both sides at the join point. Functions containing OP_CALL or
+  // OP_TAILCALL, and modules that do not pass the verifier, run tuple by tuple on a scalar
+  // VM instead.
+  // Not thread-safe; the Bytecode must outlive the runner.
+  class LaneRunner {
+  public:
+    static constexpr unsigned kLanes = 8;
+
+    explicit LaneRunner(const Bytecode &bc);
+
+    // args holds count * arity values, one tuple after another; results[i] receives the
+    // return value for tuple i
+    void run(uint32_t fnIndex, const long long *args, size_t count, long long *results);
+    void run(const std::string &fn, const long long *args, size_t count, long long *results);
+
+    // Whether fnIndex runs on lanes (false: scalar fallback)
+    bool vectorized(uint32_t fnIndex) const { return fnIndex < lanes_ok_.size() && lanes_ok_[fnIndex]; }
+
+  private:
+    struct alignas(64) Row {
+      long long v[kLanes];
+    };
+
+    // Runs the group whose arguments are in the first rows of stack_; out gets a result per lane
+    void runGroup(uint32_t fnIndex, long long *out);
+
+    const Bytecode &bc_;
+    VM scalar_; // decodes and verifies the module; runs the fallback
+    std::vector<bool> lanes_ok_;
+    std::vector<Row> stack_; // locals, then the operand stack
+  };
+
+} // namespace mplx
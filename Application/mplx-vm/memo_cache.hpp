@@ -0,0 +1,88 @@
+#pragma once
+#include "value_stack.hpp"
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace mplx {
+
+  // Bounded result cache of one pure function (FuncMeta::pure), keyed by the argument
+  // tuple. Direct-mapped: each tuple has one slot, and a colliding insert replaces the
+  // entry that was there, so the table never grows past its capacity.
+  class MemoCache {
+  public:
+    static constexpr unsigned kMaxArity = 4;
+
+    // capacity is rounded up to a power of two; arity 0 or above kMaxArity disables it
+    void init(uint8_t arity, size_t capacity) {
+      arity_ = arity;
+      if (arity == 0 || arity > kMaxArity) {
+        entries_.clear();
+        return;
+      }
+      size_t n = 1;
+      while (n < capacity)
+        n <<= 1;
+      entries_.assign(n, Entry{});
+      mask_ = n - 1;
+    }
+    bool enabled() const { return !entries_.empty(); }
+
+    bool lookup(const VMValue *args, long long &value) {
+      const Entry &e = entries_[slot(args)];
+      if (e.used && same(e, args)) {
+        ++hits_;
+        value = e.value;
+        return true;
+      }
+      ++misses_;
+      return false;
+    }
+    void insert(const long long *args, long long value) {
+      Entry &e = entries_[slot(args)];
+      e.used   = true;
+      for (unsigned i = 0; i < arity_; ++i)
+        e.args[i] = args[i];
+      e.value = value;
+    }
+
+    uint8_t arity() const { return arity_; }
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+  private:
+    struct Entry {
+      long long args[kMaxArity]{};
+      long long value{0};
+      bool used{false};
+    };
+
+    template <typename T>
+    static long long valueOf(const T &v) {
+      if constexpr (std::is_same_v<T, VMValue>)
+        return v.i;
+      else
+        return v;
+    }
+    template <typename T>
+    size_t slot(const T *args) const {
+      uint64_t h = 0x9E3779B97F4A7C15ull;
+      for (unsigned i = 0; i < arity_; ++i)
+        h = (h ^ (uint64_t)valueOf(args[i])) * 0xBF58476D1CE4E5B9ull;
+      return (size_t)(h ^ (h >> 31)) & mask_;
+    }
+    bool same(const Entry &e, const VMValue *args) const {
+      for (unsigned i = 0; i < arity_; ++i)
+        if (e.args[i] != args[i].i)
+          return false;
+      return true;
+    }
+
+    std::vector<Entry> entries_;
+    size_t mask_{0};
+    uint8_t arity_{0};
+    uint64_t hits_{0};
+    uint64_t misses_{0};
+  };
+
+} // namespace mplx
@@ -0,0 +1,52 @@
+#include "op_histogram.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+namespace mplx {
+
+  uint64_t OpHistogram::total() const {
+    return std::accumulate(ops_.begin(), ops_.end(), uint64_t(0));
+  }
+
+  std::string OpHistogram::toJson() const {
+    const uint64_t all = total();
+    auto share         = [&](uint64_t n) {
+      char buf[32];
+      std::snprintf(buf, sizeof buf, "%.6f", all ? (double)n / (double)all : 0.0);
+      return std::string(buf);
+    };
+
+    std::vector<unsigned> ops;
+    for (unsigned op = 0; op < kOps; ++op)
+      if (ops_[op])
+        ops.push_back(op);
+    std::stable_sort(ops.begin(), ops.end(), [&](unsigned a, unsigned b) { return ops_[a] > ops_[b]; });
+
+    std::vector<unsigned> pairs;
+    for (unsigned i = 0; i < kOps * kOps; ++i)
+      if (pairs_[i])
+        pairs.push_back(i);
+    std::stable_sort(pairs.begin(), pairs.end(), [&](unsigned a, unsigned b) { return pairs_[a] > pairs_[b]; });
+
+    std::string out = "{\"total\":" + std::to_string(all) + ",\"ops\":[";
+    for (size_t i = 0; i < ops.size(); ++i) {
+      if (i)
+        out += ",";
+      out += "{\"op\":\"" + std::string(op_name((Op)ops[i])) + "\",\"count\":" + std::to_string(ops_[ops[i]]) +
+             ",\"share\":" + share(ops_[ops[i]]) + "}";
+    }
+    out += "],\"pairs\":[";
+    for (size_t i = 0; i < pairs.size(); ++i) {
+      if (i)
+        out += ",";
+      const unsigned a = pairs[i] / kOps, b = pairs[i] % kOps;
+      out += "{\"first\":\"" + std::string(op_name((Op)a)) + "\",\"second\":\"" + op_name((Op)b) +
+             "\",\"count\":" + std::to_string(pairs_[pairs[i]]) + ",\"share\":" + share(pairs_[pairs[i]]) + "}";
+    }
+    out += "]}";
+    return out;
+  }
+
+} // namespace mplx
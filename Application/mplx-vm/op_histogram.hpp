@@ -0,0 +1,44 @@
+#pragma once
+#include "../mplx-compiler/bytecode.hpp"
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace mplx {
+
+  // Dynamic counts of every opcode and of every pair of consecutively executed opcodes,
+  // recorded by the interpreter when built with MPLX_VM_HISTOGRAM (see VM::setHistogram).
+  // A pair spans taken jumps and calls, since it follows execution order.
+  class OpHistogram {
+  public:
+    static constexpr unsigned kOps = kLastOp + 1;
+
+    void record(unsigned op) {
+      ++ops_[op];
+      if (prev_ < kOps)
+        ++pairs_[prev_ * kOps + op];
+      prev_ = op;
+    }
+    // A new run does not continue the previous run's pair
+    void breakSequence() { prev_ = kOps; }
+    void clear() {
+      ops_.fill(0);
+      pairs_.fill(0);
+      prev_ = kOps;
+    }
+
+    uint64_t count(unsigned op) const { return ops_[op]; }
+    uint64_t pair(unsigned a, unsigned b) const { return pairs_[a * kOps + b]; }
+    uint64_t total() const;
+
+    // {"total":N,"ops":[{"op":"ADD","count":N,"share":0.1},...],"pairs":[{"first":..,
+    // "second":..,"count":N,"share":..},...]}, non-zero entries only, most frequent first
+    std::string toJson() const;
+
+  private:
+    std::array<uint64_t, kOps> ops_{};
+    std::array<uint64_t, kOps * kOps> pairs_{};
+    unsigned prev_{kOps};
+  };
+
+} // namespace mplx
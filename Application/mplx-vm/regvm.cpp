@@ -0,0 +1,152 @@
+#include "regvm.hpp"
+#include "dispatch.hpp"
+#include <stdexcept>
+
+namespace mplx {
+
+  long long RegVM::run(const std::string &entry) {
+    for (uint32_t i = 0; i < rc_.functions.size(); ++i)
+      if (rc_.functions[i].name == entry)
+        return runByIndex(i);
+    throw std::runtime_error("entry function not found");
+  }
+
+  long long RegVM::runByIndex(uint32_t fnIndex) {
+    if (fnIndex >= rc_.functions.size())
+      throw std::runtime_error("function index out of range");
+    if (stack_.base() == nullptr || stack_.capacity() != stack_slots_)
+      stack_.allocate(stack_slots_);
+    frames_.clear();
+    return count_dispatch_ ? execute<true>(fnIndex) : execute<false>(fnIndex);
+  }
+
+  template <bool kCount>
+  long long RegVM::execute(uint32_t fnIndex) {
+    const RegInsn *code = rc_.code.data();
+    const RegFunc &entry = rc_.functions[fnIndex];
+    VMValue *r           = stack_.base();
+    if (r + entry.nregs > stack_.limit())
+      throw std::runtime_error("stack overflow");
+    for (uint32_t i = 0; i < entry.nregs; ++i)
+      r[i].i = 0;
+    const RegInsn *pc = code + entry.entry;
+    const RegInsn *in;
+
+#define VM_FETCH() (in = pc++, op = in->op)
+#define VM_HOOK()                                                                                   \
+  if constexpr (kCount) {                                                                          \
+    ++dispatched_;                                                                                 \
+  }
+#define VM_LAST_OP ROP_HALT
+#define VM_LABELS                                                                                   \
+  &&L_ROP_MOV, &&L_ROP_LOADK, &&L_ROP_ADD, &&L_ROP_SUB, &&L_ROP_MUL, &&L_ROP_DIV, &&L_ROP_MOD,     \
+      &&L_ROP_EQ, &&L_ROP_NE, &&L_ROP_LT, &&L_ROP_LE, &&L_ROP_GT, &&L_ROP_GE, &&L_ROP_AND,          \
+      &&L_ROP_OR, &&L_ROP_ADDI, &&L_ROP_MULI, &&L_ROP_NEG, &&L_ROP_NOT, &&L_ROP_JMP, &&L_ROP_JF,    \
+      &&L_ROP_JT, &&L_ROP_JLT, &&L_ROP_JLE, &&L_ROP_JGT, &&L_ROP_JGE, &&L_ROP_JEQ, &&L_ROP_JNE,     \
+      &&L_ROP_JLTI, &&L_ROP_JLEI, &&L_ROP_JGTI, &&L_ROP_JGEI, &&L_ROP_JEQI, &&L_ROP_JNEI,           \
+      &&L_ROP_CALL, &&L_ROP_RET, &&L_ROP_HALT
+#define R(x) r[in->x].i
+#define BINARY(name, expr)                                                                          \
+  VM_CASE(name) {                                                                                  \
+    long long a = R(a), b = R(b);                                                                  \
+    R(dst)      = (expr);                                                                          \
+    VM_NEXT();                                                                                     \
+  }
+#define BRANCH(name, cond)                                                                          \
+  VM_CASE(name) {                                                                                  \
+    if (cond)                                                                                      \
+      pc = code + in->target;                                                                      \
+    VM_NEXT();                                                                                     \
+  }
+
+    VM_LOOP_BEGIN()
+      VM_CASE(ROP_MOV) {
+        R(dst) = R(a);
+        VM_NEXT();
+      }
+      VM_CASE(ROP_LOADK) {
+        R(dst) = in->imm;
+        VM_NEXT();
+      }
+      BINARY(ROP_ADD, a + b)
+      BINARY(ROP_SUB, a - b)
+      BINARY(ROP_MUL, a * b)
+      BINARY(ROP_DIV, a / b)
+      BINARY(ROP_MOD, a % b)
+      BINARY(ROP_EQ, a == b)
+      BINARY(ROP_NE, a != b)
+      BINARY(ROP_LT, a < b)
+      BINARY(ROP_LE, a <= b)
+      BINARY(ROP_GT, a > b)
+      BINARY(ROP_GE, a >= b)
+      BINARY(ROP_AND, (a != 0) && (b != 0))
+      BINARY(ROP_OR, (a != 0) || (b != 0))
+      VM_CASE(ROP_ADDI) {
+        R(dst) = R(a) + in->imm;
+        VM_NEXT();
+      }
+      VM_CASE(ROP_MULI) {
+        R(dst) = R(a) * in->imm;
+        VM_NEXT();
+      }
+      VM_CASE(ROP_NEG) {
+        R(dst) = -R(a);
+        VM_NEXT();
+      }
+      VM_CASE(ROP_NOT) {
+        R(dst) = R(a) == 0;
+        VM_NEXT();
+      }
+      BRANCH(ROP_JMP, true)
+      BRANCH(ROP_JF, !R(a))
+      BRANCH(ROP_JT, R(a))
+      BRANCH(ROP_JLT, R(a) < R(b))
+      BRANCH(ROP_JLE, R(a) <= R(b))
+      BRANCH(ROP_JGT, R(a) > R(b))
+      BRANCH(ROP_JGE, R(a) >= R(b))
+      BRANCH(ROP_JEQ, R(a) == R(b))
+      BRANCH(ROP_JNE, R(a) != R(b))
+      BRANCH(ROP_JLTI, R(a) < in->imm)
+      BRANCH(ROP_JLEI, R(a) <= in->imm)
+      BRANCH(ROP_JGTI, R(a) > in->imm)
+      BRANCH(ROP_JGEI, R(a) >= in->imm)
+      BRANCH(ROP_JEQI, R(a) == in->imm)
+      BRANCH(ROP_JNEI, R(a) != in->imm)
+      VM_CASE(ROP_CALL) {
+        const RegFunc &callee = rc_.functions[in->b];
+        VMValue *nr           = r + in->a;
+        if (nr + callee.nregs > stack_.limit())
+          throw std::runtime_error("stack overflow");
+        frames_.push_back(Frame{pc, r, in->dst});
+        for (uint32_t i = callee.arity; i < callee.nregs; ++i)
+          nr[i].i = 0;
+        r  = nr;
+        pc = code + callee.entry;
+        VM_NEXT();
+      }
+      VM_CASE(ROP_RET) {
+        long long v = R(a);
+        if (frames_.empty())
+          return v;
+        Frame f = frames_.back();
+        frames_.pop_back();
+        r          = f.regs;
+        r[f.dst].i = v;
+        pc         = f.ret;
+        VM_NEXT();
+      }
+      VM_CASE(ROP_HALT) {
+        return 0;
+      }
+    VM_LOOP_END()
+
+#undef BRANCH
+#undef BINARY
+#undef R
+#undef VM_LABELS
+#undef VM_LAST_OP
+#undef VM_HOOK
+#undef VM_FETCH
+  }
+
+} // namespace mplx
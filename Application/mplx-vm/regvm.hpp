@@ -0,0 +1,44 @@
+#pragma once
+#include "../mplx-compiler/regcode.hpp"
+#include "value_stack.hpp"
+#include <string>
+#include <vector>
+
+namespace mplx {
+
+  // Interpreter for the register tier (see regcode.hpp). Each call gets a window of
+  // `nregs` registers on a ValueStack; arguments are passed in place because the caller
+  // evaluates them straight into the bottom of the callee's window.
+  class RegVM {
+  public:
+    explicit RegVM(const RegCode &rc) : rc_(rc) {}
+    long long run(const std::string &entry = "main");
+    long long runByIndex(uint32_t fnIndex);
+
+    // Register file capacity in slots; exceeding it raises std::runtime_error("stack overflow")
+    void setStackSize(size_t slots) { stack_slots_ = slots; }
+    size_t stackSize() const { return stack_slots_; }
+
+    // Count dispatched instructions (accumulated across runs while on)
+    void setCountDispatch(bool enabled) { count_dispatch_ = enabled; }
+    uint64_t dispatched() const { return dispatched_; }
+
+  private:
+    struct Frame {
+      const RegInsn *ret;
+      VMValue *regs;
+      uint16_t dst;
+    };
+
+    template <bool kCount>
+    long long execute(uint32_t fnIndex);
+
+    const RegCode &rc_;
+    ValueStack stack_;
+    size_t stack_slots_{size_t(1) << 20};
+    std::vector<Frame> frames_;
+    bool count_dispatch_{false};
+    uint64_t dispatched_{0};
+  };
+
+} // namespace mplx
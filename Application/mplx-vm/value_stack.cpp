@@ -0,0 +1,64 @@
+#include "value_stack.hpp"
+#include <new>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace mplx {
+
+  static size_t page_size() {
+#if defined(_WIN32)
+    SYSTEM_INFO si;
+    ::GetSystemInfo(&si);
+    return (size_t)si.dwPageSize;
+#else
+    return (size_t)::sysconf(_SC_PAGESIZE);
+#endif
+  }
+
+  ValueStack::~ValueStack() {
+    release();
+  }
+
+  void ValueStack::allocate(size_t slots) {
+    release();
+    const size_t page  = page_size();
+    const size_t bytes = ((slots * sizeof(VMValue) + page - 1) / page) * page;
+    const size_t total = bytes + page; // + guard page
+#if defined(_WIN32)
+    void *p = ::VirtualAlloc(nullptr, total, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!p)
+      throw std::bad_alloc();
+    DWORD old = 0;
+    ::VirtualProtect((char *)p + bytes, page, PAGE_NOACCESS, &old);
+#else
+    void *p = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc();
+    ::mprotect((char *)p + bytes, page, PROT_NONE);
+#endif
+    mem_    = p;
+    mapped_ = total;
+    // place the last slot right below the guard page
+    slots_ = slots;
+    base_  = reinterpret_cast<VMValue *>((char *)p + bytes) - slots;
+  }
+
+  void ValueStack::release() {
+    if (!mem_)
+      return;
+#if defined(_WIN32)
+    ::VirtualFree(mem_, 0, MEM_RELEASE);
+#else
+    ::munmap(mem_, mapped_);
+#endif
+    mem_    = nullptr;
+    mapped_ = 0;
+    base_   = nullptr;
+    slots_  = 0;
+  }
+
+} // namespace mplx
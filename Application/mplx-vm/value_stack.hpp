@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace mplx {
+
+  struct VMValue {
+    long long i;
+  };
+
+  // Fixed-capacity operand/locals stack for the interpreter. Slots live in their own
+  // pages with an inaccessible guard page right above the last slot, so a push past the
+  // end faults instead of corrupting the heap. The interpreter checks for overflow at
+  // call boundaries (see VM::kStackHeadroom); the guard page is only a backstop.
+  class ValueStack {
+  public:
+    ValueStack() = default;
+    ~ValueStack();
+    ValueStack(const ValueStack &)            = delete;
+    ValueStack &operator=(const ValueStack &) = delete;
+
+    // (Re)allocates room for `slots` values; previous contents are discarded.
+    // Throws std::bad_alloc if the pages cannot be mapped.
+    void allocate(size_t slots);
+    void release();
+
+    VMValue *base() const { return base_; }
+    VMValue *limit() const { return base_ + slots_; }
+    size_t capacity() const { return slots_; }
+
+  private:
+    void *mem_{nullptr};
+    size_t mapped_{0};
+    VMValue *base_{nullptr};
+    size_t slots_{0};
+  };
+
+} // namespace mplx
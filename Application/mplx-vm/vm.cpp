@@ -1,4 +1,7 @@
 ﻿#include "vm.hpp"
+#include "../mplx-compiler/verifier.hpp"
+#include "dispatch.hpp"
+#include <cstdio>
 #include <cstring>
 #if defined(MPLX_WITH_JIT)
 #include "../Jit/jit_compiler.hpp"
@@ -7,469 +10,803 @@
 
 namespace mplx {
 
-  static uint32_t read_u32(const std::vector<uint8_t> &c, uint32_t &ip) {
-    uint32_t v = (uint32_t)c[ip] | ((uint32_t)c[ip + 1] << 8) | ((uint32_t)c[ip + 2] << 16) | ((uint32_t)c[ip + 3] << 24);
-    ip += 4;
-    return v;
+  VM::VM(const Bytecode &bc) : bc_(bc) {
+    calls_.reserve(bc_.functions.size());
+    for (const auto &f : bc_.functions)
+      calls_.push_back(CallDesc{f.entry, f.arity, f.locals});
+    predecode();
+    verify_errors_ = verify_bytecode(bc_, (uint32_t)kStackHeadroom);
+    verified_      = verify_errors_.empty();
+  }
+
+  const char *VM::dispatchEngine() {
+    return MPLX_VM_THREADED ? "threaded" : "switch";
   }
 
   long long VM::run(const std::string &entry) {
-    std::unordered_map<std::string, uint32_t> name2idx;
-    for (uint32_t i = 0; i < bc_.functions.size(); ++i)
-      name2idx[bc_.functions[i].name] = i;
-    auto it = name2idx.find(entry);
-    if (it == name2idx.end())
+    uint32_t fnIndex = 0;
+    if (!find_function(bc_, entry, fnIndex))
       throw std::runtime_error("entry function not found");
-    auto& fn = bc_.functions[it->second];
-
-    // initial frame (return ip = code end -> HALT)
-    frames_.push_back(CallFrame{(uint32_t)bc_.code.size() - 1, it->second, 0, fn.arity, fn.locals});
-    // sync JIT state for base frame
-    jit_state_.bp_index  = 0;
-    jit_state_.stack_ptr = (stack_.empty() ? nullptr : &stack_[0].i);
-    jit_state_.sp_index  = (uint64_t)stack_.size();
-    ip_ = fn.entry;
 #if defined(MPLX_WITH_JIT)
     // JIT integration
-#if defined(MPLX_WITH_JIT)
+    // compiled entries and hotness live in the VM, so the Bytecode stays immutable and
+    // can be shared by VMs on other threads
     if (jit_mode_ != JitMode::Off) {
-      auto& fnmeta = const_cast<FuncMeta&>(bc_.functions[it->second]);
-      if (fnmeta.compiled_entry) {
-        using FnPtr = long long (*)(void *);
-        return ((FnPtr)fnmeta.compiled_entry)(this);
-      }
-      if (jit_mode_ == JitMode::On || (jit_mode_ == JitMode::Auto && (++fnmeta.hot_count >= hot_threshold_))) {
+      auto it = jitted_.find(fnIndex);
+      if (it != jitted_.end())
+        return it->second(this);
+      if (hot_counts_.empty())
+        hot_counts_.assign(bc_.functions.size(), 0);
+      if (jit_mode_ == JitMode::On || (jit_mode_ == JitMode::Auto && (++hot_counts_[fnIndex] >= hot_threshold_))) {
         mplx::jit::JitCompiler jc;
-        mplx::jit::CompileCtx cctx; cctx.bc = &bc_; cctx.fnIndex = it->second;
+        mplx::jit::CompileCtx cctx; cctx.bc = &bc_; cctx.fnIndex = fnIndex;
         if (auto compiled = jc.compileFunction(cctx)) {
-          jitted_[it->second]             = compiled->entry;
-          jit_mem_[it->second]            = std::move(compiled->mem);
-          fnmeta.compiled_entry           = (void *)compiled->entry;
-          fnmeta.is_jitted                = true;
-          using FnPtr = long long (*)(void *);
-          return ((FnPtr)fnmeta.compiled_entry)(this);
+          jitted_[fnIndex]                = compiled->entry;
+          jit_mem_[fnIndex]               = std::move(compiled->mem);
+          return compiled->entry(this);
         }
       }
     }
 #endif
-#endif
+    return enter(fnIndex, 0);
+  }
 
-    uint64_t steps = 0;
-    while (true) {
-      auto op = (Op)bc_.code[ip_++];
-      if (trace_enabled_) {
-        if (trace_limit_ == 0 || steps < trace_limit_) {
-          // Minimal trace: pc is ip_-1 (already incremented), stack size and TOS
-          long long tos = stack_.empty() ? 0 : stack_.back().i;
-          std::cout << "pc=" << (ip_-1) << " op=" << (int)op << " sp=" << stack_.size() << " tos=" << tos << "\n";
-        }
-        ++steps;
-      }
-      switch (op) {
-      case OP_PUSH_CONST: {
-        uint32_t idx = read_u32(bc_.code, ip_);
-        push(bc_.consts[idx]);
-        break;
-      }
-      case OP_LOAD_LOCAL: {
-        uint32_t idx = read_u32(bc_.code, ip_);
-        auto bp      = frames_.back().bp;
-        push(stack_[bp + idx].i);
-        break;
-      }
-      case OP_LOAD_LOCAL8: {
-        uint32_t idx = bc_.code[ip_++];
-        auto bp      = frames_.back().bp;
-        push(stack_[bp + idx].i);
-        break;
-      }
-      case OP_STORE_LOCAL: {
-        uint32_t idx = read_u32(bc_.code, ip_);
-        auto bp      = frames_.back().bp;
-        long long v  = pop();
-        if (bp + idx >= stack_.size())
-          stack_.resize(bp + idx + 1);
-        stack_[bp + idx].i = v;
-        push(v);
-        break;
-      }
-      case OP_STORE_LOCAL8: {
-        uint32_t idx = bc_.code[ip_++];
-        auto bp      = frames_.back().bp;
-        long long v  = pop();
-        if (bp + idx >= stack_.size())
-          stack_.resize(bp + idx + 1);
-        stack_[bp + idx].i = v;
-        push(v);
-        break;
-      }
-      case OP_LD0: { auto bp = frames_.back().bp; push(stack_[bp + 0].i); break; }
-      case OP_LD1: { auto bp = frames_.back().bp; push(stack_[bp + 1].i); break; }
-      case OP_LD2: { auto bp = frames_.back().bp; push(stack_[bp + 2].i); break; }
-      case OP_LD3: { auto bp = frames_.back().bp; push(stack_[bp + 3].i); break; }
-      case OP_ST0: { auto bp = frames_.back().bp; auto v = pop(); stack_[bp + 0].i = v; push(v); break; }
-      case OP_ST1: { auto bp = frames_.back().bp; auto v = pop(); stack_[bp + 1].i = v; push(v); break; }
-      case OP_ST2: { auto bp = frames_.back().bp; auto v = pop(); stack_[bp + 2].i = v; push(v); break; }
-      case OP_ST3: { auto bp = frames_.back().bp; auto v = pop(); stack_[bp + 3].i = v; push(v); break; }
-      case OP_ADD: {
-        auto b = pop();
-        auto a = pop();
-        push(a + b);
-        break;
-      }
-      case OP_SUB: {
-        auto b = pop();
-        auto a = pop();
-        push(a - b);
-        break;
-      }
-      case OP_MUL: {
-        auto b = pop();
-        auto a = pop();
-        push(a * b);
-        break;
-      }
-      case OP_DIV: {
-        auto b = pop();
-        auto a = pop();
-        push(a / b);
-        break;
-      }
-      case OP_MOD: {
-        auto b = pop();
-        auto a = pop();
-        push(a % b);
-        break;
-      }
-      case OP_NEG: {
-        auto a = pop();
-        push(-a);
-        break;
-      }
-      case OP_EQ: {
-        auto b = pop();
-        auto a = pop();
-        push(a == b);
-        break;
-      }
-      case OP_NE: {
-        auto b = pop();
-        auto a = pop();
-        push(a != b);
-        break;
-      }
-      case OP_LT: {
-        auto b = pop();
-        auto a = pop();
-        push(a < b);
-        break;
-      }
-      case OP_LE: {
-        auto b = pop();
-        auto a = pop();
-        push(a <= b);
-        break;
-      }
-      case OP_GT: {
-        auto b = pop();
-        auto a = pop();
-        push(a > b);
-        break;
-      }
-      case OP_GE: {
-        auto b = pop();
-        auto a = pop();
-        push(a >= b);
-        break;
-      }
-      case OP_JMP: {
-        uint32_t dst = read_u32(bc_.code, ip_);
-        ip_          = dst;
-        break;
-      }
-      case OP_JMP_IF_FALSE: {
-        uint32_t dst = read_u32(bc_.code, ip_);
-        auto c       = pop();
-        if (!c)
-          ip_ = dst;
-        break;
-      }
-      case OP_JMP_IF_TRUE: {
-        uint32_t dst = read_u32(bc_.code, ip_);
-        auto c       = pop();
-        if (c)
-          ip_ = dst;
-        break;
-      }
-      case OP_AND: {
-        auto b = pop();
-        auto a = pop();
-        push((a != 0) && (b != 0));
-        break;
-      }
-      case OP_OR: {
-        auto b = pop();
-        auto a = pop();
-        push((a != 0) || (b != 0));
-        break;
-      }
-      case OP_NOT: {
-        auto a = pop();
-        push(a == 0);
-        break;
-      }
-      case OP_CALL: {
-        uint32_t idx    = read_u32(bc_.code, ip_);
-        auto callee     = bc_.functions[idx];
-        uint32_t bp     = (uint32_t)(stack_.size() - callee.arity);
-        uint32_t ret_ip = ip_; // return to next instruction after CALL
-        // pre-reserve locals to minimize resizes
-        if (stack_.size() < (size_t)(bp + callee.locals))
-          stack_.resize((size_t)(bp + callee.locals));
-        frames_.push_back(CallFrame{ret_ip, idx, bp, callee.arity, callee.locals});
-        ip_ = callee.entry;
-        break;
-      }
-      case OP_RET: {
-        long long ret = pop();
-        auto frame    = frames_.back();
-        frames_.pop_back();
-        // drop stack to base pointer
-        stack_.resize(frame.bp);
-        push(ret);
-        // after returning to caller, bp changes
-        jit_state_.bp_index = frames_.empty() ? 0 : frames_.back().bp;
-        if (frames_.empty())
-          return ret;
-        ip_ = frame.ip;
-        break;
-      }
-      case OP_POP: {
-        // fast-path: if next instruction is RET, skip actual pop
-        Op next = (ip_ < bc_.code.size()) ? (Op)bc_.code[ip_] : OP_HALT;
-        if (next == OP_RET) {
-          break;
-        }
-        (void)pop();
-        break;
-      }
-      case OP_HALT:
-        return pop();
-      default:
-        throw std::runtime_error("unknown opcode");
-      }
-    }
+  void VM::reset() {
+    frames_.clear();
+    suspended_ = false;
+    sp_ = stack_.base();
+    op_counts_.fill(0);
+    seq_profile_.reset();
+    cost_.clear();
+#if defined(MPLX_VM_HISTOGRAM)
+    histogram_.clear();
+#endif
+    fuel_used_ = 0;
   }
 
   long long VM::runByIndex(uint32_t fnIndex) {
     if (fnIndex >= bc_.functions.size())
       throw std::runtime_error("function index out of bounds");
-    auto& fn = bc_.functions[fnIndex];
-    
-    // initial frame (return ip = code end -> HALT)
-    frames_.push_back(CallFrame{(uint32_t)bc_.code.size() - 1, fnIndex, 0, fn.arity, fn.locals});
-    // sync JIT state for base frame
-    jit_state_.bp_index  = 0;
-    jit_state_.stack_ptr = (stack_.empty() ? nullptr : &stack_[0].i);
-    jit_state_.sp_index  = (uint64_t)stack_.size();
-    ip_ = fn.entry;
+    return enter(fnIndex, 0);
+  }
 
-    while (true) {
-      auto op = (Op)bc_.code[ip_++];
+  long long VM::call(uint32_t fnIndex, const long long *args, size_t nargs) {
+    if (fnIndex >= calls_.size())
+      throw std::runtime_error("function index out of bounds");
+    if (nargs != calls_[fnIndex].arity)
+      throw std::runtime_error("argument count mismatch");
+    ensureStack();
+    if (sp_ + nargs > stack_.limit())
+      throw std::runtime_error("stack overflow");
+    for (size_t i = 0; i < nargs; ++i)
+      (sp_++)->i = args[i];
+    return enter(fnIndex, nargs);
+  }
+
+  // Execution policies for the interpreter core. Each feature is a compile-time flag, so
+  // the plain instantiation carries no per-instruction checks for tracing, profiling or
+  // the instruction budget; the policy is picked once per entry in VM::enter.
+  // kSlice is the resumable mode (VM::start/resume): the budget is charged and checked
+  // only at backward jumps, calls and returns. kMemo consults the pure-function result
+  // caches at calls and fills them at returns. kChecked validates each instruction's
+  // locals and stack accesses before it runs; it is the only mode for modules that did
+  // not pass the verifier, every other policy trusts the verified code.
+  namespace {
+    struct PlainPolicy {
+      static constexpr bool kTrace     = false;
+      static constexpr bool kProfile   = false;
+      static constexpr bool kFuel      = false;
+      static constexpr bool kSlice     = false;
+      static constexpr bool kCost      = false;
+      static constexpr bool kHistogram = false;
+      static constexpr bool kMemo      = false;
+      static constexpr bool kChecked   = false;
+    };
+    struct FuelPolicy : PlainPolicy {
+      static constexpr bool kFuel = true;
+    };
+    struct TracePolicy : FuelPolicy {
+      static constexpr bool kTrace = true;
+    };
+    struct ProfilePolicy : FuelPolicy {
+      static constexpr bool kProfile = true;
+    };
+    struct CostPolicy : FuelPolicy {
+      static constexpr bool kCost = true;
+    };
+    struct MemoPolicy : FuelPolicy {
+      static constexpr bool kMemo = true;
+    };
+    struct CostMemoPolicy : CostPolicy {
+      static constexpr bool kMemo = true;
+    };
+#if defined(MPLX_VM_HISTOGRAM)
+    struct HistogramPolicy : FuelPolicy {
+      static constexpr bool kHistogram = true;
+    };
+#endif
+    struct SlicePolicy : PlainPolicy {
+      static constexpr bool kSlice = true;
+    };
+    struct CheckedPolicy : FuelPolicy {
+      static constexpr bool kChecked = true;
+    };
+    struct CheckedSlicePolicy : SlicePolicy {
+      static constexpr bool kChecked = true;
+    };
+  } // namespace
+
+  void VM::ensureStack() {
+    if (!stack_.base() || stack_.capacity() != stack_slots_) {
+      if (!frames_.empty())
+        throw std::runtime_error("cannot resize the value stack while running");
+      stack_.allocate(stack_slots_);
+      sp_ = stack_.base();
+    }
+  }
+
+  long long VM::enter(uint32_t fnIndex, size_t nargs) {
+    ensureStack();
+    VMValue *const sp = sp_ - nargs;
+    const size_t depth = frames_.size();
+    try {
+      return runEntry(fnIndex);
+    } catch (...) {
+      unwind(depth, sp);
+      throw;
+    }
+  }
+
+  void VM::unwind(size_t depth, VMValue *sp) {
+    frames_.erase(frames_.begin() + (std::ptrdiff_t)depth, frames_.end());
+    sp_ = sp;
+    syncJitState();
+  }
+
+  long long VM::runEntry(uint32_t fnIndex) {
+    const size_t baseDepth = pushEntryFrame(fnIndex);
+    const uint32_t entry   = calls_[fnIndex].entry;
+    if (!verified_)
+      return execute<CheckedPolicy>(baseDepth, entry);
+    if (trace_enabled_)
+      return execute<TracePolicy>(baseDepth, entry);
+    if (profile_enabled_) {
+      seq_profile_.breakSequence();
+      return execute<ProfilePolicy>(baseDepth, entry);
+    }
+#if defined(MPLX_VM_HISTOGRAM)
+    if (histogram_enabled_) {
+      histogram_.breakSequence();
+      return execute<HistogramPolicy>(baseDepth, entry);
+    }
+#endif
+    if (cost_enabled_) {
+      cost_.attach(bc_, insn_pc_);
+      cost_.countCall(fnIndex);
+      cost_.startSampler(cost_interval_us_);
+      struct StopSampler {
+        CostProfile &p;
+        ~StopSampler() { p.stopSampler(); }
+      } stop{cost_};
+      if (memo_enabled_) {
+        prepareMemo(baseDepth);
+        return execute<CostMemoPolicy>(baseDepth, entry);
+      }
+      return execute<CostPolicy>(baseDepth, entry);
+    }
+    if (memo_enabled_) {
+      prepareMemo(baseDepth);
+      return execute<MemoPolicy>(baseDepth, entry);
+    }
+    if (fuel_limit_ != 0)
+      return execute<FuelPolicy>(baseDepth, entry);
+    return execute<PlainPolicy>(baseDepth, entry);
+  }
+
+  void VM::prepareMemo(size_t baseDepth) {
+    if (memo_.empty()) {
+      memo_.resize(bc_.functions.size());
+      for (size_t f = 0; f < bc_.functions.size(); ++f)
+        if (bc_.functions[f].pure)
+          memo_[f].init(bc_.functions[f].arity, memo_capacity_);
+      memo_pending_.reserve(256);
+    }
+    // pending results of frames that did not return (a run that threw) are stale
+    while (!memo_pending_.empty() && memo_pending_.back().depth > baseDepth)
+      memo_pending_.pop_back();
+  }
+
+  std::string VM::memoReport() const {
+    uint64_t hits = 0, misses = 0;
+    for (const auto &m : memo_) {
+      hits += m.hits();
+      misses += m.misses();
+    }
+    std::string out;
+    char line[256];
+    std::snprintf(line, sizeof line, "memo: %llu hits, %llu misses (%.2f%% hit rate)\n", (unsigned long long)hits,
+                  (unsigned long long)misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    out += line;
+    if (hits + misses == 0)
+      return out;
+    out += "          hits        misses    hit%  function\n";
+    for (size_t f = 0; f < memo_.size(); ++f) {
+      const MemoCache &m = memo_[f];
+      if (m.hits() + m.misses() == 0)
+        continue;
+      std::snprintf(line, sizeof line, "%14llu %13llu %7.2f  %s\n", (unsigned long long)m.hits(), (unsigned long long)m.misses(),
+                    100.0 * m.hits() / (m.hits() + m.misses()), bc_.functions[f].name.c_str());
+      out += line;
+    }
+    return out;
+  }
+
+  std::string VM::profileReport(size_t topN) const {
+    std::string out = cost_.report(topN);
+    if (memo_enabled_)
+      out += memoReport();
+    return out;
+  }
+
+  VM::RunResult VM::start(const std::string &entry, uint64_t budget) {
+    uint32_t fnIndex = 0;
+    if (!find_function(bc_, entry, fnIndex))
+      throw std::runtime_error("entry function not found");
+    return startByIndex(fnIndex, budget);
+  }
+
+  VM::RunResult VM::startByIndex(uint32_t fnIndex, uint64_t budget) {
+    if (fnIndex >= calls_.size())
+      throw std::runtime_error("function index out of bounds");
+    if (suspended_)
+      throw std::runtime_error("a suspended run is pending; resume or reset it first");
+    ensureStack();
+    slice_sp_         = sp_;
+    slice_base_depth_ = pushEntryFrame(fnIndex);
+    return slice(calls_[fnIndex].entry, budget);
+  }
+
+  VM::RunResult VM::resume(uint64_t budget) {
+    if (!suspended_)
+      throw std::runtime_error("no suspended run to resume");
+    suspended_ = false;
+    return slice(resume_pc_, budget);
+  }
+
+  VM::RunResult VM::slice(uint32_t pc, uint64_t budget) {
+    slice_budget_ = budget;
+    slice_used_   = 0;
+    long long v   = 0;
+    try {
+      v = verified_ ? execute<SlicePolicy>(slice_base_depth_, pc) : execute<CheckedSlicePolicy>(slice_base_depth_, pc);
+    } catch (...) {
+      unwind(slice_base_depth_, slice_sp_);
+      throw;
+    }
+    if (suspended_)
+      return RunResult{RunStatus::Suspended, 0};
+    return RunResult{RunStatus::Finished, v};
+  }
+
+  size_t VM::pushEntryFrame(uint32_t fnIndex) {
+    if (bc_.fused.mask != 0 && bc_.fused.version != kSuperinstructionVersion)
+      throw std::runtime_error("bytecode uses an unsupported superinstruction set");
+    const CallDesc &fn = calls_[fnIndex];
+    ensureStack();
+    if (frames_.capacity() < max_call_depth_ && frames_.empty())
+      frames_.reserve(max_call_depth_);
+    // entry frame: arguments (if any) are already on the stack; the return ip is never
+    // used because returning from this frame leaves the interpreter
+    const size_t baseDepth = frames_.size();
+    VMValue *fp            = (size_t)(sp_ - stack_.base()) >= fn.arity ? sp_ - fn.arity : stack_.base();
+    if (fp + fn.locals + kStackHeadroom > stack_.limit() || frames_.size() >= max_call_depth_)
+      throw std::runtime_error("stack overflow");
+    for (VMValue *p = sp_; p < fp + fn.locals; ++p)
+      p->i = 0;
+    sp_ = fp + fn.locals;
+    frames_.push_back(CallFrame{0, fnIndex, (uint32_t)(fp - stack_.base()), fn.arity, fn.locals});
+    syncJitState();
+    return baseDepth;
+  }
+
+  // Load-time decode of the serialized byte code into fixed-width records: operands
+  // are read once, constants are inlined and jump targets become record indices.
+  void VM::predecode() {
+    const auto &code = bc_.code;
+    std::vector<uint32_t> recordAt(code.size() + 1, UINT32_MAX);
+    uint32_t ip = 0;
+    while (ip < code.size()) {
+      Op op = (Op)code[ip];
+      if (op > kLastOp)
+        throw std::runtime_error("unknown opcode");
+      uint32_t next = ip + 1 + op_operand_size(op);
+      if (next > code.size())
+        throw std::runtime_error("truncated instruction");
+      recordAt[ip] = (uint32_t)insns_.size();
+      insn_pc_.push_back(ip);
+      DecodedInsn in{};
+      in.op  = (uint16_t)op;
+      auto k = [&](uint32_t at) {
+        uint32_t idx = read_u32_at(code, at);
+        if (idx >= bc_.consts.size())
+          throw std::runtime_error("constant index out of range");
+        return bc_.consts[idx];
+      };
       switch (op) {
-      case OP_PUSH_CONST: {
-        uint32_t idx = read_u32(bc_.code, ip_);
-        push(bc_.consts[idx]);
-        break;
-      }
-      case OP_LOAD_LOCAL: {
-        uint32_t idx = read_u32(bc_.code, ip_);
-        auto bp      = frames_.back().bp;
-        push(stack_[bp + idx].i);
-        break;
-      }
-      case OP_LOAD_LOCAL8: {
-        uint32_t idx = bc_.code[ip_++];
-        auto bp      = frames_.back().bp;
-        push(stack_[bp + idx].i);
-        break;
-      }
-      case OP_STORE_LOCAL: {
-        uint32_t idx = read_u32(bc_.code, ip_);
-        auto bp      = frames_.back().bp;
-        long long v  = pop();
-        if (bp + idx >= stack_.size())
-          stack_.resize(bp + idx + 1);
-        stack_[bp + idx].i = v;
-        push(v);
-        break;
-      }
-      case OP_STORE_LOCAL8: {
-        uint32_t idx = bc_.code[ip_++];
-        auto bp      = frames_.back().bp;
-        long long v  = pop();
-        if (bp + idx >= stack_.size())
-          stack_.resize(bp + idx + 1);
-        stack_[bp + idx].i = v;
-        push(v);
-        break;
-      }
-      case OP_LD0: { auto bp = frames_.back().bp; push(stack_[bp + 0].i); break; }
-      case OP_LD1: { auto bp = frames_.back().bp; push(stack_[bp + 1].i); break; }
-      case OP_LD2: { auto bp = frames_.back().bp; push(stack_[bp + 2].i); break; }
-      case OP_LD3: { auto bp = frames_.back().bp; push(stack_[bp + 3].i); break; }
-      case OP_ST0: { auto bp = frames_.back().bp; auto v = pop(); stack_[bp + 0].i = v; push(v); break; }
-      case OP_ST1: { auto bp = frames_.back().bp; auto v = pop(); stack_[bp + 1].i = v; push(v); break; }
-      case OP_ST2: { auto bp = frames_.back().bp; auto v = pop(); stack_[bp + 2].i = v; push(v); break; }
-      case OP_ST3: { auto bp = frames_.back().bp; auto v = pop(); stack_[bp + 3].i = v; push(v); break; }
-      case OP_ADD: {
-        auto b = pop();
-        auto a = pop();
-        push(a + b);
-        break;
-      }
-      case OP_SUB: {
-        auto b = pop();
-        auto a = pop();
-        push(a - b);
-        break;
-      }
-      case OP_MUL: {
-        auto b = pop();
-        auto a = pop();
-        push(a * b);
-        break;
-      }
-      case OP_DIV: {
-        auto b = pop();
-        auto a = pop();
-        push(a / b);
-        break;
-      }
-      case OP_MOD: {
-        auto b = pop();
-        auto a = pop();
-        push(a % b);
-        break;
-      }
-      case OP_NEG: {
-        auto a = pop();
-        push(-a);
-        break;
-      }
-      case OP_EQ: {
-        auto b = pop();
-        auto a = pop();
-        push(a == b);
-        break;
-      }
-      case OP_NE: {
-        auto b = pop();
-        auto a = pop();
-        push(a != b);
-        break;
-      }
-      case OP_LT: {
-        auto b = pop();
-        auto a = pop();
-        push(a < b);
-        break;
-      }
-      case OP_LE: {
-        auto b = pop();
-        auto a = pop();
-        push(a <= b);
-        break;
-      }
-      case OP_GT: {
-        auto b = pop();
-        auto a = pop();
-        push(a > b);
-        break;
-      }
-      case OP_GE: {
-        auto b = pop();
-        auto a = pop();
-        push(a >= b);
-        break;
-      }
-      case OP_JMP: {
-        uint32_t dst = read_u32(bc_.code, ip_);
-        ip_          = dst;
-        break;
-      }
-      case OP_JMP_IF_FALSE: {
-        uint32_t dst = read_u32(bc_.code, ip_);
-        auto c       = pop();
-        if (!c)
-          ip_ = dst;
-        break;
-      }
-      case OP_JMP_IF_TRUE: {
-        uint32_t dst = read_u32(bc_.code, ip_);
-        auto c       = pop();
-        if (c)
-          ip_ = dst;
-        break;
-      }
-      case OP_AND: {
-        auto b = pop();
-        auto a = pop();
-        push((a != 0) && (b != 0));
-        break;
-      }
-      case OP_OR: {
-        auto b = pop();
-        auto a = pop();
-        push((a != 0) || (b != 0));
-        break;
-      }
-      case OP_NOT: {
-        auto a = pop();
-        push(a == 0);
-        break;
-      }
-      case OP_CALL: {
-        uint32_t idx    = read_u32(bc_.code, ip_);
-        auto callee     = bc_.functions[idx];
-        uint32_t bp     = (uint32_t)(stack_.size() - callee.arity);
-        uint32_t ret_ip = ip_; // return to next instruction after CALL
-        // pre-reserve locals to minimize resizes
-        if (stack_.size() < (size_t)(bp + callee.locals))
-          stack_.resize((size_t)(bp + callee.locals));
-        frames_.push_back(CallFrame{ret_ip, idx, bp, callee.arity, callee.locals});
-        ip_ = callee.entry;
-        break;
+      case OP_PUSH_CONST: in.k = k(ip + 1); break;
+      case OP_PUSH_I8:
+      case OP_PUSH_I32: in.k = immediate_at(code, ip); break;
+      case OP_LOAD_LOCAL:
+      case OP_STORE_LOCAL:
+      case OP_SET_LOCAL: in.b = read_u32_at(code, ip + 1); break;
+      case OP_LOAD_LOCAL8:
+      case OP_STORE_LOCAL8:
+      case OP_SET_LOCAL8:
+      case OP_ST_POP: in.a = code[ip + 1]; break;
+      case OP_JMP:
+      case OP_JMP_IF_FALSE:
+      case OP_JMP_IF_TRUE: in.b = read_u32_at(code, ip + 1); break; // byte offset, resolved below
+      case OP_CALL:
+      case OP_TAILCALL:
+        in.b = read_u32_at(code, ip + 1);
+        if (in.b >= bc_.functions.size())
+          throw std::runtime_error("call to unknown function index");
+        break;
+      case OP_INC_LOCAL:
+      case OP_LK_SUB:
+        in.a = code[ip + 1];
+        in.k = k(ip + 2);
+        break;
+      case OP_LL_LT_JF:
+      case OP_LL_LE_JF:
+        in.a = code[ip + 1];
+        in.k = code[ip + 2];
+        in.b = read_u32_at(code, ip + 3);
+        break;
+      case OP_LK_LT_JF:
+      case OP_LK_LE_JF:
+        in.a = code[ip + 1];
+        in.k = k(ip + 2);
+        in.b = read_u32_at(code, ip + 6);
+        break;
+      case OP_LL_ADD:
+        in.a = code[ip + 1];
+        in.k = code[ip + 2];
+        break;
+      default: break;
+      }
+      insns_.push_back(in);
+      ip = next;
+    }
+    // sentinel, so OP_POP's look-ahead never reads past the stream
+    recordAt[code.size()] = (uint32_t)insns_.size();
+    insns_.push_back(DecodedInsn{OP_HALT, 0, 0, 0});
+    insn_pc_.push_back((uint32_t)code.size());
+    for (auto &in : insns_) {
+      if (!op_is_jump((Op)in.op))
+        continue;
+      if (in.b > code.size() || recordAt[in.b] == UINT32_MAX)
+        throw std::runtime_error("jump target is not an instruction boundary");
+      in.b = recordAt[in.b];
+    }
+    for (auto &c : calls_) {
+      if (c.entry >= code.size() || recordAt[c.entry] == UINT32_MAX)
+        throw std::runtime_error("function entry is not an instruction boundary");
+      c.entry = recordAt[c.entry];
+    }
+  }
+
+  void VM::checkInsn(const DecodedInsn *in, const VMValue *sp, const VMValue *fp) const {
+    const uint32_t locals = frames_.back().locals;
+    auto local            = [&](uint32_t idx) {
+      if (idx >= locals)
+        throw std::runtime_error("local index out of range");
+    };
+    Op op = (Op)in->op;
+    switch (op) {
+    case OP_LD0:
+    case OP_ST0:
+    case OP_SET0: local(0); break;
+    case OP_LD1:
+    case OP_ST1:
+    case OP_SET1: local(1); break;
+    case OP_LD2:
+    case OP_ST2:
+    case OP_SET2: local(2); break;
+    case OP_LD3:
+    case OP_ST3:
+    case OP_SET3: local(3); break;
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_SET_LOCAL: local(in->b); break;
+    case OP_LOAD_LOCAL8:
+    case OP_STORE_LOCAL8:
+    case OP_SET_LOCAL8:
+    case OP_ST_POP:
+    case OP_INC_LOCAL:
+    case OP_LK_LT_JF:
+    case OP_LK_LE_JF:
+    case OP_LK_SUB: local(in->a); break;
+    case OP_LL_LT_JF:
+    case OP_LL_LE_JF:
+    case OP_LL_ADD:
+      local(in->a);
+      local((uint32_t)in->k);
+      break;
+    default: break;
+    }
+    StackEffect e = op_stack_effect(op, op == OP_CALL || op == OP_TAILCALL ? calls_[in->b].arity : 0);
+    if (op == OP_POP && in[1].op == OP_RET)
+      e.pops = 0;
+    if ((size_t)(sp - (fp + locals)) < e.pops)
+      throw std::runtime_error("operand stack underflow");
+    if (sp - e.pops + e.pushes > stack_.limit())
+      throw std::runtime_error("stack overflow");
+  }
+
+  template <typename Policy>
+  long long VM::execute(size_t baseDepth, uint32_t startPc) {
+    [[maybe_unused]] uint64_t steps = 0;
+    VMValue *const base     = stack_.base();
+    VMValue *sp             = sp_;                      // one past TOS, kept in a register
+    VMValue *fp             = base + frames_.back().bp; // current frame's locals
+    const DecodedInsn *code = insns_.data();
+    const DecodedInsn *pc   = code + startPc;
+    const DecodedInsn *in   = pc;
+    [[maybe_unused]] const DecodedInsn *mark = pc; // start of the stretch not yet charged
+#define PUSH(v) ((sp++)->i = (v))
+#define POP() ((--sp)->i)
+#if defined(MPLX_VM_HISTOGRAM)
+#define VM_HISTOGRAM_HOOK()                                                                         \
+  if constexpr (Policy::kHistogram) {                                                              \
+    histogram_.record(op);                                                                         \
+  }
+#else
+#define VM_HISTOGRAM_HOOK()
+#endif
+#define VM_HOOK()                                                                                   \
+  if constexpr (Policy::kChecked) {                                                                \
+    sp_ = sp;                                                                                      \
+    checkInsn(in, sp, fp);                                                                         \
+  }                                                                                                \
+  VM_HISTOGRAM_HOOK()                                                                              \
+  if constexpr (Policy::kTrace) {                                                                  \
+    /* Minimal trace: pc is the instruction's byte offset, stack size and TOS */                   \
+    if (trace_limit_ == 0 || steps < trace_limit_) {                                               \
+      long long tos = sp == base ? 0 : sp[-1].i;                                                   \
+      std::cout << "pc=" << insn_pc_[in - code] << " op=" << (int)op << " sp=" << (sp - base) << " tos=" << tos << "\n"; \
+    }                                                                                              \
+    ++steps;                                                                                       \
+  }                                                                                                \
+  if constexpr (Policy::kProfile) {                                                                \
+    ++op_counts_[(uint8_t)op];                                                                     \
+    seq_profile_.record(op);                                                                       \
+  }                                                                                                \
+  if constexpr (Policy::kCost) {                                                                   \
+    cost_.countInsn((uint32_t)(in - code));                                                        \
+    if (cost_.sampleDue())                                                                         \
+      cost_.sample(frames_);                                                                       \
+  }                                                                                                \
+  if constexpr (Policy::kFuel) {                                                                   \
+    if (fuel_limit_ != 0 && ++fuel_used_ > fuel_limit_)                                            \
+      throw std::runtime_error("instruction budget exhausted");                                    \
+  }
+// Slice budget: a stretch of code between two control transfers runs front to back, so
+// `in - mark + 1` bounds the records executed since the last charge. CHARGE runs at every
+// backward jump, call and return; YIELD_POINT suspends with pc as the resume point.
+#define CHARGE()                                                                                    \
+  if constexpr (Policy::kSlice) {                                                                  \
+    slice_used_ += (uint64_t)(in - mark) + 1;                                                      \
+    mark = pc;                                                                                     \
+  }
+#define YIELD_POINT()                                                                               \
+  if constexpr (Policy::kSlice) {                                                                  \
+    if (slice_used_ >= slice_budget_) {                                                            \
+      sp_        = sp;                                                                             \
+      resume_pc_ = (uint32_t)(pc - code);                                                          \
+      suspended_ = true;                                                                           \
+      return 0;                                                                                    \
+    }                                                                                              \
+  }
+#define BACK_EDGE()                                                                                 \
+  if constexpr (Policy::kSlice) {                                                                  \
+    if (pc <= in) {                                                                                \
+      CHARGE()                                                                                     \
+      YIELD_POINT()                                                                                \
+    }                                                                                              \
+  }
+#define VM_FETCH() (in = pc++, op = in->op)
+#define VM_LAST_OP kLastOp
+#define VM_LABELS                                                                                   \
+  &&L_OP_PUSH_CONST, &&L_OP_LD0, &&L_OP_LD1, &&L_OP_LD2, &&L_OP_LD3, &&L_OP_ST0, &&L_OP_ST1,       \
+      &&L_OP_ST2, &&L_OP_ST3, &&L_OP_LOAD_LOCAL8, &&L_OP_STORE_LOCAL8, &&L_OP_LOAD_LOCAL,          \
+      &&L_OP_STORE_LOCAL, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV, &&L_OP_MOD, &&L_OP_NEG,  \
+      &&L_OP_EQ, &&L_OP_NE, &&L_OP_LT, &&L_OP_LE, &&L_OP_GT, &&L_OP_GE, &&L_OP_JMP,                \
+      &&L_OP_JMP_IF_FALSE, &&L_OP_JMP_IF_TRUE, &&L_OP_AND, &&L_OP_OR, &&L_OP_NOT, &&L_OP_CALL,     \
+      &&L_OP_RET, &&L_OP_POP, &&L_OP_HALT, &&L_OP_PUSH_I8, &&L_OP_PUSH_I32, &&L_OP_SET0,           \
+      &&L_OP_SET1, &&L_OP_SET2, &&L_OP_SET3, &&L_OP_SET_LOCAL8, &&L_OP_SET_LOCAL, &&L_OP_TAILCALL, \
+      &&L_OP_ST_POP, &&L_OP_INC_LOCAL, &&L_OP_LL_LT_JF, &&L_OP_LL_LE_JF, &&L_OP_LK_LT_JF,          \
+      &&L_OP_LK_LE_JF, &&L_OP_LL_ADD, &&L_OP_LK_SUB
+#define BINARY(name, expr)                                                                          \
+  VM_CASE(name) {                                                                                  \
+    auto b = POP();                                                                                \
+    auto a = POP();                                                                                \
+    PUSH(expr);                                                                                    \
+    VM_NEXT();                                                                                     \
+  }
+    VM_LOOP_BEGIN()
+      VM_CASE(OP_PUSH_CONST) {
+        PUSH(in->k);
+        VM_NEXT();
+      }
+      VM_CASE(OP_PUSH_I8) {
+        PUSH(in->k);
+        VM_NEXT();
+      }
+      VM_CASE(OP_PUSH_I32) {
+        PUSH(in->k);
+        VM_NEXT();
+      }
+      VM_CASE(OP_LOAD_LOCAL) {
+        PUSH(fp[in->b].i);
+        VM_NEXT();
+      }
+      VM_CASE(OP_LOAD_LOCAL8) {
+        PUSH(fp[in->a].i);
+        VM_NEXT();
+      }
+      VM_CASE(OP_STORE_LOCAL) {
+        fp[in->b].i = sp[-1].i;
+        VM_NEXT();
+      }
+      VM_CASE(OP_STORE_LOCAL8) {
+        fp[in->a].i = sp[-1].i;
+        VM_NEXT();
+      }
+      VM_CASE(OP_LD0) { PUSH(fp[0].i); VM_NEXT(); }
+      VM_CASE(OP_LD1) { PUSH(fp[1].i); VM_NEXT(); }
+      VM_CASE(OP_LD2) { PUSH(fp[2].i); VM_NEXT(); }
+      VM_CASE(OP_LD3) { PUSH(fp[3].i); VM_NEXT(); }
+      // stores leave the value on the stack
+      VM_CASE(OP_ST0) { fp[0].i = sp[-1].i; VM_NEXT(); }
+      VM_CASE(OP_ST1) { fp[1].i = sp[-1].i; VM_NEXT(); }
+      VM_CASE(OP_ST2) { fp[2].i = sp[-1].i; VM_NEXT(); }
+      VM_CASE(OP_ST3) { fp[3].i = sp[-1].i; VM_NEXT(); }
+      VM_CASE(OP_SET0) { fp[0].i = POP(); VM_NEXT(); }
+      VM_CASE(OP_SET1) { fp[1].i = POP(); VM_NEXT(); }
+      VM_CASE(OP_SET2) { fp[2].i = POP(); VM_NEXT(); }
+      VM_CASE(OP_SET3) { fp[3].i = POP(); VM_NEXT(); }
+      VM_CASE(OP_SET_LOCAL8) {
+        fp[in->a].i = POP();
+        VM_NEXT();
+      }
+      VM_CASE(OP_SET_LOCAL) {
+        fp[in->b].i = POP();
+        VM_NEXT();
+      }
+      BINARY(OP_ADD, a + b)
+      BINARY(OP_SUB, a - b)
+      BINARY(OP_MUL, a * b)
+      BINARY(OP_DIV, a / b)
+      BINARY(OP_MOD, a % b)
+      VM_CASE(OP_NEG) {
+        auto a = POP();
+        PUSH(-a);
+        VM_NEXT();
+      }
+      BINARY(OP_EQ, a == b)
+      BINARY(OP_NE, a != b)
+      BINARY(OP_LT, a < b)
+      BINARY(OP_LE, a <= b)
+      BINARY(OP_GT, a > b)
+      BINARY(OP_GE, a >= b)
+      VM_CASE(OP_JMP) {
+        pc = code + in->b;
+        BACK_EDGE()
+        VM_NEXT();
+      }
+      VM_CASE(OP_JMP_IF_FALSE) {
+        if (!POP()) {
+          pc = code + in->b;
+          BACK_EDGE()
+        }
+        VM_NEXT();
       }
-      case OP_RET: {
-        long long ret = pop();
-        auto frame    = frames_.back();
+      VM_CASE(OP_JMP_IF_TRUE) {
+        if (POP()) {
+          pc = code + in->b;
+          BACK_EDGE()
+        }
+        VM_NEXT();
+      }
+      BINARY(OP_AND, (a != 0) && (b != 0))
+      BINARY(OP_OR, (a != 0) || (b != 0))
+      VM_CASE(OP_NOT) {
+        auto a = POP();
+        PUSH(a == 0);
+        VM_NEXT();
+      }
+      VM_CASE(OP_CALL) {
+        uint32_t idx           = in->b;
+        const CallDesc &callee = calls_[idx];
+        if constexpr (Policy::kMemo) {
+          if (memo_[idx].enabled()) {
+            long long v;
+            if (memo_[idx].lookup(sp - callee.arity, v)) {
+              sp -= callee.arity;
+              PUSH(v);
+              VM_NEXT();
+            }
+            // remember the arguments: the callee may overwrite its parameters
+            MemoPending &p = memo_pending_.emplace_back();
+            p.depth        = frames_.size() + 1;
+            p.fn           = idx;
+            for (unsigned i = 0; i < callee.arity; ++i)
+              p.args[i] = sp[(int)i - (int)callee.arity].i;
+          }
+        }
+        VMValue *nfp = sp - callee.arity;
+        if (nfp + callee.locals + kStackHeadroom > stack_.limit() || frames_.size() >= max_call_depth_) {
+          sp_ = sp;
+          throw std::runtime_error("stack overflow");
+        }
+        // zero the non-argument locals
+        for (VMValue *p = sp; p < nfp + callee.locals; ++p)
+          p->i = 0;
+        sp = nfp + callee.locals;
+        fp = nfp;
+        // return to the record after the CALL
+        frames_.push_back(CallFrame{(uint32_t)(pc - code), idx, (uint32_t)(nfp - base), callee.arity, callee.locals});
+        sp_ = sp;
+        syncJitState();
+        pc = code + callee.entry;
+        if constexpr (Policy::kCost)
+          cost_.countCall(idx);
+        CHARGE()
+        YIELD_POINT()
+        VM_NEXT();
+      }
+      VM_CASE(OP_TAILCALL) {
+        uint32_t idx           = in->b;
+        const CallDesc &callee = calls_[idx];
+        if constexpr (Policy::kMemo) {
+          if (memo_[idx].enabled()) {
+            long long v;
+            if (memo_[idx].lookup(sp - callee.arity, v)) {
+              sp -= callee.arity;
+              PUSH(v);
+              VM_NEXT(); // the RET that follows returns it
+            }
+            // the callee's result is this frame's: the RET of the reused frame records both
+            MemoPending &p = memo_pending_.emplace_back();
+            p.depth        = frames_.size();
+            p.fn           = idx;
+            for (unsigned i = 0; i < callee.arity; ++i)
+              p.args[i] = sp[(int)i - (int)callee.arity].i;
+          }
+        }
+        if (fp + callee.locals + kStackHeadroom > stack_.limit()) {
+          sp_ = sp;
+          throw std::runtime_error("stack overflow");
+        }
+        // the arguments sit above this frame's locals, so copying them down in order is safe
+        const VMValue *args = sp - callee.arity;
+        for (unsigned i = 0; i < callee.arity; ++i)
+          fp[i] = args[i];
+        for (VMValue *p = fp + callee.arity; p < fp + callee.locals; ++p)
+          p->i = 0;
+        sp                = fp + callee.locals;
+        CallFrame &frame  = frames_.back();
+        frame.fn          = idx;
+        frame.arity       = callee.arity;
+        frame.locals      = callee.locals;
+        sp_               = sp;
+        syncJitState();
+        pc = code + callee.entry;
+        if constexpr (Policy::kCost)
+          cost_.countCall(idx);
+        CHARGE()
+        YIELD_POINT()
+        VM_NEXT();
+      }
+      VM_CASE(OP_RET) {
+        long long ret   = POP();
+        if constexpr (Policy::kMemo) {
+          // a frame reused by TAILCALLs has one pending entry per memoized call it made
+          while (!memo_pending_.empty() && memo_pending_.back().depth == frames_.size()) {
+            const MemoPending &p = memo_pending_.back();
+            memo_[p.fn].insert(p.args, ret);
+            memo_pending_.pop_back();
+          }
+        }
+        CallFrame frame = frames_.back();
         frames_.pop_back();
         // drop stack to base pointer
-        stack_.resize(frame.bp);
-        push(ret);
-        // after returning to caller, bp changes
-        jit_state_.bp_index = frames_.empty() ? 0 : frames_.back().bp;
-        if (frames_.empty())
+        sp  = base + frame.bp;
+        sp_ = sp;
+        if (frames_.size() == baseDepth) {
+          syncJitState();
           return ret;
-        ip_ = frame.ip;
-        break;
+        }
+        PUSH(ret);
+        sp_ = sp;
+        // after returning to caller, bp changes
+        fp = base + frames_.back().bp;
+        syncJitState();
+        pc = code + frame.ip;
+        CHARGE()
+        VM_NEXT();
       }
-      case OP_POP: {
+      VM_CASE(OP_POP) {
         // fast-path: if next instruction is RET, skip actual pop
-        Op next = (ip_ < bc_.code.size()) ? (Op)bc_.code[ip_] : OP_HALT;
-        if (next == OP_RET) {
-          break;
+        if (pc->op == OP_RET) {
+          VM_NEXT();
         }
-        (void)pop();
-        break;
+        (void)POP();
+        VM_NEXT();
+      }
+      VM_CASE(OP_HALT) {
+        long long v = POP();
+        sp_         = sp;
+        return v;
+      }
+      // superinstructions; the rewriter only fuses in-range locals
+      VM_CASE(OP_ST_POP) {
+        fp[in->a].i = POP();
+        VM_NEXT();
+      }
+      VM_CASE(OP_INC_LOCAL) {
+        fp[in->a].i += in->k;
+        VM_NEXT();
+      }
+      VM_CASE(OP_LL_LT_JF) {
+        if (!(fp[in->a].i < fp[in->k].i)) {
+          pc = code + in->b;
+          BACK_EDGE()
+        }
+        VM_NEXT();
       }
-      case OP_HALT:
-        return pop();
-      default:
-        throw std::runtime_error("unknown opcode");
+      VM_CASE(OP_LL_LE_JF) {
+        if (!(fp[in->a].i <= fp[in->k].i)) {
+          pc = code + in->b;
+          BACK_EDGE()
+        }
+        VM_NEXT();
       }
-    }
+      VM_CASE(OP_LK_LT_JF) {
+        if (!(fp[in->a].i < in->k)) {
+          pc = code + in->b;
+          BACK_EDGE()
+        }
+        VM_NEXT();
+      }
+      VM_CASE(OP_LK_LE_JF) {
+        if (!(fp[in->a].i <= in->k)) {
+          pc = code + in->b;
+          BACK_EDGE()
+        }
+        VM_NEXT();
+      }
+      VM_CASE(OP_LL_ADD) {
+        PUSH(fp[in->a].i + fp[in->k].i);
+        VM_NEXT();
+      }
+      VM_CASE(OP_LK_SUB) {
+        PUSH(fp[in->a].i - in->k);
+        VM_NEXT();
+      }
+    VM_LOOP_END()
+#undef BINARY
+#undef BACK_EDGE
+#undef YIELD_POINT
+#undef CHARGE
+#undef VM_LABELS
+#undef VM_LAST_OP
+#undef VM_FETCH
+#undef VM_HOOK
+#undef VM_HISTOGRAM_HOOK
+#undef POP
+#undef PUSH
   }
 
-} 
\ No newline at end of file
+}
@@ -1,5 +1,13 @@
 ﻿#pragma once
 #include "../mplx-compiler/bytecode.hpp"
+#include "../mplx-compiler/superinstructions.hpp"
+#include "cost_profile.hpp"
+#include "memo_cache.hpp"
+#if defined(MPLX_VM_HISTOGRAM)
+#include "op_histogram.hpp"
+#endif
+#include "value_stack.hpp"
+#include <array>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -8,24 +16,67 @@
 
 namespace mplx {
 
-  struct VMValue {
-    long long i;
-  };
-
   struct CallFrame {
-    uint32_t ip;
+    uint32_t ip; // return address: index into the decoded instruction stream
     uint32_t fn;
     uint32_t bp;
     uint8_t arity;
     uint16_t locals;
   };
 
+  // What OP_CALL needs from FuncMeta, without the name or JIT bookkeeping
+  struct CallDesc {
+    uint32_t entry;
+    uint8_t arity;
+    uint16_t locals;
+  };
+
+  // One pre-decoded instruction (see VM::predecode). Operands are resolved at load time:
+  // `k` holds the constant (or the second local of the LL_* superinstructions), `b` a
+  // jump target as a record index, a function index or a wide local index, `a` a
+  // narrow local index.
+  struct DecodedInsn {
+    uint16_t op;
+    uint16_t a;
+    uint32_t b;
+    long long k;
+  };
+  static_assert(sizeof(DecodedInsn) == 16, "decoded instructions are 16-byte records");
+
   class VM {
   public:
-    explicit VM(const Bytecode &bc) : bc_(bc) {}
+    // Pre-decodes bc.code; throws std::runtime_error if it is malformed. The module is then
+    // checked by verify_bytecode (verifier.hpp): verified code runs on interpreter cores
+    // without dynamic checks, anything else on a checked core that validates every local
+    // index and stack access and throws std::runtime_error on a violation. The checked
+    // core honours the fuel budget but not trace, profile, cost, histogram or memo settings.
+    explicit VM(const Bytecode &bc);
     long long run(const std::string &entry = "main");
     // v0 JIT helper: run by function index (no argument marshalling beyond VM's own stack)
     long long runByIndex(uint32_t fnIndex);
+    // Runs fnIndex with `args` as its parameters; nargs must equal the function's arity
+    long long call(uint32_t fnIndex, const long long *args, size_t nargs);
+
+    // Resumable execution (cooperative preemption). start() runs a function until it
+    // returns or about `budget` instructions have executed, then returns Suspended with the
+    // frames and stack left in place; resume() continues with a fresh budget. The budget is
+    // only checked at backward jumps and calls, so a slice can overshoot it by one
+    // straight-line stretch of code. Trace, profile and fuel settings do not apply here.
+    enum class RunStatus { Finished, Suspended };
+    struct RunResult {
+      RunStatus status;
+      long long value; // return value once Finished
+    };
+    RunResult start(const std::string &entry, uint64_t budget);
+    RunResult startByIndex(uint32_t fnIndex, uint64_t budget);
+    RunResult resume(uint64_t budget);
+    bool isSuspended() const { return suspended_; }
+
+    // Drops any state left by earlier runs: the frames and stack of a suspended run, profile
+    // counters (opcode and cost) and fuel used. A run that throws unwinds its own frames, so
+    // errors need no reset(). Keeps the stack, frame and decoded-code storage, so the next
+    // run does not allocate.
+    void reset();
     // JIT mode
     enum class JitMode { Off, On, Auto };
     void setJitMode(JitMode m) { jit_mode_ = m; }
@@ -38,6 +89,68 @@ namespace mplx {
     bool isTraceEnabled() const { return trace_enabled_; }
     uint64_t traceLimit() const { return trace_limit_; }
 
+    // Per-opcode execution counts (accumulated across runs while profiling is on)
+    void setProfile(bool enabled) { profile_enabled_ = enabled; }
+    bool isProfileEnabled() const { return profile_enabled_; }
+    const std::array<uint64_t, 256> &opcodeCounts() const { return op_counts_; }
+    // Opcode pair/triple counts, input for select_superinstructions()
+    const OpSequenceProfile &sequenceProfile() const { return seq_profile_; }
+    // Per-function and per-instruction cost profile (instructions, calls, sampled
+    // self/total time), accumulated across runs; trace and opcode profiling take precedence
+    void setCostProfile(bool enabled, uint32_t sampleIntervalUs = 1000) {
+      cost_enabled_     = enabled;
+      cost_interval_us_ = sampleIntervalUs;
+    }
+    const CostProfile &costProfile() const { return cost_; }
+    // Cost report followed by the memo cache hit rates when memoizing
+    std::string profileReport(size_t topN = 20) const;
+
+    // Memoize pure functions (FuncMeta::pure) of 1..MemoCache::kMaxArity arguments: a call
+    // with an argument tuple seen before returns the cached result without running the
+    // body. Each function gets a cache of `entriesPerFunction` results; caches survive
+    // reset() since the results stay valid.
+    void setMemoize(bool enabled, size_t entriesPerFunction = 4096) {
+      memo_enabled_  = enabled;
+      memo_capacity_ = entriesPerFunction;
+      memo_.clear();
+    }
+    bool isMemoizing() const { return memo_enabled_; }
+    // Hits and misses per memoized function
+    std::string memoReport() const;
+#if defined(MPLX_VM_HISTOGRAM)
+    // Opcode and opcode-pair execution counts (accumulated across runs while on). Only
+    // in builds configured with -DMPLX_VM_HISTOGRAM=ON; otherwise none of it is compiled.
+    void setHistogram(bool enabled) { histogram_enabled_ = enabled; }
+    const OpHistogram &histogram() const { return histogram_; }
+#endif
+
+    // Instruction budget: 0 = unlimited; exceeding it throws std::runtime_error
+    void setFuel(uint64_t limit) { fuel_limit_ = limit; fuel_used_ = 0; }
+    uint64_t fuelUsed() const { return fuel_used_; }
+
+    // Value stack capacity in slots (default kDefaultStackSlots). Takes effect on the
+    // next run; exceeding it raises std::runtime_error("stack overflow").
+    void setStackSize(size_t slots) { stack_slots_ = slots; }
+    size_t stackSize() const { return stack_slots_; }
+    static constexpr size_t kDefaultStackSlots = size_t(1) << 20;
+    // Maximum call depth; the frame stack is reserved up front so calls never allocate
+    void setMaxCallDepth(size_t frames) { max_call_depth_ = frames; }
+    size_t maxCallDepth() const { return max_call_depth_; }
+    static constexpr size_t kDefaultMaxCallDepth = size_t(1) << 18;
+    // Slots kept free above a new frame's locals for expression temporaries
+    static constexpr size_t kStackHeadroom = 256;
+
+    // Whether the module passed the verifier, and its findings if not
+    bool isVerified() const { return verified_; }
+    const std::vector<std::string> &verifyErrors() const { return verify_errors_; }
+    // Decoded instruction stream (ending in a HALT sentinel) and the record index of each
+    // function's entry, for executors that reuse the VM's decoding (LaneRunner)
+    const std::vector<DecodedInsn> &decodedCode() const { return insns_; }
+    uint32_t decodedEntry(uint32_t fnIndex) const { return calls_[fnIndex].entry; }
+
+    // Interpreter dispatch engine compiled in: "threaded" (computed goto) or "switch"
+    static const char *dispatchEngine();
+
     // Minimal ABI snapshot for JIT codegen (stable layout)
     struct JitVmState {
       long long *stack_ptr{nullptr};
@@ -48,14 +161,77 @@ namespace mplx {
 
   private:
     const Bytecode &bc_;
-    std::vector<VMValue> stack_;
+    ValueStack stack_;
+    size_t stack_slots_{kDefaultStackSlots};
+    VMValue *sp_{nullptr}; // one past TOS; the core keeps it in a local and spills on exit
+    std::vector<CallDesc> calls_; // indexed like bc_.functions; entry is a record index
+    std::vector<DecodedInsn> insns_;
+    std::vector<uint32_t> insn_pc_; // byte offset of each record in bc_.code, for tracing
+    bool verified_{false};
+    std::vector<std::string> verify_errors_;
     std::vector<CallFrame> frames_;
-    uint32_t ip_{0};
+    size_t max_call_depth_{kDefaultMaxCallDepth};
     JitVmState jit_state_{};
     JitMode jit_mode_{JitMode::Auto};
     uint32_t hot_threshold_{1};
     bool trace_enabled_{false};
     uint64_t trace_limit_{0};
+    bool profile_enabled_{false};
+    std::array<uint64_t, 256> op_counts_{};
+    OpSequenceProfile seq_profile_;
+    bool cost_enabled_{false};
+    uint32_t cost_interval_us_{1000};
+    CostProfile cost_;
+    // memoization (see setMemoize); a pending entry is filled when the frame at `depth` returns
+    struct MemoPending {
+      size_t depth;
+      uint32_t fn;
+      long long args[MemoCache::kMaxArity];
+    };
+    bool memo_enabled_{false};
+    size_t memo_capacity_{4096};
+    std::vector<MemoCache> memo_;
+    std::vector<MemoPending> memo_pending_;
+#if defined(MPLX_VM_HISTOGRAM)
+    bool histogram_enabled_{false};
+    OpHistogram histogram_;
+#endif
+    uint64_t fuel_limit_{0};
+    uint64_t fuel_used_{0};
+    // resumable execution state (see start/resume)
+    bool suspended_{false};
+    uint32_t resume_pc_{0};
+    size_t slice_base_depth_{0};
+    VMValue *slice_sp_{nullptr};
+    uint64_t slice_budget_{0};
+    uint64_t slice_used_{0};
+
+    // Allocates the value stack on first use or after setStackSize
+    void ensureStack();
+    // Runs fnIndex, whose `nargs` arguments the caller has pushed. When the run throws, the
+    // frames and the stack pointer go back to what they were before the arguments, so the
+    // VM (and any run it is nested in) can go on.
+    long long enter(uint32_t fnIndex, size_t nargs);
+    // Drops the frames above `depth` and sets the stack pointer to `sp`
+    void unwind(size_t depth, VMValue *sp);
+    // Sets up the entry frame for fnIndex and runs the interpreter core with the policy
+    // selected from the trace/profile/fuel settings.
+    long long runEntry(uint32_t fnIndex);
+    // Builds the memo caches on first use and drops pending entries above baseDepth
+    void prepareMemo(size_t baseDepth);
+    // Pushes the entry frame for fnIndex; returns the frame depth below it
+    size_t pushEntryFrame(uint32_t fnIndex);
+    // Runs the sliced interpreter from record `pc` with a fresh budget
+    RunResult slice(uint32_t pc, uint64_t budget);
+    // Builds insns_ from bc_.code; throws std::runtime_error on malformed code
+    void predecode();
+    // Checked core only: throws unless `in` stays inside the current frame's locals and the
+    // value stack when executed with the given stack and frame pointers
+    void checkInsn(const DecodedInsn *in, const VMValue *sp, const VMValue *fp) const;
+    // Single interpreter core, starting at record startPc of the innermost frame; returns
+    // when the frame stack drops back to baseDepth (or when a SlicePolicy run suspends).
+    template <typename Policy>
+    long long execute(size_t baseDepth, uint32_t startPc);
 
 #if defined(MPLX_WITH_JIT)
     // JIT placeholders for future integration
@@ -66,20 +242,14 @@ namespace mplx {
     std::unordered_map<uint32_t, std::unique_ptr<uint8_t[]>> jit_mem_;
 
   private:
+    std::vector<uint32_t> hot_counts_; // run() entries per function, for JitMode::Auto
 #endif
 
-    void push(long long x) {
-      stack_.push_back(VMValue{x});
-      // keep ABI state in sync
-      jit_state_.stack_ptr = (stack_.empty() ? nullptr : &stack_[0].i);
-      jit_state_.sp_index  = (uint64_t)stack_.size();
-    }
-    long long pop() {
-      auto v = stack_.back().i;
-      stack_.pop_back();
-      jit_state_.stack_ptr = (stack_.empty() ? nullptr : &stack_[0].i);
-      jit_state_.sp_index  = (uint64_t)stack_.size();
-      return v;
+    // JIT ABI state is only refreshed at call boundaries, not per push/pop
+    void syncJitState() {
+      jit_state_.stack_ptr = &stack_.base()->i;
+      jit_state_.sp_index  = (uint64_t)(sp_ - stack_.base());
+      jit_state_.bp_index  = frames_.empty() ? 0 : frames_.back().bp;
     }
   };
 
@@ -0,0 +1,28 @@
+#include "vm_pool.hpp"
+
+namespace mplx {
+
+  VMPool &VMPool::local() {
+    static thread_local VMPool pool;
+    return pool;
+  }
+
+  VM &VMPool::acquire(const Bytecode &bc) {
+    auto it = vms_.find(&bc);
+    // a different module at a recycled address gets a fresh VM
+    if (it != vms_.end() && it->second.module_id != bc.module_id) {
+      vms_.erase(it);
+      it = vms_.end();
+    }
+    if (it == vms_.end())
+      it = vms_.emplace(&bc, Slot{bc.module_id, std::make_unique<VM>(bc)}).first;
+    VM &vm = *it->second.vm;
+    vm.reset();
+    return vm;
+  }
+
+  void VMPool::release(const Bytecode &bc) {
+    vms_.erase(&bc);
+  }
+
+} // namespace mplx
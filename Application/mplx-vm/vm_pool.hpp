@@ -0,0 +1,31 @@
+#pragma once
+#include "vm.hpp"
+#include <memory>
+#include <unordered_map>
+
+namespace mplx {
+
+  // Per-thread cache of VMs, one per module, so repeated runs of the same Bytecode reuse
+  // the decoded code, value stack and frame stack instead of building a VM each time.
+  // A VM keeps a reference to its Bytecode: release() a module before destroying it.
+  class VMPool {
+  public:
+    // The calling thread's pool
+    static VMPool &local();
+
+    // A reset VM for `bc`, created on first use. Settings made on it (stack size, JIT
+    // mode, ...) persist across acquires. The reference stays valid until release()/clear().
+    VM &acquire(const Bytecode &bc);
+    void release(const Bytecode &bc);
+    void clear() { vms_.clear(); }
+    size_t size() const { return vms_.size(); }
+
+  private:
+    struct Slot {
+      uint64_t module_id;
+      std::unique_ptr<VM> vm;
+    };
+    std::unordered_map<const Bytecode *, Slot> vms_;
+  };
+
+} // namespace mplx
@@ -1,70 +1,108 @@
 ﻿#pragma once
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
 namespace mplx {
 
+  // Every node carries its kind, so passes switch on it (and static_cast to the node type)
+  // instead of probing with dynamic_cast
+  enum class ExprKind : uint8_t { Literal, Var, Unary, Binary, Call };
+  enum class StmtKind : uint8_t { Let, Assign, Return, Expr, If, While };
+
+  enum class UnaryOp : uint8_t { Neg };
+  enum class BinOp : uint8_t { Add, Sub, Mul, Div, Eq, Ne, Lt, Le, Gt, Ge };
+
+  // Source spelling of an operator, for diagnostics and dumps
+  inline const char *unary_op_spelling(UnaryOp op) {
+    switch (op) {
+    case UnaryOp::Neg: return "-";
+    }
+    return "?";
+  }
+  inline const char *binop_spelling(BinOp op) {
+    switch (op) {
+    case BinOp::Add: return "+";
+    case BinOp::Sub: return "-";
+    case BinOp::Mul: return "*";
+    case BinOp::Div: return "/";
+    case BinOp::Eq: return "==";
+    case BinOp::Ne: return "!=";
+    case BinOp::Lt: return "<";
+    case BinOp::Le: return "<=";
+    case BinOp::Gt: return ">";
+    case BinOp::Ge: return ">=";
+    }
+    return "?";
+  }
+
   struct Expr {
+    const ExprKind kind;
+    explicit Expr(ExprKind k) : kind(k) {}
     virtual ~Expr() = default;
   };
 
   struct LiteralExpr : Expr {
     long long value;
-    explicit LiteralExpr(long long v) : value(v) {}
+    explicit LiteralExpr(long long v) : Expr(ExprKind::Literal), value(v) {}
   };
   struct VarExpr : Expr {
     std::string name;
-    explicit VarExpr(std::string n) : name(std::move(n)) {}
+    explicit VarExpr(std::string n) : Expr(ExprKind::Var), name(std::move(n)) {}
   };
   struct UnaryExpr : Expr {
-    std::string op;
+    UnaryOp op;
     std::unique_ptr<Expr> rhs;
-    UnaryExpr(std::string o, std::unique_ptr<Expr> r) : op(std::move(o)), rhs(std::move(r)) {}
+    UnaryExpr(UnaryOp o, std::unique_ptr<Expr> r) : Expr(ExprKind::Unary), op(o), rhs(std::move(r)) {}
   };
   struct BinaryExpr : Expr {
-    std::string op;
+    BinOp op;
     std::unique_ptr<Expr> lhs, rhs;
-    BinaryExpr(std::unique_ptr<Expr> l, std::string o, std::unique_ptr<Expr> r) : op(std::move(o)), lhs(std::move(l)), rhs(std::move(r)) {}
+    BinaryExpr(std::unique_ptr<Expr> l, BinOp o, std::unique_ptr<Expr> r)
+        : Expr(ExprKind::Binary), op(o), lhs(std::move(l)), rhs(std::move(r)) {}
   };
   struct CallExpr : Expr {
     std::string callee;
     std::vector<std::unique_ptr<Expr>> args;
-    explicit CallExpr(std::string c) : callee(std::move(c)) {}
+    explicit CallExpr(std::string c) : Expr(ExprKind::Call), callee(std::move(c)) {}
   };
 
   struct Stmt {
+    const StmtKind kind;
+    explicit Stmt(StmtKind k) : kind(k) {}
     virtual ~Stmt() = default;
   };
   struct LetStmt : Stmt {
     std::string name;
     std::unique_ptr<Expr> init;
-    LetStmt(std::string n, std::unique_ptr<Expr> i) : name(std::move(n)), init(std::move(i)) {}
+    LetStmt(std::string n, std::unique_ptr<Expr> i) : Stmt(StmtKind::Let), name(std::move(n)), init(std::move(i)) {}
   };
   struct AssignStmt : Stmt {
     std::string name;
     std::unique_ptr<Expr> value;
-    AssignStmt(std::string n, std::unique_ptr<Expr> v) : name(std::move(n)), value(std::move(v)) {}
+    AssignStmt(std::string n, std::unique_ptr<Expr> v) : Stmt(StmtKind::Assign), name(std::move(n)), value(std::move(v)) {}
   };
   struct ReturnStmt : Stmt {
     std::unique_ptr<Expr> value;
-    explicit ReturnStmt(std::unique_ptr<Expr> v) : value(std::move(v)) {}
+    explicit ReturnStmt(std::unique_ptr<Expr> v) : Stmt(StmtKind::Return), value(std::move(v)) {}
   };
   struct ExprStmt : Stmt {
     std::unique_ptr<Expr> expr;
-    explicit ExprStmt(std::unique_ptr<Expr> e) : expr(std::move(e)) {}
+    explicit ExprStmt(std::unique_ptr<Expr> e) : Stmt(StmtKind::Expr), expr(std::move(e)) {}
   };
   struct IfStmt : Stmt {
     std::unique_ptr<Expr> cond;
     std::vector<std::unique_ptr<Stmt>> thenS;
     std::vector<std::unique_ptr<Stmt>> elseS;
+    IfStmt() : Stmt(StmtKind::If) {}
   };
 
   struct WhileStmt : Stmt {
     std::unique_ptr<Expr> cond;
     std::vector<std::unique_ptr<Stmt>> body;
     WhileStmt(std::unique_ptr<Expr> c, std::vector<std::unique_ptr<Stmt>> b)
-        : cond(std::move(c)), body(std::move(b)) {}
+        : Stmt(StmtKind::While), cond(std::move(c)), body(std::move(b)) {}
   };
 
   struct Param {
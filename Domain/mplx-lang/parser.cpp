@@ -227,8 +227,8 @@ namespace mplx {
   std::unique_ptr<Expr> Parser::equality() {
     auto e = comparison();
     while (check(TokenKind::EqEq) || check(TokenKind::BangEq)) {
-      std::string op = advance().lexeme;
-      auto r         = comparison();
+      BinOp op = advance().kind == TokenKind::EqEq ? BinOp::Eq : BinOp::Ne;
+      auto r   = comparison();
       e              = std::make_unique<BinaryExpr>(std::move(e), op, std::move(r));
     }
     return e;
@@ -237,8 +237,9 @@ namespace mplx {
   std::unique_ptr<Expr> Parser::comparison() {
     auto e = term();
     while (check(TokenKind::Lt) || check(TokenKind::Le) || check(TokenKind::Gt) || check(TokenKind::Ge)) {
-      std::string op = advance().lexeme;
-      auto r         = term();
+      TokenKind k = advance().kind;
+      BinOp op    = k == TokenKind::Lt ? BinOp::Lt : k == TokenKind::Le ? BinOp::Le : k == TokenKind::Gt ? BinOp::Gt : BinOp::Ge;
+      auto r      = term();
       e              = std::make_unique<BinaryExpr>(std::move(e), op, std::move(r));
     }
     return e;
@@ -247,8 +248,8 @@ namespace mplx {
   std::unique_ptr<Expr> Parser::term() {
     auto e = factor();
     while (check(TokenKind::Plus) || check(TokenKind::Minus)) {
-      std::string op = advance().lexeme;
-      auto r         = factor();
+      BinOp op = advance().kind == TokenKind::Plus ? BinOp::Add : BinOp::Sub;
+      auto r   = factor();
       e              = std::make_unique<BinaryExpr>(std::move(e), op, std::move(r));
     }
     return e;
@@ -257,18 +258,17 @@ namespace mplx {
   std::unique_ptr<Expr> Parser::factor() {
     auto e = unary();
     while (check(TokenKind::Star) || check(TokenKind::Slash)) {
-      std::string op = advance().lexeme;
-      auto r         = unary();
+      BinOp op = advance().kind == TokenKind::Star ? BinOp::Mul : BinOp::Div;
+      auto r   = unary();
       e              = std::make_unique<BinaryExpr>(std::move(e), op, std::move(r));
     }
     return e;
   }
 
   std::unique_ptr<Expr> Parser::unary() {
-    if (check(TokenKind::Minus)) {
-      std::string op = advance().lexeme;
-      auto r         = unary();
-      return std::make_unique<UnaryExpr>(op, std::move(r));
+    if (match(TokenKind::Minus)) {
+      auto r = unary();
+      return std::make_unique<UnaryExpr>(UnaryOp::Neg, std::move(r));
     }
     return call();
   }
@@ -277,10 +277,9 @@ namespace mplx {
     auto e = primary();
     for (;;) {
       if (match(TokenKind::LParen)) {
-        auto callee = dynamic_cast<VarExpr *>(e.get());
-        if (!callee)
+        if (e->kind != ExprKind::Var)
           return e; // not a callable
-        auto call = std::make_unique<CallExpr>(callee->name);
+        auto call = std::make_unique<CallExpr>(static_cast<VarExpr *>(e.get())->name);
         if (!check(TokenKind::RParen)) {
           do {
             call->args.push_back(expression());
@@ -1,11 +1,16 @@
 ﻿#include "capi.hpp"
+#include "../../Application/mplx-compiler/compile_cache.hpp"
 #include "../../Application/mplx-compiler/compiler.hpp"
+#include "../../Application/mplx-compiler/optimizer.hpp"
 #include "../../Application/mplx-vm/vm.hpp"
+#include "../../Application/mplx-vm/vm_pool.hpp"
 #include "../../Domain/mplx-lang/lexer.hpp"
 #include "../../Domain/mplx-lang/parser.hpp"
 #include <cstring>
+#include <memory>
 #include <new>
 #include <string>
+#include <utility>
 
 static char *dup_utf8(const std::string &s) {
   char *p = (char *)::malloc(s.size() + 1);
@@ -16,6 +21,30 @@ static char *dup_utf8(const std::string &s) {
   return p;
 }
 
+// Last module compiled on this thread; running the same source again skips the front end
+// and reuses the pooled VM
+struct CachedModule {
+  std::string source;
+  mplx::Bytecode bc;
+  bool valid{false};
+};
+
+static CachedModule &cached_module() {
+  static thread_local CachedModule m;
+  return m;
+}
+
+// Functions compiled by any thread of the process: after an edit only the functions the
+// edit reached are compiled again
+static mplx::CompileCache &compile_cache() {
+  static const std::unique_ptr<mplx::CompileCache> cache = [] {
+    auto c = std::make_unique<mplx::CompileCache>();
+    c->setCapacity(1 << 14);
+    return c;
+  }();
+  return *cache;
+}
+
 extern "C" {
 
 MPLX_API void mplx_free(char *ptr) {
@@ -65,29 +94,40 @@ MPLX_API int mplx_run_from_source(const char *source_utf8, const char *entry_utf
     return 1;
   *out_error = nullptr;
   try {
-    std::string src(source_utf8);
-    std::string entry(entry_utf8);
-    mplx::Lexer lex(src);
-    auto toks = lex.Lex();
-    mplx::Parser p(toks);
-    auto mod = p.parse();
-    mplx::Compiler c;
-    auto res = c.compile(mod);
-    if (!res.diags.empty()) {
-      std::string error = "{\"compile\": [";
-      bool first        = true;
-      for (auto &d : res.diags) {
-        if (!first)
-          error += ", ";
-        error += "\"" + d + "\"";
-        first = false;
+    CachedModule &cm = cached_module();
+    if (!cm.valid || cm.source != source_utf8) {
+      if (cm.valid) {
+        mplx::VMPool::local().release(cm.bc);
+        cm.valid = false;
+      }
+      std::string src(source_utf8);
+      mplx::Lexer lex(src);
+      auto toks = lex.Lex();
+      mplx::Parser p(toks);
+      auto mod = p.parse();
+      mplx::optimize_module(mod);
+      mplx::Compiler c;
+      c.setCache(&compile_cache());
+      auto res = c.compile(mod);
+      if (!res.diags.empty()) {
+        std::string error = "{\"compile\": [";
+        bool first        = true;
+        for (auto &d : res.diags) {
+          if (!first)
+            error += ", ";
+          error += "\"" + d + "\"";
+          first = false;
+        }
+        error += "]}";
+        *out_error = dup_utf8(error);
+        return 4;
       }
-      error += "]}";
-      *out_error = dup_utf8(error);
-      return 4;
+      cm.source = src;
+      cm.bc     = std::move(res.bc);
+      cm.valid  = true;
     }
-    mplx::VM vm(res.bc);
-    long long rv = vm.run(entry);
+    mplx::VM &vm = mplx::VMPool::local().acquire(cm.bc);
+    long long rv = vm.run(entry_utf8);
     *out_result  = rv;
     return 0;
   } catch (const std::exception &ex) {
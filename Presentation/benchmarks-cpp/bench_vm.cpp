@@ -1,9 +1,91 @@
-#include "../../../Application/mplx-compiler/compiler.hpp"
-#include "../../../Application/mplx-vm/vm.hpp"
-#include "../../../Domain/mplx-lang/lexer.hpp"
-#include "../../../Domain/mplx-lang/parser.hpp"
+#include "../../Application/mplx-compiler/compile_cache.hpp"
+#include "../../Application/mplx-compiler/compiler.hpp"
+#include "../../Application/mplx-vm/batch.hpp"
+#include "../../Application/mplx-vm/lanes.hpp"
+#include "../../Application/mplx-vm/vm.hpp"
+#include "../../Application/mplx-vm/vm_pool.hpp"
+#include "../../Domain/mplx-lang/lexer.hpp"
+#include "../../Domain/mplx-lang/parser.hpp"
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Heap allocation counter, so allocations on the call path show up in the output. Only
+// allocations made on a thread inside an AllocCounter scope are counted. Every throwing
+// form of operator new/delete is replaced, so each block is freed by the function matching
+// the one that allocated it; the nothrow forms forward to these by default.
+static thread_local uint64_t *t_allocs = nullptr;
+
+class AllocCounter {
+public:
+  AllocCounter() : prev_(t_allocs) { t_allocs = &count_; }
+  ~AllocCounter() { t_allocs = prev_; }
+  AllocCounter(const AllocCounter &)            = delete;
+  AllocCounter &operator=(const AllocCounter &) = delete;
+  // allocations since the scope began
+  uint64_t count() const { return count_; }
+
+private:
+  uint64_t *prev_;
+  uint64_t count_{0};
+};
+
+// Out of line so the compiler does not pair the free() with the operator new it came from
+[[gnu::noinline]] static void *alloc_block(std::size_t n, std::size_t align) {
+  if (t_allocs)
+    ++*t_allocs;
+  n = n ? n : 1;
+  void *p = align > alignof(std::max_align_t) ? std::aligned_alloc(align, (n + align - 1) / align * align) : std::malloc(n);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+[[gnu::noinline]] static void free_block(void *p) noexcept {
+  std::free(p);
+}
+
+void *operator new(std::size_t n) {
+  return alloc_block(n, 0);
+}
+void *operator new[](std::size_t n) {
+  return alloc_block(n, 0);
+}
+void *operator new(std::size_t n, std::align_val_t a) {
+  return alloc_block(n, std::size_t(a));
+}
+void *operator new[](std::size_t n, std::align_val_t a) {
+  return alloc_block(n, std::size_t(a));
+}
+void operator delete(void *p) noexcept {
+  free_block(p);
+}
+void operator delete[](void *p) noexcept {
+  free_block(p);
+}
+void operator delete(void *p, std::size_t) noexcept {
+  free_block(p);
+}
+void operator delete[](void *p, std::size_t) noexcept {
+  free_block(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept {
+  free_block(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept {
+  free_block(p);
+}
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  free_block(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  free_block(p);
+}
 
 static void BM_CompileAndRun() {
   const char *src = "fn main() -> i32 { let x = 0; x = x + 1 * 2; return x; }";
@@ -40,12 +122,395 @@ static void BM_RunOnly() {
   std::cout << "RunOnly: " << duration.count() << " microseconds, result: " << v << std::endl;
 }
 
+// Presentation/examples/fib_20.mplx, plus a copy whose function name is too long for the
+// small-string buffer (a FuncMeta copy per call would then allocate)
+static void BM_CallAllocations(const char *label, const std::string &fnName) {
+  std::string src = "fn " + fnName + "(n) { if (n <= 1) { return n; } return " + fnName + "(n-1) + " + fnName + "(n-2); }\n" +
+                    "fn main() { return " + fnName + "(20); }";
+  mplx::Lexer lx(src);
+  auto toks = lx.Lex();
+  mplx::Parser ps(std::move(toks));
+  auto mod = ps.parse();
+  mplx::Compiler c;
+  auto res = c.compile(mod);
+  mplx::VM vm(res.bc);
+#if defined(MPLX_WITH_JIT)
+  vm.setJitMode(mplx::VM::JitMode::Off);
+#endif
+
+  uint32_t mainIdx = 0;
+  while (res.bc.functions[mainIdx].name != "main")
+    ++mainIdx;
+
+  long long v     = 0;
+  uint64_t first  = 0;
+  uint64_t second = 0;
+  {
+    AllocCounter count;
+    v     = vm.runByIndex(mainIdx);
+    first = count.count();
+  }
+  {
+    AllocCounter count;
+    (void)vm.runByIndex(mainIdx);
+    second = count.count();
+  }
+  std::cout << "CallAllocations " << label << ": first run " << first << " allocations, next run " << second
+            << " (21891 calls), result: " << v << std::endl;
+}
+
+// Repeated run("main") through the thread's VMPool: after the first acquire the VM is
+// only reset, so steady-state invocations should not allocate
+static void BM_PooledRuns() {
+  const char *src = "fn fib(n) { if (n <= 1) { return n; } return fib(n-1) + fib(n-2); }\n"
+                    "fn main() { return fib(15); }";
+  mplx::Lexer lx(src);
+  auto toks = lx.Lex();
+  mplx::Parser ps(std::move(toks));
+  auto mod = ps.parse();
+  mplx::Compiler c;
+  auto res = c.compile(mod);
+
+  long long v     = 0;
+  uint64_t first  = 0;
+  uint64_t steady = 0;
+  {
+    AllocCounter count;
+    v     = mplx::VMPool::local().acquire(res.bc).run("main");
+    first = count.count();
+  }
+  {
+    AllocCounter count;
+    for (int i = 0; i < 100; ++i)
+      (void)mplx::VMPool::local().acquire(res.bc).run("main");
+    steady = count.count();
+  }
+  mplx::VMPool::local().release(res.bc);
+  std::cout << "PooledRuns: first run " << first << " allocations, next 100 runs " << steady << ", result: " << v
+            << std::endl;
+}
+
+// One module run over 20000 argument tuples by BatchRunner with 1..N worker threads
+static void BM_BatchScaling() {
+  const char *src = "fn fib(n) { if (n <= 1) { return n; } return fib(n-1) + fib(n-2); }\n"
+                    "fn main() { return fib(15); }";
+  mplx::Lexer lx(src);
+  auto toks = lx.Lex();
+  mplx::Parser ps(std::move(toks));
+  auto mod = ps.parse();
+  mplx::Compiler c;
+  auto res = c.compile(mod);
+
+  const size_t count = 20000;
+  std::vector<long long> args(count), results(count);
+  for (size_t i = 0; i < count; ++i)
+    args[i] = 10 + (long long)(i % 8); // uneven work per tuple
+  long long check = 0;
+
+  unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned> threadCounts;
+  for (unsigned t = 1; t < maxThreads; t *= 2)
+    threadCounts.push_back(t);
+  threadCounts.push_back(maxThreads);
+
+  double single = 0;
+  for (unsigned t : threadCounts) {
+    mplx::BatchRunner runner(res.bc, t);
+    runner.run("fib", args.data(), count, results.data()); // warm-up: stacks, frames
+    auto start = std::chrono::high_resolution_clock::now();
+    runner.run("fib", args.data(), count, results.data());
+    auto end  = std::chrono::high_resolution_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    long long sum = 0;
+    for (auto v : results)
+      sum += v;
+    if (t == 1) {
+      single = ms;
+      check  = sum;
+    }
+    std::cout << "BatchScaling threads=" << t << ": " << ms << " ms, speedup " << single / ms
+              << (sum == check ? "" : " (MISMATCH)") << std::endl;
+  }
+}
+
+// LaneRunner against one scalar VM::call per tuple: a branchy straight-line kernel, and a
+// loop whose trip count differs between lanes (waiting lanes idle until the loop drains)
+static void BM_LaneEvaluation() {
+  const char *src = "fn poly(x, y) { let a = x * 3 + y; let b = a * a - x * y + 7; if (b > a) { b = b - a; }\n"
+                    "  return (a + b) * (a - y) + (b < 100); }\n"
+                    "fn steps(x, y) { let s = 0; let i = 0; while (i < x / 50) { s = s + x * i - y; i = i + 1; } return s; }";
+  mplx::Lexer lx(src);
+  auto toks = lx.Lex();
+  mplx::Parser ps(std::move(toks));
+  auto mod = ps.parse();
+  mplx::Compiler c;
+  auto res = c.compile(mod);
+
+  const size_t count = 400000;
+  std::vector<long long> args(2 * count), scalar(count), lanes(count);
+  for (size_t i = 0; i < count; ++i) {
+    args[2 * i]     = (long long)(i * 7919 % 1000) - 300;
+    args[2 * i + 1] = (long long)(i * 104729 % 997) - 400;
+  }
+  mplx::VM vm(res.bc);
+  mplx::LaneRunner runner(res.bc);
+  for (const char *fn : {"poly", "steps"}) {
+    uint32_t idx = 0;
+    mplx::find_function(res.bc, fn, idx);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < count; ++i)
+      scalar[i] = vm.call(idx, &args[2 * i], 2);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    runner.run(idx, args.data(), count, lanes.data());
+    auto t2         = std::chrono::high_resolution_clock::now();
+    double scalarMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    double lanesMs  = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    std::cout << "LaneEvaluation " << fn << " (" << mplx::LaneRunner::kLanes << " lanes"
+              << (runner.vectorized(idx) ? "" : ", scalar fallback") << "): scalar " << scalarMs << " ms, lanes "
+              << lanesMs << " ms, speedup " << scalarMs / lanesMs << (scalar == lanes ? "" : " (MISMATCH)") << std::endl;
+  }
+}
+
+// A million levels of recursion in tail position: a function calling itself (a loop once
+// compiled) and two calling each other (OP_TAILCALL), against the same code compiled as
+// CALL + RET, which needs the stack and frame limits raised to get that deep
+static void BM_DeepRecursion() {
+  const char *src = "fn sum(n, acc) { if (n == 0) { return acc; } return sum(n - 1, acc + n); }\n"
+                    "fn even(n) { if (n == 0) { return 1; } return odd(n - 1); }\n"
+                    "fn odd(n) { if (n == 0) { return 0; } return even(n - 1); }";
+  mplx::Lexer lx(src);
+  auto toks = lx.Lex();
+  mplx::Parser ps(std::move(toks));
+  auto mod = ps.parse();
+
+  const long long depth = 1000000;
+  for (bool tailCalls : {true, false}) {
+    mplx::CompileOptions opts;
+    opts.tailCalls = tailCalls;
+    mplx::Compiler c(opts);
+    auto res = c.compile(mod);
+    for (const char *fn : {"sum", "even"}) {
+      mplx::VM vm(res.bc);
+#if defined(MPLX_WITH_JIT)
+      vm.setJitMode(mplx::VM::JitMode::Off);
+#endif
+      if (!tailCalls) {
+        vm.setMaxCallDepth(size_t(depth) + 16);
+        vm.setStackSize(size_t(depth) * 4);
+      }
+      uint32_t idx = 0;
+      mplx::find_function(res.bc, fn, idx);
+      const long long args[2] = {depth, 0};
+      std::string out;
+      auto start = std::chrono::high_resolution_clock::now();
+      try {
+        out = "result: " + std::to_string(vm.call(idx, args, res.bc.functions[idx].arity));
+      } catch (const std::exception &e) {
+        out = e.what();
+      }
+      auto end  = std::chrono::high_resolution_clock::now();
+      double ms = std::chrono::duration<double, std::milli>(end - start).count();
+      std::cout << "DeepRecursion " << fn << (tailCalls ? " (tail calls)" : " (CALL + RET)") << ": " << ms << " ms, "
+                << out << std::endl;
+    }
+  }
+}
+
+// Two loops through the SSA pipeline with each loop transform alone, none and the default
+// set: one recomputes an invariant every iteration, the other is an affine reduction that
+// the closed form replaces and strength reduction rewrites
+static void BM_LoopOptimizations() {
+  const char *src = "fn inv(n, a, b) { let i = 0; let s = 0; while (i < n) { s = s + (a * b + a / 3 - b) / (i + 1); i = i + 1; } return s; }\n"
+                    "fn red(n, k) { let i = 0; let s = 0; while (i < n) { s = s + i * k + 3; i = i + 1; } return s; }";
+  mplx::Lexer lx(src);
+  auto toks = lx.Lex();
+  mplx::Parser ps(std::move(toks));
+  auto mod = ps.parse();
+
+  struct Variant {
+    const char *name;
+    bool licm, strengthReduction, closedForm;
+  };
+  const mplx::CompileOptions defaults;
+  const Variant variants[] = {{"none", false, false, false},
+                              {"licm", true, false, false},
+                              {"strength reduction", false, true, false},
+                              {"closed form", false, false, true},
+                              {"default", defaults.licm, defaults.strengthReduction, defaults.closedForm}};
+  for (const Variant &v : variants) {
+    mplx::CompileOptions opts;
+    opts.ssa               = true;
+    opts.licm              = v.licm;
+    opts.strengthReduction = v.strengthReduction;
+    opts.closedForm        = v.closedForm;
+    mplx::Compiler c(opts);
+    auto res = c.compile(mod);
+    for (const char *fn : {"inv", "red"}) {
+      mplx::VM vm(res.bc);
+#if defined(MPLX_WITH_JIT)
+      vm.setJitMode(mplx::VM::JitMode::Off);
+#endif
+      uint32_t idx = 0;
+      mplx::find_function(res.bc, fn, idx);
+      const long long args[3] = {3000000, 7, 5};
+      auto start              = std::chrono::high_resolution_clock::now();
+      long long r             = vm.call(idx, args, res.bc.functions[idx].arity);
+      auto end                = std::chrono::high_resolution_clock::now();
+      double ms               = std::chrono::duration<double, std::milli>(end - start).count();
+      std::cout << "LoopOptimizations " << fn << " (" << v.name << "): " << ms << " ms, result: " << r << std::endl;
+    }
+  }
+}
+
+// A module of `functions` small functions, each calling the one before it
+static std::string generated_module(int functions) {
+  std::string src;
+  src.reserve(size_t(functions) * 200);
+  for (int i = 0; i < functions; ++i) {
+    std::string n = std::to_string(i);
+    src += "fn f" + n + "(a, b) { let x = a + b * 2; let y = x - a / 3; if (x < y) { y = y + 1; } else { y = y - 1; }\n";
+    src += "  while (x > 0 - 1) { x = x - 1; } return ";
+    if (i == 0) {
+      src += "y";
+    } else {
+      src += "f";
+      src += std::to_string(i - 1);
+      src += "(x, y) + y";
+    }
+    src += " == 0 - 1; }\n";
+  }
+  return src;
+}
+
+// Parse and compile a generated module with many small functions; compile time alone is
+// what the AST node dispatch shows up in
+static void BM_CompileThroughput() {
+  const int functions = 20000;
+  std::string src     = generated_module(functions);
+  mplx::Lexer lx(src);
+  auto toks = lx.Lex();
+  auto t0   = std::chrono::high_resolution_clock::now();
+  mplx::Parser ps(std::move(toks));
+  auto mod = ps.parse();
+  auto t1  = std::chrono::high_resolution_clock::now();
+  double best = 0;
+  size_t codeSize = 0;
+  for (int rep = 0; rep < 5; ++rep) {
+    auto c0 = std::chrono::high_resolution_clock::now();
+    mplx::Compiler c;
+    auto res = c.compile(mod);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - c0).count();
+    best      = rep == 0 ? ms : std::min(best, ms);
+    codeSize  = res.bc.code.size();
+  }
+  std::cout << "CompileThroughput: " << functions << " functions, parse "
+            << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms, compile (best of 5) " << best << " ms ("
+            << functions / best * 1000.0 << " functions/s), " << codeSize << " bytes" << std::endl;
+}
+
+// The same module compiled on 1..N threads (CompileOptions::threads), straight from the AST
+// and through the SSA pipeline; every count must produce the single-threaded bytecode
+static void BM_ParallelCompile() {
+  const int functions = 20000;
+  mplx::Lexer lx(generated_module(functions));
+  auto toks = lx.Lex();
+  mplx::Parser ps(std::move(toks));
+  auto mod = ps.parse();
+
+  unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned> threadCounts;
+  for (unsigned t = 1; t < maxThreads; t *= 2)
+    threadCounts.push_back(t);
+  threadCounts.push_back(maxThreads);
+
+  for (bool ssa : {false, true}) {
+    mplx::Bytecode reference;
+    double single = 0;
+    for (unsigned t : threadCounts) {
+      mplx::CompileOptions opts;
+      opts.ssa     = ssa;
+      opts.threads = t;
+      double best  = 0;
+      mplx::Bytecode bc;
+      for (int rep = 0; rep < 3; ++rep) {
+        auto c0 = std::chrono::high_resolution_clock::now();
+        mplx::Compiler c(opts);
+        auto res  = c.compile(mod);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - c0).count();
+        best      = rep == 0 ? ms : std::min(best, ms);
+        bc        = std::move(res.bc);
+      }
+      if (t == 1) {
+        single    = best;
+        reference = bc;
+      }
+      bool same = mplx::dump_bytecode_json(bc) == mplx::dump_bytecode_json(reference);
+      std::cout << "ParallelCompile " << (ssa ? "ssa" : "ast") << " threads=" << t << ": " << best
+                << " ms (best of 3), speedup " << single / best << (same ? "" : " (MISMATCH)") << std::endl;
+    }
+  }
+}
+
+// Recompiling the 20 000-function module through a CompileCache: unchanged, and after
+// editing one function's body, against a compile without the cache
+static void BM_IncrementalCompile() {
+  const int functions = 20000;
+  std::string src     = generated_module(functions);
+  std::string edited  = src;
+  const std::string from = "fn f10000(a, b) { let x = a + b * 2;";
+  edited.replace(edited.find(from), from.size(), "fn f10000(a, b) { let x = a + b * 3;");
+  auto parse = [](const std::string &text) {
+    mplx::Lexer lx(text);
+    auto toks = lx.Lex();
+    mplx::Parser ps(std::move(toks));
+    return ps.parse();
+  };
+  auto mod       = parse(src);
+  auto editedMod = parse(edited);
+
+  for (bool ssa : {false, true}) {
+    mplx::CompileOptions opts;
+    opts.ssa = ssa;
+    mplx::CompileCache cache;
+    auto timed = [&](const mplx::Module &m, mplx::CompileCache *c, mplx::CompileResult &res) {
+      auto c0 = std::chrono::high_resolution_clock::now();
+      mplx::Compiler comp(opts);
+      comp.setCache(c);
+      res = comp.compile(m);
+      return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - c0).count();
+    };
+    mplx::CompileResult plain, cold, warm, edit, reference;
+    double plainMs = timed(mod, nullptr, plain);
+    double coldMs  = timed(mod, &cache, cold);
+    double warmMs  = timed(mod, &cache, warm);
+    double editMs  = timed(editedMod, &cache, edit);
+    timed(editedMod, nullptr, reference);
+    bool same = mplx::dump_bytecode_json(warm.bc) == mplx::dump_bytecode_json(plain.bc) &&
+                mplx::dump_bytecode_json(edit.bc) == mplx::dump_bytecode_json(reference.bc);
+    const char *mode = ssa ? "ssa" : "ast";
+    std::cout << "IncrementalCompile " << mode << ": no cache " << plainMs << " ms, cold " << coldMs << " ms, unchanged "
+              << warmMs << " ms (" << warm.cache.hits << " hits), one function edited " << editMs << " ms ("
+              << edit.cache.hits << " hits, " << edit.cache.misses << " misses)" << (same ? "" : " (MISMATCH)")
+              << std::endl;
+  }
+}
+
 int main() {
   std::cout << "MPLX Benchmarks (simplified version)\n";
   std::cout << "Note: Full benchmarks require Google Benchmark library\n\n";
 
   BM_CompileAndRun();
+  BM_CompileThroughput();
+  BM_ParallelCompile();
+  BM_IncrementalCompile();
   BM_RunOnly();
+  BM_CallAllocations("fib_20", "fib");
+  BM_CallAllocations("fib_20 long name", "fibonacci_recursive_reference");
+  BM_PooledRuns();
+  BM_BatchScaling();
+  BM_LaneEvaluation();
+  BM_DeepRecursion();
+  BM_LoopOptimizations();
 
   return 0;
 }
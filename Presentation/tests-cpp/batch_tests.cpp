@@ -0,0 +1,66 @@
+#include "compile_helpers.hpp"
+#include "../../Application/mplx-vm/batch.hpp"
+#include <algorithm>
+
+using namespace mplx_test;
+
+static const char *kWork = "fn collatz(x: i32, cap: i32)->i32{ let n = 0; while (x != 1) { if (n == cap) { return 0 - n; }"
+                           "  if (x - x / 2 * 2 == 0) { x = x / 2; } else { x = 3 * x + 1; } n = n + 1; } return n; }"
+                           "fn depth(n: i32)->i32{ if (n == 0) { return 0; } return 1 + depth(n - 1); }";
+
+// (x, cap) tuples with trip counts that vary a lot from one tuple to the next
+static std::vector<long long> collatz_args(size_t count) {
+  std::vector<long long> args;
+  for (size_t i = 0; i < count; ++i) {
+    args.push_back((long long)(i * 7919 % 100000) + 1);
+    args.push_back(i % 5 == 0 ? 20 : 1000);
+  }
+  return args;
+}
+
+static std::vector<long long> serial(const mplx::Bytecode &bc, const char *fn, const std::vector<long long> &args) {
+  uint32_t idx = 0;
+  EXPECT_TRUE(mplx::find_function(bc, fn, idx));
+  const uint32_t arity = bc.functions[idx].arity;
+  std::vector<long long> out(args.size() / arity);
+  mplx::VM vm(bc);
+  for (size_t i = 0; i < out.size(); ++i)
+    out[i] = vm.call(idx, &args[i * arity], arity);
+  return out;
+}
+
+// Every thread count and grain gives the results of calling the function tuple by tuple on
+// one VM, in tuple order, including counts smaller than the number of workers
+TEST(Batch, MatchesSerialRuns) {
+  auto bc             = compile(parse(kWork)).bc;
+  const auto args     = collatz_args(3000);
+  const auto expected = serial(bc, "collatz", args);
+  for (unsigned threads : {1u, 2u, 4u, 8u}) {
+    mplx::BatchRunner runner(bc, threads);
+    EXPECT_EQ(runner.threads(), threads);
+    for (size_t grain : {size_t(0), size_t(1), size_t(7), expected.size()}) {
+      runner.setGrain(grain);
+      for (size_t count : {expected.size(), size_t(0), size_t(1), size_t(threads + 1)}) {
+        std::vector<long long> got(count, -12345);
+        runner.run("collatz", args.data(), count, got.data());
+        EXPECT_TRUE(std::equal(got.begin(), got.end(), expected.begin()))
+            << "threads=" << threads << " grain=" << grain << " count=" << count;
+      }
+    }
+  }
+}
+
+// A failing call fails the batch with the VM's error; the runner and its VMs stay usable
+TEST(Batch, ErrorsPropagate) {
+  auto bc = compile(parse(kWork)).bc;
+  mplx::BatchRunner runner(bc, 4);
+  runner.setStackSize(1024);
+  std::vector<long long> args(200, 10), got(200);
+  args[137] = 5000;
+  EXPECT_THROW(runner.run("depth", args.data(), args.size(), got.data()), std::runtime_error);
+  args[137] = 10;
+  runner.run("depth", args.data(), args.size(), got.data());
+  EXPECT_EQ(got, std::vector<long long>(200, 10));
+  EXPECT_THROW(runner.run("nope", args.data(), 1, got.data()), std::runtime_error);
+  EXPECT_THROW(runner.run((uint32_t)bc.functions.size(), args.data(), 1, got.data()), std::runtime_error);
+}
@@ -0,0 +1,236 @@
+#include "compile_helpers.hpp"
+#include "../../Application/mplx-compiler/compile_cache.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <random>
+
+using namespace mplx_test;
+namespace fs = std::filesystem;
+
+static const char *kProgram = "fn sq(x: i32)->i32{ return x * x; }"
+                              "fn sum(n: i32, acc: i32)->i32{ if (n == 0) { return acc; } return sum(n - 1, acc + n); }"
+                              "fn even(n: i32)->i32{ if (n == 0) { return 1; } return odd(n - 1); }"
+                              "fn odd(n: i32)->i32{ if (n == 0) { return 0; } return even(n - 1); }"
+                              "fn poly(x: i32)->i32{ let s = 0; let i = 0; while (i < x) { s = s + sq(i) - i; i = i + 1; } return s; }"
+                              "fn main()->i32{ return poly(10) + sum(20, 0) * even(7) + odd(9) * 1000; }";
+
+static mplx::CompileResult compile_cached(const mplx::Module &m, mplx::CompileCache &cache, const mplx::CompileOptions &opts = {}) {
+  mplx::Compiler c(opts);
+  c.setCache(&cache);
+  auto res = c.compile(m);
+  EXPECT_TRUE(res.diags.empty());
+  return res;
+}
+
+// A fresh directory under the system's temp directory, removed with its contents
+struct TempDir {
+  fs::path path;
+  TempDir() {
+    path = fs::temp_directory_path() / ("mplx-cache-test-" + std::to_string(std::random_device{}()));
+    fs::remove_all(path);
+  }
+  ~TempDir() {
+    std::error_code ec;
+    fs::remove_all(path, ec);
+  }
+  std::vector<fs::path> files() const {
+    std::vector<fs::path> out;
+    for (const auto &e : fs::directory_iterator(path))
+      if (e.path().extension() == ".mfc")
+        out.push_back(e.path());
+    std::sort(out.begin(), out.end());
+    return out;
+  }
+};
+
+static std::string read_file(const fs::path &p) {
+  std::ifstream f(p, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const fs::path &p, const std::string &data) {
+  std::ofstream f(p, std::ios::binary | std::ios::trunc);
+  f.write(data.data(), (std::streamsize)data.size());
+}
+
+TEST(CompileCache, WarmMatchesCold) {
+  auto m = parse(kProgram);
+  const uint64_t n = m.functions.size();
+  for (bool ssa : {false, true}) {
+    mplx::CompileOptions opts;
+    opts.ssa  = ssa;
+    auto cold = compile(m, opts);
+    mplx::CompileCache cache;
+    auto first = compile_cached(m, cache, opts), second = compile_cached(m, cache, opts);
+    EXPECT_EQ(first.cache.misses, n);
+    EXPECT_EQ(second.cache.hits, n);
+    EXPECT_EQ(second.cache.misses, 0u);
+    EXPECT_TRUE(same_bytecode(first.bc, cold.bc)) << "ssa=" << ssa;
+    EXPECT_TRUE(same_bytecode(second.bc, cold.bc)) << "ssa=" << ssa;
+    EXPECT_EQ(second.inlined.size(), cold.inlined.size());
+    EXPECT_EQ(run(second.bc), run(cold.bc));
+  }
+}
+
+static bool inlines(const mplx::CompileResult &res, const char *caller, const char *callee) {
+  for (const auto &site : res.inlined)
+    if (site.caller == caller && site.callee == callee)
+      return true;
+  return false;
+}
+
+// Editing a function recompiles it and the callers whose code depends on it; the rest is
+// linked from the cache and the whole equals a fresh compile of the edited program
+TEST(CompileCache, EditRecompilesAffectedFunctions) {
+  mplx::CompileCache cache;
+  auto base = compile_cached(parse(kProgram), cache);
+  EXPECT_TRUE(inlines(base, "main", "poly"));
+  std::string edited = kProgram;
+  edited.replace(edited.find("return x * x;"), 13, "return x * x + 1;");
+  auto m   = parse(edited);
+  auto res = compile_cached(m, cache);
+  EXPECT_TRUE(same_bytecode(res.bc, compile(m).bc));
+  // sq; poly, which inlines it; and main, since the larger sq puts poly over the inlining
+  // budget and main now calls it
+  EXPECT_FALSE(inlines(res, "main", "poly"));
+  EXPECT_EQ(res.cache.misses, 3u);
+  EXPECT_EQ(res.cache.hits, m.functions.size() - 3);
+  EXPECT_EQ(run(res.bc), run(compile(m).bc));
+}
+
+// Inserting and reordering functions moves their indices: cached calls are bound to the
+// new ones by name
+TEST(CompileCache, RebindsCallsAfterInsertAndReorder) {
+  mplx::CompileCache cache;
+  auto base = parse(kProgram);
+  compile_cached(base, cache);
+  const std::string src = kProgram;
+  for (const std::string &variant : {"fn extra(a: i32)->i32{ return a - 1; }" + src,
+                                     src.substr(src.find("fn even")) + src.substr(0, src.find("fn even"))}) {
+    auto m   = parse(variant);
+    auto res = compile_cached(m, cache);
+    EXPECT_TRUE(same_bytecode(res.bc, compile(m).bc)) << variant;
+    EXPECT_GE(res.cache.hits, base.functions.size());
+    EXPECT_EQ(run(res.bc), run(compile(base).bc)) << variant;
+  }
+  // removing a function moves the ones after it back
+  std::string removed = src;
+  removed.erase(removed.find("fn sq"), removed.find("fn sum") - removed.find("fn sq"));
+  removed.replace(removed.find("sq(i)"), 5, "i * i");
+  auto m   = parse(removed);
+  auto res = compile_cached(m, cache);
+  EXPECT_TRUE(same_bytecode(res.bc, compile(m).bc));
+}
+
+// Options that change code generation change the keys; those that only act on the linked
+// code (threads, superinstructions, peephole) reuse the entries
+TEST(CompileCache, OptionsSelectEntries) {
+  auto m = parse(kProgram);
+  const uint64_t n = m.functions.size();
+  mplx::CompileCache cache;
+  compile_cached(m, cache);
+  mplx::CompileOptions ssa, noInline, noTail, threads, fused, noPeephole;
+  ssa.ssa                 = true;
+  noInline.inlineBudget   = 0;
+  noTail.tailCalls        = false;
+  threads.threads         = 4;
+  fused.superinstructions = mplx::kAllSuperinstructions;
+  noPeephole.peephole     = false;
+  for (const auto &opts : {ssa, noInline, noTail}) {
+    auto res = compile_cached(m, cache, opts);
+    EXPECT_EQ(res.cache.misses, n);
+    EXPECT_TRUE(same_bytecode(res.bc, compile(m, opts).bc));
+  }
+  for (const auto &opts : {threads, fused, noPeephole}) {
+    auto res = compile_cached(m, cache, opts);
+    EXPECT_EQ(res.cache.hits, n);
+    EXPECT_TRUE(same_bytecode(res.bc, compile(m, opts).bc));
+  }
+}
+
+TEST(CompileCache, DiskSharedAcrossInstances) {
+  TempDir dir;
+  auto m = parse(kProgram);
+  const uint64_t n = m.functions.size();
+  auto cold = compile(m);
+  {
+    mplx::CompileCache writer(dir.path);
+    EXPECT_EQ(compile_cached(m, writer).cache.misses, n);
+  }
+  EXPECT_EQ(dir.files().size(), n);
+  mplx::CompileCache reader(dir.path);
+  auto res = compile_cached(m, reader);
+  EXPECT_EQ(res.cache.hits, n);
+  EXPECT_EQ(res.cache.diskHits, n);
+  EXPECT_TRUE(same_bytecode(res.bc, cold.bc));
+  // the second lookup is served from memory
+  auto again = compile_cached(m, reader);
+  EXPECT_EQ(again.cache.hits, n);
+  EXPECT_EQ(again.cache.diskHits, 0u);
+}
+
+// A damaged file is a miss, the function is compiled and the file written again
+TEST(CompileCache, DamagedFilesMiss) {
+  TempDir dir;
+  auto m = parse(kProgram);
+  const uint64_t n = m.functions.size();
+  auto cold = compile(m);
+  {
+    mplx::CompileCache writer(dir.path);
+    compile_cached(m, writer);
+  }
+  const auto files = dir.files();
+  ASSERT_EQ(files.size(), n);
+  std::vector<std::string> originals;
+  for (const auto &f : files)
+    originals.push_back(read_file(f));
+
+  using Damage = std::function<std::string(std::string)>;
+  std::vector<std::pair<const char *, Damage>> damages = {
+      {"empty", [](std::string) { return std::string(); }},
+      {"truncated", [](std::string s) { return s.substr(0, s.size() / 2); }},
+      {"one byte short", [](std::string s) { return s.substr(0, s.size() - 1); }},
+      {"trailing byte", [](std::string s) { return s + '\0'; }},
+      {"magic", [](std::string s) { s[3] ^= 0x20; return s; }},
+      {"format", [](std::string s) { s[8] ^= 0x7f; return s; }},
+      {"garbled code", [](std::string s) { s[s.size() / 2] ^= 0x5a; return s; }},
+  };
+  for (const auto &[what, damage] : damages) {
+    for (size_t i = 0; i < files.size(); ++i)
+      write_file(files[i], damage(originals[i]));
+    mplx::CompileCache cache(dir.path);
+    auto res = compile_cached(m, cache);
+    EXPECT_EQ(res.cache.misses, n) << what;
+    EXPECT_EQ(res.cache.diskHits, 0u) << what;
+    EXPECT_TRUE(same_bytecode(res.bc, cold.bc)) << what;
+    // rewritten by the compile above
+    mplx::CompileCache fresh(dir.path);
+    EXPECT_EQ(compile_cached(m, fresh).cache.diskHits, n) << what;
+  }
+}
+
+// Each file records its key: one copied under another function's key is a miss rather than
+// that function's code
+TEST(CompileCache, KeyMismatchMisses) {
+  TempDir dir;
+  auto m = parse(kProgram);
+  const uint64_t n = m.functions.size();
+  auto cold = compile(m);
+  {
+    mplx::CompileCache writer(dir.path);
+    compile_cached(m, writer);
+  }
+  const auto files = dir.files();
+  ASSERT_EQ(files.size(), n);
+  const std::string first = read_file(files[0]);
+  for (size_t i = 1; i < files.size(); ++i)
+    write_file(files[i], first);
+  mplx::CompileCache cache(dir.path);
+  auto res = compile_cached(m, cache);
+  EXPECT_EQ(res.cache.diskHits, 1u);
+  EXPECT_EQ(res.cache.misses, n - 1);
+  EXPECT_TRUE(same_bytecode(res.bc, cold.bc));
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include "../../Application/mplx-compiler/compiler.hpp"
+#include "../../Application/mplx-compiler/regcode.hpp"
+#include "../../Application/mplx-compiler/superinstructions.hpp"
+#include "../../Application/mplx-compiler/verifier.hpp"
+#include "../../Application/mplx-vm/regvm.hpp"
+#include "../../Application/mplx-vm/vm.hpp"
+#include "../../Domain/mplx-lang/lexer.hpp"
+#include "../../Domain/mplx-lang/parser.hpp"
+#include <functional>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+// Helpers shared by the compiler test suites: parse a source string, compile it with given
+// options and run it on either tier
+namespace mplx_test {
+
+  inline mplx::Module parse(const std::string &src) {
+    mplx::Lexer lx(src);
+    mplx::Parser ps(lx.Lex());
+    auto m = ps.parse();
+    EXPECT_TRUE(ps.diagnostics().empty()) << src;
+    return m;
+  }
+
+  inline mplx::CompileResult compile(const mplx::Module &m, const mplx::CompileOptions &opts = {}) {
+    mplx::Compiler c(opts);
+    auto res = c.compile(m);
+    EXPECT_TRUE(res.diags.empty());
+    return res;
+  }
+
+  inline long long run(const mplx::Bytecode &bc) {
+    mplx::VM vm(bc);
+    return vm.run("main");
+  }
+
+  inline long long run_reg(const mplx::Bytecode &bc) {
+    auto rc = mplx::lower_to_regcode(bc);
+    mplx::RegVM vm(rc);
+    return vm.run("main");
+  }
+
+  // main() of `src` on the stack tier
+  inline long long run(const std::string &src, const mplx::CompileOptions &opts = {}) {
+    return run(compile(parse(src), opts).bc);
+  }
+
+  // Occurrences of `op` in the code of function `fn`
+  inline size_t count_op(const mplx::Bytecode &bc, const std::string &fn, mplx::Op op) {
+    uint32_t index = 0;
+    if (!mplx::find_function(bc, fn, index))
+      return 0;
+    uint32_t ip = bc.functions[index].entry, end = (uint32_t)bc.code.size();
+    for (const auto &f : bc.functions)
+      if (f.entry > ip && f.entry < end)
+        end = f.entry;
+    size_t n = 0;
+    while (ip < end) {
+      n += bc.code[ip] == op;
+      ip += 1 + mplx::op_operand_size((mplx::Op)bc.code[ip]);
+    }
+    return n;
+  }
+
+  // Instructions a run of main() executes
+  inline uint64_t executed(const mplx::Bytecode &bc) {
+    mplx::VM vm(bc);
+    vm.setProfile(true);
+    vm.run("main");
+    uint64_t n = 0;
+    for (uint64_t c : vm.opcodeCounts())
+      n += c;
+    return n;
+  }
+
+  // Everything execution depends on; symbols and module_id are derived or per-compile
+  inline bool same_bytecode(const mplx::Bytecode &a, const mplx::Bytecode &b) {
+    if (a.code != b.code || a.consts != b.consts || a.functions.size() != b.functions.size())
+      return false;
+    for (size_t i = 0; i < a.functions.size(); ++i) {
+      const auto &x = a.functions[i], &y = b.functions[i];
+      if (x.name != y.name || x.entry != y.entry || x.arity != y.arity || x.locals != y.locals || x.pure != y.pure)
+        return false;
+    }
+    return a.fused.version == b.fused.version && a.fused.mask == b.fused.mask;
+  }
+
+  // One value of a compile option, named for failure messages
+  struct Setting {
+    std::string name;
+    std::function<void(mplx::CompileOptions &)> apply;
+  };
+  // The values one option takes across a test; the first is the reference
+  using Axis = std::vector<Setting>;
+
+  // A bool option off, then on
+  inline Axis toggle(const std::string &name, bool mplx::CompileOptions::*flag) {
+    return {{name + "=0", [flag](mplx::CompileOptions &o) { o.*flag = false; }},
+            {name + "=1", [flag](mplx::CompileOptions &o) { o.*flag = true; }}};
+  }
+
+  // Without superinstructions, then with all of them
+  inline Axis fusion_axis() {
+    return {{"super=0", [](mplx::CompileOptions &o) { o.superinstructions = 0; }},
+            {"super=all", [](mplx::CompileOptions &o) { o.superinstructions = mplx::kAllSuperinstructions; }}};
+  }
+
+  // main() of `src` compiled with every combination of one setting from each axis, run on
+  // the stack tier and, with `regTier`, on the register tier. Every module must pass the
+  // verifier and every result equal the one of the first combination, which is returned.
+  inline long long run_matrix(const std::string &src, const std::vector<Axis> &axes, bool regTier = true) {
+    auto m = parse(src);
+    std::vector<size_t> pick(axes.size(), 0);
+    bool first = true;
+    long long v = 0;
+    for (;;) {
+      mplx::CompileOptions opts;
+      std::string name;
+      for (size_t a = 0; a < axes.size(); ++a) {
+        axes[a][pick[a]].apply(opts);
+        name += " " + axes[a][pick[a]].name;
+      }
+      auto bc = compile(m, opts).bc;
+      EXPECT_TRUE(mplx::verify_bytecode(bc, (uint32_t)mplx::VM::kStackHeadroom).empty()) << src << name;
+      long long r = run(bc);
+      if (first)
+        v = r;
+      first = false;
+      EXPECT_EQ(r, v) << src << name;
+      if (regTier) {
+        EXPECT_EQ(run_reg(bc), v) << src << name << " (register tier)";
+      }
+      size_t a = 0;
+      while (a < axes.size() && ++pick[a] == axes[a].size())
+        pick[a++] = 0;
+      if (a == axes.size())
+        return v;
+    }
+  }
+
+} // namespace mplx_test
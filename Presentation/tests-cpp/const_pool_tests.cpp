@@ -0,0 +1,87 @@
+#include "compile_helpers.hpp"
+#include <algorithm>
+#include <climits>
+
+using namespace mplx_test;
+
+// `fn main()->i32{ return v; }` for any v, including values the parser cannot spell
+static mplx::Module returning(long long v) {
+  auto m = parse("fn main()->i32{ return 1; }");
+  auto *ret = static_cast<mplx::ReturnStmt *>(m.functions[0].body.back().get());
+  static_cast<mplx::LiteralExpr *>(ret->value.get())->value = v;
+  return m;
+}
+
+// A literal takes the shortest push that holds it: PUSH_I8 for [-128, 127], PUSH_I32 for
+// the rest of the i32 range, a pool constant beyond; on both front ends and both tiers
+TEST(ConstPool, PushWidthBoundaries) {
+  const std::pair<long long, mplx::Op> cases[] = {
+      {0, mplx::OP_PUSH_I8},
+      {-128, mplx::OP_PUSH_I8},
+      {127, mplx::OP_PUSH_I8},
+      {-129, mplx::OP_PUSH_I32},
+      {128, mplx::OP_PUSH_I32},
+      {INT32_MIN, mplx::OP_PUSH_I32},
+      {INT32_MAX, mplx::OP_PUSH_I32},
+      {(long long)INT32_MIN - 1, mplx::OP_PUSH_CONST},
+      {(long long)INT32_MAX + 1, mplx::OP_PUSH_CONST},
+      {LLONG_MIN, mplx::OP_PUSH_CONST},
+      {LLONG_MAX, mplx::OP_PUSH_CONST},
+  };
+  for (bool ssa : {false, true}) {
+    for (auto [v, op] : cases) {
+      mplx::CompileOptions opts;
+      opts.ssa = ssa;
+      auto bc  = compile(returning(v), opts).bc;
+      EXPECT_EQ(bc.code[bc.functions[0].entry], op) << v << " ssa=" << ssa;
+      EXPECT_EQ(bc.consts.size(), op == mplx::OP_PUSH_CONST ? 1u : 0u) << v;
+      EXPECT_EQ(run(bc), v) << " ssa=" << ssa;
+      EXPECT_EQ(run_reg(bc), v) << " ssa=" << ssa;
+    }
+  }
+}
+
+static const char *kWide = "fn a(x: i32)->i32{ return x * 5000000000 + 7000000000; }"
+                           "fn b(x: i32)->i32{ return x - 5000000000; }"
+                           "fn c(x: i32)->i32{ let s = 5000000000; let i = 0; while (i < x) { s = s + 7000000000; i = i + 1; } return s; }"
+                           "fn main()->i32{ return a(2) + b(3) * 2 + c(4) + 5000000000; }";
+
+// Each value is pooled once, whatever the front end, the number of compile threads and
+// however many functions use it; the SSA passes may add constants of their own
+TEST(ConstPool, ValuesPooledOnce) {
+  auto m = parse(kWide);
+  for (bool ssa : {false, true})
+    for (uint32_t threads : {1u, 4u}) {
+      mplx::CompileOptions opts;
+      opts.inlineBudget = 0;
+      opts.ssa          = ssa;
+      opts.threads      = threads;
+      auto bc           = compile(m, opts).bc;
+      auto pool         = bc.consts;
+      std::sort(pool.begin(), pool.end());
+      EXPECT_EQ(std::adjacent_find(pool.begin(), pool.end()), pool.end()) << "ssa=" << ssa << " threads=" << threads;
+      EXPECT_TRUE(std::binary_search(pool.begin(), pool.end(), 5000000000ll));
+      EXPECT_TRUE(std::binary_search(pool.begin(), pool.end(), 7000000000ll));
+      if (!ssa)
+        EXPECT_EQ(pool.size(), 2u);
+    }
+}
+
+// Superinstructions with a constant operand take it from the pool: a PUSH_I8 value is
+// added once, and one already there is shared
+TEST(ConstPool, FusedConstantsShared) {
+  mplx::CompileOptions opts;
+  opts.inlineBudget      = 0;
+  opts.superinstructions = mplx::kAllSuperinstructions;
+  auto bc                = compile(parse("fn f(n: i32)->i32{ let i = 0; while (i < 10) { i = i + 1; } let j = 0;"
+                                         "  while (j < n) { j = j + 1; } return i + j; }"
+                                         "fn main()->i32{ return f(5000000000); }"),
+                                   opts)
+                .bc;
+  ASSERT_GT(count_op(bc, "f", mplx::OP_INC_LOCAL), 1u);
+  ASSERT_GT(count_op(bc, "f", mplx::OP_LK_LT_JF), 0u);
+  auto pool = bc.consts;
+  std::sort(pool.begin(), pool.end());
+  EXPECT_EQ(pool, (std::vector<long long>{1, 10, 5000000000}));
+  EXPECT_EQ(run(bc), 5000000010);
+}
@@ -0,0 +1,66 @@
+#include "compile_helpers.hpp"
+
+using namespace mplx_test;
+
+// main() with inlining off, at the default budget and with everything non-recursive
+// inlined, from the AST and through SSA, on both tiers; all must agree
+static long long run_inlined(const char *src) {
+  Axis budget;
+  for (uint32_t b : {0u, 24u, 1000u})
+    budget.push_back({"budget=" + std::to_string(b), [b](mplx::CompileOptions &o) { o.inlineBudget = b; }});
+  return run_matrix(src, {budget, toggle("ssa", &mplx::CompileOptions::ssa)});
+}
+
+TEST(Inliner, MatchesWithoutInlining) {
+  EXPECT_EQ(run_inlined("fn sq(x: i32)->i32{ return x * x; } fn add(a: i32, b: i32)->i32{ return a + b; }"
+                        "fn main()->i32{ return add(sq(3), sq(add(1, 1))) * 2; }"),
+            26);
+  // arguments evaluated once and in order, callees that call callees
+  EXPECT_EQ(run_inlined("fn d(a: i32, b: i32)->i32{ return a - b; } fn q(x: i32)->i32{ return d(x, 1) * d(x, 2); }"
+                        "fn main()->i32{ let i = 0; let s = 0; while (i < 6) { s = s + q(i) - d(s, i); i = i + 1; } return s; }"),
+            17);
+  // a large body stays a call at the default budget and is inlined at 1000
+  const char *big = "fn big(x: i32)->i32{ let a = x + 1; let b = a * 2; let c = b - x; let d = c * c; let e = d / 3; return a + b + c + d + e; }"
+                    "fn main()->i32{ return big(4) + big(7); }";
+  EXPECT_EQ(run_inlined(big), 210);
+  mplx::CompileOptions all;
+  all.inlineBudget = 1000;
+  EXPECT_TRUE(compile(parse(big)).inlined.empty());
+  EXPECT_EQ(compile(parse(big), all).inlined.size(), 2u);
+}
+
+TEST(Inliner, RecordsSitesAndSkipsRecursion) {
+  auto m = parse("fn sq(x: i32)->i32{ return x * x; }"
+                 "fn fact(n: i32)->i32{ if (n <= 1) { return 1; } return n * fact(n - 1); }"
+                 "fn main()->i32{ return sq(4) + fact(5); }");
+  auto res = compile(m);
+  EXPECT_EQ(run(res.bc), 136);
+  ASSERT_EQ(res.inlined.size(), 1u);
+  EXPECT_EQ(res.inlined[0].caller, "main");
+  EXPECT_EQ(res.inlined[0].callee, "sq");
+  EXPECT_EQ(count_op(res.bc, "main", mplx::OP_CALL), 1u); // fact
+  mplx::CompileOptions off;
+  off.inlineBudget = 0;
+  auto plain       = compile(m, off);
+  EXPECT_TRUE(plain.inlined.empty());
+  EXPECT_EQ(count_op(plain.bc, "main", mplx::OP_CALL), 2u);
+}
+
+// An early return in an inlined body jumps to the end of the body with the caller's
+// partial expression still on the operand stack
+TEST(Inliner, IfInsideExpression) {
+  EXPECT_EQ(run_inlined("fn clamp(x: i32)->i32{ if (x > 10) { return 10; } if (x < 0) { return 0; } return x; }"
+                        "fn main()->i32{ let a = 7; return 1 + clamp(a) * 2 + (100 - clamp(a * 3)) * clamp(0 - a); }"),
+            15);
+  EXPECT_EQ(run_inlined("fn pick(c: i32, a: i32, b: i32)->i32{ if (c) { return a; } else { return b; } }"
+                        "fn main()->i32{ return (pick(1, 2, 3) * 10 + pick(0, 4, 5)) * (pick(1 > 2, 6, 7) - pick(3, 1, 0)); }"),
+            150);
+}
+
+// Each inlined call starts with the callee's locals at 0, as a called frame would; here a
+// let in an untaken branch must not see the previous iteration's value
+TEST(Inliner, LocalsResetPerCall) {
+  EXPECT_EQ(run_inlined("fn h(x: i32)->i32{ if (x > 2) { let u = x; } return u; }"
+                        "fn main()->i32{ let i = 5; let s = 0; while (i > 0) { s = s + h(i); i = i - 1; } return s; }"),
+            12);
+}
@@ -0,0 +1,126 @@
+#include "compile_helpers.hpp"
+#include "../../Application/mplx-vm/lanes.hpp"
+#include <algorithm>
+
+using namespace mplx_test;
+
+// Tuples of `arity` values from a fixed pseudo-random sequence in [-range, range]
+static std::vector<long long> tuples(size_t count, uint32_t arity, long long range) {
+  std::vector<long long> args(count * arity);
+  unsigned long long x = 88172645463325252ull;
+  for (auto &a : args) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    a = (long long)(x % (unsigned long long)(2 * range + 1)) - range;
+  }
+  return args;
+}
+
+// Runs fn over `args` on lanes and tuple by tuple on a VM; the results must match for every
+// count up to two full groups and a short one, so short last groups are covered
+static void expect_same(const mplx::Bytecode &bc, const char *fn, const std::vector<long long> &args) {
+  uint32_t idx = 0;
+  ASSERT_TRUE(mplx::find_function(bc, fn, idx));
+  const uint32_t arity = bc.functions[idx].arity;
+  const size_t count   = args.size() / arity;
+  std::vector<long long> expected(count);
+  mplx::VM vm(bc);
+  for (size_t i = 0; i < count; ++i)
+    expected[i] = vm.call(idx, &args[i * arity], arity);
+  mplx::LaneRunner runner(bc);
+  for (size_t n : {count, size_t(1), size_t(mplx::LaneRunner::kLanes - 1), size_t(2 * mplx::LaneRunner::kLanes + 3)}) {
+    n = std::min(n, count);
+    std::vector<long long> got(n);
+    runner.run(fn, args.data(), n, got.data());
+    for (size_t i = 0; i < n; ++i)
+      ASSERT_EQ(got[i], expected[i]) << fn << " tuple " << i << " of " << n;
+  }
+}
+
+static const char *kBranchy = "fn poly(x: i32, y: i32)->i32{ let a = x * 3 + y; let b = a * a - x * y + 7;"
+                              "  if (b > a) { b = b - a; } else { if (x == y) { return 0 - a; } b = b + 1; }"
+                              "  return (a + b) * (a - y) + (b < 100) + (x >= y) * 2 + (x != 0) * 4 + (y <= 3) * 8; }"
+                              "fn steps(x: i32, y: i32)->i32{ let s = 0; let i = 0;"
+                              "  while (i < x) { if (i > y) { s = s + i * 3; } else { s = s - y; } i = i + 1; } return s; }";
+
+// Lanes take different sides of the branches and run loops for different trip counts; the
+// masked writes keep each lane's own values. With superinstructions on, the fused compares
+// and INC_LOCAL run on lanes too.
+TEST(Lanes, DivergentBranchesMatchScalar) {
+  for (uint32_t super : {0u, mplx::kAllSuperinstructions}) {
+    mplx::CompileOptions opts;
+    opts.superinstructions = super;
+    auto bc                = compile(parse(kBranchy), opts).bc;
+    mplx::LaneRunner runner(bc);
+    for (const char *fn : {"poly", "steps"}) {
+      uint32_t idx = 0;
+      ASSERT_TRUE(mplx::find_function(bc, fn, idx));
+      EXPECT_TRUE(runner.vectorized(idx)) << fn;
+    }
+    expect_same(bc, "poly", tuples(100, 2, 20));
+    // y == x in some lanes takes the early return while the others go on
+    expect_same(bc, "poly", tuples(40, 2, 3));
+    expect_same(bc, "steps", tuples(60, 2, 30));
+  }
+}
+
+// Only the lanes of the running group divide: a lane whose divisor is 0 waits on the other
+// side of the branch and does not trap
+TEST(Lanes, DivisionOnlyInActiveLanes) {
+  auto bc   = compile(parse("fn q(x: i32, y: i32)->i32{ if (y == 0) { return 0 - 1; } return x / y + (x - x / y * y) * 100; }")).bc;
+  auto args = tuples(64, 2, 5);
+  for (size_t i = 1; i < args.size(); i += 6)
+    args[i] = 0;
+  expect_same(bc, "q", args);
+}
+
+// Opcodes the compiler does not emit (AND, OR, NOT, MOD) on hand-built bytecode:
+// f(a, b) = (a AND b) * 1000 + (a OR b) * 100 + (NOT a) * 10 + a MOD b
+TEST(Lanes, LogicAndModuloOpcodes) {
+  mplx::Bytecode bc;
+  auto emit = [&](std::initializer_list<int> bytes) {
+    for (int b : bytes)
+      bc.code.push_back((uint8_t)b);
+  };
+  emit({mplx::OP_LD0, mplx::OP_LD1, mplx::OP_AND, mplx::OP_PUSH_I32, 0xe8, 0x03, 0x00, 0x00, mplx::OP_MUL});
+  emit({mplx::OP_LD0, mplx::OP_LD1, mplx::OP_OR, mplx::OP_PUSH_I8, 100, mplx::OP_MUL, mplx::OP_ADD});
+  emit({mplx::OP_LD0, mplx::OP_NOT, mplx::OP_PUSH_I8, 10, mplx::OP_MUL, mplx::OP_ADD});
+  emit({mplx::OP_LD0, mplx::OP_LD1, mplx::OP_MOD, mplx::OP_ADD, mplx::OP_RET});
+  bc.functions.push_back(mplx::FuncMeta{"f", 0, 2, 2});
+  ASSERT_TRUE(mplx::verify_bytecode(bc, (uint32_t)mplx::VM::kStackHeadroom).empty());
+  auto args = tuples(50, 2, 4);
+  for (size_t i = 1; i < args.size(); i += 2)
+    if (args[i] == 0)
+      args[i] = 3;
+  for (size_t i = 0; i < args.size(); i += 10)
+    args[i] = 0;
+  EXPECT_TRUE(mplx::LaneRunner(bc).vectorized(0));
+  expect_same(bc, "f", args);
+}
+
+// A function that calls runs tuple by tuple on the scalar VM, as does every function of a
+// module that does not verify
+TEST(Lanes, CallsAndUnverifiedModulesFallBack) {
+  mplx::CompileOptions opts;
+  opts.inlineBudget = 0;
+  auto bc           = compile(parse("fn sq(x: i32)->i32{ return x * x; }"
+                                    "fn f(x: i32, y: i32)->i32{ if (x > y) { return sq(x - y); } return y - x; }"),
+                              opts)
+                .bc;
+  uint32_t sq = 0, f = 0;
+  ASSERT_TRUE(mplx::find_function(bc, "sq", sq));
+  ASSERT_TRUE(mplx::find_function(bc, "f", f));
+  {
+    mplx::LaneRunner runner(bc);
+    EXPECT_TRUE(runner.vectorized(sq));
+    EXPECT_FALSE(runner.vectorized(f));
+  }
+  expect_same(bc, "f", tuples(30, 2, 9));
+  auto broken = bc;
+  broken.functions.push_back(broken.functions[sq]); // shares sq's entry
+  broken.functions.back().name = "alias";
+  mplx::LaneRunner runner(broken);
+  EXPECT_FALSE(runner.vectorized(sq));
+  expect_same(broken, "sq", tuples(12, 1, 9));
+}
@@ -1,4 +1,4 @@
-﻿#include "../../../Domain/mplx-lang/lexer.hpp"
+﻿#include "../../Domain/mplx-lang/lexer.hpp"
 #include <iostream>
 
 int main() {
@@ -0,0 +1,90 @@
+#include "compile_helpers.hpp"
+
+using namespace mplx_test;
+
+// Counting loops of each shape the closed form takes: up and down, strict and not, unit and
+// larger steps, the bound on either side of the comparison
+static const char *kCounted = "fn up(a: i32, b: i32)->i32{ let s = 0; let i = a; while (i < b) { s = s + i * 3 + 1; i = i + 1; } return s * 100 + i; }"
+                              "fn upby(a: i32, b: i32)->i32{ let s = 0; let i = a; while (i <= b) { s = s + i; i = i + 3; } return s * 100 + i; }"
+                              "fn down(a: i32, b: i32)->i32{ let s = 0; let i = a; while (i > b) { s = s + i; i = i - 2; } return s * 100 + i; }"
+                              "fn downto(a: i32, b: i32)->i32{ let s = 0; let i = a; while (b <= i) { s = s - i; i = i - 5; } return s * 100 + i; }";
+
+static mplx::CompileOptions loop_options(bool licm, bool closedForm, bool strengthReduction, uint32_t inlineBudget = 24) {
+  mplx::CompileOptions o;
+  o.ssa               = true;
+  o.inlineBudget      = inlineBudget;
+  o.licm              = licm;
+  o.closedForm        = closedForm;
+  o.strengthReduction = strengthReduction;
+  return o;
+}
+
+// main() from the AST and through SSA with every combination of the loop transforms, on
+// both tiers; all must agree. Without inlining, a callee's loop bounds are parameters and
+// the closed form is picked at run time rather than folded.
+static long long run_loops(const std::string &src) {
+  Axis budget = {{"budget=0", [](mplx::CompileOptions &o) { o.inlineBudget = 0; }},
+                 {"budget=24", [](mplx::CompileOptions &o) { o.inlineBudget = 24; }}};
+  return run_matrix(src, {toggle("ssa", &mplx::CompileOptions::ssa), budget, toggle("licm", &mplx::CompileOptions::licm),
+                          toggle("closed", &mplx::CompileOptions::closedForm),
+                          toggle("sr", &mplx::CompileOptions::strengthReduction)});
+}
+
+TEST(LoopOpts, MatchWithTransformsOff) {
+  EXPECT_EQ(run_loops("fn main()->i32{ let s = 0; let i = 0; while (i < 100) { s = s + i * 7 - 3; i = i + 1; } return s + i; }"), 34450);
+  // invariant products next to an inlined callee with branches
+  EXPECT_EQ(run_loops("fn g(x: i32)->i32{ if (x > 3) { return x - 3; } return x; }"
+                      "fn f(a: i32, b: i32)->i32{ let s = 0; let i = 0; while (i < 20) { s = s + a * b + g(i) * a + i * b; i = i + 1; } return s; }"
+                      "fn main()->i32{ return f(3, 4) - f(0 - 2, 5); }"),
+            960);
+  // a nested loop whose inner trip count depends on the outer variable
+  EXPECT_EQ(run_loops("fn main()->i32{ let s = 0; let i = 0; while (i < 30) { let j = i; while (j < 40) { s = s + j * 2 + i; j = j + 3; } i = i + 2; } return s; }"),
+            8160);
+  // induction variables with a step other than 1 and an index read after the loop
+  EXPECT_EQ(run_loops("fn main()->i32{ let s = 0; let t = 1; let i = 50; while (i > 0 - 13) { s = s + i; t = t + 2; i = i - 4; } return s * 1000 + t + i; }"),
+            320019);
+}
+
+// The trip count of a closed-form sum is the distance to the bound over the step when the
+// loop is entered, and 0 when the start is already past the bound or on it
+TEST(LoopOpts, ClosedFormEmptyAndNegativeTrips) {
+  const std::string up = kCounted;
+  // start == bound, start past the bound, and negative starts and bounds
+  for (const char *args : {"(5, 5)", "(7, 3)", "(0 - 4, 0 - 9)", "(0 - 10, 3)", "(0, 10)", "(0 - 9, 0 - 4)"})
+    for (const char *fn : {"up", "upby", "down", "downto"})
+      run_loops(up + "fn main()->i32{ return " + fn + args + "; }");
+  EXPECT_EQ(run_loops(up + "fn main()->i32{ return up(5, 5) + upby(7, 3) + down(3, 3) + downto(0 - 4, 0 - 2); }"), 5 + 7 + 3 - 4);
+  EXPECT_EQ(run_loops(up + "fn main()->i32{ return up(0 - 3, 2) + down(4, 0 - 5); }"), -1004);
+}
+
+// The closed form replaces the loop: the instructions executed no longer grow with the trip
+// count
+TEST(LoopOpts, ClosedFormRemovesLoop) {
+  auto m = parse("fn f(n: i32)->i32{ let s = 0; let i = 0; while (i < n) { s = s + i * 3 + 1; i = i + 1; } return s; }"
+                 "fn main()->i32{ return f(100000); }");
+  auto on = compile(m, loop_options(true, true, false)).bc, off = compile(m, loop_options(true, false, false)).bc;
+  EXPECT_EQ(run(on), 14999950000LL);
+  EXPECT_EQ(run(off), run(on));
+  EXPECT_LT(executed(on), 200u);
+  EXPECT_GT(executed(off), 100000u);
+  // each shape, with its bounds as parameters
+  for (const char *call : {"up(0 - 5000, 5000)", "upby(0 - 5000, 5000)", "down(5000, 0 - 5000)", "downto(5000, 0 - 5000)"}) {
+    auto c  = parse(std::string(kCounted) + "fn main()->i32{ return " + call + "; }");
+    auto on = compile(c, loop_options(true, true, false, 0)).bc, off = compile(c, loop_options(true, false, false, 0)).bc;
+    EXPECT_EQ(run(on), run(off)) << call;
+    EXPECT_LT(executed(on), 200u) << call;
+    EXPECT_GT(executed(off), 10000u) << call;
+  }
+}
+
+// The hoisted product is computed once instead of on every iteration; the division stays
+// in the loop, since hoisting it would trap on b == 0 even when the loop never runs
+TEST(LoopOpts, LicmHoistsInvariants) {
+  auto m = parse("fn g(x: i32)->i32{ return x; }"
+                 "fn f(a: i32, b: i32)->i32{ let s = 0; let i = 0; while (i < 1000) { s = s + (a * b + a / b) * g(i); i = i + 1; } return s; }"
+                 "fn main()->i32{ return f(6, 4); }");
+  auto on = compile(m, loop_options(true, false, false)).bc, off = compile(m, loop_options(false, false, false)).bc;
+  EXPECT_EQ(run(on), 25 * 499500);
+  EXPECT_EQ(run(off), run(on));
+  EXPECT_LT(executed(on) + 1000, executed(off));
+}
@@ -0,0 +1,153 @@
+#include "compile_helpers.hpp"
+#include "../../Application/mplx-compiler/purity.hpp"
+#include "../../Application/mplx-vm/memo_cache.hpp"
+#include <cstdio>
+
+using namespace mplx_test;
+
+// Hits and misses over all functions, from the first line of VM::memoReport
+static std::pair<unsigned long long, unsigned long long> memo_counts(const mplx::VM &vm) {
+  unsigned long long hits = 0, misses = 0;
+  EXPECT_EQ(std::sscanf(vm.memoReport().c_str(), "memo: %llu hits, %llu misses", &hits, &misses), 2);
+  return {hits, misses};
+}
+
+static mplx::Bytecode compile_calls(const std::string &src) {
+  mplx::CompileOptions opts;
+  opts.inlineBudget = 0;
+  return compile(parse(src), opts).bc;
+}
+
+// Every compiled function only touches its frame, so all are pure; an unknown opcode makes
+// a function impure and so are its callers, while a cycle of pure functions stays pure
+TEST(Memo, Purity) {
+  auto bc = compile_calls("fn sq(x: i32)->i32{ return x * x; }"
+                          "fn even(n: i32)->i32{ if (n == 0) { return 1; } return odd(n - 1); }"
+                          "fn odd(n: i32)->i32{ if (n == 0) { return 0; } return even(n - 1); }"
+                          "fn main()->i32{ return sq(3) + even(4); }");
+  for (const auto &f : bc.functions)
+    EXPECT_TRUE(f.pure) << f.name;
+
+  mplx::Bytecode hand;
+  auto fn = [&](const char *name, const std::vector<int> &bytes) {
+    hand.functions.push_back(mplx::FuncMeta{name, (uint32_t)hand.code.size(), 0, 0});
+    for (int b : bytes)
+      hand.code.push_back((uint8_t)b);
+  };
+  auto call = [](int f) { return std::vector<int>{mplx::OP_CALL, f, 0, 0, 0, mplx::OP_RET}; };
+  fn("effect", {mplx::kLastOp + 1, mplx::OP_PUSH_I8, 1, mplx::OP_RET});
+  fn("caller", call(0));
+  fn("ping", call(3));
+  fn("pong", call(2));
+  fn("outer", call(1));
+  fn("bad_target", call(99));
+  mplx::analyze_purity(hand);
+  std::vector<bool> pure;
+  for (const auto &f : hand.functions)
+    pure.push_back(f.pure);
+  EXPECT_EQ(pure, (std::vector<bool>{false, false, true, true, false, false}));
+}
+
+static const char *kFib = "fn fib(n: i32)->i32{ if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); }"
+                          "fn main()->i32{ return fib(25); }";
+
+// Each distinct argument misses once, on the way down fib(n - 1); the fib(n - 2) calls
+// that follow hit, except in fib(2), where fib(0) is new
+TEST(Memo, HitsAndMisses) {
+  auto bc = compile_calls(kFib);
+  mplx::VM vm(bc);
+  vm.setMemoize(true);
+  EXPECT_EQ(vm.run("main"), 75025);
+  auto [hits, misses] = memo_counts(vm);
+  EXPECT_EQ(misses, 26u);
+  EXPECT_EQ(hits, 23u);
+  // the cache survives reset(): a second run is one hit
+  vm.reset();
+  EXPECT_EQ(vm.run("main"), 75025);
+  EXPECT_EQ(memo_counts(vm).first, hits + 1);
+  EXPECT_EQ(memo_counts(vm).second, misses);
+}
+
+// The arguments are recorded at the call: a callee that overwrites its parameters still
+// caches its result under the values it was called with
+TEST(Memo, ArgumentsRecordedBeforeTheCallee) {
+  auto bc = compile_calls("fn g(n: i32, k: i32)->i32{ n = n * 2; k = k + n; return n + k; }"
+                          "fn main()->i32{ return g(3, 1) * 1000 + g(3, 1) * 10 + g(6, 1); }");
+  mplx::VM vm(bc);
+  vm.setMemoize(true);
+  EXPECT_EQ(vm.run("main"), 13 * 1000 + 13 * 10 + 25);
+  EXPECT_EQ(memo_counts(vm), std::make_pair(1ull, 2ull));
+}
+
+// A TAILCALL reuses the frame, which then returns for both functions: the pending entries
+// of the caller and the callee are both filled by that one RET
+TEST(Memo, TailCallsFillPendingEntries) {
+  const char *src = "fn even(n: i32)->i32{ if (n == 0) { return 1; } return odd(n - 1); }"
+                    "fn odd(n: i32)->i32{ if (n == 0) { return 0; } return even(n - 1); }"
+                    "fn main()->i32{ return even(30) * 100 + odd(29) * 10 + even(31); }";
+  auto bc         = compile_calls(src);
+  uint32_t odd    = 0;
+  ASSERT_TRUE(mplx::find_function(bc, "odd", odd));
+  ASSERT_GT(count_op(bc, "even", mplx::OP_TAILCALL), 0u);
+  mplx::VM vm(bc);
+  vm.setMemoize(true);
+  EXPECT_EQ(vm.run("main"), 110);
+  // even(30) runs the chain even(30), odd(29), ..., even(0) and caches all 31 results, so
+  // odd(29) hits; even(31) starts the other chain, even(31), odd(30), ..., odd(0): 32 misses
+  EXPECT_EQ(memo_counts(vm), std::make_pair(1ull, 63ull));
+  long long n = 17;
+  EXPECT_EQ(vm.call(odd, &n, 1), 1);
+  EXPECT_EQ(memo_counts(vm), std::make_pair(2ull, 63ull));
+}
+
+// A run that throws leaves pending entries of frames that never returned; the next run
+// drops them instead of caching a result they did not compute
+TEST(Memo, StalePendingEntriesDropped) {
+  auto bc = compile_calls("fn depth(n: i32)->i32{ if (n == 0) { return 0; } return 1 + depth(n - 1); }"
+                          "fn main()->i32{ return depth(100); }");
+  uint32_t depth = 0;
+  ASSERT_TRUE(mplx::find_function(bc, "depth", depth));
+  mplx::VM vm(bc);
+  vm.setMemoize(true);
+  vm.setMaxCallDepth(64);
+  EXPECT_THROW(vm.run("main"), std::runtime_error);
+  for (long long n : {10ll, 40ll, 5ll})
+    EXPECT_EQ(vm.call(depth, &n, 1), n);
+  vm.setMaxCallDepth(200);
+  EXPECT_EQ(vm.run("main"), 100);
+  for (long long n = 0; n <= 100; n += 7)
+    EXPECT_EQ(vm.call(depth, &n, 1), n);
+}
+
+// A direct-mapped table smaller than the working set replaces entries on collision; the
+// results stay right and the table never grows
+TEST(Memo, CollisionsReplaceEntries) {
+  auto bc = compile_calls(kFib);
+  mplx::VM vm(bc);
+  vm.setMemoize(true, 2);
+  EXPECT_EQ(vm.run("main"), 75025);
+  auto [hits, misses] = memo_counts(vm);
+  EXPECT_GT(misses, 26u);
+  EXPECT_GT(hits, 0u);
+
+  mplx::MemoCache cache;
+  cache.init(2, 3); // rounded up to 4 slots
+  long long v = 0;
+  mplx::VMValue a[2];
+  a[0].i = 1;
+  a[1].i = 2;
+  EXPECT_FALSE(cache.lookup(a, v));
+  const long long args[2] = {1, 2};
+  cache.insert(args, 42);
+  EXPECT_TRUE(cache.lookup(a, v));
+  EXPECT_EQ(v, 42);
+  a[1].i = 3;
+  EXPECT_FALSE(cache.lookup(a, v));
+  EXPECT_EQ(cache.hits(), 1u);
+  EXPECT_EQ(cache.misses(), 2u);
+  // arity 0 and above kMaxArity are not cached
+  cache.init(0, 16);
+  EXPECT_FALSE(cache.enabled());
+  cache.init(mplx::MemoCache::kMaxArity + 1, 16);
+  EXPECT_FALSE(cache.enabled());
+}
@@ -1,7 +1,9 @@
 #include "../../Application/mplx-compiler/compiler.hpp"
+#include "../../Application/mplx-compiler/optimizer.hpp"
 #include "../../Application/mplx-vm/vm.hpp"
 #include "../../Domain/mplx-lang/lexer.hpp"
 #include "../../Domain/mplx-lang/parser.hpp"
+#include <climits>
 #include <gtest/gtest.h>
 
 static long long run_src(const char *src) {
@@ -17,6 +19,39 @@ static long long run_src(const char *src) {
   return vm.run("main");
 }
 
+static mplx::Module parse_src(const char *src) {
+  mplx::Lexer lx(src);
+  auto toks = lx.Lex();
+  mplx::Parser ps(std::move(toks));
+  auto m = ps.parse();
+  EXPECT_TRUE(ps.diagnostics().empty());
+  return m;
+}
+
+// Runs `src` after optimize_module; the result must match the unoptimized run
+static long long run_opt(const char *src, mplx::OptimizeStats *stats = nullptr, mplx::Module *out = nullptr) {
+  auto m  = parse_src(src);
+  auto st = mplx::optimize_module(m);
+  if (stats)
+    *stats = st;
+  mplx::Compiler c;
+  auto res = c.compile(m);
+  EXPECT_TRUE(res.diags.empty());
+  mplx::VM vm(res.bc);
+  long long v = vm.run("main");
+  EXPECT_EQ(v, run_src(src));
+  if (out)
+    *out = std::move(m);
+  return v;
+}
+
+static const mplx::Expr *returned(const mplx::Module &m, size_t fn = 0) {
+  const auto &body = m.functions[fn].body;
+  if (body.empty() || body.back()->kind != mplx::StmtKind::Return)
+    return nullptr;
+  return static_cast<const mplx::ReturnStmt *>(body.back().get())->value.get();
+}
+
 TEST(Optimizer, AlgebraicSimplify) {
   EXPECT_EQ(run_src("fn main()->i32{ let x = 21+0; return x*2; }"), 42);
   EXPECT_EQ(run_src("fn main()->i32{ let x = 21*1; return x*2; }"), 42);
@@ -25,6 +60,94 @@ TEST(Optimizer, AlgebraicSimplify) {
 }
 
 TEST(Optimizer, ConstIfFolding) {
-  EXPECT_EQ(run_src("fn main()->i32{ if(true){ return 42; } else { return 0; } }"), 42);
-  EXPECT_EQ(run_src("fn main()->i32{ if(false){ return 0; } else { return 42; } }"), 42);
+  EXPECT_EQ(run_src("fn main()->i32{ if(1){ return 42; } else { return 0; } }"), 42);
+  EXPECT_EQ(run_src("fn main()->i32{ if(0){ return 0; } else { return 42; } }"), 42);
 }
+
+TEST(Optimizer, NestedConstantSubtrees) {
+  mplx::Module m;
+  EXPECT_EQ(run_opt("fn main()->i32{ return (1+2)*3 - (10/2 - -1); }", nullptr, &m), 3);
+  ASSERT_NE(returned(m), nullptr);
+  EXPECT_EQ(returned(m)->kind, mplx::ExprKind::Literal);
+  EXPECT_EQ(run_opt("fn f(x: i32)->i32{ return (x + 1) + 2 - 3; } fn main()->i32{ return f(7); }", nullptr, &m), 7);
+  EXPECT_EQ(returned(m)->kind, mplx::ExprKind::Var);
+}
+
+TEST(Optimizer, LetPropagation) {
+  mplx::Module m;
+  mplx::OptimizeStats st;
+  EXPECT_EQ(run_opt("fn main()->i32{ let k = 4; return k*k; }", &st, &m), 16);
+  EXPECT_EQ(st.propagated, 2u);
+  ASSERT_EQ(m.functions[0].body.size(), 1u); // the let is gone
+  EXPECT_EQ(returned(m)->kind, mplx::ExprKind::Literal);
+  EXPECT_EQ(run_opt("fn main()->i32{ let a = 2; let b = a * 3; let i = 0; while (i < b) { i = i + a; } return i; }", &st), 6);
+  EXPECT_EQ(st.propagated, 3u);
+}
+
+TEST(Optimizer, ReassignedOrRedeclaredLetsStay) {
+  mplx::OptimizeStats st;
+  EXPECT_EQ(run_opt("fn main()->i32{ let k = 4; k = 5; return k*k; }", &st), 25);
+  EXPECT_EQ(st.propagated, 0u);
+  EXPECT_EQ(run_opt("fn main()->i32{ let k = 4; let c = 1; if (c == 1) { let k = 9; } return k; }", &st), 9);
+  EXPECT_EQ(run_opt("fn f(k: i32)->i32{ let k = 3; return k; } fn main()->i32{ return f(8); }", &st), 3);
+  EXPECT_EQ(st.propagated, 0u);
+}
+
+TEST(Optimizer, UnaryMinusAndComparisons) {
+  mplx::Module m;
+  EXPECT_EQ(run_opt("fn f(x: i32)->i32{ return -(-x); } fn main()->i32{ return f(5); }", nullptr, &m), 5);
+  EXPECT_EQ(returned(m)->kind, mplx::ExprKind::Var);
+  EXPECT_EQ(run_opt("fn f(x: i32)->i32{ return (x == x) + (x < x) + (3 < 4); } fn main()->i32{ return f(1); }", nullptr, &m), 2);
+  EXPECT_EQ(returned(m)->kind, mplx::ExprKind::Literal);
+  // a literal on the left moves to the right: 10 > x -> x < 10
+  EXPECT_EQ(run_opt("fn f(x: i32)->i32{ return 10 > x; } fn main()->i32{ return f(3); }", nullptr, &m), 1);
+  auto cmp = static_cast<const mplx::BinaryExpr *>(returned(m));
+  EXPECT_EQ(cmp->op, mplx::BinOp::Lt);
+  EXPECT_EQ(cmp->rhs->kind, mplx::ExprKind::Literal);
+}
+
+TEST(Optimizer, ConstantBranchesRemoved) {
+  mplx::OptimizeStats st;
+  EXPECT_EQ(run_opt("fn main()->i32{ let d = 2; if (d * 2 == 4) { return 42; } else { return 0; } }", &st), 42);
+  EXPECT_EQ(st.branchesRemoved, 1u);
+  EXPECT_EQ(run_opt("fn main()->i32{ let s = 1; let stop = 0; while (stop > 1) { s = s + 1; } return s; }", &st), 1);
+  EXPECT_EQ(st.branchesRemoved, 1u);
+  // a `let` in the untaken branch still names the local read after the if, so the branch stays
+  EXPECT_EQ(run_opt("fn main()->i32{ let b = 7; let one = 1; if (one == 2) { let b = 5; } return b; }", &st), 0);
+  EXPECT_EQ(st.branchesRemoved, 0u);
+  // and so does a literal one, where the compiler gives the name a slot that stays 0
+  EXPECT_EQ(run_opt("fn main()->i32{ if (0) { let b = 5; } return b + 3; }", &st), 3);
+  EXPECT_EQ(st.branchesRemoved, 0u);
+}
+
+TEST(Optimizer, CallsAndFaultsKept) {
+  mplx::OptimizeStats st;
+  EXPECT_EQ(run_opt("fn g()->i32{ return 7; } fn main()->i32{ let z = g() * 0; return z + 1; }", &st), 1);
+  // division by zero is left for the VM
+  auto m = parse_src("fn main()->i32{ let z = 0; return 10 / z; }");
+  mplx::optimize_module(m);
+  ASSERT_EQ(returned(m)->kind, mplx::ExprKind::Binary);
+  EXPECT_EQ(static_cast<const mplx::BinaryExpr *>(returned(m))->op, mplx::BinOp::Div);
+}
+
+// The compiler folds literal operands itself, with the same wrapping arithmetic
+TEST(Optimizer, CompilerFoldWraps) {
+  auto wrap_mul = [](long long a, long long b) { return (long long)((unsigned long long)a * (unsigned long long)b); };
+  EXPECT_EQ(run_src("fn main()->i32{ return 2147483647 * 5000000000; }"), wrap_mul(2147483647, 5000000000));
+  EXPECT_EQ(run_src("fn main()->i32{ return 9223372036854775807 + 1 < 0; }"), 1);
+  // a division that faults stays a DIV: by zero, and LLONG_MIN / -1
+  for (auto [lhs, rhs] : {std::pair<long long, long long>{10, 0}, {LLONG_MIN, -1}}) {
+    auto m  = parse_src("fn main()->i32{ return 1 / 1; }");
+    auto *d = static_cast<mplx::BinaryExpr *>(const_cast<mplx::Expr *>(returned(m)));
+    static_cast<mplx::LiteralExpr *>(d->lhs.get())->value = lhs;
+    static_cast<mplx::LiteralExpr *>(d->rhs.get())->value = rhs;
+    mplx::Compiler c;
+    auto res = c.compile(m);
+    EXPECT_TRUE(res.diags.empty());
+    bool div = false;
+    for (size_t ip = 0; ip < res.bc.code.size(); ip += 1 + mplx::op_operand_size((mplx::Op)res.bc.code[ip]))
+      div = div || res.bc.code[ip] == mplx::OP_DIV;
+    EXPECT_TRUE(div) << lhs << " / " << rhs;
+  }
+}
+
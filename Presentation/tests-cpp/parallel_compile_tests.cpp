@@ -0,0 +1,73 @@
+#include "compile_helpers.hpp"
+
+using namespace mplx_test;
+
+// A module of `n` functions, each calling a few earlier ones, small enough to be inlined and
+// large enough not to be, plus loops and a tail-recursive helper
+static std::string generated_module(int n) {
+  std::string src = "fn loop0(n: i32, acc: i32)->i32{ if (n == 0) { return acc; } return loop0(n - 1, acc + n); }";
+  for (int i = 1; i <= n; ++i) {
+    src += "fn f" + std::to_string(i) + "(x: i32)->i32{ let s = x; let i = 0; while (i < " + std::to_string(i % 7 + 1) + ") { s = s + i * " + std::to_string(i) + "; i = i + 1; }";
+    if (i > 1)
+      src += " s = s + f" + std::to_string(i - 1) + "(x - 1);";
+    if (i > 3 && i % 3 == 0)
+      src += " if (s > 1000) { s = s - f" + std::to_string(i / 3) + "(2); } else { s = s + loop0(" + std::to_string(i) + ", 0); }";
+    if (i % 4 == 0) {
+      src += " let t = s * 3 + x; t = t - s; t = t * 2 + 1; s = s + t / 5;";
+      src += " return f" + std::to_string(i / 2) + "(s / 100);";
+    }
+    src += " return s; }";
+  }
+  src += "fn main()->i32{ return f" + std::to_string(n) + "(3) - f" + std::to_string(n / 2) + "(1); }";
+  return src;
+}
+
+// Any number of compile threads must produce the bytecode a single thread does, byte for
+// byte, along with the same inline sites and peephole counts
+TEST(ParallelCompile, MatchesSingleThread) {
+  auto m = parse(generated_module(60));
+  for (bool ssa : {false, true})
+    for (uint32_t super : {0u, mplx::kAllSuperinstructions}) {
+      mplx::CompileOptions one;
+      one.ssa               = ssa;
+      one.superinstructions = super;
+      auto ref              = compile(m, one);
+      long long v           = run(ref.bc);
+      EXPECT_FALSE(ref.inlined.empty());
+      for (unsigned threads : {2u, 4u, 16u, 0u}) {
+        auto opts    = one;
+        opts.threads = threads;
+        for (int round = 0; round < 3; ++round) {
+          auto res = compile(m, opts);
+          EXPECT_TRUE(same_bytecode(res.bc, ref.bc)) << "ssa=" << ssa << " super=" << super << " threads=" << threads;
+          ASSERT_EQ(res.inlined.size(), ref.inlined.size());
+          for (size_t i = 0; i < res.inlined.size(); ++i) {
+            EXPECT_EQ(res.inlined[i].caller, ref.inlined[i].caller);
+            EXPECT_EQ(res.inlined[i].callee, ref.inlined[i].callee);
+          }
+          EXPECT_EQ(res.peephole.storesFused, ref.peephole.storesFused);
+          EXPECT_EQ(res.peephole.jumpsThreaded, ref.peephole.jumpsThreaded);
+          EXPECT_EQ(res.peephole.loopsInverted, ref.peephole.loopsInverted);
+          EXPECT_EQ(res.peephole.unreachable, ref.peephole.unreachable);
+          EXPECT_EQ(run(res.bc), v);
+        }
+      }
+    }
+}
+
+// Diagnostics come out in function order whichever thread found them
+TEST(ParallelCompile, DiagnosticsInFunctionOrder) {
+  std::string src;
+  for (int i = 0; i < 40; ++i)
+    src += "fn g" + std::to_string(i) + "(x: i32)->i32{ return x + " + (i % 5 == 0 ? "missing" + std::to_string(i) : std::string("1")) + "; }";
+  src += "fn main()->i32{ return g1(1); }";
+  auto m = parse(src);
+  for (bool ssa : {false, true}) {
+    mplx::CompileOptions one, many;
+    one.ssa = many.ssa = ssa;
+    many.threads       = 8;
+    auto a = mplx::Compiler(one).compile(m), b = mplx::Compiler(many).compile(m);
+    EXPECT_EQ(a.diags.size(), 8u) << "ssa=" << ssa;
+    EXPECT_EQ(a.diags, b.diags) << "ssa=" << ssa;
+  }
+}
@@ -0,0 +1,44 @@
+#include "compile_helpers.hpp"
+
+using namespace mplx_test;
+
+// main() with the peephole pass off and on, from the AST and through SSA, with and without
+// superinstructions, on both tiers; all must agree and the rewritten code must pass the
+// verifier. `stats` receives the pass's counts for the default options.
+static long long run_peephole(const char *src, mplx::PeepholeStats *stats = nullptr) {
+  if (stats)
+    *stats = compile(parse(src)).peephole;
+  return run_matrix(src, {toggle("peephole", &mplx::CompileOptions::peephole), toggle("ssa", &mplx::CompileOptions::ssa), fusion_axis()});
+}
+
+TEST(Peephole, StoresAndJumps) {
+  mplx::PeepholeStats st;
+  EXPECT_EQ(run_peephole("fn main()->i32{ let x = 1; let y = 2; x = x + y; y = x * 3; return x + y; }", &st), 12);
+  EXPECT_GT(st.storesFused, 0u);
+  // the if's false jump lands on the else's JMP over the join, and code after a return is dead
+  EXPECT_EQ(run_peephole("fn f(x: i32)->i32{ let y = 0; if (x > 0) { if (x > 5) { y = 2; } else { y = 1; } } else { y = 3; } return y; return 9; }"
+                         "fn main()->i32{ return f(7) * 100 + f(2) * 10 + f(-1); }",
+                         &st),
+            213);
+  EXPECT_GT(st.jumpsThreaded, 0u);
+  EXPECT_GT(st.unreachable, 0u);
+}
+
+// Inverting a loop inserts a copy of its test at the bottom, so everything after it moves:
+// jumps across the loop, the targets of enclosing loops and the entries of later functions
+// must all be relocated. The `if` that ends inner's loop body jumps to the back edge the
+// copy replaces.
+TEST(Peephole, LoopInversionRelocatesJumps) {
+  mplx::PeepholeStats st;
+  const char *src = "fn inner(n: i32)->i32{ let s = 0; let i = 0; while (i < n) { let j = 0; while (j < i) { s = s + j; j = j + 1; } if (s > 50) { s = s - 7; } else { s = s + 1; } i = i + 1; if (i > 4) { s = s + i; } } return s; }"
+                    "fn outer(k: i32)->i32{ let t = 0; if (k > 0) { while (k > 0) { t = t + inner(k); k = k - 1; } } else { t = 0 - 1; } return t; }"
+                    "fn main()->i32{ return outer(12) + outer(0) + inner(3); }";
+  long long v     = run_peephole(src, &st);
+  EXPECT_GE(st.loopsInverted, 3u);
+  mplx::CompileOptions off;
+  off.peephole = false;
+  EXPECT_EQ(v, run(src, off));
+  // a bottom-tested loop takes one jump per iteration instead of two
+  auto m = parse(src);
+  EXPECT_LT(executed(compile(m).bc), executed(compile(m, off).bc));
+}
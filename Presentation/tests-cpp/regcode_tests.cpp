@@ -0,0 +1,42 @@
+#include "compile_helpers.hpp"
+
+using namespace mplx_test;
+
+// main() of `src` on the stack tier and on the register tier, with and without
+// superinstructions; all four must agree
+static long long run_both_tiers(const char *src) {
+  return run_matrix(src, {fusion_axis()});
+}
+
+TEST(RegTier, MatchesStackTier) {
+  EXPECT_EQ(run_both_tiers("fn fib(n: i32)->i32{ if (n <= 1) { return n; } return fib(n-1) + fib(n-2); }"
+                           "fn main()->i32{ return fib(15); }"),
+            610);
+  EXPECT_EQ(run_both_tiers("fn main()->i32{ let s = 0; let i = 0; while (i < 100) { s = s + i * 3 - 1; i = i + 1; } return s; }"),
+            14750);
+  EXPECT_EQ(run_both_tiers("fn g(a: i32, b: i32)->i32{ return (a - b) * (a + b) / 3; } fn main()->i32{ return g(9, 4) + g(2, 7); }"),
+            6);
+}
+
+// The inliner puts f0's `if` inside the comparison in f1, with the product still on the
+// operand stack. Its constant condition folds, so the else block is reached only by dead
+// code and must still be lowered at the stack depth of the branch, not at 0.
+TEST(RegTier, FoldedBranchInsideInlinedExpression) {
+  EXPECT_EQ(run_both_tiers("fn f0(p0: i32)->i32{ if (-5) { let v0 = (p0 <= p0); } else { let v3 = (-1 / 7); } let v0 = v3; return 3; }"
+                           "fn f1(p0: i32)->i32{ ((p0 * 11) == f0(p0)); return 1; }"
+                           "fn main()->i32{ return f1(2); }"),
+            1);
+  // the same through a folded comparison (compareBranch) instead of a folded value
+  EXPECT_EQ(run_both_tiers("fn f0(p0: i32)->i32{ if (2 > 1) { let v0 = p0; } else { let v3 = (p0 / 7); } return p0 + 1; }"
+                           "fn f1(p0: i32)->i32{ return (p0 * 11) - f0(p0); }"
+                           "fn main()->i32{ return f1(2); }"),
+            19);
+}
+
+// An immediate left operand of a comparison must not be swapped below a register operand:
+// loading it would overwrite that register before the comparison reads it
+TEST(RegTier, ImmediateLeftOperand) {
+  EXPECT_EQ(run_both_tiers("fn main()->i32{ return (0 != ((-1 / 7) < 3)); }"), 1);
+  EXPECT_EQ(run_both_tiers("fn f(x: i32)->i32{ return (5 == (x + 4)) + (0 < (x * 2)); } fn main()->i32{ return f(1); }"), 2);
+  EXPECT_EQ(run_both_tiers("fn f(x: i32)->i32{ return 10 - (x / 3); } fn main()->i32{ return f(9); }"), 7);
+}
@@ -0,0 +1,73 @@
+#include "compile_helpers.hpp"
+#include "../../Application/mplx-compiler/ir.hpp"
+#include "../../Application/mplx-compiler/ir_passes.hpp"
+
+using namespace mplx_test;
+
+// main() compiled straight from the AST and through the SSA pipeline, on both tiers; all
+// must agree
+static long long run_ast_and_ssa(const char *src) {
+  return run_matrix(src, {toggle("ssa", &mplx::CompileOptions::ssa)});
+}
+
+TEST(Ssa, MatchesAstCompiler) {
+  // phis at a join and around a loop, including a swap through a temporary
+  EXPECT_EQ(run_ast_and_ssa("fn main()->i32{ let a = 0; let b = 1; let i = 0; while (i < 40) { let t = a + b; a = b; b = t; i = i + 1; } return a; }"),
+            102334155);
+  EXPECT_EQ(run_ast_and_ssa("fn f(x: i32)->i32{ let y = 0; if (x > 3) { y = x * 2; } else { if (x < 0) { y = 0 - x; } else { y = 7; } } return y; }"
+                            "fn main()->i32{ return f(5) * 10000 + f(-4) * 100 + f(1); }"),
+            100407);
+  // nested loops, calls and recursion
+  EXPECT_EQ(run_ast_and_ssa("fn g(n: i32)->i32{ if (n <= 1) { return 1; } return n * g(n - 1); }"
+                            "fn main()->i32{ let s = 0; let i = 0; while (i < 5) { let j = 0; while (j < i) { s = s + g(j); j = j + 1; } i = i + 1; } return s; }"),
+            17);
+  // a let in a branch names one slot for the whole function: it reads 0 until written and
+  // keeps its value across loop iterations
+  EXPECT_EQ(run_ast_and_ssa("fn main()->i32{ let i = 0; let s = 0; while (i < 3) { if (i == 1) { let v = 10; } s = s + v; v = v + 1; i = i + 1; } return s; }"),
+            21);
+  // a let in the untaken branch of a literal `if` never binds
+  EXPECT_EQ(run_ast_and_ssa("fn main()->i32{ let b = 7; if (0) { let b = 5; } return b; }"), 7);
+  // but still declares a name bound nowhere else: it reads 0 until assigned, inlined copies
+  // included, and the other branch can assign it
+  EXPECT_EQ(run_ast_and_ssa("fn main()->i32{ if (0) { let b = 5; } return b * 0 + 3; }"), 3);
+  EXPECT_EQ(run_ast_and_ssa("fn main()->i32{ if (0) { let b = 5; } let s = 0; let i = 0; while (i < 3) { s = s + b; b = b + 2; i = i + 1; } return s; }"), 6);
+  EXPECT_EQ(run_ast_and_ssa("fn main()->i32{ if (0) { let c = 1; } else { c = 4; } if (1) { c = c + 1; } else { while (c < 9) { let d = 2; } } return c * 10 + d; }"), 50);
+  EXPECT_EQ(run_ast_and_ssa("fn f(x: i32)->i32{ if (0) { let t = 9; } let r = t; t = x; return r + x; }"
+                            "fn main()->i32{ let s = 0; let i = 0; while (i < 3) { s = s + f(i); i = i + 1; } return s; }"),
+            3);
+  // division keeps truncation toward zero
+  EXPECT_EQ(run_ast_and_ssa("fn main()->i32{ let a = 0 - 7; let b = 2; return (a / 2) * 100 + (a / b) * 10 + (7 / (0 - b)); }"), -333);
+}
+
+// SCCP folds a branch whose condition is constant on every path; the function reduces to
+// returning the constant
+TEST(Ssa, ConstantBranchesFold) {
+  auto m = parse("fn main()->i32{ let x = 3; let y = 0; if (x > 2) { y = x * 2; } else { y = 1; } while (x < 3) { y = y + 1; } return y; }");
+  mplx::CompileOptions ast, ssa;
+  ssa.ssa = true;
+  auto a = compile(m, ast), s = compile(m, ssa);
+  EXPECT_EQ(run(a.bc), 6);
+  EXPECT_EQ(run(s.bc), 6);
+  EXPECT_GT(count_op(a.bc, "main", mplx::OP_JMP_IF_FALSE) + count_op(a.bc, "main", mplx::OP_JMP_IF_TRUE), 0u);
+  EXPECT_EQ(count_op(s.bc, "main", mplx::OP_JMP_IF_FALSE) + count_op(s.bc, "main", mplx::OP_JMP_IF_TRUE), 0u);
+  EXPECT_LT(s.bc.code.size(), a.bc.code.size());
+}
+
+// build_ir and every pass of the default pipeline leave well-formed IR
+TEST(Ssa, PassesKeepIrWellFormed) {
+  auto m = parse("fn f(n: i32, k: i32)->i32{ let s = 0; let i = 0; while (i < n) { s = s + i * k + (k / 3); if (s > 100) { s = s - 50; } i = i + 1; } return s; }"
+                 "fn r(n: i32, acc: i32)->i32{ if (n == 0) { return acc; } return r(n - 1, acc + n); }"
+                 "fn main()->i32{ return f(20, 4) + r(10, 0); }");
+  std::vector<std::string> diags;
+  auto ir = mplx::build_ir(m, diags);
+  EXPECT_TRUE(diags.empty());
+  for (const auto &f : ir.functions)
+    EXPECT_TRUE(mplx::verify_ir(f).empty()) << mplx::dump_ir(f);
+  mplx::IrPipelineOptions all;
+  all.strengthReduction = true;
+  auto pm = mplx::default_ir_pipeline(all);
+  pm.setVerify(true); // throws naming the pass that broke it
+  EXPECT_NO_THROW(pm.run(ir));
+  for (const auto &f : ir.functions)
+    EXPECT_TRUE(mplx::verify_ir(f).empty()) << mplx::dump_ir(f);
+}
@@ -0,0 +1,97 @@
+#include "compile_helpers.hpp"
+
+using namespace mplx_test;
+
+// One function per pattern, so each superinstruction has a sequence to fuse
+static const char *kLoops = "fn count(n: i32)->i32{ let s = 0; let i = 0; while (i < n) { s = s + i; i = i + 1; } return s; }"
+                            "fn down(n: i32)->i32{ let k = 0; while (k <= 9) { n = n - 3; k = k + 1; } return n; }"
+                            "fn tri(n: i32)->i32{ let t = 0; let j = 1; while (j <= n) { t = t + j * 2; j = j + 1; }"
+                            "  while (t < 1000) { t = t * 2; } return t; }"
+                            "fn main()->i32{ return count(100) + down(50) + tri(12); }";
+
+// Calls stay calls and stores stay STx POP, so every pattern survives to the fusion pass
+static mplx::CompileOptions fusion_opts(uint32_t mask) {
+  mplx::CompileOptions opts;
+  opts.inlineBudget      = 0;
+  opts.peephole          = false;
+  opts.superinstructions = mask;
+  return opts;
+}
+
+static size_t count_everywhere(const mplx::Bytecode &bc, mplx::Op op) {
+  size_t n = 0;
+  for (const auto &f : bc.functions)
+    n += count_op(bc, f.name, op);
+  return n;
+}
+
+// Each superinstruction on its own replaces its sequence, keeps the result and lowers the
+// number of dispatched instructions; the fused code verifies and lowers to the register tier
+TEST(Superinstructions, EachFusesAndRunsTheSame) {
+  auto m                    = parse(kLoops);
+  const auto plain          = compile(m, fusion_opts(0)).bc;
+  const long long expected  = run(plain);
+  const uint64_t dispatched = executed(plain);
+  for (unsigned op = mplx::OP_ST_POP; op <= mplx::kLastOp; ++op) {
+    const uint32_t bit = mplx::superinstruction_bit((mplx::Op)op);
+    auto bc            = compile(m, fusion_opts(bit)).bc;
+    const char *name   = mplx::op_name((mplx::Op)op);
+    EXPECT_EQ(bc.fused.mask, bit) << name;
+    EXPECT_EQ(bc.fused.version, mplx::kSuperinstructionVersion) << name;
+    EXPECT_GT(count_everywhere(bc, (mplx::Op)op), 0u) << name;
+    EXPECT_TRUE(mplx::verify_bytecode(bc, (uint32_t)mplx::VM::kStackHeadroom).empty()) << name;
+    EXPECT_EQ(run(bc), expected) << name;
+    EXPECT_EQ(run_reg(bc), expected) << name;
+    EXPECT_LT(executed(bc), dispatched) << name;
+  }
+  auto all = compile(m, fusion_opts(mplx::kAllSuperinstructions)).bc;
+  EXPECT_EQ(run(all), expected);
+  EXPECT_LT(all.code.size(), plain.code.size());
+}
+
+// Sequences of superinstructions outside the mask stay base opcodes
+TEST(Superinstructions, DisabledPatternsStay) {
+  auto m  = parse(kLoops);
+  auto bc = compile(m, fusion_opts(mplx::kAllSuperinstructions & ~mplx::superinstruction_bit(mplx::OP_INC_LOCAL))).bc;
+  EXPECT_EQ(count_everywhere(bc, mplx::OP_INC_LOCAL), 0u);
+  auto none = compile(m, fusion_opts(0)).bc;
+  EXPECT_EQ(none.fused.mask, 0u);
+  for (unsigned op = mplx::OP_ST_POP; op <= mplx::kLastOp; ++op)
+    EXPECT_EQ(count_everywhere(none, (mplx::Op)op), 0u) << mplx::op_name((mplx::Op)op);
+}
+
+// Fused code records the set's version: code fused by a build with another set is refused
+// by both the verifier and the VM, and fusing twice is an error
+TEST(Superinstructions, VersionIsChecked) {
+  auto m  = parse(kLoops);
+  auto bc = compile(m, fusion_opts(mplx::kAllSuperinstructions)).bc;
+  EXPECT_THROW(mplx::fuse_superinstructions(bc, mplx::kAllSuperinstructions), std::runtime_error);
+  bc.fused.version = mplx::kSuperinstructionVersion + 1;
+  auto errors      = mplx::verify_bytecode(bc, (uint32_t)mplx::VM::kStackHeadroom);
+  ASSERT_EQ(errors.size(), 1u);
+  EXPECT_NE(errors[0].find("unsupported superinstruction set version"), std::string::npos);
+  EXPECT_THROW(mplx::VM(bc).run("main"), std::runtime_error);
+  // unfused code has no set to mismatch
+  auto plain          = compile(m, fusion_opts(0)).bc;
+  plain.fused.version = mplx::kSuperinstructionVersion + 1;
+  EXPECT_TRUE(mplx::verify_bytecode(plain, (uint32_t)mplx::VM::kStackHeadroom).empty());
+  EXPECT_EQ(run(plain), run(compile(m).bc));
+}
+
+// The profile of an unfused run selects the sequences that dominate it
+TEST(Superinstructions, ProfileSelectsHotSequences) {
+  auto bc = compile(parse(kLoops), fusion_opts(0)).bc;
+  mplx::VM vm(bc);
+  vm.setProfile(true);
+  vm.run("main");
+  const auto &profile = vm.sequenceProfile();
+  EXPECT_GT(profile.total(), 0u);
+  uint32_t mask = mplx::select_superinstructions(profile);
+  EXPECT_TRUE(mask & mplx::superinstruction_bit(mplx::OP_INC_LOCAL)) << mplx::superinstruction_names(mask);
+  EXPECT_TRUE(mask & mplx::superinstruction_bit(mplx::OP_LL_LT_JF)) << mplx::superinstruction_names(mask);
+  const uint32_t top = mplx::select_superinstructions(profile, 0.01, 1);
+  EXPECT_TRUE(top != 0 && (top & (top - 1)) == 0) << mplx::superinstruction_names(top);
+  EXPECT_EQ(mplx::select_superinstructions(profile, 1.0), 0u);
+  EXPECT_EQ(mplx::superinstruction_names(mplx::superinstruction_bit(mplx::OP_ST_POP) | mplx::superinstruction_bit(mplx::OP_INC_LOCAL)),
+            "ST_POP,INC_LOCAL");
+}
@@ -0,0 +1,55 @@
+#include "compile_helpers.hpp"
+
+using namespace mplx_test;
+
+static const char *kSum = "fn sum(n: i32, acc: i32)->i32{ if (n == 0) { return acc; } return sum(n - 1, acc + n); }";
+static const char *kEvenOdd = "fn even(n: i32)->i32{ if (n == 0) { return 1; } return odd(n - 1); }"
+                              "fn odd(n: i32)->i32{ if (n == 0) { return 0; } return even(n - 1); }";
+
+// main() with tail calls on and off, from the AST and through SSA, on both tiers; all must
+// agree (the recursion is kept shallow enough for the calls)
+static long long run_tail(const std::string &src) {
+  return run_matrix(src, {toggle("tail", &mplx::CompileOptions::tailCalls), toggle("ssa", &mplx::CompileOptions::ssa)});
+}
+
+TEST(TailCalls, MatchesWithoutTailCalls) {
+  EXPECT_EQ(run_tail(std::string(kSum) + "fn main()->i32{ return sum(100, 0); }"), 5050);
+  EXPECT_EQ(run_tail(std::string(kEvenOdd) + "fn main()->i32{ return even(10) * 10 + odd(7); }"), 11);
+  // a tail call with the parameters swapped must read both before either is overwritten
+  EXPECT_EQ(run_tail("fn gcd(a: i32, b: i32)->i32{ if (b == 0) { return a; } return gcd(b, a - (a / b) * b); }"
+                     "fn main()->i32{ return gcd(1071, 462) * 1000 + gcd(17, 5); }"),
+            21001);
+  // a call that is not in tail position stays a call
+  EXPECT_EQ(run_tail("fn f(n: i32)->i32{ if (n == 0) { return 0; } return 1 + f(n - 1); } fn main()->i32{ return f(50); }"), 50);
+}
+
+// Self tail recursion becomes a jump back to the entry and runs in one frame at any depth;
+// compiled as calls the same recursion exceeds the VM's call depth limit
+TEST(TailCalls, DeepSelfRecursion) {
+  auto m = parse(std::string(kSum) + "fn main()->i32{ return sum(1000000, 0); }");
+  for (bool ssa : {false, true}) {
+    mplx::CompileOptions on, off;
+    on.ssa        = off.ssa = ssa;
+    off.tailCalls = false;
+    auto bc       = compile(m, on).bc;
+    EXPECT_EQ(count_op(bc, "sum", mplx::OP_CALL) + count_op(bc, "sum", mplx::OP_TAILCALL), 0u) << "ssa=" << ssa;
+    EXPECT_EQ(run(bc), 500000500000LL) << "ssa=" << ssa;
+    EXPECT_EQ(run_reg(bc), 500000500000LL) << "ssa=" << ssa;
+    EXPECT_THROW(run(compile(m, off).bc), std::runtime_error) << "ssa=" << ssa;
+  }
+}
+
+// Mutual recursion reuses the frame through OP_TAILCALL
+TEST(TailCalls, DeepMutualRecursion) {
+  auto m = parse(std::string(kEvenOdd) + "fn main()->i32{ return even(1000001) * 10 + odd(1000001); }");
+  for (bool ssa : {false, true}) {
+    mplx::CompileOptions on, off;
+    on.ssa        = off.ssa = ssa;
+    off.tailCalls = false;
+    auto bc       = compile(m, on).bc;
+    EXPECT_EQ(count_op(bc, "even", mplx::OP_TAILCALL), 1u) << "ssa=" << ssa;
+    EXPECT_EQ(count_op(bc, "even", mplx::OP_CALL), 0u) << "ssa=" << ssa;
+    EXPECT_EQ(run(bc), 1) << "ssa=" << ssa;
+    EXPECT_THROW(run(compile(m, off).bc), std::runtime_error) << "ssa=" << ssa;
+  }
+}
@@ -0,0 +1,105 @@
+#include "compile_helpers.hpp"
+
+using namespace mplx_test;
+
+// Address of the first `op` in the code of function `fn`
+static uint32_t find_op(const mplx::Bytecode &bc, const std::string &fn, mplx::Op op) {
+  uint32_t index = 0;
+  EXPECT_TRUE(mplx::find_function(bc, fn, index)) << fn;
+  uint32_t ip = bc.functions[index].entry;
+  while (ip < bc.code.size() && bc.code[ip] != op)
+    ip += 1 + mplx::op_operand_size((mplx::Op)bc.code[ip]);
+  EXPECT_LT(ip, bc.code.size()) << fn << " has no " << mplx::op_name(op);
+  return ip;
+}
+
+static std::vector<std::string> verify(const mplx::Bytecode &bc) {
+  return mplx::verify_bytecode(bc, (uint32_t)mplx::VM::kStackHeadroom);
+}
+
+// Calls stay calls, so each function keeps the code mutated below
+static mplx::Bytecode compile_calls(const char *src) {
+  mplx::CompileOptions opts;
+  opts.inlineBudget = 0;
+  return compile(parse(src), opts).bc;
+}
+
+static bool mentions(const std::vector<std::string> &errors, const std::string &what) {
+  for (const auto &e : errors)
+    if (e.find(what) != std::string::npos)
+      return true;
+  return false;
+}
+
+static const char *kProgram = "fn big(x: i32)->i32{ return x * 5000000000; }"
+                              "fn pick(x: i32)->i32{ if (x > 2) { return x - 2; } return x; }"
+                              "fn main()->i32{ let s = 0; let i = 0; while (i < 6) { s = s + pick(i); i = i + 1; } return s; }";
+
+// What the compiler emits passes, so the VM runs it on the unchecked core
+TEST(Verifier, CompiledModulesVerify) {
+  auto m = parse(kProgram);
+  for (bool ssa : {false, true})
+    for (uint32_t super : {0u, mplx::kAllSuperinstructions}) {
+      mplx::CompileOptions opts;
+      opts.inlineBudget      = 0;
+      opts.ssa               = ssa;
+      opts.superinstructions = super;
+      auto bc                = compile(m, opts).bc;
+      EXPECT_TRUE(verify(bc).empty()) << "ssa=" << ssa << " super=" << super;
+      mplx::VM vm(bc);
+      EXPECT_TRUE(vm.isVerified());
+      EXPECT_EQ(vm.run("main"), 9);
+    }
+}
+
+// Two functions with one entry leave the first of them an empty code range; the verifier
+// rejects the module and the VM runs it on the checked core, main now executing f's code
+TEST(Verifier, DuplicateEntry) {
+  auto bc = compile(parse("fn f()->i32{ return 7; } fn main()->i32{ return f() + 1; }")).bc;
+  ASSERT_EQ(bc.functions.size(), 2u);
+  bc.functions[1].entry = bc.functions[0].entry;
+  EXPECT_TRUE(mentions(verify(bc), "is shared with another function"));
+  mplx::VM vm(bc);
+  EXPECT_FALSE(vm.isVerified());
+  EXPECT_EQ(vm.run("main"), 7);
+}
+
+// A module that fails only in code main never reaches still runs, checked, to the same result
+TEST(Verifier, UnverifiedModuleRunsChecked) {
+  auto bc = compile_calls(kProgram);
+  uint32_t big = 0;
+  ASSERT_TRUE(mplx::find_function(bc, "big", big));
+  bc.functions[big].locals = 0;
+  EXPECT_TRUE(mentions(verify(bc), "arity exceeds locals"));
+  mplx::VM vm(bc);
+  EXPECT_FALSE(vm.isVerified());
+  EXPECT_EQ(vm.run("main"), 9);
+}
+
+// The VM throws on the faults the verifier would have rejected: the checked core when it
+// reaches them, the load-time decode for bad constants and jump targets
+TEST(Verifier, CheckedCoreThrows) {
+  const auto good = compile_calls(kProgram);
+  {
+    auto bc = good;
+    bc.code[find_op(bc, "pick", mplx::OP_LD0)] = mplx::OP_LD3;
+    EXPECT_TRUE(mentions(verify(bc), "local 3 out of range"));
+    mplx::VM vm(bc);
+    EXPECT_FALSE(vm.isVerified());
+    EXPECT_THROW(vm.run("main"), std::runtime_error);
+  }
+  {
+    auto bc = good;
+    bc.code[find_op(bc, "big", mplx::OP_PUSH_CONST) + 1] = 0xff;
+    EXPECT_TRUE(mentions(verify(bc), "constant index"));
+    EXPECT_THROW(mplx::VM(bc).run("main"), std::runtime_error);
+  }
+  {
+    auto bc     = good;
+    uint32_t ip = find_op(bc, "pick", mplx::OP_JMP_IF_FALSE);
+    for (uint32_t k = 0; k < 4; ++k)
+      bc.code[ip + mplx::op_operand_size(mplx::OP_JMP_IF_FALSE) - 3 + k] = 0xff;
+    EXPECT_TRUE(mentions(verify(bc), "jump target"));
+    EXPECT_THROW(mplx::VM(bc).run("main"), std::runtime_error);
+  }
+}
@@ -0,0 +1,231 @@
+#include "compile_helpers.hpp"
+#include "../../Application/mplx-vm/vm_pool.hpp"
+#include <thread>
+
+using namespace mplx_test;
+
+static const char *kDepth = "fn depth(n: i32)->i32{ if (n == 0) { return 0; } return 1 + depth(n - 1); }"
+                            "fn main()->i32{ return depth(100); }";
+
+// A run that throws leaves the VM as it was before the run: the next one starts from an
+// empty frame stack without reset(), and the arguments of failed calls do not pile up
+TEST(Vm, RecoversAfterError) {
+  auto bc = compile(parse(kDepth)).bc;
+  uint32_t depth = 0;
+  ASSERT_TRUE(mplx::find_function(bc, "depth", depth));
+  mplx::VM vm(bc);
+  vm.setMaxCallDepth(64);
+  EXPECT_THROW(vm.run("main"), std::runtime_error);
+  long long n = 10;
+  EXPECT_EQ(vm.call(depth, &n, 1), 10);
+  for (int i = 0; i < 10000; ++i) {
+    n = 1000;
+    EXPECT_THROW(vm.call(depth, &n, 1), std::runtime_error);
+  }
+  n = 60;
+  EXPECT_EQ(vm.call(depth, &n, 1), 60);
+  vm.setMaxCallDepth(120);
+  EXPECT_EQ(vm.run("main"), 100);
+}
+
+// The same on the checked core, which runs modules that did not verify
+TEST(Vm, CheckedCoreRecoversAfterError) {
+  auto bc     = compile(parse(kDepth)).bc;
+  auto broken = bc.functions[0];
+  broken.name = "broken";
+  ++broken.arity; // more parameters than locals, and an entry shared with depth()
+  bc.functions.push_back(broken);
+  mplx::VM vm(bc);
+  ASSERT_FALSE(vm.isVerified());
+  vm.setMaxCallDepth(64);
+  EXPECT_THROW(vm.run("main"), std::runtime_error);
+  vm.setMaxCallDepth(120);
+  EXPECT_EQ(vm.run("main"), 100);
+}
+
+// A slice that throws ends the suspended run; the next start needs no reset()
+TEST(Vm, SliceRecoversAfterError) {
+  auto bc = compile(parse(kDepth)).bc;
+  mplx::VM vm(bc);
+  vm.setMaxCallDepth(64);
+  EXPECT_THROW(
+      {
+        auto r = vm.start("main", 10);
+        while (r.status == mplx::VM::RunStatus::Suspended)
+          r = vm.resume(10);
+      },
+      std::runtime_error);
+  EXPECT_FALSE(vm.isSuspended());
+  vm.setMaxCallDepth(120);
+  auto r = vm.start("main", 1u << 20);
+  EXPECT_EQ(r.status, mplx::VM::RunStatus::Finished);
+  EXPECT_EQ(r.value, 100);
+}
+
+// Runs main in slices of `budget` instructions; `slices` receives how many it took
+static long long run_sliced(mplx::VM &vm, uint64_t budget, size_t &slices) {
+  auto r = vm.start("main", budget);
+  slices = 1;
+  while (r.status == mplx::VM::RunStatus::Suspended) {
+    EXPECT_TRUE(vm.isSuspended());
+    r = vm.resume(budget);
+    ++slices;
+  }
+  EXPECT_FALSE(vm.isSuspended());
+  return r.value;
+}
+
+static const char *kSliced = "fn depth(n: i32)->i32{ if (n == 0) { return 0; } return 1 + depth(n - 1); }"
+                             "fn fib(n: i32)->i32{ if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); }"
+                             "fn spin(n: i32, k: i32)->i32{ let s = 0; let i = 0; while (i < n) { s = s + i * k; i = i + 1; } return s; }"
+                             "fn main()->i32{ let s = 0; let i = 0; while (i < 12) { s = s + fib(i); i = i + 1; } return s + spin(3000, 7) + depth(80); }";
+
+// Any budget gives the result of an uninterrupted run. Small ones suspend inside calls:
+// deep in the recursion of fib and depth, and in the loop of spin, whose arguments and
+// locals must survive each resume.
+TEST(Vm, SlicesMatchRun) {
+  for (uint32_t super : {0u, mplx::kAllSuperinstructions}) {
+    mplx::CompileOptions opts;
+    opts.inlineBudget        = 0;
+    opts.superinstructions   = super;
+    auto bc                  = compile(parse(kSliced), opts).bc;
+    const long long expected = run(bc);
+    mplx::VM vm(bc);
+    size_t prev = 0;
+    for (uint64_t budget : {uint64_t(1) << 40, uint64_t(5000), uint64_t(100), uint64_t(7), uint64_t(1)}) {
+      size_t slices = 0;
+      EXPECT_EQ(run_sliced(vm, budget, slices), expected) << "budget " << budget << " super " << super;
+      if (budget == uint64_t(1) << 40)
+        EXPECT_EQ(slices, 1u);
+      else
+        EXPECT_GT(slices, prev) << "budget " << budget;
+      prev = slices;
+    }
+    // a run in between does not disturb a suspended one's frames or stack
+    auto r = vm.start("main", 50);
+    ASSERT_EQ(r.status, mplx::VM::RunStatus::Suspended);
+    long long n  = 20;
+    uint32_t fib = 0;
+    ASSERT_TRUE(mplx::find_function(bc, "fib", fib));
+    EXPECT_EQ(vm.call(fib, &n, 1), 6765);
+    while (r.status == mplx::VM::RunStatus::Suspended)
+      r = vm.resume(50);
+    EXPECT_EQ(r.value, expected);
+  }
+}
+
+// The checked core slices the same way
+TEST(Vm, CheckedCoreSlices) {
+  auto bc     = compile(parse(kSliced)).bc;
+  auto broken = bc.functions[0];
+  broken.name = "broken";
+  ++broken.arity;
+  bc.functions.push_back(broken);
+  mplx::VM vm(bc);
+  ASSERT_FALSE(vm.isVerified());
+  size_t slices = 0;
+  EXPECT_EQ(run_sliced(vm, 10, slices), run(bc));
+  EXPECT_GT(slices, 100u);
+}
+
+// start() refuses while a run is suspended and resume() without one; reset() drops the
+// suspended run
+TEST(Vm, SliceStateErrors) {
+  auto bc = compile(parse(kSliced)).bc;
+  mplx::VM vm(bc);
+  EXPECT_THROW(vm.resume(10), std::runtime_error);
+  ASSERT_EQ(vm.start("main", 10).status, mplx::VM::RunStatus::Suspended);
+  EXPECT_THROW(vm.start("main", 10), std::runtime_error);
+  vm.reset();
+  EXPECT_FALSE(vm.isSuspended());
+  EXPECT_THROW(vm.resume(10), std::runtime_error);
+  auto r = vm.start("main", uint64_t(1) << 40);
+  EXPECT_EQ(r.status, mplx::VM::RunStatus::Finished);
+  EXPECT_EQ(r.value, run(bc));
+  EXPECT_EQ(vm.run("main"), r.value);
+}
+
+// Profile counters and fuel accumulate across runs until reset(), which zeroes them so the
+// next run counts as the first one did
+TEST(Vm, ResetClearsCounters) {
+  auto bc = compile(parse(kDepth)).bc;
+  mplx::VM vm(bc);
+  vm.setProfile(true);
+  vm.run("main");
+  const auto counts   = vm.opcodeCounts();
+  const uint64_t seqs = vm.sequenceProfile().total();
+  ASSERT_GT(seqs, 0u);
+  vm.run("main");
+  EXPECT_EQ(vm.opcodeCounts()[mplx::OP_CALL], 2 * counts[mplx::OP_CALL]);
+  vm.reset();
+  EXPECT_EQ(vm.sequenceProfile().total(), 0u);
+  for (uint64_t c : vm.opcodeCounts())
+    EXPECT_EQ(c, 0u);
+  vm.run("main");
+  EXPECT_EQ(vm.opcodeCounts(), counts);
+  EXPECT_EQ(vm.sequenceProfile().total(), seqs);
+
+  vm.setProfile(false);
+  vm.setFuel(1u << 20);
+  vm.run("main");
+  const uint64_t used = vm.fuelUsed();
+  ASSERT_GT(used, 0u);
+  vm.setFuel(used + used / 2);
+  vm.run("main");
+  EXPECT_THROW(vm.run("main"), std::runtime_error);
+  vm.reset();
+  EXPECT_EQ(vm.fuelUsed(), 0u);
+  EXPECT_EQ(vm.run("main"), 100);
+  EXPECT_EQ(vm.fuelUsed(), used);
+}
+
+// Entry names resolve through the compiler's symbol table, or by a scan on hand-built
+// bytecode without one; either way the last definition of a name wins
+TEST(Vm, EntryLookup) {
+  auto bc = compile(parse(kDepth)).bc;
+  ASSERT_FALSE(bc.symbols.empty());
+  mplx::VM vm(bc);
+  EXPECT_EQ(vm.run("main"), 100);
+  EXPECT_THROW(vm.run("nope"), std::runtime_error);
+
+  mplx::Bytecode hand;
+  hand.code = {mplx::OP_PUSH_I8, 1, mplx::OP_RET, mplx::OP_PUSH_I8, 2, mplx::OP_RET};
+  hand.functions.push_back(mplx::FuncMeta{"main", 0, 0, 0});
+  hand.functions.push_back(mplx::FuncMeta{"main", 3, 0, 0});
+  mplx::VM hvm(hand);
+  EXPECT_EQ(hvm.run("main"), 2);
+  EXPECT_THROW(hvm.run("depth"), std::runtime_error);
+}
+
+// A pool keeps one VM per module and hands it back reset, with its settings; a different
+// module at the same address gets a fresh VM, and every thread has its own pool
+TEST(VmPool, OneVmPerModule) {
+  mplx::VMPool pool;
+  auto bc    = compile(parse(kDepth)).bc;
+  auto other = compile(parse("fn main()->i32{ return 7; }")).bc;
+  mplx::VM &vm = pool.acquire(bc);
+  vm.setStackSize(1u << 12);
+  ASSERT_EQ(vm.start("main", 10).status, mplx::VM::RunStatus::Suspended);
+  mplx::VM &again = pool.acquire(bc);
+  EXPECT_EQ(&again, &vm);
+  EXPECT_FALSE(again.isSuspended());
+  EXPECT_EQ(again.stackSize(), 1u << 12);
+  EXPECT_EQ(again.run("main"), 100);
+  EXPECT_EQ(pool.acquire(other).run("main"), 7);
+  EXPECT_EQ(pool.size(), 2u);
+
+  bc = compile(parse("fn main()->i32{ return 9; }")).bc; // same address, new module
+  mplx::VM &fresh = pool.acquire(bc);
+  EXPECT_EQ(fresh.stackSize(), mplx::VM(bc).stackSize());
+  EXPECT_EQ(fresh.run("main"), 9);
+  EXPECT_EQ(pool.size(), 2u);
+  pool.release(other);
+  EXPECT_EQ(pool.size(), 1u);
+  pool.clear();
+  EXPECT_EQ(pool.size(), 0u);
+
+  mplx::VMPool *mine = &mplx::VMPool::local(), *theirs = nullptr;
+  std::thread([&] { theirs = &mplx::VMPool::local(); }).join();
+  EXPECT_NE(mine, theirs);
+  EXPECT_EQ(mine, &mplx::VMPool::local());
+}
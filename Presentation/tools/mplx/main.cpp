@@ -1,5 +1,11 @@
-﻿#include "../../../Application/mplx-compiler/compiler.hpp"
+﻿#include "../../../Application/mplx-compiler/compile_cache.hpp"
+#include "../../../Application/mplx-compiler/compiler.hpp"
+#include "../../../Application/mplx-compiler/optimizer.hpp"
+#include "../../../Application/mplx-compiler/regcode.hpp"
+#include "../../../Application/mplx-compiler/superinstructions.hpp"
+#include "../../../Application/mplx-vm/regvm.hpp"
 #include "../../../Application/mplx-vm/vm.hpp"
+#include "../../../Application/mplx-vm/vm_pool.hpp"
 #include "../../../Domain/mplx-lang/lexer.hpp"
 #include "../../../Domain/mplx-lang/parser.hpp"
 #include <fstream>
@@ -9,6 +15,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <filesystem>
+#include <memory>
 #include <system_error>
 
 namespace fs = std::filesystem;
@@ -57,6 +64,67 @@ static void write_result_if_needed(const fs::path &inputPath,
   }
 }
 
+// Instructions the --super auto training run may execute before its profile is used
+static constexpr uint64_t kSuperTrainingBudget = 1000000;
+
+// --super off|all|auto|MASK. "auto" profiles a capped run of the unfused program and
+// keeps the superinstructions whose sequences dominate it.
+template <typename ModuleT>
+static uint32_t resolve_superinstructions(const std::string &spec, const ModuleT &mod, size_t stackSlots, const mplx::CompileOptions &opts,
+                                          mplx::CompileCache *cache) {
+  if (spec == "off")
+    return 0;
+  if (spec == "all")
+    return mplx::kAllSuperinstructions;
+  if (spec != "auto")
+    return (uint32_t)std::strtoul(spec.c_str(), nullptr, 0) & mplx::kAllSuperinstructions;
+  mplx::CompileOptions trainOpts = opts; // profile the code the real run will execute
+  trainOpts.superinstructions    = 0;
+  mplx::Compiler c(trainOpts);
+  c.setCache(cache); // the functions' code does not depend on the fusion mask: the real compile links it
+  auto res = c.compile(mod);
+  if (!res.diags.empty())
+    return 0;
+  mplx::VM vm(res.bc);
+  vm.setStackSize(stackSlots);
+#if defined(MPLX_WITH_JIT)
+  vm.setJitMode(mplx::VM::JitMode::Off);
+#endif
+  vm.setProfile(true);
+  vm.setFuel(kSuperTrainingBudget);
+  try {
+    (void)vm.run("main");
+  } catch (const std::exception &) {
+    // budget exhausted (or a runtime error the real run will report): the partial profile still counts
+  }
+  uint32_t mask = mplx::select_superinstructions(vm.sequenceProfile());
+  std::cerr << mplx::format_sequence_profile(vm.sequenceProfile(), 8);
+  std::cerr << "[cli] superinstructions: " << mask << " (" << mplx::superinstruction_names(mask) << ")\n";
+  return mask;
+}
+
+#if defined(MPLX_VM_HISTOGRAM)
+// --histogram: opcode and opcode-pair counts, written next to bench.json
+static void write_histogram(const mplx::OpHistogram &h) {
+  std::ofstream("histogram.json") << h.toJson() << "\n";
+  std::cerr << "[cli] histogram: histogram.json (" << h.total() << " instructions)\n";
+}
+#endif
+
+// Runs main, in resumable slices of `sliceBudget` instructions when it is non-zero (--slice)
+static long long run_main(mplx::VM &vm, uint64_t sliceBudget) {
+  if (sliceBudget == 0)
+    return vm.run("main");
+  uint64_t slices = 1;
+  auto r = vm.start("main", sliceBudget);
+  while (r.status == mplx::VM::RunStatus::Suspended) {
+    r = vm.resume(sliceBudget);
+    ++slices;
+  }
+  std::cerr << "[cli] slices: " << slices << "\n";
+  return r.value;
+}
+
 template <typename ModuleT>
 static int handle_run(const ModuleT &mod,
                       const fs::path &inputPath,
@@ -67,10 +135,21 @@ static int handle_run(const ModuleT &mod,
                       int hotThreshold,
                       bool traceExec,
                       uint64_t traceLimit,
-                      bool jitDump) {
+                      bool jitDump,
+                      size_t stackSlots,
+                      const std::string &tier,
+                      const mplx::CompileOptions &compileOpts,
+                      uint64_t sliceBudget,
+                      bool profile,
+                      const fs::path &profileOut,
+                      bool histogram,
+                      bool memo,
+                      bool optReport,
+                      mplx::CompileCache *compileCache) {
   std::cerr << "[cli] enter --run\n";
   try {
-    mplx::Compiler c;
+    mplx::Compiler c(compileOpts);
+    c.setCache(compileCache);
     auto res = c.compile(mod);
     if (!res.diags.empty()) {
       std::ostringstream os;
@@ -88,8 +167,41 @@ static int handle_run(const ModuleT &mod,
       }
       return 1;
     }
+    if (compileOpts.peephole) {
+      const auto &p = res.peephole;
+      std::cerr << "[cli] peephole: stores " << p.storesFused << ", jumps " << p.jumpsThreaded << ", loops inverted " << p.loopsInverted
+                << ", unreachable " << p.unreachable << "\n";
+    }
+    if (compileCache)
+      std::cerr << "[cli] compile cache: " << res.cache.hits << " hits (" << res.cache.diskHits << " from disk), "
+                << res.cache.misses << " misses\n";
+    if (compileOpts.inlineBudget > 0)
+      std::cerr << "[cli] inline: " << res.inlined.size() << " call sites (budget " << compileOpts.inlineBudget << ")\n";
+    if (optReport) {
+      for (const auto &site : res.inlined)
+        std::cerr << "[opt] inlined " << site.callee << " into " << site.caller << "\n";
+    }
+
+    if (tier == "reg") {
+      auto rc = mplx::lower_to_regcode(res.bc);
+      mplx::RegVM rvm(rc);
+      rvm.setStackSize(stackSlots);
+      long long result = rvm.run("main");
+      std::cerr << "[cli] ran (reg tier): " << result << "\n";
+      write_result_if_needed(inputPath, outPath, noRunFile, result);
+      std::cout << "Result: " << result << "\n";
+      return 0;
+    }
 
     mplx::VM vm(res.bc);
+    vm.setStackSize(stackSlots);
+    if (vm.isVerified()) {
+      std::cerr << "[cli] verifier: ok\n";
+    } else {
+      std::cerr << "[cli] verifier: " << vm.verifyErrors().size() << " problem(s), running checked\n";
+      for (const auto &e : vm.verifyErrors())
+        std::cerr << "  " << e << "\n";
+    }
 #if defined(MPLX_WITH_JIT)
     if (jitDump) {
 #if defined(_WIN32)
@@ -103,11 +215,34 @@ static int handle_run(const ModuleT &mod,
     else vm.setJitMode(mplx::VM::JitMode::Auto);
     vm.setHotThreshold(hotThreshold);
 #endif
+    if (profile) {
+#if defined(MPLX_WITH_JIT)
+      vm.setJitMode(mplx::VM::JitMode::Off); // jitted code is not profiled
+#endif
+      vm.setCostProfile(true);
+    }
+    if (memo) {
+#if defined(MPLX_WITH_JIT)
+      vm.setJitMode(mplx::VM::JitMode::Off); // jitted code bypasses the caches
+#endif
+      vm.setMemoize(true);
+    }
+#if defined(MPLX_VM_HISTOGRAM)
+    if (histogram) {
+#if defined(MPLX_WITH_JIT)
+      vm.setJitMode(mplx::VM::JitMode::Off);
+#endif
+      vm.setHistogram(true);
+    }
+#else
+    (void)histogram;
+#endif
 
     long long result = 0;
 #if defined(MPLX_WITH_JIT)
     if (jitVerify) {
       mplx::VM vmInterp(res.bc);
+      vmInterp.setStackSize(stackSlots);
       vmInterp.setJitMode(mplx::VM::JitMode::Off);
       vmInterp.setHotThreshold(hotThreshold);
       vmInterp.setTrace(traceExec);
@@ -139,16 +274,31 @@ static int handle_run(const ModuleT &mod,
     } else {
       vm.setTrace(traceExec);
       vm.setTraceLimit(traceLimit);
-      result = vm.run("main");
+      result = run_main(vm, sliceBudget);
     }
 #else
     vm.setTrace(traceExec);
     vm.setTraceLimit(traceLimit);
-    result = vm.run("main");
+    result = run_main(vm, sliceBudget);
 #endif
     std::cerr << "[cli] ran: " << result << "\n";
     write_result_if_needed(inputPath, outPath, noRunFile, result);
     std::cout << "Result: " << result << "\n";
+#if defined(MPLX_VM_HISTOGRAM)
+    if (histogram)
+      write_histogram(vm.histogram());
+#endif
+    if (memo && !profile)
+      std::cerr << vm.memoReport();
+    if (profile) {
+      std::cout << vm.profileReport();
+      try {
+        write_text_atomic(profileOut, vm.costProfile().collapsedStacks());
+        std::cerr << "[cli] collapsed stacks: " << profileOut.string() << "\n";
+      } catch (const std::exception &ex) {
+        std::cerr << "write profile failed: " << ex.what() << "\n";
+      }
+    }
     return 0;
   } catch (const std::exception &e) {
     std::ostringstream os;
@@ -176,9 +326,31 @@ int main(int argc, char **argv) {
   bool jitVerify = false; 
   bool traceExec = false;
   uint64_t traceLimit = 0;
+  size_t stackSlots = mplx::VM::kDefaultStackSlots;
+  std::string benchMode = "compile-run"; // or "run-only"
+  int benchRuns = 20;
+  bool benchJson = true;
+  std::string tier = "stack"; // or "reg"
+  std::string superSpec = "off"; // all | auto | bit mask
+  uint64_t sliceBudget = 0;      // --slice: resumable run, instructions per slice
+  bool profile = false;          // --profile: cost report + collapsed stacks
+  fs::path profileOut = "profile.folded";
+  bool histogram = false;        // --histogram: opcode/pair counts (MPLX_VM_HISTOGRAM builds)
+  bool memo = false;             // --memo: cache results of pure functions
+  bool optimize = true;          // --no-opt: skip the AST folding pass (optimizer.hpp)
+  bool ssa = false;              // --ssa: generate code through the SSA IR (ir.hpp)
+  bool peephole = true;          // --no-peephole: skip the bytecode peephole pass (peephole.hpp)
+  uint32_t inlineBudget = mplx::CompileOptions{}.inlineBudget; // --inline-budget N: inliner cost limit, 0 = off
+  bool optReport = false;        // --opt-report: list the inlined call sites
+  bool tailCalls = true;         // --no-tail-calls: compile `return f(...)` as CALL + RET
+  bool licm = true;              // --no-licm: keep loop-invariant code in the loop (--ssa)
+  bool strengthReduction = false; // --strength-reduction: turn i * k in loops into additions (--ssa)
+  bool closedForm = true;        // --no-closed-form: run counting loops in full (--ssa)
+  unsigned compileThreads = 1;   // --compile-threads N: compile functions in parallel, 0 = all cores
+  fs::path compileCacheDir;      // --compile-cache DIR: reuse functions' bytecode across runs
 
   auto print_usage = []() {
-    const char *u = "Usage: mplx [--run|--check|--symbols|--bench] [--jit on|off|auto] [--jit-dump] [--hot N] [--jit-verify] [--trace] [--trace-limit N] [--out PATH] [--no-runfile] <file>\n";
+    const char *u = "Usage: mplx [--run|--check|--symbols|--bench] [--mode compile-run|run-only] [--runs N] [--jit on|off|auto] [--jit-dump] [--hot N] [--jit-verify] [--trace] [--trace-limit N] [--stack-size SLOTS] [--tier stack|reg] [--super off|all|auto|MASK] [--slice N] [--profile] [--profile-out PATH] [--histogram] [--memo] [--no-opt] [--ssa] [--no-peephole] [--inline-budget N] [--opt-report] [--no-tail-calls] [--no-licm] [--strength-reduction] [--no-closed-form] [--compile-threads N] [--compile-cache DIR] [--out PATH] [--no-runfile] <file>\n";
     std::cout << u;
     std::ofstream("help.txt").write(u, (std::streamsize)std::char_traits<char>::length(u));
   };
@@ -217,13 +389,51 @@ int main(int argc, char **argv) {
     if (a == "--jit-verify") { jitVerify = true; continue; }
     if (a == "--trace") { traceExec = true; continue; }
     if (a == "--trace-limit" && i + 1 < args.size()) { traceLimit = (uint64_t)std::strtoull(args[++i].c_str(), nullptr, 10); continue; }
+    if (a == "--stack-size" && i + 1 < args.size()) { stackSlots = (size_t)std::max(1ull, std::strtoull(args[++i].c_str(), nullptr, 10)); continue; }
+    if (a == "--tier" && i + 1 < args.size()) { tier = args[++i]; continue; }
+    if (a == "--super" && i + 1 < args.size()) { superSpec = args[++i]; continue; }
+    if (a == "--profile") { profile = true; continue; }
+    if (a == "--histogram") { histogram = true; continue; }
+    if (a == "--memo") { memo = true; continue; }
+    if (a == "--no-opt") { optimize = false; continue; }
+    if (a == "--ssa") { ssa = true; continue; }
+    if (a == "--no-peephole") { peephole = false; continue; }
+    if (a == "--inline-budget" && i + 1 < args.size()) { inlineBudget = (uint32_t)std::strtoul(args[++i].c_str(), nullptr, 10); continue; }
+    if (a == "--opt-report") { optReport = true; continue; }
+    if (a == "--no-tail-calls") { tailCalls = false; continue; }
+    if (a == "--no-licm") { licm = false; continue; }
+    if (a == "--strength-reduction") { strengthReduction = true; continue; }
+    if (a == "--no-closed-form") { closedForm = false; continue; }
+    if (a == "--compile-cache" && i + 1 < args.size()) { compileCacheDir = args[++i]; continue; }
+    if (a == "--compile-threads" && i + 1 < args.size()) { compileThreads = (unsigned)std::strtoul(args[++i].c_str(), nullptr, 10); continue; }
+    if (a == "--profile-out" && i + 1 < args.size()) { profileOut = fs::path(args[++i]); continue; }
+    if (a == "--slice" && i + 1 < args.size()) { sliceBudget = (uint64_t)std::strtoull(args[++i].c_str(), nullptr, 10); continue; }
+    if (a == "--mode" && i + 1 < args.size()) { benchMode = args[++i]; continue; }
+    if (a == "--runs" && i + 1 < args.size()) { benchRuns = std::max(1, std::atoi(args[++i].c_str())); continue; }
+    if (a == "--json") { benchJson = true; continue; }
     // Non-flag -> positional (candidate input)
     if (!a.empty() && a[0] != '-') positional.push_back(a);
   }
+#if !defined(MPLX_VM_HISTOGRAM)
+  if (histogram) {
+    std::cerr << "--histogram needs a build configured with -DMPLX_VM_HISTOGRAM=ON\n";
+    return 2;
+  }
+#endif
   if (!(mode == "--run" || mode == "--check" || mode == "--symbols" || mode == "--bench")) {
     print_usage();
     return 2;
   }
+  bool superOk = superSpec == "off" || superSpec == "all" || superSpec == "auto";
+  if (!superOk) {
+    char *end = nullptr;
+    (void)std::strtoul(superSpec.c_str(), &end, 0);
+    superOk = !superSpec.empty() && end && *end == '\0';
+  }
+  if (!superOk || (tier != "stack" && tier != "reg")) {
+    print_usage();
+    return 2;
+  }
   if (!positional.empty()) fileArg = positional.back();
   if ((mode == "--run" || mode == "--check" || mode == "--symbols" || mode == "--bench") && fileArg.empty()) {
     print_usage();
@@ -280,7 +490,15 @@ int main(int argc, char **argv) {
     ss << ifs.rdbuf();
     src = ss.str();
   } else {
-    src = "fn main() -> i32 { let x = 1 + 2; return x; }";
+    // --bench: measure the given file; one that cannot be read is an error, not a sample
+    std::ifstream bfs(fileArg);
+    if (!bfs) {
+      std::cout << "cannot open file: " << fileArg << "\n";
+      return 1;
+    }
+    std::stringstream ss;
+    ss << bfs.rdbuf();
+    src = ss.str();
   }
 
   std::cerr << "[cli] before lex\n";
@@ -326,6 +544,25 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  if (optimize) {
+    auto st = mplx::optimize_module(mod);
+    std::cerr << "[cli] optimize: folded " << st.folded << ", propagated " << st.propagated << ", branches removed " << st.branchesRemoved << "\n";
+  }
+
+  mplx::CompileOptions compileOpts;
+  compileOpts.ssa               = ssa;
+  compileOpts.peephole          = peephole;
+  compileOpts.inlineBudget      = inlineBudget;
+  compileOpts.tailCalls         = tailCalls;
+  compileOpts.licm              = licm;
+  compileOpts.strengthReduction = strengthReduction;
+  compileOpts.closedForm        = closedForm;
+  compileOpts.threads           = compileThreads;
+  std::unique_ptr<mplx::CompileCache> compileCache;
+  if (!compileCacheDir.empty())
+    compileCache = std::make_unique<mplx::CompileCache>(compileCacheDir);
+  compileOpts.superinstructions = resolve_superinstructions(superSpec, mod, stackSlots, compileOpts, compileCache.get());
+
   if (mode == "--run") {
     std::cerr << "[cli] dispatch --run\n";
     return handle_run(mod,
@@ -337,32 +574,54 @@ int main(int argc, char **argv) {
                       hotThreshold,
                       traceExec,
                       traceLimit,
-                      jitDump);
+                      jitDump,
+                      stackSlots,
+                      tier,
+                      compileOpts,
+                      sliceBudget,
+                      profile,
+                      profileOut,
+                      histogram,
+                      memo,
+                      optReport,
+                      compileCache.get());
   }
 
   if (mode == "--bench") {
     try {
-      // defaults
-      std::string benchMode = "compile-run"; // or "run-only"
-      int runs = 20;
-      bool jsonOut = true;
-      // parse extra bench flags (disabled for now due to reordered arg parsing)
-      int opti = argc; // no-op
-      for (int i = opti; i + 0 < argc; ++i) {
-        std::string a = argv[i];
-        if (a == "--mode" && i + 1 < argc) { benchMode = argv[++i]; }
-        else if (a == "--runs" && i + 1 < argc) { runs = std::max(1, atoi(argv[++i])); }
-        else if (a == "--json") { jsonOut = true; }
-      }
+      // bench flags (--mode, --runs, --json) are parsed with the rest of the args
+      const int runs = benchRuns;
+      const bool jsonOut = benchJson;
 
-      mplx::Compiler c0;
+      mplx::Compiler c0(compileOpts);
+      c0.setCache(compileCache.get());
       std::vector<double> timesMs; timesMs.reserve((size_t)runs);
 
-      if (benchMode == "run-only") {
+      if (tier == "reg") {
+        // the lowering pass counts as compile time; run-only measures the interpreter alone
+        mplx::RegCode rcOnce;
+        if (benchMode == "run-only")
+          rcOnce = mplx::lower_to_regcode(c0.compile(mod).bc);
+        for (int i = 0; i < runs; ++i) {
+          auto t0 = std::chrono::high_resolution_clock::now();
+          mplx::RegCode rcFresh;
+          if (benchMode != "run-only") {
+            mplx::Compiler c(compileOpts);
+            c.setCache(compileCache.get());
+            rcFresh = mplx::lower_to_regcode(c.compile(mod).bc);
+          }
+          mplx::RegVM rvm(benchMode == "run-only" ? rcOnce : rcFresh);
+          rvm.setStackSize(stackSlots);
+          volatile auto rv = rvm.run("main"); (void)rv;
+          auto t1 = std::chrono::high_resolution_clock::now();
+          timesMs.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+        }
+      } else if (benchMode == "run-only") {
         auto cres = c0.compile(mod);
         for (int i = 0; i < runs; ++i) {
           auto t0 = std::chrono::high_resolution_clock::now();
-          mplx::VM vm(cres.bc);
+          mplx::VM &vm = mplx::VMPool::local().acquire(cres.bc);
+          vm.setStackSize(stackSlots);
 #if defined(MPLX_WITH_JIT)
           if (jitMode == "off") vm.setJitMode(mplx::VM::JitMode::Off);
           else if (jitMode == "on") vm.setJitMode(mplx::VM::JitMode::On);
@@ -373,11 +632,13 @@ int main(int argc, char **argv) {
           auto t1 = std::chrono::high_resolution_clock::now();
           timesMs.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
         }
+        mplx::VMPool::local().release(cres.bc);
       } else {
         for (int i = 0; i < runs; ++i) {
           auto t0 = std::chrono::high_resolution_clock::now();
-          mplx::Compiler c; auto cres = c.compile(mod);
+          mplx::Compiler c(compileOpts); c.setCache(compileCache.get()); auto cres = c.compile(mod);
           mplx::VM vm(cres.bc);
+          vm.setStackSize(stackSlots);
 #if defined(MPLX_WITH_JIT)
           if (jitMode == "off") vm.setJitMode(mplx::VM::JitMode::Off);
           else if (jitMode == "on") vm.setJitMode(mplx::VM::JitMode::On);
@@ -396,8 +657,44 @@ int main(int argc, char **argv) {
 
       bool jitEnabled = false;
 #if defined(MPLX_WITH_JIT)
-      jitEnabled = (jitMode != "off");
+      jitEnabled = (tier == "stack" && jitMode != "off");
+#endif
+
+      // instructions dispatched by one run, from an extra untimed interpreter-only run
+      uint64_t dispatched = 0;
+      {
+        mplx::Compiler cc(compileOpts);
+        auto cres = cc.compile(mod);
+        if (tier == "reg") {
+          auto rc = mplx::lower_to_regcode(cres.bc);
+          mplx::RegVM rvm(rc);
+          rvm.setStackSize(stackSlots);
+          rvm.setCountDispatch(true);
+          (void)rvm.run("main");
+          dispatched = rvm.dispatched();
+        } else {
+          mplx::VM vm(cres.bc);
+          vm.setStackSize(stackSlots);
+#if defined(MPLX_WITH_JIT)
+          vm.setJitMode(mplx::VM::JitMode::Off);
+#endif
+          vm.setProfile(true);
+          (void)vm.run("main");
+          for (auto n : vm.opcodeCounts()) dispatched += n;
+#if defined(MPLX_VM_HISTOGRAM)
+          if (histogram) {
+            mplx::VM hvm(cres.bc);
+            hvm.setStackSize(stackSlots);
+#if defined(MPLX_WITH_JIT)
+            hvm.setJitMode(mplx::VM::JitMode::Off);
 #endif
+            hvm.setHistogram(true);
+            (void)hvm.run("main");
+            write_histogram(hvm.histogram());
+          }
+#endif
+        }
+      }
 
       if (jsonOut) {
         std::ostringstream os;
@@ -406,7 +703,11 @@ int main(int argc, char **argv) {
            << "\"avg_ms\": " << avg << ", "
            << "\"best_ms\": " << best << ", "
            << "\"worst_ms\": " << worst << ", "
-           << "\"jit\": " << (jitEnabled ? "true" : "false")
+           << "\"jit\": " << (jitEnabled ? "true" : "false") << ", "
+           << "\"dispatch\": \"" << mplx::VM::dispatchEngine() << "\", "
+           << "\"tier\": \"" << tier << "\", "
+           << "\"dispatched\": " << dispatched << ", "
+           << "\"superinstructions\": \"" << mplx::superinstruction_names(compileOpts.superinstructions) << "\""
            << "}\n";
         auto s = os.str();
         std::cout << s;
@@ -414,7 +715,9 @@ int main(int argc, char **argv) {
       } else {
         std::cout << "mode=" << benchMode << " runs=" << runs
                   << " avg=" << avg << "ms best=" << best << "ms worst=" << worst
-                  << " jit=" << (jitEnabled ? "on" : "off") << "\n";
+                  << " jit=" << (jitEnabled ? "on" : "off") << " dispatch=" << mplx::VM::dispatchEngine()
+                  << " tier=" << tier << " dispatched=" << dispatched
+                  << " super=" << mplx::superinstruction_names(compileOpts.superinstructions) << "\n";
       }
       return 0;
     } catch (const std::exception &e) {